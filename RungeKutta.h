@@ -5,4 +5,5 @@
 #pragma once
 
 #include "src/expression/Expression.h"
+#include "src/expression/VectorExpression.h"
 #include "src/runge-kutta/RungeKuttaMethods.h"
\ No newline at end of file
@@ -0,0 +1,45 @@
+#include <algorithm>
+
+#include "CompileOptions.h"
+
+namespace rk {
+
+    std::string CompileOptions::flags() const {
+        std::string flags = "-shared -fPIC -O" + std::to_string(std::clamp(this->optimization, 0, 3));
+        if (this->nativeArchitecture)
+            flags += " -march=native";
+        flags += this->contractFma ? " -ffp-contract=fast" : " -ffp-contract=off";
+        if (this->noMathErrno)
+            flags += " -fno-math-errno";
+        if (this->reciprocalMath)
+            flags += " -freciprocal-math";
+        // Reassociation is only done by gcc and clang when signed zeros and traps may be ignored as well
+        if (this->associativeMath)
+            flags += " -fassociative-math -fno-signed-zeros -fno-trapping-math";
+        if (this->finiteMathOnly)
+            flags += " -ffinite-math-only";
+        if (this->vectorWidth != 0)
+            flags += " -mprefer-vector-width=" + std::to_string(this->vectorWidth);
+        return flags;
+    }
+
+    std::vector<CompileOptions> CompileOptions::candidates() {
+        std::vector<CompileOptions> variants(1);
+        CompileOptions o3;
+        o3.optimization = 3;
+        variants.push_back(o3);
+        CompileOptions native = o3;
+        native.nativeArchitecture = true;
+        variants.push_back(native);
+        CompileOptions fma = native;
+        fma.contractFma = true;
+        fma.noMathErrno = true;
+        variants.push_back(fma);
+        CompileOptions fast = fma;
+        fast.reciprocalMath = true;
+        fast.associativeMath = true;
+        variants.push_back(fast);
+        return variants;
+    }
+
+}
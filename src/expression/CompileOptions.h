@@ -0,0 +1,38 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace rk {
+
+    /*
+     * Settings of the system compiler building generated code, the defaults are the strict IEEE build used so far.
+     * Everything past the optimization level may change results in the last bits (FMA contraction, reciprocal
+     * and reassociated arithmetic) or on special values (finite math). The built-in JIT ignores them.
+     */
+    struct CompileOptions {
+        // -O0 ... -O3
+        int optimization = 2;
+        // -march=native, the module only runs on machines like the one which built it
+        bool nativeArchitecture = false;
+        // a * b + c may become one fused multiply-add, which needs an FMA capable target such as nativeArchitecture
+        bool contractFma = false;
+        // Fast math piece by piece
+        bool noMathErrno = false;
+        bool reciprocalMath = false;
+        bool associativeMath = false;
+        bool finiteMathOnly = false;
+        // Preferred vector register width in bits for auto-vectorized batch code, 0 leaves it to the compiler.
+        // x86 compilers only. Not varied by candidates, as autoTune times evaluate and not batches
+        unsigned vectorWidth = 0;
+
+        // Command line flags of the compiler, the shared library ones included
+        std::string flags() const;
+        bool operator==(const CompileOptions& other) const { return flags() == other.flags(); }
+        bool operator!=(const CompileOptions& other) const { return !(*this == other); }
+
+        // Variants tried by Expression::autoTune: the default, then each step trading more strictness for speed
+        static std::vector<CompileOptions> candidates();
+    };
+
+}
@@ -0,0 +1,117 @@
+#include <limits>
+#include <stdexcept>
+
+#include "Derivative.h"
+
+
+namespace rk {
+
+    template<typename Value>
+    Program<Value> differentiate(const Program<Value>& program, uint32_t variable) {
+        using Node = typename Program<Value>::Node;
+        std::vector<uint32_t> roots;
+        auto nodes = program.tree(roots);
+        const size_t count = nodes.size();
+
+        // Derivative of every original node, zero where the node does not depend on variable
+        const uint32_t zero = std::numeric_limits<uint32_t>::max();
+        std::vector<uint32_t> d(count, zero);
+        auto push = [&nodes](OpCode code, std::vector<uint32_t> args) {
+            nodes.push_back({code, 0, Value(0), std::move(args)});
+            return (uint32_t) nodes.size() - 1;
+        };
+        auto constant = [&nodes](Value v) {
+            nodes.push_back({OpNumber, 0, v, {}});
+            return (uint32_t) nodes.size() - 1;
+        };
+        auto sum = [&push, zero](uint32_t a, uint32_t b) {
+            if (a == zero)
+                return b;
+            return b == zero ? a : push(OpSum, {a, b});
+        };
+        auto sub = [&push, zero](uint32_t a, uint32_t b) {
+            if (b == zero)
+                return a;
+            return a == zero ? push(OpUnaryMinus, {b}) : push(OpSub, {a, b});
+        };
+        auto mul = [&push, zero](uint32_t a, uint32_t b) {
+            return a == zero || b == zero ? zero : push(OpMul, {a, b});
+        };
+
+        for (uint32_t i = 0; i < count; ++i) {
+            const Node n = nodes[i];
+            switch (n.code) {
+                case OpNumber:
+                    break;
+                case OpVariable:
+                    if (n.arg == variable)
+                        d[i] = constant(1);
+                    break;
+                case OpSum:
+                    d[i] = sum(d[n.args[0]], d[n.args[1]]);
+                    break;
+                case OpSub:
+                    d[i] = sub(d[n.args[0]], d[n.args[1]]);
+                    break;
+                case OpUnaryMinus:
+                    d[i] = sub(zero, d[n.args[0]]);
+                    break;
+                case OpMul:
+                    d[i] = sum(mul(d[n.args[0]], n.args[1]), mul(n.args[0], d[n.args[1]]));
+                    break;
+                case OpDiv: {
+                    // (a / b)' = (a' - (a / b) * b') / b, the quotient itself is reused
+                    uint32_t numerator = sub(d[n.args[0]], mul(i, d[n.args[1]]));
+                    if (numerator != zero)
+                        d[i] = push(OpDiv, {numerator, n.args[1]});
+                    break;
+                }
+                case OpSin:
+                    d[i] = mul(push(OpCos, {n.args[0]}), d[n.args[0]]);
+                    break;
+                case OpCos:
+                    if (d[n.args[0]] != zero)
+                        d[i] = push(OpUnaryMinus, {mul(push(OpSin, {n.args[0]}), d[n.args[0]])});
+                    break;
+                case OpSqrt:
+                    // (sqrt(a))' = a' / (2 * sqrt(a))
+                    if (d[n.args[0]] != zero)
+                        d[i] = push(OpDiv, {d[n.args[0]], push(OpMul, {constant(2), i})});
+                    break;
+                case OpPow: {
+                    if (d[n.args[1]] != zero)
+                        throw std::logic_error("Differentiation Error:\n\t\tExponent depends on the variable\n");
+                    if (d[n.args[0]] == zero)
+                        break;
+                    // (a ^ b)' = b * a ^ (b - 1) * a'
+                    uint32_t power = push(OpPow, {n.args[0], push(OpSub, {n.args[1], constant(1)})});
+                    d[i] = mul(mul(n.args[1], power), d[n.args[0]]);
+                    break;
+                }
+                case OpCall:
+                    for (auto a: n.args) {
+                        if (d[a] != zero)
+                            throw std::logic_error("Differentiation Error:\n\t\tFunction "
+                                                   + program.calls[n.arg].token->cname() + " depends on the variable\n");
+                    }
+                    break;
+                default:
+                    break;
+            }
+        }
+
+        Program<Value> result = program;
+        uint32_t root = d[roots[0]] == zero ? constant(0) : d[roots[0]];
+        result.assign(nodes, {root});
+        return result;
+    }
+
+    template Program<float> differentiate<float>(const Program<float>&, uint32_t);
+    template Program<double> differentiate<double>(const Program<double>&, uint32_t);
+    template Program<long double> differentiate<long double>(const Program<long double>&, uint32_t);
+    template Program<Dual<float>> differentiate<Dual<float>>(const Program<Dual<float>>&, uint32_t);
+    template Program<Dual<double>> differentiate<Dual<double>>(const Program<Dual<double>>&, uint32_t);
+    template Program<Dual<long double>> differentiate<Dual<long double>>(const Program<Dual<long double>>&, uint32_t);
+    template Program<Dual<double, 4>> differentiate<Dual<double, 4>>(const Program<Dual<double, 4>>&, uint32_t);
+
+}
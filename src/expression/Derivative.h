@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Program.h"
+
+namespace rk {
+
+    /*
+     * Program computing the derivative of the single output of program with respect to variable,
+     * over the same variables and function tokens. Terms known to be zero are dropped while building,
+     * the operands of the original program are shared with the derivative rather than copied.
+     * Throws std::logic_error when the derivative needs a logarithm (an exponent depending on variable)
+     * or goes through a function token depending on variable, those have no derivative.
+     */
+    template<typename Value>
+    Program<Value> differentiate(const Program<Value>& program, uint32_t variable);
+
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "../utils/utils.h"
+
+namespace rk {
+
+    /*
+     * Forward mode automatic differentiation number: a value together with its derivatives along N directions.
+     * An expression evaluated over duals seeded with a direction returns the value and the directional derivative
+     * in one pass, solvers carry the derivatives through every step. Comparisons only look at the value,
+     * so step size control and other branches behave exactly as for plain numbers.
+     */
+    template<typename T, size_t N = 1>
+    class Dual {
+    public:
+        Dual(T value = 0) : value(value), derivative{} {}
+        Dual(T value, const std::array<T, N>& derivative) : value(value), derivative(derivative) {}
+
+        // Drops the derivatives
+        template<typename U, typename = std::enable_if_t<std::is_arithmetic<U>::value>>
+        explicit operator U() const { return U(value); }
+
+        T value;
+        std::array<T, N> derivative;
+
+        Dual& operator+=(const Dual& b) {
+            value += b.value;
+            for (size_t k = 0; k < N; ++k)
+                derivative[k] += b.derivative[k];
+            return *this;
+        }
+
+        Dual& operator-=(const Dual& b) {
+            value -= b.value;
+            for (size_t k = 0; k < N; ++k)
+                derivative[k] -= b.derivative[k];
+            return *this;
+        }
+
+        Dual& operator*=(const Dual& b) {
+            for (size_t k = 0; k < N; ++k)
+                derivative[k] = derivative[k] * b.value + value * b.derivative[k];
+            value *= b.value;
+            return *this;
+        }
+
+        Dual& operator/=(const Dual& b) {
+            value /= b.value;
+            for (size_t k = 0; k < N; ++k)
+                derivative[k] = (derivative[k] - value * b.derivative[k]) / b.value;
+            return *this;
+        }
+
+        friend Dual operator+(Dual a, const Dual& b) { return a += b; }
+        friend Dual operator-(Dual a, const Dual& b) { return a -= b; }
+        friend Dual operator*(Dual a, const Dual& b) { return a *= b; }
+        friend Dual operator/(Dual a, const Dual& b) { return a /= b; }
+
+        friend Dual operator-(Dual a) {
+            a.value = -a.value;
+            for (auto &d: a.derivative)
+                d = -d;
+            return a;
+        }
+
+        friend bool operator==(const Dual& a, const Dual& b) { return a.value == b.value; }
+        friend bool operator!=(const Dual& a, const Dual& b) { return a.value != b.value; }
+        friend bool operator<(const Dual& a, const Dual& b) { return a.value < b.value; }
+        friend bool operator>(const Dual& a, const Dual& b) { return a.value > b.value; }
+        friend bool operator<=(const Dual& a, const Dual& b) { return a.value <= b.value; }
+        friend bool operator>=(const Dual& a, const Dual& b) { return a.value >= b.value; }
+
+        friend Dual sin(const Dual& a) {
+            Dual r(std::sin(a.value));
+            const T c = std::cos(a.value);
+            for (size_t k = 0; k < N; ++k)
+                r.derivative[k] = c * a.derivative[k];
+            return r;
+        }
+
+        friend Dual cos(const Dual& a) {
+            Dual r(std::cos(a.value));
+            const T s = -std::sin(a.value);
+            for (size_t k = 0; k < N; ++k)
+                r.derivative[k] = s * a.derivative[k];
+            return r;
+        }
+
+        friend Dual log(const Dual& a) {
+            Dual r(std::log(a.value));
+            for (size_t k = 0; k < N; ++k)
+                r.derivative[k] = a.derivative[k] / a.value;
+            return r;
+        }
+
+        friend Dual pow(const Dual& a, const Dual& b) {
+            Dual r(std::pow(a.value, b.value));
+            // Directions the base or the exponent does not move along add nothing, which keeps pow(0, 0.5) finite
+            for (size_t k = 0; k < N; ++k) {
+                if (a.derivative[k] != 0)
+                    r.derivative[k] += b.value * std::pow(a.value, b.value - 1) * a.derivative[k];
+                if (b.derivative[k] != 0)
+                    r.derivative[k] += r.value * std::log(a.value) * b.derivative[k];
+            }
+            return r;
+        }
+
+        friend Dual sqrt(const Dual& a) {
+            Dual r(std::sqrt(a.value));
+            // Like pow, directions the argument does not move along stay zero at sqrt(0)
+            for (size_t k = 0; k < N; ++k) {
+                if (a.derivative[k] != 0)
+                    r.derivative[k] = a.derivative[k] / (2 * r.value);
+            }
+            return r;
+        }
+
+        friend Dual fabs(const Dual& a) { return a.value < 0 ? -a : a; }
+        friend Dual abs(const Dual& a) { return fabs(a); }
+
+        friend void sinCos(const Dual& x, Dual* s, Dual* c) {
+            *s = sin(x);
+            *c = cos(x);
+        }
+
+        friend bool isnan(const Dual& a) { return std::isnan(a.value); }
+        friend bool isinf(const Dual& a) { return std::isinf(a.value); }
+        friend bool signbit(const Dual& a) { return std::signbit(a.value); }
+
+        friend std::string to_string(const Dual& a) { return std::to_string(a.value); }
+
+        friend std::ostream& operator<<(std::ostream& out, const Dual& a) {
+            out << a.value << " [";
+            for (size_t k = 0; k < N; ++k)
+                out << (k > 0 ? ", " : "") << a.derivative[k];
+            return out << "]";
+        }
+    };
+
+    // Converter for Expression<Dual<T, N>>::parse, constants do not depend on anything
+    template<typename T, size_t N = 1>
+    std::pair<Dual<T, N>, bool> stringToDual(const std::string& s) {
+        if constexpr (std::is_same<T, float>::value) {
+            auto [value, isNum] = utils_rk::stringToFloat(s);
+            return {Dual<T, N>(value), isNum};
+        } else if constexpr (std::is_same<T, double>::value) {
+            auto [value, isNum] = utils_rk::stringToDouble(s);
+            return {Dual<T, N>(value), isNum};
+        } else {
+            auto [value, isNum] = utils_rk::stringToLongDouble(s);
+            return {Dual<T, N>(T(value)), isNum};
+        }
+    }
+
+}
+
+namespace std {
+
+    template<typename T, size_t N>
+    struct numeric_limits<rk::Dual<T, N>> : numeric_limits<T> {};
+
+}
@@ -2,6 +2,12 @@
 // Created by Ivan on 19.04.2020.
 //
 
+#include <chrono>
+#include <limits>
+#include <optional>
+#include <thread>
+#include <unordered_set>
+
 #include "Expression.h"
 
 
@@ -10,10 +16,14 @@ namespace rk {
     template class Expression<float>;
     template class Expression<double>;
     template class Expression<long double>;
+    template class Expression<Dual<float>>;
+    template class Expression<Dual<double>>;
+    template class Expression<Dual<long double>>;
+    template class Expression<Dual<double, 4>>;
 
 
     template<typename Value>
-    std::map<std::string, std::shared_ptr<Token<Value>>> Expression<Value>::tokens = {
+    typename Expression<Value>::SymbolTable Expression<Value>::tokens = {
             {"*",   std::make_shared<MulToken<Value>>()},
             {"+",   std::make_shared<SumToken<Value>>()},
             {"-",   std::make_shared<SubToken<Value>>()},
@@ -24,30 +34,185 @@ namespace rk {
             {",",   std::make_shared<DelimiterToken<Value>>()},
             {"sin", std::make_shared<SinToken<Value>>()},
             {"pow", std::make_shared<PowToken<Value>>()},
-            {"cos", std::make_shared<CosToken<Value>>()}
+            {"cos", std::make_shared<CosToken<Value>>()},
+            {"sqrt", std::make_shared<SqrtToken<Value>>()}
     };
     
     template<typename Value>
-    std::map<std::string, size_t> Expression<Value>::dlls{};
+    std::mutex Expression<Value>::tokensMutex;
+
+    template<typename Value>
+    std::pair<std::vector<std::string>, std::shared_ptr<const typename Expression<Value>::SymbolTable>>
+            Expression<Value>::lastVariables;
+
+    template<typename Value>
+    std::shared_ptr<const typename Expression<Value>::Parsed> Expression<Value>::empty() {
+        // Shared by every expression not parsed yet, so it never has to be checked for
+        static const auto nothing = std::make_shared<const Parsed>();
+        return nothing;
+    }
+
+    namespace {
+
+        /*
+         * Background compilations still running at exit are joined before the static state they use is destroyed,
+         * the instance is created on first use, so it goes away before the statics defined above.
+         */
+        class TieringWorkers {
+        public:
+            static TieringWorkers& instance() {
+                static TieringWorkers workers;
+                return workers;
+            }
+
+            void start(std::function<void()> job) {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (auto it = threads.begin(); it != threads.end();) {
+                    if (*it->second) {
+                        it->first.join();
+                        it = threads.erase(it);
+                    } else {
+                        ++it;
+                    }
+                }
+                auto done = std::make_shared<std::atomic<bool>>(false);
+                threads.emplace_back(std::thread([job, done]() {
+                    job();
+                    *done = true;
+                }), done);
+            }
+
+            ~TieringWorkers() {
+                std::lock_guard<std::mutex> lock(mutex);
+                for (auto &t: threads)
+                    t.first.join();
+            }
+
+        private:
+            std::mutex mutex;
+            std::list<std::pair<std::thread, std::shared_ptr<std::atomic<bool>>>> threads;
+        };
+
+        // Name of an operation in a Profile. No default, so a new opcode without a name is warned about
+        const char* opcodeName(OpCode code) {
+            switch (code) {
+                case OpNumber: return "number";
+                case OpVariable: return "variable";
+                case OpSum: return "+";
+                case OpSub: return "-";
+                case OpMul: return "*";
+                case OpDiv: return "/";
+                case OpUnaryMinus: return "neg";
+                case OpSin: return "sin";
+                case OpCos: return "cos";
+                case OpPow: return "pow";
+                case OpCall: return "call";
+                case OpStore: return "store";
+                case OpLoad: return "load";
+                case OpSinCos: return "sincos";
+                case OpOutput: return "output";
+                case OpSqrt: return "sqrt";
+            }
+            return "unknown";
+        }
+
+        // Tables are looked up in lower case
+        std::string tableName(std::string name) {
+            std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return (char) tolower(c); });
+            return name;
+        }
+
+    }
+
+    template<typename Value>
+    void Expression<Value>::parse(std::string s,
+                                  const std::vector<std::string> &variables,
+                                  std::pair<Value, bool> (*f)(const std::string &)) {
+        this->parse(std::move(s), variables, {}, f);
+    }
 
     template<typename Value>
     void Expression<Value>::parse(std::string s,
                                   const std::vector<std::string> &variables,
+                                  const std::vector<std::string> &params,
                                   std::pair<Value, bool> (*f)(const std::string &)) {
-        this->vars = variables;
-        this->converter = f;
+        ParseCache& cache = Expression<Value>::parseCache();
+        bool cached;
+        uint64_t generation;
+        {
+            std::lock_guard<std::mutex> lock(cache.mutex);
+            cached = cache.capacity > 0;
+            generation = cache.generation;
+        }
+        const std::string key = cached ? this->parseKey(s, variables, params, f) : std::string();
+        if (cached) {
+            std::shared_ptr<const Parsed> hit;
+            {
+                std::lock_guard<std::mutex> lock(cache.mutex);
+                auto it = cache.byKey.find(key);
+                if (it != cache.byKey.end()) {
+                    cache.entries.splice(cache.entries.begin(), cache.entries, it->second);
+                    hit = it->second->parsed;
+                    ++cache.statistics.hits;
+                } else {
+                    ++cache.statistics.misses;
+                }
+            }
+            if (hit) {
+                if (params != this->parsed->parameters)
+                    this->parameterValues.assign(params.size(), Value(0));
+                this->parsed = std::move(hit);
+                this->reset();
+                return;
+            }
+        }
 
-        this->expression.clear();
-        this->mainQueue.clear();
+        auto next = std::make_shared<Parsed>();
+        const bool sameNames = this->parsed->variableTokens && variables == this->parsed->vars
+                               && params == this->parsed->parameters;
+        if (!sameNames || f != this->parsed->converter) {
+            // The lexer would read such a name as the number, inf or nan for the builtin converters
+            for (auto names: {&variables, &params}) {
+                for (auto &name: *names) {
+                    if (f(name).second)
+                        throw std::logic_error("Parsing Error:\n\t\tVariable " + name + " is a number\n");
+                }
+            }
+        }
+        if (sameNames) {
+            next->variableTokens = this->parsed->variableTokens;
+        } else {
+            // Parameters are variables past the state variables, for the lexer and the program alike
+            std::vector<std::string> names = variables;
+            for (auto &p: params) {
+                if (std::find(names.begin(), names.end(), p) != names.end())
+                    throw std::logic_error("Parsing Error:\n\t\tParameter " + p + " is already defined\n");
+                names.push_back(p);
+            }
+            next->variableTokens = Expression<Value>::variableTable(names);
+        }
+        next->vars = variables;
+        next->parameters = params;
+        next->converter = f;
 
-        this->tokenize(s, this->expression);
+        std::vector<std::shared_ptr<Token<Value>>> infix;
+        Expression<Value>::tokenize(s, *next, infix);
+        auto &mainQueue = next->mainQueue;
+        mainQueue.reserve(infix.size());
 
-        std::stack<std::shared_ptr<Token<Value>>> opStack;
-        for (auto &t: this->expression) {
+        // Argument count of every function in the order the functions reach mainQueue
+        std::vector<size_t> arities;
+        std::stack<size_t, std::vector<size_t>> argCounts;
+        std::stack<std::shared_ptr<Token<Value>>, std::vector<std::shared_ptr<Token<Value>>>> opStack;
+        std::shared_ptr<Token<Value>> prev = nullptr;
+        for (auto &t: infix) {
             if (t->type() == Number || t->type() == Variable) {
                 mainQueue.push_back(t);
-            } else if (t->type() == LeftParen || t->type() == Function) {
+            } else if (t->type() == LeftParen) {
                 opStack.push(t);
+            } else if (t->type() == Function) {
+                opStack.push(t);
+                argCounts.push(1);
             } else if (t->type() == Operator) {
                 while ((!opStack.empty()) && (opStack.top()->type() == Function
                                               || (opStack.top()->type() == Operator &&
@@ -55,10 +220,23 @@ namespace rk {
                                                    (opStack.top()->precedence() == t->precedence() &&
                                                     isLeftAssociative(t)))))
                        && (opStack.top()->type() != LeftParen)) {
+                    if (opStack.top()->type() == Function) {
+                        arities.push_back(argCounts.top());
+                        argCounts.pop();
+                    }
                     mainQueue.push_back(opStack.top());
                     opStack.pop();
                 }
                 opStack.push(t);
+            } else if (t->type() == Delimiter) {
+                // Finish the current argument before starting the next one
+                while ((!opStack.empty()) && opStack.top()->type() != LeftParen) {
+                    mainQueue.push_back(opStack.top());
+                    opStack.pop();
+                }
+                if (opStack.empty() || argCounts.empty())
+                    throw std::logic_error("Parsing Error:\n\t\tMisplaced delimiter\n");
+                ++argCounts.top();
             } else if (t->type() == RightParen) {
                 while ((!opStack.empty()) && opStack.top()->type() != LeftParen) {
                     mainQueue.push_back(opStack.top());
@@ -69,18 +247,310 @@ namespace rk {
                 if (opStack.top()->type() == LeftParen) {
                     opStack.pop();
                 }
+                if ((!opStack.empty()) && opStack.top()->type() == Function) {
+                    arities.push_back(prev && prev->type() == LeftParen ? 0 : argCounts.top());
+                    argCounts.pop();
+                    mainQueue.push_back(opStack.top());
+                    opStack.pop();
+                }
             }
+            prev = t;
         }
         while (!opStack.empty()) {
             if (isParen(opStack.top()))
                 throw std::logic_error("Parsing Error:\n\t\tMismatched parentheses\n");
+            if (opStack.top()->type() == Function) {
+                arities.push_back(argCounts.top());
+                argCounts.pop();
+            }
             mainQueue.push_back(opStack.top());
             opStack.pop();
         }
+        this->build(*next, arities);
+        Expression<Value>::share(*next);
+        if (cached) {
+            std::lock_guard<std::mutex> lock(cache.mutex);
+            // Another thread may have parsed the same source meanwhile, the cache may be disabled by now, or a token
+            // this parse looked up may be gone
+            if (cache.capacity > 0 && cache.generation == generation && cache.byKey.find(key) == cache.byKey.end()) {
+                cache.entries.push_front({key, next, {}});
+                cache.byKey[key] = cache.entries.begin();
+                cache.byParsed[next.get()] = cache.entries.begin();
+                while (cache.entries.size() > cache.capacity) {
+                    cache.byKey.erase(cache.entries.back().key);
+                    cache.byParsed.erase(cache.entries.back().parsed.get());
+                    cache.entries.pop_back();
+                    ++cache.statistics.evictions;
+                }
+            }
+        }
+        // Values survive a parse over the same parameters
+        if (params != this->parsed->parameters)
+            this->parameterValues.assign(params.size(), Value(0));
+        this->parsed = std::move(next);
+        this->reset();
+    }
+
+    template<typename Value>
+    typename Expression<Value>::ParseCache& Expression<Value>::parseCache() {
+        static ParseCache cache;
+        return cache;
+    }
+
+    template<typename Value>
+    std::string Expression<Value>::parseKey(const std::string& source, const std::vector<std::string>& variables,
+                                            const std::vector<std::string>& parameters,
+                                            std::pair<Value, bool> (*f)(const std::string&)) const {
+        auto word = [](char c) { return isalnum((unsigned char) c) || c == '.'; };
+        std::string key;
+        key.reserve(source.size() + 64);
+        bool space = false;
+        for (char c: source) {
+            if (isspace((unsigned char) c)) {
+                space = true;
+                continue;
+            }
+            // "x y" is not "xy", nor is "1e -5" the number 1e-5
+            if (space && !key.empty() && word(key.back())
+                && (word(c) || ((c == '-' || c == '+') && key.back() == 'e')))
+                key.push_back(' ');
+            // Names and numbers are case insensitive
+            key.push_back((char) tolower((unsigned char) c));
+            space = false;
+        }
+        key.push_back('\0');
+        for (auto &v: variables)
+            key.append(v).push_back(',');
+        key.push_back('\0');
+        for (auto &p: parameters)
+            key.append(p).push_back(',');
+        key.push_back('\0');
+        key.append(std::to_string((uintptr_t) f));
+        // Both change the program built from the same tokens
+        key.push_back(this->reciprocalDivision ? 'r' : '-');
+        key.push_back(NodeStore<Value>::enabled() ? 's' : '-');
+        return key;
+    }
+
+    template<typename Value>
+    void Expression<Value>::enableParseCache(size_t capacity) {
+        ParseCache& cache = Expression<Value>::parseCache();
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        cache.capacity = std::max<size_t>(capacity, 1);
+        while (cache.entries.size() > cache.capacity) {
+            cache.byKey.erase(cache.entries.back().key);
+            cache.byParsed.erase(cache.entries.back().parsed.get());
+            cache.entries.pop_back();
+            ++cache.statistics.evictions;
+        }
+    }
+
+    template<typename Value>
+    void Expression<Value>::disableParseCache() {
+        ParseCache& cache = Expression<Value>::parseCache();
+        std::list<typename ParseCache::Entry> dropped;
+        {
+            std::lock_guard<std::mutex> lock(cache.mutex);
+            cache.capacity = 0;
+            cache.byKey.clear();
+            cache.byParsed.clear();
+            dropped.swap(cache.entries);
+        }
+    }
+
+    template<typename Value>
+    void Expression<Value>::forgetParses(const Token<Value>* token) {
+        auto calls = [token](const Parsed& parsed) {
+            // Programs in the NodeStore keep no tokens of their own, they are dropped whatever they call
+            if (parsed.dag)
+                return true;
+            for (auto &t: parsed.mainQueue) {
+                if (t.get() == token)
+                    return true;
+            }
+            for (auto &call: parsed.program.calls) {
+                if (call.token.get() == token)
+                    return true;
+            }
+            return false;
+        };
+        ParseCache& cache = Expression<Value>::parseCache();
+        std::list<typename ParseCache::Entry> dropped;
+        {
+            std::lock_guard<std::mutex> lock(cache.mutex);
+            ++cache.generation;
+            for (auto it = cache.entries.begin(); it != cache.entries.end();) {
+                auto next = std::next(it);
+                if (calls(*it->parsed)) {
+                    cache.byKey.erase(it->key);
+                    cache.byParsed.erase(it->parsed.get());
+                    dropped.splice(dropped.end(), cache.entries, it);
+                }
+                it = next;
+            }
+        }
+    }
+
+    template<typename Value>
+    typename Expression<Value>::ParseCacheStatistics Expression<Value>::parseCacheStatistics() {
+        ParseCache& cache = Expression<Value>::parseCache();
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        ParseCacheStatistics statistics = cache.statistics;
+        statistics.entries = cache.entries.size();
+        statistics.capacity = cache.capacity;
+        return statistics;
+    }
+
+    template<typename Value>
+    bool Expression<Value>::reuseNative(CompileBackend backend) {
+        ParseCache& cache = Expression<Value>::parseCache();
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        auto it = cache.byParsed.find(this->parsed.get());
+        if (it == cache.byParsed.end())
+            return false;
+        const std::string flags = this->options.flags();
+        for (auto &n: it->second->natives) {
+            if (n.backend != backend || n.flags != flags)
+                continue;
+            this->module = n.module;
+            this->jitCode = n.jitCode;
+            this->compiled = n.compiled;
+            this->compiledBatch = n.compiledBatch;
+            this->batchFrame = n.batchFrame;
+            this->compiledSymbol = n.compiledSymbol;
+            this->batchSymbol = n.batchSymbol;
+            ++cache.statistics.nativeHits;
+            return true;
+        }
+        return false;
+    }
+
+    template<typename Value>
+    void Expression<Value>::rememberNative(CompileBackend backend) const {
+        ParseCache& cache = Expression<Value>::parseCache();
+        std::lock_guard<std::mutex> lock(cache.mutex);
+        auto it = cache.byParsed.find(this->parsed.get());
+        if (it == cache.byParsed.end())
+            return;
+        const std::string flags = this->options.flags();
+        for (auto &n: it->second->natives) {
+            if (n.backend == backend && n.flags == flags)
+                return;
+        }
+        it->second->natives.push_back({backend, flags, this->module, this->jitCode, this->compiled,
+                                       this->compiledBatch, this->batchFrame, this->compiledSymbol,
+                                       this->batchSymbol});
+    }
+
+    template<typename Value>
+    void Expression<Value>::build(Parsed& parsed, const std::vector<size_t>& arities) const {
+        parsed.program.lower(parsed.mainQueue, arities, parsed.vars.size() + parsed.parameters.size());
+        parsed.removed = simplify(parsed.program, this->reciprocalDivision);
+        eliminateCommonSubexpressions(parsed.program);
+    }
+
+    template<typename Value>
+    void Expression<Value>::share(Parsed& parsed) {
+        // Parameters hold values of one expression, nodes reading them could not be shared
+        if (!NodeStore<Value>::enabled() || !parsed.parameters.empty() || parsed.program.empty())
+            return;
+        parsed.dag = NodeStore<Value>::intern(parsed.program);
+        parsed.mainQueue = std::vector<std::shared_ptr<Token<Value>>>();
+        parsed.program = Program<Value>();
+    }
+
+    template<typename Value>
+    const Program<Value>& Expression<Value>::program(Program<Value>& storage) const {
+        if (!this->parsed->dag)
+            return this->parsed->program;
+        storage = NodeStore<Value>::program(*this->parsed->dag);
+        return storage;
+    }
+
+    template<typename Value>
+    Value Expression<Value>::run(const Value* vars, Value* scratch) const {
+        if (this->parsed->dag)
+            return NodeStore<Value>::evaluate(*this->parsed->dag, vars);
+        return scratch != nullptr ? this->parsed->program.run(vars, scratch) : this->parsed->program.run(vars);
+    }
+
+    template<typename Value>
+    void Expression<Value>::reset() {
         this->uncompile();
         this->fromString = true;
-        this->compiled = nullptr;
-        this->dll = nullptr;
+        this->linked.reset();
+        this->tier = this->tieringThreshold > 0
+                     ? std::make_shared<Tier>(this->tieringThreshold, this->tieringBackend) : nullptr;
+    }
+
+    template<typename Value>
+    Expression<Value> Expression<Value>::derivative(size_t variable) const {
+        if (!this->fromString)
+            throw std::logic_error("Differentiation Error:\n\t\tOnly parsed expressions can be differentiated\n");
+        if (variable >= this->parsed->vars.size())
+            throw std::logic_error("Differentiation Error:\n\t\tUnknown variable " + std::to_string(variable) + "\n");
+        Program<Value> storage;
+        auto derived = differentiate(this->program(storage), (uint32_t) variable);
+
+        // Back to tokens in postfix order, so the derivative is interpreted and lowered like a parsed expression
+        Expression<Value> result;
+        auto postfix = std::make_shared<Parsed>();
+        postfix->variableTokens = this->parsed->variableTokens;
+        postfix->vars = this->parsed->vars;
+        postfix->parameters = this->parsed->parameters;
+        postfix->converter = this->parsed->converter;
+        result.parameterValues = this->parameterValues;
+        result.reciprocalDivision = this->reciprocalDivision;
+        std::vector<size_t> arities;
+        std::vector<uint32_t> roots;
+        auto nodes = derived.tree(roots);
+        std::vector<std::pair<uint32_t, size_t>> todo = {{roots[0], 0}};
+        while (!todo.empty()) {
+            auto &[i, next] = todo.back();
+            const auto &n = nodes[i];
+            if (next < n.args.size()) {
+                todo.emplace_back(n.args[next++], 0);
+                continue;
+            }
+            switch (n.code) {
+                case OpNumber:
+                    postfix->mainQueue.push_back(std::make_shared<NumberToken<Value>>(n.value));
+                    break;
+                case OpVariable:
+                    postfix->mainQueue.push_back(std::make_shared<VariableToken<Value>>((int) n.arg));
+                    break;
+                case OpCall:
+                    postfix->mainQueue.push_back(derived.calls[n.arg].token);
+                    arities.push_back(derived.calls[n.arg].arity);
+                    break;
+                default: {
+                    static const std::map<OpCode, std::string> names = {
+                            {OpSum, "+"}, {OpSub, "-"}, {OpMul, "*"}, {OpDiv, "/"}, {OpUnaryMinus, "--"},
+                            {OpSin, "sin"}, {OpCos, "cos"}, {OpPow, "pow"}, {OpSqrt, "sqrt"}
+                    };
+                    std::lock_guard<std::mutex> lock(Expression<Value>::tokensMutex);
+                    postfix->mainQueue.push_back(Expression<Value>::tokens.at(names.at(n.code)));
+                    break;
+                }
+            }
+            todo.pop_back();
+        }
+        result.build(*postfix, arities);
+        Expression<Value>::share(*postfix);
+        result.parsed = std::move(postfix);
+        result.reset();
+        return result;
+    }
+
+    template<typename Value>
+    std::vector<std::vector<std::shared_ptr<Expression<Value>>>>
+    Expression<Value>::jacobian(const std::vector<std::shared_ptr<Expression<Value>>>& system) {
+        std::vector<std::vector<std::shared_ptr<Expression<Value>>>> matrix(system.size());
+        for (size_t i = 0; i < system.size(); ++i) {
+            for (size_t j = 0; j < system.size(); ++j)
+                matrix[i].push_back(std::make_shared<Expression<Value>>(system[i]->derivative(j + 1)));
+        }
+        return matrix;
     }
 
     template<typename Value>
@@ -88,37 +558,311 @@ namespace rk {
         this->uncompile();
         this->fromString = false;
         this->compiled = function;
-        this->dll = nullptr;
+        this->linked.reset();
+        this->tier.reset();
+    }
+
+    template<typename Value>
+    void Expression<Value>::enableTiering(size_t threshold, CompileBackend backend) {
+        this->tieringThreshold = std::max<size_t>(threshold, 1);
+        this->tieringBackend = backend;
+        this->tier = this->fromString ? std::make_shared<Tier>(this->tieringThreshold, backend) : nullptr;
+    }
+
+    template<typename Value>
+    void Expression<Value>::disableTiering() {
+        this->tieringThreshold = 0;
+        this->tier.reset();
+    }
+
+    template<typename Value>
+    bool Expression<Value>::isNative() const {
+        return this->compiled != nullptr || (this->tier && this->tier->native.load(std::memory_order_acquire));
+    }
+
+    template<typename Value>
+    void Expression<Value>::promote() const {
+        // The worker compiles its own copy, callers keep interpreting this one meanwhile
+        auto state = this->tier;
+        auto module = std::make_shared<Expression<Value>>(*this);
+        module->disableTiering();
+        TieringWorkers::instance().start([state, module]() {
+            if (module->compile(state->backend)) {
+                state->module = module;
+                state->native.store(module.get(), std::memory_order_release);
+            }
+        });
     }
 
     template<typename Value>
     void Expression<Value>::uncompile() {
-        if (this->fromString && this->compiled != nullptr && --Expression<Value>::dlls[compileName] == 0) {
-#ifndef WIN32
-            dlclose(this->dll);
-#else
-            FreeLibrary((HINSTANCE) this->dll);
-#endif
-            remove(("./" + compileName + ".so").c_str());
-            remove(("./" + compileName + ".cc").c_str());
-        }
+        this->jitCode.reset();
+        this->module.reset();
+        this->compiled = nullptr;
+        this->compiledBatch = nullptr;
     }
 
     template<typename Value>
     void Expression<Value>::addFunctionToken(const std::string& name, std::shared_ptr<FunctionToken<Value>> token) {
+        std::lock_guard<std::mutex> lock(Expression<Value>::tokensMutex);
         if (Expression<Value>::tokens.find(name) != Expression<Value>::tokens.end())
             throw std::logic_error("Function with this name already exists");
         Expression<Value>::tokens[name] = token;
     }
 
+    template<typename Value>
+    void Expression<Value>::removeFunctionToken(const std::string& name) {
+        std::shared_ptr<Token<Value>> old;
+        {
+            std::lock_guard<std::mutex> lock(Expression<Value>::tokensMutex);
+            auto it = Expression<Value>::tokens.find(name);
+            if (it == Expression<Value>::tokens.end() || it->second->type() != Function)
+                throw std::logic_error("Function with this name does not exist");
+            old = std::move(it->second);
+            Expression<Value>::tokens.erase(it);
+        }
+        Expression<Value>::forgetParses(old.get());
+    }
+
+    template<typename Value>
+    void Expression<Value>::addTable(const std::string& name, std::shared_ptr<const Table<Value>> table) {
+        Expression<Value>::addFunctionToken(tableName(name), std::make_shared<TableToken<Value>>(std::move(table)));
+    }
+
+    template<typename Value>
+    void Expression<Value>::removeTable(const std::string& name) {
+        Expression<Value>::removeFunctionToken(tableName(name));
+    }
+
+    template<typename Value>
+    void Expression<Value>::replaceTable(const std::string& name, std::shared_ptr<const Table<Value>> table) {
+        const std::string lower = tableName(name);
+        std::shared_ptr<Token<Value>> token = std::make_shared<TableToken<Value>>(std::move(table));
+        {
+            std::lock_guard<std::mutex> lock(Expression<Value>::tokensMutex);
+            auto it = Expression<Value>::tokens.find(lower);
+            if (it == Expression<Value>::tokens.end()) {
+                Expression<Value>::tokens[lower] = std::move(token);
+                return;
+            }
+            if (it->second->type() != Function)
+                throw std::logic_error("Name is taken by a token which is not a function");
+            std::swap(it->second, token);
+        }
+        // token is the old one now
+        Expression<Value>::forgetParses(token.get());
+    }
+
+    template<typename Value>
+    size_t Expression<Value>::parameterIndex(const std::string& name) const {
+        auto it = std::find(this->parsed->parameters.begin(), this->parsed->parameters.end(), name);
+        if (it == this->parsed->parameters.end())
+            throw std::logic_error("Parameter Error:\n\t\tUnknown parameter " + name + "\n");
+        return (size_t) (it - this->parsed->parameters.begin());
+    }
+
+    template<typename Value>
+    void Expression<Value>::setParameter(const std::string& name, Value value) {
+        this->parameterValues[this->parameterIndex(name)] = value;
+    }
+
+    template<typename Value>
+    void Expression<Value>::setParameters(const std::vector<Value>& values) {
+        this->checkParameters(values);
+        this->parameterValues = values;
+    }
+
+    template<typename Value>
+    void Expression<Value>::checkParameters(const std::vector<Value>& params) const {
+        if (params.size() != this->parsed->parameters.size())
+            throw std::logic_error("Parameter Error:\n\t\tExpected " + std::to_string(this->parsed->parameters.size())
+                                   + " parameter values, got " + std::to_string(params.size()) + "\n");
+    }
+
+    template<typename Value>
+    Value Expression<Value>::getParameter(const std::string& name) const {
+        return this->parameterValues[this->parameterIndex(name)];
+    }
+
+    template<typename Value>
+    void Expression<Value>::fillRow(const Value* varsValues, const Value* params, Value* row) const {
+        std::copy(varsValues, varsValues + this->parsed->vars.size(), row);
+        std::copy(params, params + this->parsed->parameters.size(), row + this->parsed->vars.size());
+    }
+
     template<typename Value>
     Value Expression<Value>::evaluate(const std::vector<Value> &varsValues) const {
+        if (this->profiler)
+            return this->instrumented(1, [this, &varsValues]() { return this->compute(varsValues); });
+        return this->compute(varsValues);
+    }
+
+    template<typename Value>
+    Value Expression<Value>::evaluate(const Value* varsValues, Value* scratch) const {
+        if (this->profiler)
+            return this->instrumented(1, [this, varsValues, scratch]() { return this->compute(varsValues, scratch); });
+        return this->compute(varsValues, scratch);
+    }
+
+    template<typename Value>
+    Value Expression<Value>::evaluate(const std::vector<Value> &varsValues, const std::vector<Value> &params) const {
+        this->checkParameters(params);
+        if (this->profiler)
+            return this->instrumented(1, [this, &varsValues, &params]() {
+                return this->compute(varsValues.data(), params.data());
+            });
+        return this->compute(varsValues.data(), params.data());
+    }
+
+    template<typename Value>
+    Value Expression<Value>::compute(const std::vector<Value> &varsValues) const {
+        if (!this->parsed->parameters.empty())
+            return this->compute(varsValues.data(), this->parameterValues.data());
         if (this->compiled != nullptr) {
-            return this->compiled(varsValues.data());
+            return this->runCompiled(varsValues.data());
+        }
+        if (this->tier) {
+            if (const Expression<Value>* native = this->tier->native.load(std::memory_order_acquire))
+                return native->runCompiled(varsValues.data());
+            if (this->tier->count(1))
+                this->promote();
+        }
+        return this->run(varsValues.data(), nullptr);
+    }
+
+    template<typename Value>
+    Value Expression<Value>::compute(const Value* varsValues, const Value* params) const {
+        // The row of variables and parameters goes into scratch, on the stack while it is small
+        const size_t size = this->scratchSize();
+        if (size <= Program<Value>::inlineStackSize) {
+            Value scratch[Program<Value>::inlineStackSize];
+            return this->compute(varsValues, params, scratch);
+        }
+        std::vector<Value> scratch(size);
+        return this->compute(varsValues, params, scratch.data());
+    }
+
+    template<typename Value>
+    Value Expression<Value>::compute(const Value* varsValues, Value* scratch) const {
+        return this->compute(varsValues, this->parameterValues.data(), scratch);
+    }
+
+    template<typename Value>
+    Value Expression<Value>::compute(const Value* varsValues, const Value* params, Value* scratch) const {
+        if (!this->parsed->parameters.empty()) {
+            Value* row = scratch + this->parsed->program.frameSize();
+            this->fillRow(varsValues, params, row);
+            varsValues = row;
+        }
+        if (this->compiled != nullptr)
+            return this->runCompiled(varsValues);
+        if (this->tier) {
+            if (const Expression<Value>* native = this->tier->native.load(std::memory_order_acquire))
+                return native->runCompiled(varsValues);
+            if (this->tier->count(1))
+                this->promote();
+        }
+        return this->run(varsValues, scratch);
+    }
+
+    template<typename Value>
+    void Expression<Value>::evaluateBatch(const std::vector<const Value*> &varsValues, Value* results, size_t n) const {
+        if (this->profiler) {
+            this->instrumented(n, [this, &varsValues, results, n]() {
+                this->computeBatch(varsValues, this->parameterValues.data(), results, n);
+                return true;
+            });
+            return;
+        }
+        this->computeBatch(varsValues, this->parameterValues.data(), results, n);
+    }
+
+    template<typename Value>
+    void Expression<Value>::evaluateBatch(const std::vector<const Value*> &varsValues, Value* results, size_t n,
+                                          const std::vector<Value> &params) const {
+        this->checkParameters(params);
+        if (this->profiler) {
+            this->instrumented(n, [this, &varsValues, &params, results, n]() {
+                this->computeBatch(varsValues, params.data(), results, n);
+                return true;
+            });
+            return;
+        }
+        this->computeBatch(varsValues, params.data(), results, n);
+    }
+
+    template<typename Value>
+    void Expression<Value>::computeBatch(const std::vector<const Value*> &varsValues, const Value* params,
+                                         Value* results, size_t n) const {
+        if (this->parsed->parameters.empty()) {
+            this->evaluateColumns(varsValues, results, n);
+            return;
+        }
+        // Every parameter is broadcast over a column of one block of points, the points go a block at a time
+        const size_t vars = this->parsed->vars.size(), count = this->parsed->parameters.size();
+        const size_t block = std::min(n, 16 * Program<Value>::batchWidth);
+        std::vector<Value> columns(count * block);
+        std::vector<const Value*> all(vars + count);
+        for (size_t i = 0; i < count; ++i) {
+            std::fill(columns.begin() + (ptrdiff_t) (i * block), columns.begin() + (ptrdiff_t) ((i + 1) * block),
+                      params[i]);
+            all[vars + i] = columns.data() + i * block;
+        }
+        for (size_t offset = 0; offset < n; offset += block) {
+            for (size_t j = 0; j < vars; ++j)
+                all[j] = varsValues[j] + offset;
+            this->evaluateColumns(all, results + offset, std::min(block, n - offset));
+        }
+    }
+
+    template<typename Value>
+    void Expression<Value>::evaluateColumns(const std::vector<const Value*> &varsValues, Value* results, size_t n) const {
+        if (this->compiled == nullptr && this->tier) {
+            if (const Expression<Value>* native = this->tier->native.load(std::memory_order_acquire)) {
+                native->evaluateColumns(varsValues, results, n);
+                return;
+            }
+            if (this->tier->count(n))
+                this->promote();
         }
+        if (this->compiledBatch != nullptr) {
+            std::vector<Value> frame(this->batchFrame * Program<Value>::batchWidth);
+            Expression<Value>::callNative(this->module.get(), this->compiledBatch, this->batchSymbol,
+                                          varsValues.data(), results, n, &vectorKernels<Value>(), frame.data());
+        } else if (this->compiled != nullptr) {
+            // Plain native functions take one point at a time, so gather every point into a row
+            std::vector<Value> row(varsValues.size());
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t j = 0; j < row.size(); ++j)
+                    row[j] = varsValues[j][i];
+                results[i] = this->runCompiled(row.data());
+            }
+        } else if (this->parsed->dag) {
+            std::vector<Value> row(varsValues.size());
+            for (size_t i = 0; i < n; ++i) {
+                for (size_t j = 0; j < row.size(); ++j)
+                    row[j] = varsValues[j][i];
+                results[i] = NodeStore<Value>::evaluate(*this->parsed->dag, row.data());
+            }
+        } else {
+            this->parsed->program.runBatch(varsValues.data(), results, n);
+        }
+    }
+
+    template<typename Value>
+    Value Expression<Value>::interpret(const std::vector<Value> &varsValues) const {
+        const std::vector<Value>* row = &varsValues;
+        std::vector<Value> withParameters;
+        if (!this->parsed->parameters.empty()) {
+            withParameters.resize(this->parsed->vars.size() + this->parsed->parameters.size());
+            this->fillRow(varsValues.data(), this->parameterValues.data(), withParameters.data());
+            row = &withParameters;
+        }
+        if (this->parsed->mainQueue.empty() && this->fromString)
+            return this->run(row->data(), nullptr);
         std::stack<Value> s;
-        for (auto &t: mainQueue) {
-            t->evaluate(s, varsValues);
+        for (auto &t: this->parsed->mainQueue) {
+            t->evaluate(s, *row);
         }
         return s.top();
     }
@@ -126,153 +870,635 @@ namespace rk {
 
     // Edited by TV on 21.04.2020
     template<typename Value>
-    void Expression<Value>::tokenize(std::string &s, std::vector<std::shared_ptr<Token<Value>>> &v) {
-        std::string curToken;
-        curToken.reserve(20);
-        for (size_t i = 0; i < s.length(); ++i) {
-            int c = tolower(s[i]);
+    void Expression<Value>::tokenize(const std::string &s, const Parsed& parsed, std::vector<std::shared_ptr<Token<Value>>> &v) {
+        // Numbers of one expression live in a single arena, their tokens share its ownership
+        auto numbers = std::make_shared<std::deque<NumberToken<Value>>>();
+        std::string word;
+        word.reserve(20);
+        std::lock_guard<std::mutex> lock(Expression<Value>::tokensMutex);
+        const size_t n = s.length();
+        for (size_t i = 0; i < n;) {
+            const auto c = (unsigned char) s[i];
+            if (isspace(c)) {
+                ++i;
+                continue;
+            }
             if (isalnum(c) || c == '.') {
-                curToken.push_back(c);
-            } else {
-                if (!curToken.empty())
-                    v.emplace_back(Expression::getToken(curToken));
-                curToken.clear();
-                if (!isspace(c)) {
-                    if (c == '-') {
-                        if (i == s.length() - 1) {
-                            throw std::logic_error(
-                                    "Parsing Error:\n\t\tWrong syntax at pos " + std::to_string(s.size() - 1) + "\n");
-                        }
-                        if (i == 0 || v.back()->type() == Operator || v.back()->type() == LeftParen ||
-                            v.back()->type() == Delimiter) {
-                            v.emplace_back(Expression::getToken("--"));
-                            continue;
-                        }
-                    }
-                    v.emplace_back(Expression::getToken(std::string(1, c)));
+                word.clear();
+                for (; i < n && (isalnum((unsigned char) s[i]) || s[i] == '.'); ++i) {
+                    word.push_back((char) tolower((unsigned char) s[i]));
+                    // Signed exponent of a decimal number like 1e-5, hexadecimal 0x1e - 5 stays a difference
+                    if (word.back() == 'e' && i + 2 < n && (s[i + 1] == '-' || s[i + 1] == '+') &&
+                        isdigit((unsigned char) s[i + 2]) && (isdigit((unsigned char) word[0]) || word[0] == '.') &&
+                        word.find('x') == std::string::npos)
+                        word.push_back(s[++i]);
                 }
+                v.emplace_back(Expression<Value>::getToken(word, parsed, numbers));
+                continue;
             }
+            ++i;
+            if (c == '-') {
+                if (i == n) {
+                    throw std::logic_error(
+                            "Parsing Error:\n\t\tWrong syntax at pos " + std::to_string(n - 1) + "\n");
+                }
+                if (v.empty() || v.back()->type() == Operator || v.back()->type() == LeftParen ||
+                    v.back()->type() == Delimiter) {
+                    v.emplace_back(Expression::tokens.at("--"));
+                    continue;
+                }
+            }
+            word.assign(1, (char) c);
+            auto token = Expression::tokens.find(word);
+            if (token == Expression::tokens.end())
+                throw std::logic_error("Parsing Error:\n\t\tFound unknown token: " + word + "\n");
+            v.emplace_back(token->second);
         }
-        if (!curToken.empty())
-            v.emplace_back(Expression::getToken(curToken));
     }
 
 
     template<typename Value>
-    std::shared_ptr<Token<Value>> Expression<Value>::getToken(const std::string &tokenName) {
+    std::shared_ptr<const typename Expression<Value>::SymbolTable>
+    Expression<Value>::variableTable(const std::vector<std::string> &variables) {
+        // Equations of one system are parsed over the same variables, they all get the last table
+        std::lock_guard<std::mutex> lock(Expression<Value>::tokensMutex);
+        if (!Expression::lastVariables.second || Expression::lastVariables.first != variables) {
+            auto table = std::make_shared<SymbolTable>();
+            for (size_t i = 0; i < variables.size(); ++i)
+                table->emplace(variables[i], std::make_shared<VariableToken<Value>>((int) i));
+            Expression::lastVariables = {variables, std::move(table)};
+        }
+        return Expression::lastVariables.second;
+    }
 
-        auto[value, isNum] = this->converter(tokenName);
-        if (isNum) {
-            return std::make_shared<NumberToken<Value>>(value);
-        } else if (Expression::tokens.find(tokenName) != Expression::tokens.end()) {
-            const auto &token = Expression::tokens.at(tokenName);
-            return token;
-        } else {
-            auto it = std::find(this->vars.begin(), this->vars.end(), tokenName);
-            if (it != this->vars.end()) {
-                return std::make_shared<VariableToken<Value>>(it - this->vars.begin());
-            }
+
+    template<typename Value>
+    std::shared_ptr<Token<Value>> Expression<Value>::getToken(const std::string &word, const Parsed& parsed,
+                                                              const std::shared_ptr<std::deque<NumberToken<Value>>> &numbers) {
+        // Words starting like a number are converted first, other words only when no symbol has the name: inf and nan.
+        // parse refuses variables the converter reads as numbers, so no name can hide a number
+        auto number = [&parsed, &word, &numbers]() -> std::shared_ptr<Token<Value>> {
+            auto[value, isNum] = parsed.converter(word);
+            if (!isNum)
+                return nullptr;
+            numbers->emplace_back(value);
+            return std::shared_ptr<Token<Value>>(numbers, &numbers->back());
+        };
+        const bool numeric = isdigit((unsigned char) word[0]) || word[0] == '.';
+        if (numeric) {
+            if (auto token = number())
+                return token;
         }
-        throw std::logic_error("Parsing Error:\n\t\tFound unknown token: " + tokenName + "\n");
+        auto token = Expression::tokens.find(word);
+        if (token != Expression::tokens.end())
+            return token->second;
+        auto variable = parsed.variableTokens->find(word);
+        if (variable != parsed.variableTokens->end())
+            return variable->second;
+        if (!numeric) {
+            if (auto converted = number())
+                return converted;
+        }
+        throw std::logic_error("Parsing Error:\n\t\tFound unknown token: " + word + "\n");
     }
 
 
     template<typename Value>
-    bool Expression<Value>::compile() {
+    bool Expression<Value>::compile(CompileBackend backend) {
         if (!this->fromString)
             return true;
 
         this->uncompile();
+        if (this->reuseNative(backend)) {
+            this->recordCompile(0, {});
+            return true;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        auto since = [](std::chrono::steady_clock::time_point start) {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        };
+        Program<Value> storage;
+        const Program<Value>& program = this->program(storage);
+        if (backend == JitCompiler) {
+            this->jitCode = jitCompile(program);
+            if (this->jitCode) {
+                this->compiled = (Value (*)(const Value *)) this->jitCode.get();
+                this->recordCompile(since(start), {});
+                this->rememberNative(backend);
+                return true;
+            }
+        }
+
+        std::string valueName = utils_rk::typeNameToString(typeid(Value).name());
+        std::stringstream source;
+        source << Expression<Value>::preamble(valueName, program)
+               << Expression<Value>::entryPoints(program, "", valueName)
+               << "#ifdef __cplusplus\n"
+               << "}\n"
+               << "#endif";
+        const double codegen = since(start);
+
+        ModuleRegistry::Timing timing;
+        auto module = Expression<Value>::loadModule(source.str(), valueName, {"compiled", "compiledBatch"},
+                                                    this->options, &timing);
+        this->recordCompile(codegen, timing);
+        if (module == nullptr) return false;
+        // An evictable module may already have been unloaded again to make room
+        ModuleRegistry::Lease lease(*module);
+        if (lease.symbol(0) == nullptr) return false;
+
+        this->compiled = (Value (*)(const Value *)) lease.symbol(0);
+        this->compiledBatch = (BatchFunction) lease.symbol(1);
+        this->batchFrame = program.frameSize();
+        this->compiledSymbol = 0;
+        this->batchSymbol = 1;
+        this->module = std::move(module);
+        this->rememberNative(backend);
+        return true;
+    }
+
+    template<typename Value>
+    bool Expression<Value>::autoTune(const std::vector<std::vector<Value>>& samples, double tolerance,
+                                     const std::vector<CompileOptions>& candidates) {
+        if constexpr (!std::is_floating_point<Value>::value) {
+            return false;
+        } else {
+            if (!this->fromString || samples.empty())
+                return false;
+            std::vector<Value> reference;
+            for (auto &sample: samples)
+                reference.push_back(this->interpret(sample));
+            auto accurate = [&]() {
+                for (size_t i = 0; i < samples.size(); ++i) {
+                    Value got = this->evaluate(samples[i]), expected = reference[i];
+                    if (std::isnan(expected) ? !std::isnan(got) : std::isinf(expected) ? got != expected
+                        : !(std::fabs(got - expected) <= tolerance * std::max<Value>(1, std::fabs(expected))))
+                        return false;
+                }
+                return true;
+            };
+            // Best of a few rounds of about 100.000 evaluations each
+            const size_t repeats = std::max<size_t>(1, 100000 / samples.size());
+            auto time = [&]() {
+                volatile Value sink = 0;
+                double best = std::numeric_limits<double>::infinity();
+                for (int round = 0; round < 3; ++round) {
+                    auto start = std::chrono::steady_clock::now();
+                    Value sum = 0;
+                    for (size_t r = 0; r < repeats; ++r) {
+                        for (auto &sample: samples)
+                            sum += this->evaluate(sample);
+                    }
+                    sink = sink + sum;
+                    best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+                }
+                return best;
+            };
 
-        std::string functionString;
-        for (auto &t: this->expression) {
-            if (t->type() == Operator) {
-                functionString += " " + t->cname() + " ";
-            } else {
-                functionString += t->cname();
+            const CompileOptions previous = this->options;
+            std::optional<Expression<Value>> fastest;
+            double fastestTime = std::numeric_limits<double>::infinity();
+            for (auto &candidate: candidates) {
+                this->options = candidate;
+                if (!this->compile(ExternalCompiler) || this->compiled == nullptr || !accurate())
+                    continue;
+                double elapsed = time();
+                if (elapsed < fastestTime) {
+                    fastestTime = elapsed;
+                    fastest = *this;
+                }
+            }
+            if (!fastest) {
+                this->uncompile();
+                this->options = previous;
+                return false;
             }
+            *this = std::move(*fastest);
+            return true;
+        }
+    }
+
+    template<typename Value>
+    std::shared_ptr<typename Expression<Value>::System>
+    Expression<Value>::link(const std::vector<std::shared_ptr<Expression<Value>>>& system) {
+        std::vector<const Program<Value>*> programs;
+        std::vector<Program<Value>> storage(system.size());
+        for (size_t i = 0; i < system.size(); ++i) {
+            auto &e = system[i];
+            // Parameter values belong to every equation on its own, a fused program has no place for them
+            if (!e->fromString || !e->parsed->parameters.empty())
+                return nullptr;
+            programs.push_back(&e->program(storage[i]));
         }
+        auto linked = std::make_shared<System>();
+        linked->program.link(programs);
+        eliminateCommonSubexpressions(linked->program);
+        return linked;
+    }
 
+    template<typename Value>
+    bool Expression<Value>::linkSystem(const std::vector<std::shared_ptr<Expression<Value>>>& system) {
+        auto linked = Expression<Value>::link(system);
+        if (!linked)
+            return false;
+        for (size_t i = 0; i < system.size(); ++i) {
+            system[i]->linked = linked;
+            system[i]->systemIndex = i;
+        }
+        return true;
+    }
+
+    template<typename Value>
+    bool Expression<Value>::compileSystem(const std::vector<std::shared_ptr<Expression<Value>>>& system,
+                                          const CompileOptions& options) {
+        auto linked = Expression<Value>::link(system);
+        if (!linked)
+            return false;
+        for (auto &e: system)
+            e->uncompile();
+        if (system.empty())
+            return true;
+
+        const auto start = std::chrono::steady_clock::now();
         std::string valueName = utils_rk::typeNameToString(typeid(Value).name());
-        compileName = utils_rk::generateUniqueString(128);
-        std::ofstream sf("./" + compileName + ".cc");
-        sf << "#include<math.h>\n"
-           << "#ifdef __cplusplus\n"
-           << "extern \"C\" {\n"
-           << "#endif\n"
-           << valueName << " compiled(const " << valueName << "* vars) {\n"
-           << "return " << functionString << ";\n"
-           << "}\n"
-           << "#ifdef __cplusplus\n"
-           << "}\n"
-           << "#endif";
-        sf.close();
-
-        std::string systemCall = "c++ ./" + compileName + ".cc " + "-o ./" + compileName + ".so -shared -fPIC -O2";
-        int res = system(systemCall.c_str());
-        if (res != 0) {
+        std::string statements;
+        std::string single = linked->program.source([](uint32_t j) {
+            return "vars[" + std::to_string(j) + "]";
+        }, statements, [](uint32_t j) {
+            return "out[" + std::to_string(j) + "]";
+        });
+        if (linked->program.outputs == 1)
+            statements += "out[0] = " + single + ";\n";
+        std::stringstream source;
+        // The linked program calls every function the equations call
+        source << Expression<Value>::preamble(valueName, linked->program);
+        std::vector<size_t> frames;
+        for (size_t i = 0; i < system.size(); ++i) {
+            Program<Value> storage;
+            const Program<Value>& program = system[i]->program(storage);
+            source << Expression<Value>::entryPoints(program, "_" + std::to_string(i), valueName);
+            frames.push_back(program.frameSize());
+        }
+        source << "void rhs(const " << valueName << "* vars, " << valueName << "* __restrict out) {\n"
+               << statements
+               << "}\n"
+               << "#ifdef __cplusplus\n"
+               << "}\n"
+               << "#endif";
+
+        // rhs first, then compiled_i and compiledBatch_i of every equation
+        std::vector<std::string> symbols = {"rhs"};
+        for (size_t i = 0; i < system.size(); ++i) {
+            symbols.push_back("compiled_" + std::to_string(i));
+            symbols.push_back("compiledBatch_" + std::to_string(i));
+        }
+        const double codegen = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        ModuleRegistry::Timing timing;
+        auto module = Expression<Value>::loadModule(source.str(), valueName, symbols, options, &timing);
+        for (auto &e: system)
+            e->recordCompile(codegen, timing);
+        if (module == nullptr)
             return false;
+        // An evictable module may already have been unloaded again to make room
+        ModuleRegistry::Lease lease(*module);
+        if (lease.symbol(0) == nullptr)
+            return false;
+        for (size_t i = 0; i < system.size(); ++i) {
+            if (lease.symbol(1 + 2 * i) == nullptr)
+                return false;
         }
+        linked->rhs = (SystemFunction) lease.symbol(0);
+        linked->module = module;
 
-        std::string libName = "./" + compileName + ".so";
+        for (size_t i = 0; i < system.size(); ++i) {
+            auto &e = system[i];
+            e->module = module;
+            e->compiledSymbol = 1 + 2 * i;
+            e->batchSymbol = 2 + 2 * i;
+            e->compiled = (Value (*)(const Value *)) lease.symbol(e->compiledSymbol);
+            e->compiledBatch = (BatchFunction) lease.symbol(e->batchSymbol);
+            e->batchFrame = frames[i];
+            e->linked = linked;
+            e->systemIndex = i;
+        }
+        return true;
+    }
 
-#ifndef WIN32
-        this->dll = dlopen(libName.c_str(), RTLD_LAZY);
-#else
-        this->dll = LoadLibrary(libName.c_str());
-#endif
+    template<typename Value>
+    const typename Expression<Value>::System*
+    Expression<Value>::linkedSystem(const std::vector<std::shared_ptr<Expression<Value>>>& system) {
+        if (system.empty())
+            return nullptr;
+        const System* linked = system[0]->linked.get();
+        if (linked == nullptr || linked->program.outputs != system.size())
+            return nullptr;
+        for (size_t i = 0; i < system.size(); ++i) {
+            if (system[i]->linked.get() != linked || system[i]->systemIndex != i)
+                return nullptr;
+        }
+        return linked;
+    }
 
-        if (this->dll == nullptr) return false;
+    template<typename Value>
+    void Expression<Value>::evaluateSystem(const std::vector<std::shared_ptr<Expression<Value>>>& system, const System* linked,
+                                           const std::vector<Value>& vars, Value* out) {
+        if (linked == nullptr) {
+            if (Expression<Value>::evaluateShared(system, vars.data(), out))
+                return;
+            for (size_t i = 0; i < system.size(); ++i)
+                out[i] = system[i]->evaluate(vars);
+        } else if (linked->rhs != nullptr) {
+            Expression<Value>::callNative(linked->module.get(), linked->rhs, 0, vars.data(), out);
+        } else {
+            linked->program.runAll(vars.data(), out);
+        }
+    }
 
-#ifndef WIN32
-        this->compiled = (Value (*)(const Value *))dlsym(this->dll, "compiled");
-#else
-        this->compiled = (Value (*)(const Value *)) GetProcAddress((HINSTANCE) this->dll, "compiled");
-#endif
-        if (this->compiled)
-            Expression<Value>::dlls[compileName] = 1;
+    template<typename Value>
+    void Expression<Value>::evaluateSystem(const std::vector<std::shared_ptr<Expression<Value>>>& system, const System* linked,
+                                           const Value* vars, Value* out, Value* scratch) {
+        if (linked == nullptr) {
+            if (Expression<Value>::evaluateShared(system, vars, out))
+                return;
+            for (size_t i = 0; i < system.size(); ++i)
+                out[i] = system[i]->evaluate(vars, scratch);
+        } else if (linked->rhs != nullptr) {
+            Expression<Value>::callNative(linked->module.get(), linked->rhs, 0, vars, out);
+        } else {
+            Value result = linked->program.run(vars, scratch, out);
+            if (linked->program.outputs == 1)
+                out[0] = result;
+        }
+    }
 
-        return (this->compiled != nullptr);
+    template<typename Value>
+    bool Expression<Value>::evaluateShared(const std::vector<std::shared_ptr<Expression<Value>>>& system,
+                                           const Value* vars, Value* out) {
+        for (auto &e: system) {
+            if (!e->parsed->dag || e->compiled != nullptr || e->tier)
+                return false;
+        }
+        typename NodeStore<Value>::Pass pass(vars);
+        for (size_t i = 0; i < system.size(); ++i)
+            out[i] = pass.evaluate(*system[i]->parsed->dag);
+        return true;
     }
 
+    template<typename Value>
+    size_t Expression<Value>::scratchSize(const std::vector<std::shared_ptr<Expression<Value>>>& system) {
+        const System* linked = Expression<Value>::linkedSystem(system);
+        size_t size = linked == nullptr ? 0 : linked->program.frameSize();
+        for (auto &e: system)
+            size = std::max(size, e->scratchSize());
+        return size;
+    }
 
     template<typename Value>
-    Expression<Value>::Expression(const Expression<Value> &p) {
-        this->uncompile();
-        this->compileName = p.compileName;
-        this->dll = p.dll;
-        this->mainQueue = p.mainQueue;
-        this->expression = p.expression;
-        this->vars = p.vars;
-        this->converter = p.converter;
-        this->compiled = p.compiled;
-        this->fromString = p.fromString;
-        if (p.dll != nullptr && p.fromString)
-            Expression<Value>::dlls[p.compileName]++;
-    }
-
-    template<typename Value>
-    Expression<Value>& Expression<Value>::operator=(Expression<Value> &p) {
-        if(&p == this)
-            return *this;
-        this->uncompile();
-        this->compileName = p.compileName;
-        this->dll = p.dll;
-        this->mainQueue = p.mainQueue;
-        this->expression = p.expression;
-        this->vars = p.vars;
-        this->converter = p.converter;
-        this->compiled = p.compiled;
-        this->fromString = p.fromString;
-        if (p.dll != nullptr && p.fromString)
-            Expression<Value>::dlls[p.compileName]++;
-        return *this;
+    EvaluationCounts Expression<Value>::evaluationCounts() const {
+        Program<Value> storage;
+        return countEvaluations(this->program(storage));
     }
 
+    template<typename Value>
+    typename Expression<Value>::MemoryUsage Expression<Value>::memoryUsage() const {
+        MemoryUsage usage;
+        const Parsed& p = *this->parsed;
+        // Numbers live in an arena of the expression, variables and operators are shared by every expression
+        usage.tokens = p.mainQueue.capacity() * sizeof(std::shared_ptr<Token<Value>>);
+        for (auto &t: p.mainQueue) {
+            if (t->type() == Number)
+                usage.tokens += sizeof(NumberToken<Value>);
+        }
+        usage.program = p.program.code.capacity() * sizeof(Instruction)
+                        + p.program.constants.capacity() * sizeof(Value)
+                        + p.program.calls.capacity() * sizeof(typename Program<Value>::Call);
+        if (p.dag)
+            usage.nodes = NodeStore<Value>::usage(*p.dag);
+        return usage;
+    }
 
     template<typename Value>
-    Expression<Value>::~Expression() {
-        this->uncompile();
+    void Expression<Value>::save(std::ostream &out) const {
+        Expression<Value>::saveSystem(out, {std::make_shared<Expression<Value>>(*this)});
+    }
+
+    template<typename Value>
+    Expression<Value> Expression<Value>::load(std::istream &in) {
+        auto system = Expression<Value>::loadSystem(in);
+        if (system.size() != 1)
+            throw std::logic_error("Loading Error:\n\t\tExpected one expression, found "
+                                   + std::to_string(system.size()) + ", use loadSystem\n");
+        return *system[0];
+    }
+
+    template<typename Value>
+    void Expression<Value>::saveSystem(std::ostream &out, const std::vector<std::shared_ptr<Expression<Value>>> &system) {
+        for (auto &e: system) {
+            if (!e->fromString)
+                throw std::logic_error("Saving Error:\n\t\tOnly parsed expressions can be saved\n");
+        }
+        std::map<const Token<Value>*, std::string> names;
+        {
+            std::lock_guard<std::mutex> lock(Expression<Value>::tokensMutex);
+            for (auto &[name, token]: Expression<Value>::tokens)
+                names.emplace(token.get(), name);
+        }
+        auto callName = [&names](const Token<Value>* token) {
+            auto name = names.find(token);
+            if (name == names.end())
+                throw std::logic_error("Saving Error:\n\t\tFunction token is not registered\n");
+            return name->second;
+        };
+        const System* linked = Expression<Value>::linkedSystem(system);
+        writeHeader<Value>(out, system.size());
+        for (auto &e: system) {
+            writeSize(out, e->parsed->vars.size());
+            for (auto &v: e->parsed->vars)
+                writeString(out, v);
+            writeSize(out, e->parsed->parameters.size());
+            for (auto &p: e->parsed->parameters)
+                writeString(out, p);
+            writeValues<Value>(out, e->parameterValues);
+            writeSize(out, e->parsed->removed);
+            Program<Value> storage;
+            writeProgram<Value>(out, e->program(storage), callName);
+        }
+        writeSize(out, linked != nullptr);
+        if (linked != nullptr)
+            writeProgram<Value>(out, linked->program, callName);
+        if (!out)
+            throw std::logic_error("Saving Error:\n\t\tUnable to write\n");
+    }
+
+    template<typename Value>
+    std::vector<std::shared_ptr<Expression<Value>>> Expression<Value>::loadSystem(std::istream &in) {
+        auto callToken = [](const std::string& name) {
+            std::lock_guard<std::mutex> lock(Expression<Value>::tokensMutex);
+            auto token = Expression<Value>::tokens.find(name);
+            if (token == Expression<Value>::tokens.end() || token->second->type() != Function)
+                throw std::logic_error("Loading Error:\n\t\tFunction " + name + " is not registered\n");
+            return token->second;
+        };
+        std::vector<std::shared_ptr<Expression<Value>>> system;
+        uint32_t version = 0;
+        for (size_t i = 0, n = readHeader<Value>(in, &version); i < n; ++i) {
+            auto e = std::make_shared<Expression<Value>>();
+            auto parsed = std::make_shared<Parsed>();
+            for (size_t j = 0, count = readSize(in); j < count; ++j)
+                parsed->vars.push_back(readString(in));
+            // Version 1 had no parameters
+            if (version >= 2) {
+                for (size_t j = 0, count = readSize(in); j < count; ++j)
+                    parsed->parameters.push_back(readString(in));
+                e->parameterValues = readValues<Value>(in);
+            }
+            parsed->removed = readSize(in);
+            parsed->program = readProgram<Value>(in, callToken);
+            if (parsed->program.varsCount != parsed->vars.size() + parsed->parameters.size()
+                || e->parameterValues.size() != parsed->parameters.size() || parsed->program.outputs != 1)
+                throw std::logic_error("Loading Error:\n\t\tInconsistent expression\n");
+            Expression<Value>::share(*parsed);
+            e->parsed = std::move(parsed);
+            e->reset();
+            system.push_back(std::move(e));
+        }
+        if (readSize(in) != 0) {
+            auto linked = std::make_shared<System>();
+            linked->program = readProgram<Value>(in, callToken);
+            if (linked->program.outputs != system.size())
+                throw std::logic_error("Loading Error:\n\t\tInconsistent system\n");
+            for (size_t i = 0; i < system.size(); ++i) {
+                if (system[i]->parsed->vars.size() > linked->program.varsCount)
+                    throw std::logic_error("Loading Error:\n\t\tInconsistent system\n");
+                system[i]->linked = linked;
+                system[i]->systemIndex = i;
+            }
+        }
+        return system;
+    }
+
+    template<typename Value>
+    EvaluationCounts Expression<Value>::evaluationCounts(const std::vector<std::shared_ptr<Expression<Value>>>& system) {
+        if (const System* linked = Expression<Value>::linkedSystem(system))
+            return countEvaluations(linked->program);
+        EvaluationCounts counts;
+        for (auto &e: system)
+            counts += e->evaluationCounts();
+        return counts;
+    }
+
+    template<typename Value>
+    std::string Expression<Value>::entryPoints(const Program<Value>& program, const std::string& suffix,
+                                               const std::string& valueName) {
+        std::string statements;
+        std::string functionString = program.source([](uint32_t i) {
+            return "vars[" + std::to_string(i) + "]";
+        }, statements);
+        std::string batchStatements = program.batchSource([](uint32_t i) {
+            return "vars[" + std::to_string(i) + "]";
+        }, [](uint32_t) {
+            return std::string("out");
+        });
+        std::stringstream source;
+        source << valueName << " compiled" << suffix << "(const " << valueName << "* vars) {\n"
+               << statements
+               << "return " << functionString << ";\n"
+               << "}\n"
+               << "void compiledBatch" << suffix << "(const " << valueName << "* const* vars, " << valueName
+               << "* __restrict out, size_t n, const struct rk_kernels* k, " << valueName << "* __restrict f) {\n"
+               << "for (size_t offset = 0; offset < n; offset += " << Program<Value>::batchWidth << ") {\n"
+               << "const size_t w = n - offset < " << Program<Value>::batchWidth << " ? n - offset : "
+               << Program<Value>::batchWidth << ";\n"
+               << batchStatements
+               << "}\n"
+               << "}\n";
+        return source.str();
+    }
+
+    template<typename Value>
+    std::string Expression<Value>::preamble(const std::string& valueName, const Program<Value>& program) {
+        std::stringstream source;
+        source << "#include<math.h>\n"
+               << "#include<stddef.h>\n"
+               << "#ifdef __cplusplus\n"
+               << "extern \"C\" {\n"
+               << "#endif\n"
+               << "struct rk_kernels {\n";
+        for (auto name: {"sin", "cos"})
+            source << "void (*" << name << ")(const " << valueName << "*, " << valueName << "*, size_t);\n";
+        source << "void (*sinCos)(const " << valueName << "*, " << valueName << "*, " << valueName << "*, size_t);\n"
+               << "void (*pow)(const " << valueName << "*, const " << valueName << "*, " << valueName << "*, size_t);\n"
+               << "const char* target;\n"
+               << "};\n";
+        std::unordered_set<std::string> defined;
+        for (auto &c: program.calls) {
+            if (defined.insert(c.token->cname()).second)
+                source << c.token->definition(valueName);
+        }
+        return source.str();
+    }
+
+    template<typename Value>
+    std::shared_ptr<const typename Expression<Value>::Module>
+    Expression<Value>::loadModule(const std::string& source, const std::string& valueName,
+                                  const std::vector<std::string>& symbols,
+                                  const CompileOptions& options,
+                                  ModuleRegistry::Timing* timing) {
+        // Generated sources only know the builtin floating types, other numbers such as Dual stay interpreted
+        if (!std::is_floating_point<Value>::value)
+            return nullptr;
+        return ModuleRegistry::load(source, valueName, options.flags(), symbols, timing);
+    }
+
+    template<typename Value>
+    void Expression<Value>::recordCompile(double codegen, const ModuleRegistry::Timing& timing) const {
+        if (!this->profiler)
+            return;
+        std::lock_guard<std::mutex> lock(this->profiler->mutex);
+        ++this->profiler->compiles;
+        this->profiler->codegen += codegen;
+        this->profiler->compiler += timing.build;
+        this->profiler->load += timing.open;
+    }
+
+    template<typename Value>
+    void Expression<Value>::enableProfiling(size_t samplingPeriod) {
+        uint64_t period = 1;
+        while (period < samplingPeriod)
+            period <<= 1;
+        this->profiler = std::make_shared<Profiler>(period - 1);
+    }
+
+    template<typename Value>
+    void Expression<Value>::disableProfiling() {
+        this->profiler.reset();
+    }
+
+    template<typename Value>
+    Profile Expression<Value>::profile() const {
+        Profile result;
+        if (!this->profiler)
+            return result;
+        const Profiler& p = *this->profiler;
+        result.interpreted = p.interpreted.load(std::memory_order_relaxed);
+        result.native = p.native.load(std::memory_order_relaxed);
+        result.timed = p.timed.load(std::memory_order_relaxed);
+        result.timedSeconds = (double) p.nanoseconds.load(std::memory_order_relaxed) * 1e-9;
+        {
+            std::lock_guard<std::mutex> lock(this->profiler->mutex);
+            result.compiles = p.compiles;
+            result.codegenSeconds = p.codegen;
+            result.compilerSeconds = p.compiler;
+            result.loadSeconds = p.load;
+        }
+        if (this->fromString) {
+            Program<Value> storage;
+            const uint64_t points = result.interpreted + result.native;
+            for (auto &ins: this->program(storage).code)
+                result.estimatedOperations[opcodeName(ins.code)] += points;
+        }
+        return result;
     }
 
-}
\ No newline at end of file
+}
@@ -13,56 +13,444 @@
 #include <iostream>
 #include <algorithm>
 #include <map>
+#include <unordered_map>
+#include <deque>
 #include <memory>
 #include <queue>
 #include <list>
 #include <cstring>
 #include <fstream>
-
-#ifndef WIN32
-    #include <dlfcn.h>
-#else
-    #include <windows.h>
-#endif
+#include <atomic>
+#include <mutex>
+#include <chrono>
 
 #include "Tokens.h"
+#include "Program.h"
+#include "Jit.h"
+#include "Optimizer.h"
+#include "Derivative.h"
+#include "CompileOptions.h"
+#include "ModuleCache.h"
+#include "ModuleRegistry.h"
+#include "NodeStore.h"
+#include "Profile.h"
+#include "Table.h"
+#include "Serialization.h"
 #include "../utils/utils.h"
 
 namespace rk {
 
+    enum CompileBackend {
+        // Built-in machine code emitter, falls back to ExternalCompiler for what it can not handle
+        JitCompiler,
+        // Generated C source built into a shared library by the system c++ compiler
+        ExternalCompiler
+    };
+
+    /*
+     * Const members (evaluate, evaluateBatch, interpret, evaluateSystem) may be called concurrently on one expression
+     * from any number of threads, the rest, parse and compile among them, need exclusive access to it.
+     */
     template<typename Value>
     class Expression {
+        using Module = ModuleRegistry::Module;
     public:
+        // Evaluates every equation of a system, out[i] gets the value of equation i
+        using SystemFunction = void (*)(const Value* vars, Value* out);
+
         Expression() = default;
-        Expression(const Expression<Value>&);
-        Expression<Value>& operator=(Expression<Value> &other);
-        ~Expression();
+        // Copies share the parsed program and the native code, so they cost a few reference counts
+        Expression(const Expression<Value>&) = default;
+        Expression<Value>& operator=(const Expression<Value>&) = default;
 
         void parse(std::string,
                    const std::vector<std::string>& = {},
                    std::pair<Value, bool> (*f)(const std::string&) = utils_rk::stringToDouble);
+        /*
+         * Parameters are named like variables, but are not passed to evaluate: they keep the value last set by
+         * setParameter (0 at first), unless the values of one call are given to evaluate or evaluateBatch.
+         * Changing them needs neither a new parse nor a new compile, compiled code reads them next to the
+         * variables. Equations with parameters are not linked into a System
+         */
+        void parse(std::string,
+                   const std::vector<std::string>& variables,
+                   const std::vector<std::string>& parameters,
+                   std::pair<Value, bool> (*f)(const std::string&) = utils_rk::stringToDouble);
+        void setParameter(const std::string& name, Value value);
+        // values[i] for parameter i in the order given to parse
+        void setParameters(const std::vector<Value>& values);
+        Value getParameter(const std::string& name) const;
+        const std::vector<std::string>& parameterNames() const { return parsed->parameters; }
         void setFunction(Value (*function)(const Value*));
         Value evaluate(const std::vector<Value>& = {}) const;
-        bool compile();
+        // With params[i] for parameter i in the order given to parse instead of the values set, so threads
+        // sweeping the parameters share one expression
+        Value evaluate(const std::vector<Value>& vars, const std::vector<Value>& params) const;
+        // Scratch holds at least scratchSize() values owned by the caller, one buffer per thread. Does not allocate,
+        // except for expressions in the NodeStore: those allocate until the node table of the thread has grown to
+        // them, and for calls of more than 8 arguments
+        Value evaluate(const Value* vars, Value* scratch) const;
+        size_t scratchSize() const {
+            return parsed->program.frameSize()
+                   + (parsed->parameters.empty() ? 0 : parsed->vars.size() + parsed->parameters.size());
+        }
+        // vars holds one contiguous array of n values per variable, n results are written to results
+        void evaluateBatch(const std::vector<const Value*>& vars, Value* results, size_t n) const;
+        // The same parameter values params for all n points, as for evaluate(vars, params)
+        void evaluateBatch(const std::vector<const Value*>& vars, Value* results, size_t n,
+                           const std::vector<Value>& params) const;
+        // Reference token-walking interpreter, kept for validation and benchmarking of the VM.
+        // Loaded expressions have no tokens, for them it runs the bytecode
+        Value interpret(const std::vector<Value>& = {}) const;
+        bool compile(CompileBackend backend = JitCompiler);
+        // Compiler settings of ExternalCompiler builds from the next compile on, tiering and fallbacks of the JIT
+        // included. Kept by parse and copies
+        void setCompileOptions(const CompileOptions& compileOptions) { options = compileOptions; }
+        const CompileOptions& compileOptions() const { return options; }
+        /*
+         * Builds every candidate with ExternalCompiler, times it on samples (values of the variables, as for evaluate)
+         * and keeps the fastest one whose results on every sample are within tolerance, relative to values over 1,
+         * of interpret. Its options become the compile options. False if no candidate builds and passes, then the
+         * expression is left interpreted with its options unchanged. Only the builtin floating types can be tuned.
+         * Only evaluate is timed: evaluateBatch, which runs other code and is what vectorWidth is for, may prefer
+         * other options
+         */
+        bool autoTune(const std::vector<std::vector<Value>>& samples, double tolerance = 1e-12,
+                      const std::vector<CompileOptions>& candidates = CompileOptions::candidates());
+        // Keeps interpreting, but after threshold evaluations compiles with backend on a background thread
+        // and switches this expression and all of its copies to native code once it is ready
+        void enableTiering(size_t threshold = defaultTieringThreshold, CompileBackend backend = JitCompiler);
+        void disableTiering();
+        // True once evaluate runs native code, compiled explicitly or by tiering
+        bool isNative() const;
+        // Instructions removed by simplification after the last parse
+        size_t removedOperations() const { return parsed->removed; }
+        // From the next parse on, divisions by any constant become multiplications by its rounded reciprocal,
+        // not only those by powers of two. Faster, but results may differ from the division in the last bit
+        void setReciprocalDivision(bool enabled) { reciprocalDivision = enabled; }
+        // Simplified derivative with respect to variable number variable, an expression over the same variables
+        Expression<Value> derivative(size_t variable) const;
+
+        static constexpr size_t defaultTieringThreshold = 1000;
+
+        /*
+         * Counts the points evaluated by this expression and the copies made from now on, interpreted and native
+         * apart, times one evaluate or evaluateBatch call in every samplingPeriod (rounded up to a power of two)
+         * and records the wall time of every compile. Kept by parse. Off, it costs evaluate one branch
+         */
+        void enableProfiling(size_t samplingPeriod = defaultSamplingPeriod);
+        void disableProfiling();
+        // Everything recorded so far, an empty Profile if profiling is off. Operations are estimated from the program
+        Profile profile() const;
+
+        static constexpr size_t defaultSamplingPeriod = 64;
+
+        // Operations performed by one evaluate after simplification and common subexpression elimination
+        EvaluationCounts evaluationCounts() const;
+
+        // Memory held by the parsed expression, in bytes. Copies share it
+        struct MemoryUsage {
+            // Tokens kept for interpret
+            size_t tokens = 0;
+            // Bytecode, constants and calls
+            size_t program = 0;
+            // Shared nodes, as NodeStore::usage reports them
+            typename NodeStore<Value>::Usage nodes;
+
+            // What the expression costs, shared nodes divided between their users
+            size_t total() const { return tokens + program + nodes.order + nodes.ownNodes + nodes.sharedShare; }
+        };
+        /*
+         * Parsed and loaded while NodeStore<Value> is enabled, expressions without parameters keep neither tokens
+         * nor program, but nodes of the store shared with every other such expression. Until compiled they are
+         * evaluated over these nodes, the program is rebuilt from them when compile, save, link or derivative
+         * need it
+         */
+        MemoryUsage memoryUsage() const;
+
+        // Equations merged into one program, subexpressions shared between equations are computed once
+        struct System {
+            Program<Value> program;
+            // Fused entry point of the module built by compileSystem, its symbol 0
+            SystemFunction rhs = nullptr;
+            std::shared_ptr<const Module> module;
+        };
+        // Links the equations into one System, which every *SystemSolve getting this vector evaluates in a single pass
+        static bool linkSystem(const std::vector<std::shared_ptr<Expression<Value>>>& system);
+        // Links the equations and builds them into one shared object with a fused rhs entry point, one compiler run
+        // for the whole system. Each expression gets its own entry point from that module as well
+        static bool compileSystem(const std::vector<std::shared_ptr<Expression<Value>>>& system,
+                                  const CompileOptions& options = {});
+        // System the equations were linked into in this order, nullptr otherwise
+        static const System* linkedSystem(const std::vector<std::shared_ptr<Expression<Value>>>& system);
+        // out[i] = system[i]->evaluate(vars), a single pass when linked is the System of these equations
+        static void evaluateSystem(const std::vector<std::shared_ptr<Expression<Value>>>& system, const System* linked,
+                                   const std::vector<Value>& vars, Value* out);
+        // Same over scratch of at least scratchSize(system) values owned by the caller, allocating only where
+        // evaluate(vars, scratch) does
+        static void evaluateSystem(const std::vector<std::shared_ptr<Expression<Value>>>& system, const System* linked,
+                                   const Value* vars, Value* out, Value* scratch);
+        static size_t scratchSize(const std::vector<std::shared_ptr<Expression<Value>>>& system);
+        // Operations performed per evaluation of the whole system, by its System if linked
+        static EvaluationCounts evaluationCounts(const std::vector<std::shared_ptr<Expression<Value>>>& system);
+        // jacobian[i][j] is the derivative of system[i] with respect to variable j + 1,
+        // the state variables of *SystemSolve, variable 0 being the independent one
+        static std::vector<std::vector<std::shared_ptr<Expression<Value>>>>
+        jacobian(const std::vector<std::shared_ptr<Expression<Value>>>& system);
+
+        // Writes the optimized program and the variable names in the binary format of Serialization.h
+        void save(std::ostream& out) const;
+        // Expression written by save, evaluated and compiled like the parsed one without parsing it again.
+        // Function tokens it calls must be registered under the same names
+        static Expression<Value> load(std::istream& in);
+        // Writes the equations and the System they are linked into, if any, as one record each
+        static void saveSystem(std::ostream& out, const std::vector<std::shared_ptr<Expression<Value>>>& system);
+        // Equations written by saveSystem, linked again when they were linked
+        static std::vector<std::shared_ptr<Expression<Value>>> loadSystem(std::istream& in);
 
         static void addFunctionToken(const std::string& name, std::shared_ptr<FunctionToken<Value>> token);
+        // Makes table a function of one argument called name, interpreted and compiled like the builtin functions
+        static void addTable(const std::string& name, std::shared_ptr<const Table<Value>> table);
+        /*
+         * Unregister a function token or a table. Cached parses calling the old token are dropped, so a later parse of
+         * the same source looks the name up again. Expressions parsed before keep the token they were parsed with
+         */
+        static void removeFunctionToken(const std::string& name);
+        static void removeTable(const std::string& name);
+        // Registers table under name like addTable, in place of the table or function already called so
+        static void replaceTable(const std::string& name, std::shared_ptr<const Table<Value>> table);
+
+        /*
+         * Process-wide cache of parsed programs, safe to use from any number of threads. A parse of a source
+         * equal to a cached one up to whitespace and case, over the same variables, parameters and converter, with the same
+         * reciprocal division setting, takes the cached program without tokenizing or optimizing anything. Native
+         * code of the first compile of a cached program with a backend and compile options is kept with it, later
+         * compiles of expressions parsed from it take that code instead of generating it again. Holds at most
+         * capacity programs, the least recently parsed go first. Disabled by default, disabling drops every entry
+         */
+        static void enableParseCache(size_t capacity = defaultParseCacheCapacity);
+        static void disableParseCache();
+
+        struct ParseCacheStatistics {
+            // Programs cached, and the most the cache holds
+            size_t entries = 0;
+            size_t capacity = 0;
+            // Parses served by the cache, and those that had to parse
+            size_t hits = 0;
+            size_t misses = 0;
+            size_t evictions = 0;
+            // Compiles served by native code kept in the cache
+            size_t nativeHits = 0;
+        };
+        static ParseCacheStatistics parseCacheStatistics();
+
+        static constexpr size_t defaultParseCacheCapacity = 256;
     private:
-        bool fromString;
-        std::list<std::shared_ptr<Token<Value>>> mainQueue;
-        std::vector<std::shared_ptr<Token<Value>>> expression;
-        std::vector<std::string> vars;
-        std::pair<Value, bool> (*converter)(const std::string&) = nullptr;
+        bool fromString = false;
+        using SymbolTable = std::unordered_map<std::string, std::shared_ptr<Token<Value>>>;
+
+        // Everything parse, load and derivative produce. Never changed once built, so copies share it
+        struct Parsed {
+            std::vector<std::shared_ptr<Token<Value>>> mainQueue;
+            // Variable tokens of vars and parameters by name
+            std::shared_ptr<const SymbolTable> variableTokens;
+            Program<Value> program;
+            size_t removed = 0;
+            std::vector<std::string> vars;
+            // Variables vars.size() + i of the program, filled in from parameterValues on every evaluation
+            std::vector<std::string> parameters;
+            std::pair<Value, bool> (*converter)(const std::string&) = nullptr;
+            // Set when the expression lives in the NodeStore, mainQueue and program are empty then
+            std::shared_ptr<const typename NodeStore<Value>::Dag> dag;
+        };
+        std::shared_ptr<const Parsed> parsed = Expression<Value>::empty();
+        bool reciprocalDivision = false;
+        CompileOptions options;
+        std::vector<Value> parameterValues;
 
-        void* dll = nullptr;
+        // Unloaded with its files once the last expression or System using it is gone
+        std::shared_ptr<const Module> module;
+        std::shared_ptr<void> jitCode;
         Value (*compiled)(const Value*) = nullptr;
-        std::string compileName;
+        // Columnar entry point over a frame of batchWidth lanes per slot, as Program::runBatch
+        using BatchFunction = void (*)(const Value* const*, Value*, size_t, const VectorKernels<Value>*, Value*);
+        BatchFunction compiledBatch = nullptr;
+        // Frame of compiledBatch per lane, the frameSize of the program it was generated from
+        size_t batchFrame = 0;
+        // Symbols of compiled and compiledBatch in module
+        size_t compiledSymbol = 0;
+        size_t batchSymbol = 0;
+        std::shared_ptr<const System> linked;
+        size_t systemIndex = 0;
+
+        // Shared by copies, so evaluations through solver wrappers count towards one threshold
+        struct Tier {
+            Tier(size_t threshold, CompileBackend backend) : threshold(threshold), backend(backend) {}
+
+            // True for exactly one caller, the one which has to start the compilation
+            bool count(size_t n) {
+                size_t seen = evaluations.load(std::memory_order_relaxed) + n;
+                evaluations.store(seen, std::memory_order_relaxed);
+                return seen >= threshold && !started.load(std::memory_order_relaxed) && !started.exchange(true);
+            }
+
+            const size_t threshold;
+            const CompileBackend backend;
+            std::atomic<size_t> evaluations{0};
+            std::atomic<bool> started{false};
+            // Compiled copy, published through native after the worker finishes
+            std::shared_ptr<Expression<Value>> module;
+            std::atomic<const Expression<Value>*> native{nullptr};
+        };
+        std::shared_ptr<Tier> tier;
+
+        // Shared by copies like Tier, so evaluations by solvers, which copy the expression, are counted as well
+        struct Profiler {
+            explicit Profiler(uint64_t mask) : mask(mask) {}
+
+            // Calls numbered with (n & mask) == 0 are timed
+            const uint64_t mask;
+            std::atomic<uint64_t> calls{0};
+            std::atomic<uint64_t> interpreted{0};
+            std::atomic<uint64_t> native{0};
+            std::atomic<uint64_t> timed{0};
+            std::atomic<uint64_t> nanoseconds{0};
+            // Compile times, guarded by mutex
+            std::mutex mutex;
+            uint64_t compiles = 0;
+            double codegen = 0;
+            double compiler = 0;
+            double load = 0;
+        };
+        std::shared_ptr<Profiler> profiler;
+
+        struct ParseCache {
+            // Native code of a cached program, everything compile sets
+            struct Native {
+                CompileBackend backend;
+                std::string flags;
+                std::shared_ptr<const Module> module;
+                std::shared_ptr<void> jitCode;
+                Value (*compiled)(const Value*);
+                BatchFunction compiledBatch;
+                size_t batchFrame;
+                size_t compiledSymbol;
+                size_t batchSymbol;
+            };
+            struct Entry {
+                std::string key;
+                std::shared_ptr<const Parsed> parsed;
+                std::vector<Native> natives;
+            };
+
+            // Everything below is guarded by mutex
+            std::mutex mutex;
+            // Most recently parsed first, capacity 0 while disabled
+            std::list<Entry> entries;
+            std::unordered_map<std::string, typename std::list<Entry>::iterator> byKey;
+            std::unordered_map<const Parsed*, typename std::list<Entry>::iterator> byParsed;
+            size_t capacity = 0;
+            ParseCacheStatistics statistics;
+            // Counts removed function tokens, a parse begun before one is removed is not cached
+            uint64_t generation = 0;
+        };
+        static ParseCache& parseCache();
+        // Drops the cached parses which may call token
+        static void forgetParses(const Token<Value>* token);
+        // Key of a parse in the cache: the source in lower case, whitespace dropped wherever it does not separate words
+        std::string parseKey(const std::string& source, const std::vector<std::string>& variables,
+                             const std::vector<std::string>& parameters,
+                             std::pair<Value, bool> (*f)(const std::string&)) const;
+        // Takes the native code a compile with backend left in the parse cache for the program, false if there is none
+        bool reuseNative(CompileBackend backend);
+        // Leaves the native code of this expression in the parse cache, if its program is cached
+        void rememberNative(CompileBackend backend) const;
+        size_t tieringThreshold = 0;
+        CompileBackend tieringBackend = JitCompiler;
 
-        void tokenize(std::string&, std::vector<std::shared_ptr<Token<Value>>>&);
-        std::shared_ptr<Token<Value>> getToken(const std::string&);
+        static std::shared_ptr<const Parsed> empty();
+        // Single pass: numbers, names and operators are told apart by their first character, a name no symbol has
+        // is converted as the number it may be (inf, nan)
+        static void tokenize(const std::string&, const Parsed& parsed, std::vector<std::shared_ptr<Token<Value>>>&);
+        // Lowers mainQueue of parsed into its optimized program
+        void build(Parsed& parsed, const std::vector<size_t>& arities) const;
+        // Moves the expression into the NodeStore while it is enabled
+        static void share(Parsed& parsed);
+        // The program of the expression, rebuilt into storage if it lives in the NodeStore
+        const Program<Value>& program(Program<Value>& storage) const;
+        // Interpreted evaluation of the program or of the shared nodes
+        Value run(const Value* vars, Value* scratch) const;
+        // Interpreted state of a freshly built or loaded program
+        void reset();
+        // Shared table of variable tokens by name, must not hold tokensMutex
+        static std::shared_ptr<const SymbolTable> variableTable(const std::vector<std::string>& variables);
+        static std::shared_ptr<Token<Value>> getToken(const std::string& word, const Parsed& parsed,
+                                                      const std::shared_ptr<std::deque<NumberToken<Value>>>& numbers);
+        // Drops the native code of this expression, the module goes away with its last user
         void uncompile();
+        void promote() const;
+        // The variables followed by the parameter values, as the program reads them
+        void fillRow(const Value* varsValues, const Value* params, Value* row) const;
+        // Throws unless params holds a value for every parameter
+        void checkParameters(const std::vector<Value>& params) const;
+        // evaluateBatch over a column for every program variable, parameters included
+        void evaluateColumns(const std::vector<const Value*>& columns, Value* results, size_t n) const;
+        size_t parameterIndex(const std::string& name) const;
+        // compiled and compiledBatch definitions of program named with suffix
+        static std::string entryPoints(const Program<Value>& program, const std::string& suffix,
+                                       const std::string& valueName);
+        // Includes, the opening of extern "C", the kernel table struct every generated module starts with and the
+        // definitions of the functions program calls
+        static std::string preamble(const std::string& valueName, const Program<Value>& program);
+        // One pass over the shared nodes when every equation is interpreted over them, false otherwise
+        static bool evaluateShared(const std::vector<std::shared_ptr<Expression<Value>>>& system,
+                                   const Value* vars, Value* out);
+        static std::shared_ptr<System> link(const std::vector<std::shared_ptr<Expression<Value>>>& system);
+        // Builds and loads source through the module registry. nullptr if it does not build or load
+        static std::shared_ptr<const Module> loadModule(const std::string& source, const std::string& valueName,
+                                                        const std::vector<std::string>& symbols,
+                                                        const CompileOptions& options,
+                                                        ModuleRegistry::Timing* timing = nullptr);
+        // Adds a compile to the profile, if profiling is on
+        void recordCompile(double codegen, const ModuleRegistry::Timing& timing) const;
+        // What evaluate does, without profiling
+        Value compute(const std::vector<Value>& vars) const;
+        Value compute(const Value* vars, Value* scratch) const;
+        // With the parameter values params, scratch on the stack while it is small
+        Value compute(const Value* vars, const Value* params) const;
+        Value compute(const Value* vars, const Value* params, Value* scratch) const;
+        void computeBatch(const std::vector<const Value*>& vars, const Value* params, Value* results, size_t n) const;
+        // Runs evaluation of points points, counted and now and then timed by the profiler
+        template<typename Evaluation>
+        auto instrumented(size_t points, Evaluation evaluation) const {
+            Profiler& p = *this->profiler;
+            (this->isNative() ? p.native : p.interpreted).fetch_add(points, std::memory_order_relaxed);
+            if ((p.calls.fetch_add(1, std::memory_order_relaxed) & p.mask) != 0)
+                return evaluation();
+            const auto start = std::chrono::steady_clock::now();
+            auto result = evaluation();
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+            p.nanoseconds.fetch_add((uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count(),
+                                    std::memory_order_relaxed);
+            p.timed.fetch_add(points, std::memory_order_relaxed);
+            return result;
+        }
+        // Calls function, or symbol index of module in its place while the module may be unloaded and loaded again
+        template<typename Function, typename... Args>
+        static auto callNative(const Module* module, Function function, size_t index, Args... args) {
+            if (module == nullptr || !module->evictable())
+                return function(args...);
+            ModuleRegistry::Lease lease(*module);
+            return ((Function) lease.symbol(index))(args...);
+        }
+        Value runCompiled(const Value* vars) const {
+            return Expression<Value>::callNative(this->module.get(), this->compiled, this->compiledSymbol, vars);
+        }
 
-        static std::map<std::string, std::shared_ptr<Token<Value>>> tokens;
-        static std::map<std::string, size_t> dlls;
+        static SymbolTable tokens;
+        static std::mutex tokensMutex;
+        // Variables of the last parse and their table, guarded by tokensMutex
+        static std::pair<std::vector<std::string>, std::shared_ptr<const SymbolTable>> lastVariables;
     };
 
 }
\ No newline at end of file
@@ -0,0 +1,298 @@
+#include <cmath>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#if defined(__x86_64__) && !defined(_WIN32)
+    #include <sys/mman.h>
+    #include <unistd.h>
+    #define RK_JIT_SUPPORTED
+#endif
+
+#include "Jit.h"
+
+
+namespace rk {
+
+#ifdef RK_JIT_SUPPORTED
+
+    namespace {
+
+        /*
+         * Just enough of an x86-64 assembler to emit scalar SSE2 code.
+         * Stack slot k of the program lives in xmm(k + 2), xmm0 and xmm1 carry libm arguments,
+         * rbx keeps the vars pointer alive across calls, [rsp] holds spilled slots and the registers follow them.
+         */
+        template<typename Value>
+        class Assembler {
+        public:
+            static constexpr int firstSlot = 2;
+            static constexpr int maxSlots = 14;
+            static constexpr int spillSize = 128;
+
+            explicit Assembler(size_t registers) : frameSize(spillSize + (int) ((registers * 8 + 15) & ~(size_t) 15)) {}
+
+            const int frameSize;
+
+            std::vector<uint8_t> code;
+            // Positions of rip-relative displacements and the constant index they point to
+            std::vector<std::pair<size_t, size_t>> constantFixups;
+            std::vector<size_t> maskFixups;
+
+            void byte(uint8_t b) { code.push_back(b); }
+
+            void dword(uint32_t v) {
+                for (int i = 0; i < 4; ++i)
+                    byte((v >> (8 * i)) & 0xFF);
+            }
+
+            void qword(uint64_t v) {
+                for (int i = 0; i < 8; ++i)
+                    byte((v >> (8 * i)) & 0xFF);
+            }
+
+            // Scalar prefix selects the precision of movs/adds/subs/muls/divs
+            void scalarPrefix() { byte(std::is_same<Value, float>::value ? 0xF3 : 0xF2); }
+
+            void rex(int reg, int rm) {
+                uint8_t r = 0x40 | ((reg & 8) ? 0x04 : 0) | ((rm & 8) ? 0x01 : 0);
+                if (r != 0x40)
+                    byte(r);
+            }
+
+            void scalarRegReg(uint8_t op, int dst, int src) {
+                scalarPrefix();
+                rex(dst, src);
+                byte(0x0F);
+                byte(op);
+                byte(0xC0 | ((dst & 7) << 3) | (src & 7));
+            }
+
+            void movaps(int dst, int src) {
+                if (dst == src)
+                    return;
+                rex(dst, src);
+                byte(0x0F);
+                byte(0x28);
+                byte(0xC0 | ((dst & 7) << 3) | (src & 7));
+            }
+
+            void loadVariable(int dst, uint32_t index) {
+                scalarPrefix();
+                rex(dst, 0);
+                byte(0x0F);
+                byte(0x10);
+                byte(0x80 | ((dst & 7) << 3) | 3);
+                dword(index * sizeof(Value));
+            }
+
+            void loadConstant(int dst, size_t index) {
+                scalarPrefix();
+                rex(dst, 0);
+                byte(0x0F);
+                byte(0x10);
+                byte(((dst & 7) << 3) | 5);
+                constantFixups.emplace_back(code.size(), index);
+                dword(0);
+            }
+
+            void negate(int reg) {
+                rex(reg, 0);
+                byte(0x0F);
+                byte(0x57);
+                byte(((reg & 7) << 3) | 5);
+                maskFixups.push_back(code.size());
+                dword(0);
+            }
+
+            void frameAccess(uint8_t op, int reg, int slot) {
+                scalarPrefix();
+                rex(reg, 0);
+                byte(0x0F);
+                byte(op);
+                byte(0x84 | ((reg & 7) << 3));
+                byte(0x24);
+                dword(slot * 8);
+            }
+
+            // Frame slot of program register r
+            static int registerSlot(uint32_t r) { return spillSize / 8 + (int) r; }
+
+            // lea reg, [rsp + slot * 8] for a general purpose register below r8
+            void leaFrame(int reg, int slot) {
+                byte(0x48);
+                byte(0x8D);
+                byte(0x84 | ((reg & 7) << 3));
+                byte(0x24);
+                dword(slot * 8);
+            }
+
+            // Every xmm register is caller-saved, so live slots go to the frame around libm calls
+            void call(const void* function, int liveSlots) {
+                for (int i = 0; i < liveSlots; ++i)
+                    frameAccess(0x11, firstSlot + i, i);
+                byte(0x48);
+                byte(0xB8);
+                qword((uint64_t) function);
+                byte(0xFF);
+                byte(0xD0);
+                for (int i = 0; i < liveSlots; ++i)
+                    frameAccess(0x10, firstSlot + i, i);
+            }
+
+            void prologue() {
+                byte(0x53);                             // push rbx
+                byte(0x48); byte(0x89); byte(0xFB);     // mov rbx, rdi
+                byte(0x48); byte(0x81); byte(0xEC);     // sub rsp, frameSize
+                dword(frameSize);
+            }
+
+            void epilogue() {
+                movaps(0, firstSlot);
+                byte(0x48); byte(0x81); byte(0xC4);     // add rsp, frameSize
+                dword(frameSize);
+                byte(0x5B);                             // pop rbx
+                byte(0xC3);                             // ret
+            }
+        };
+
+        template<typename Value>
+        struct Libm {
+            static Value sin(Value a) { return std::sin(a); }
+            static Value cos(Value a) { return std::cos(a); }
+            static Value pow(Value a, Value b) { return std::pow(a, b); }
+        };
+
+        template<typename Value>
+        std::shared_ptr<void> emit(const Program<Value>& program) {
+            using Asm = Assembler<Value>;
+            if (program.stackDepth > (size_t) Asm::maxSlots || !program.calls.empty() || program.outputs != 1)
+                return nullptr;
+
+            Asm a(program.registers);
+            a.prologue();
+            int depth = 0;
+            for (auto &ins: program.code) {
+                // Register of the current top of the stack
+                const int top = Asm::firstSlot + depth - 1;
+                switch (ins.code) {
+                    case OpNumber:
+                        a.loadConstant(top + 1, ins.arg);
+                        ++depth;
+                        break;
+                    case OpVariable:
+                        a.loadVariable(top + 1, ins.arg);
+                        ++depth;
+                        break;
+                    case OpSum:
+                        a.scalarRegReg(0x58, top - 1, top);
+                        --depth;
+                        break;
+                    case OpMul:
+                        a.scalarRegReg(0x59, top - 1, top);
+                        --depth;
+                        break;
+                    case OpSub:
+                        a.scalarRegReg(0x5C, top - 1, top);
+                        --depth;
+                        break;
+                    case OpDiv:
+                        a.scalarRegReg(0x5E, top - 1, top);
+                        --depth;
+                        break;
+                    case OpUnaryMinus:
+                        a.negate(top);
+                        break;
+                    case OpSqrt:
+                        a.scalarRegReg(0x51, top, top);
+                        break;
+                    case OpSin: case OpCos:
+                        a.movaps(0, top);
+                        a.call((const void*) (ins.code == OpSin ? &Libm<Value>::sin : &Libm<Value>::cos), depth - 1);
+                        a.movaps(top, 0);
+                        break;
+                    case OpPow:
+                        a.movaps(0, top - 1);
+                        a.movaps(1, top);
+                        a.call((const void*) &Libm<Value>::pow, depth - 2);
+                        a.movaps(top - 1, 0);
+                        --depth;
+                        break;
+                    case OpStore:
+                        a.frameAccess(0x11, top, Asm::registerSlot(ins.arg));
+                        break;
+                    case OpLoad:
+                        a.frameAccess(0x10, top + 1, Asm::registerSlot(ins.arg));
+                        ++depth;
+                        break;
+                    case OpSinCos:
+                        a.movaps(0, top);
+                        a.leaFrame(7, Asm::registerSlot(ins.arg));
+                        a.leaFrame(6, Asm::registerSlot(ins.arg + 1));
+                        a.call((const void*) static_cast<void (*)(Value, Value*, Value*)>(&sinCos), depth - 1);
+                        --depth;
+                        break;
+                    case OpCall: case OpOutput:
+                        return nullptr;
+                }
+            }
+            a.epilogue();
+
+            // Sign mask and constants follow the code, 16-byte aligned as xorps requires
+            size_t dataStart = (a.code.size() + 15) & ~(size_t) 15;
+            size_t constantsStart = dataStart + 16;
+            size_t size = constantsStart + program.constants.size() * sizeof(Value);
+            std::vector<uint8_t> image(size, 0);
+            std::memcpy(image.data(), a.code.data(), a.code.size());
+            image[dataStart + sizeof(Value) - 1] = 0x80;
+            if (!program.constants.empty())
+                std::memcpy(image.data() + constantsStart, program.constants.data(), program.constants.size() * sizeof(Value));
+            auto patch = [&image](size_t at, size_t target) {
+                int32_t disp = (int32_t) ((int64_t) target - (int64_t) (at + 4));
+                std::memcpy(image.data() + at, &disp, 4);
+            };
+            for (auto &f: a.constantFixups)
+                patch(f.first, constantsStart + f.second * sizeof(Value));
+            for (auto &f: a.maskFixups)
+                patch(f, dataStart);
+
+            size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+            size_t mapped = (size + pageSize - 1) / pageSize * pageSize;
+            void* memory = mmap(nullptr, mapped, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED)
+                return nullptr;
+            std::memcpy(memory, image.data(), size);
+            if (mprotect(memory, mapped, PROT_READ | PROT_EXEC) != 0) {
+                munmap(memory, mapped);
+                return nullptr;
+            }
+            return std::shared_ptr<void>(memory, [mapped](void* p) { munmap(p, mapped); });
+        }
+
+    }
+
+    template<typename Value>
+    std::shared_ptr<void> jitCompile(const Program<Value>& program) {
+        if constexpr (std::is_same<Value, float>::value || std::is_same<Value, double>::value)
+            return emit<Value>(program);
+        return nullptr;
+    }
+
+#else
+
+    template<typename Value>
+    std::shared_ptr<void> jitCompile(const Program<Value>&) {
+        return nullptr;
+    }
+
+#endif
+
+    template std::shared_ptr<void> jitCompile<float>(const Program<float>&);
+    template std::shared_ptr<void> jitCompile<double>(const Program<double>&);
+    template std::shared_ptr<void> jitCompile<long double>(const Program<long double>&);
+    template std::shared_ptr<void> jitCompile<Dual<float>>(const Program<Dual<float>>&);
+    template std::shared_ptr<void> jitCompile<Dual<double>>(const Program<Dual<double>>&);
+    template std::shared_ptr<void> jitCompile<Dual<long double>>(const Program<Dual<long double>>&);
+    template std::shared_ptr<void> jitCompile<Dual<double, 4>>(const Program<Dual<double, 4>>&);
+
+}
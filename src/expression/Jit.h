@@ -0,0 +1,18 @@
+#pragma once
+
+#include <memory>
+
+#include "Program.h"
+
+namespace rk {
+
+    /*
+     * Translates program straight into SSE2 machine code with the Value (*)(const Value*) signature
+     * and places it into an executable mapping, which is released together with the returned handle.
+     * Returns nullptr when the host (only x86-64 System V is supported), the Value type (float and double)
+     * or the program itself (user function tokens, several outputs, stack deeper than the register file) can not be jitted.
+     */
+    template<typename Value>
+    std::shared_ptr<void> jitCompile(const Program<Value>& program);
+
+}
@@ -0,0 +1,313 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#ifndef WIN32
+    #include <fcntl.h>
+    #include <sys/file.h>
+    #include <unistd.h>
+#endif
+
+#include "ModuleCache.h"
+#include "../utils/utils.h"
+
+namespace fs = std::filesystem;
+
+namespace rk {
+
+    std::string ModuleCache::dir;
+    uint64_t ModuleCache::maxBytes = ModuleCache::defaultMaxBytes;
+    double ModuleCache::grace = ModuleCache::defaultGracePeriod;
+    bool ModuleCache::initialized = false;
+
+    namespace {
+
+        std::mutex configMutex;
+
+        /*
+         * Advisory lock on a file, exclusive unless shared is set, held until destruction.
+         * Works between processes and between threads, since every instance opens its own description.
+         */
+        class FileLock {
+        public:
+            explicit FileLock(const std::string& path, bool shared = false) {
+#ifndef WIN32
+                fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+                if (fd >= 0)
+                    flock(fd, shared ? LOCK_SH : LOCK_EX);
+#endif
+            }
+            ~FileLock() {
+#ifndef WIN32
+                if (fd >= 0) {
+                    flock(fd, LOCK_UN);
+                    close(fd);
+                }
+#endif
+            }
+            FileLock(const FileLock&) = delete;
+            FileLock& operator=(const FileLock&) = delete;
+        private:
+            int fd = -1;
+        };
+
+        bool readFile(const std::string& path, std::string& content) {
+            std::ifstream in(path, std::ios::binary);
+            if (!in.is_open())
+                return false;
+            std::stringstream ss;
+            ss << in.rdbuf();
+            content = ss.str();
+            return true;
+        }
+
+        // Shared object and stored source of a module
+        uint64_t entrySize(const fs::path& so) {
+            std::error_code ec;
+            fs::path src = so;
+            src.replace_extension(".cc");
+            const uint64_t size = fs::file_size(so, ec);
+            const uint64_t source = fs::file_size(src, ec);
+            return (size == (uint64_t) -1 ? 0 : size) + (source == (uint64_t) -1 ? 0 : source);
+        }
+
+        // Size of every module as last recorded in the directory, false if there is no record. Under the cache lock
+        bool readTotal(const std::string& d, uint64_t& total) {
+            std::string content;
+            if (!readFile(d + "/cache.size", content) || content.empty())
+                return false;
+            char* end = nullptr;
+            total = std::strtoull(content.c_str(), &end, 10);
+            return *end == '\n';
+        }
+
+        void writeTotal(const std::string& d, uint64_t total) {
+            std::ofstream out(d + "/cache.size", std::ios::trunc);
+            out << total << "\n";
+        }
+
+        /*
+         * Scans the directory and removes least recently used modules until the rest fit into limit, returns their
+         * size. keep and modules used less than grace seconds ago stay: the process which used them may be about
+         * to load them. Under the exclusive cache lock
+         */
+        uint64_t shrink(const std::string& d, uint64_t limit, double grace, const std::string& keep) {
+            struct Entry {
+                fs::file_time_type used;
+                uint64_t size;
+                fs::path so;
+            };
+            std::vector<Entry> entries;
+            uint64_t total = 0;
+            std::error_code ec;
+            for (auto &f: fs::directory_iterator(d, ec)) {
+                const fs::path& p = f.path();
+                if (p.extension() != ".so" || p.stem().extension() == ".tmp")
+                    continue;
+                const uint64_t size = entrySize(p);
+                total += size;
+                entries.push_back({f.last_write_time(ec), size, p});
+            }
+            if (total <= limit)
+                return total;
+            const auto recent = fs::file_time_type::clock::now()
+                                - std::chrono::duration_cast<fs::file_time_type::duration>(
+                                        std::chrono::duration<double>(grace));
+            std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.used < b.used; });
+            for (auto &e: entries) {
+                if (total <= limit || e.used > recent)
+                    break;
+                if (e.so == fs::path(keep))
+                    continue;
+                // Processes which already loaded the module keep their mapping, only the file goes away
+                fs::path src = e.so;
+                src.replace_extension(".cc");
+                fs::remove(e.so, ec);
+                fs::remove(src, ec);
+                total -= e.size;
+            }
+            return total;
+        }
+
+        /*
+         * Target macros of -march=native on this machine, the CPU model and every instruction set extension, so that
+         * a directory shared between machines does not hand out modules built for another CPU
+         */
+        const std::string& nativeTarget(const std::string& compiler) {
+            static const std::string target = [&compiler]() {
+                std::string macros;
+#ifndef WIN32
+                const std::string command = compiler + " -march=native -dM -E -x c++ /dev/null 2>/dev/null";
+                if (FILE* pipe = popen(command.c_str(), "r")) {
+                    char buffer[4096];
+                    for (size_t read; (read = fread(buffer, 1, sizeof(buffer), pipe)) > 0;)
+                        macros.append(buffer, read);
+                    pclose(pipe);
+                }
+#endif
+                return macros;
+            }();
+            return target;
+        }
+
+        std::string temporarySuffix() {
+#ifndef WIN32
+            return "." + std::to_string(getpid()) + "." + utils_rk::generateUniqueString(8) + ".tmp";
+#else
+            return "." + utils_rk::generateUniqueString(16) + ".tmp";
+#endif
+        }
+
+    }
+
+    void ModuleCache::init() {
+        if (initialized)
+            return;
+        initialized = true;
+        if (const char* env = std::getenv("RK_CACHE_DIR"))
+            dir = env;
+        if (const char* env = std::getenv("RK_CACHE_MAX_BYTES"))
+            maxBytes = std::strtoull(env, nullptr, 10);
+    }
+
+    void ModuleCache::setGracePeriod(double seconds) {
+        std::lock_guard<std::mutex> lock(configMutex);
+        grace = seconds;
+    }
+
+    double ModuleCache::gracePeriod() {
+        std::lock_guard<std::mutex> lock(configMutex);
+        return grace;
+    }
+
+    void ModuleCache::setDirectory(const std::string& path, uint64_t limit) {
+        std::lock_guard<std::mutex> lock(configMutex);
+        initialized = true;
+        dir = path;
+        maxBytes = limit;
+    }
+
+    void ModuleCache::disable() {
+        std::lock_guard<std::mutex> lock(configMutex);
+        initialized = true;
+        dir.clear();
+    }
+
+    bool ModuleCache::enabled() {
+        return !directory().empty();
+    }
+
+    std::string ModuleCache::directory() {
+        std::lock_guard<std::mutex> lock(configMutex);
+        init();
+        return dir;
+    }
+
+    std::string ModuleCache::build(const std::string& source, const std::string& valueName, const std::string& flags) {
+        const std::string d = directory();
+        if (d.empty())
+            return "";
+        std::error_code ec;
+        fs::create_directories(d, ec);
+
+        const std::string compiler = "c++";
+        uint64_t hash = utils_rk::hashString(source);
+        hash = utils_rk::hashString(std::string(1, '\0') + valueName, hash);
+        hash = utils_rk::hashString(std::string(1, '\0') + compiler + " " + flags, hash);
+        if (flags.find("-march=native") != std::string::npos)
+            hash = utils_rk::hashString(std::string(1, '\0') + nativeTarget(compiler), hash);
+        std::stringstream name;
+        name << std::hex << std::setw(16) << std::setfill('0') << hash;
+
+        const std::string base = d + "/" + name.str();
+        const std::string so = base + ".so", cc = base + ".cc";
+        /*
+         * The stored source guards against hash collisions, it is published before the .so. A module found is
+         * marked as used, its modification time doubling as the last use, under a shared lock of the cache:
+         * eviction sees either no module or a module used just now, which it leaves for the grace period
+         */
+        auto lookup = [&]() {
+            FileLock lock(d + "/cache.lock", true);
+            std::string stored;
+            if (!readFile(cc, stored))
+                return 0;
+            if (stored != source)
+                return -1;
+            fs::last_write_time(so, fs::file_time_type::clock::now(), ec);
+            return ec ? 0 : 1;
+        };
+
+        int found = lookup();
+        if (found == 0) {
+            FileLock lock(base + ".lock");
+            found = lookup();
+            if (found == 0) {
+                const std::string tmp = base + temporarySuffix();
+                std::ofstream sf(tmp + ".cc");
+                sf << source;
+                sf.close();
+                std::string systemCall = compiler + " " + tmp + ".cc -o " + tmp + ".so " + flags;
+                int res = system(systemCall.c_str());
+                if (res != 0 || std::rename((tmp + ".cc").c_str(), cc.c_str()) != 0
+                    || std::rename((tmp + ".so").c_str(), so.c_str()) != 0) {
+                    std::remove((tmp + ".cc").c_str());
+                    std::remove((tmp + ".so").c_str());
+                    return "";
+                }
+                ModuleCache::added(so);
+                found = 1;
+            }
+        }
+        if (found < 0)
+            return "";
+        return so;
+    }
+
+    void ModuleCache::added(const std::string& so) {
+        std::string d;
+        uint64_t limit;
+        double seconds;
+        {
+            std::lock_guard<std::mutex> lock(configMutex);
+            d = dir;
+            limit = maxBytes;
+            seconds = grace;
+        }
+        // Only a new module makes the cache grow, the directory is scanned once it is over the limit
+        FileLock lock(d + "/cache.lock");
+        uint64_t total;
+        if (readTotal(d, total))
+            total += entrySize(so);
+        else
+            total = limit + 1;
+        if (total > limit)
+            total = shrink(d, limit, seconds, so);
+        writeTotal(d, total);
+    }
+
+    void ModuleCache::evict(const std::string& keep) {
+        std::string d;
+        uint64_t limit;
+        double seconds;
+        {
+            std::lock_guard<std::mutex> lock(configMutex);
+            init();
+            d = dir;
+            limit = maxBytes;
+            seconds = grace;
+        }
+        if (d.empty())
+            return;
+
+        FileLock lock(d + "/cache.lock");
+        writeTotal(d, shrink(d, limit, seconds, keep));
+    }
+
+}
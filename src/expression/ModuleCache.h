@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+namespace rk {
+
+    /*
+     * Persistent content-addressed store of shared objects built by the external compiler.
+     * A module is named after the hash of its source, Value type and compiler command, with -march=native
+     * resolved to the target of this machine, so any process compiling the same expression with the same settings
+     * on the same kind of CPU reuses the file instead of running the compiler.
+     * Builds are serialized per module with a lock file and published with an atomic rename,
+     * the least recently used modules are removed once the directory grows over its size limit. The size is
+     * recorded in the directory as modules are added, so only a build going over the limit scans it, and modules
+     * used within the grace period stay, so that a process which found one can still load it.
+     * Disabled unless a directory is set here or through the RK_CACHE_DIR environment variable
+     * (RK_CACHE_MAX_BYTES overrides the size limit).
+     */
+    class ModuleCache {
+    public:
+        static constexpr uint64_t defaultMaxBytes = 256ull << 20u;
+        static constexpr double defaultGracePeriod = 60;
+
+        static void setDirectory(const std::string& path, uint64_t maxBytes = defaultMaxBytes);
+        static void disable();
+        static bool enabled();
+        static std::string directory();
+
+        // Path of the shared object built from source, running c++ with flags only on a miss. Empty string on failure
+        static std::string build(const std::string& source, const std::string& valueName, const std::string& flags);
+        // Removes least recently used modules until the directory fits into the size limit, keep and modules used
+        // within the grace period are never removed
+        static void evict(const std::string& keep = "");
+        // Seconds after its last use during which eviction leaves a module alone
+        static void setGracePeriod(double seconds);
+        static double gracePeriod();
+
+    private:
+        static std::string dir;
+        static uint64_t maxBytes;
+        static double grace;
+        static bool initialized;
+
+        static void init();
+        // Records the new module so, evicting others if the cache outgrew its limit
+        static void added(const std::string& so);
+    };
+
+}
@@ -0,0 +1,445 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+#ifndef WIN32
+    #include <csignal>
+    #include <cstdlib>
+    #include <dlfcn.h>
+    #include <pthread.h>
+    #include <sys/mman.h>
+    #include <unistd.h>
+#else
+    #include <windows.h>
+#endif
+
+#include "ModuleRegistry.h"
+#include "ModuleCache.h"
+#include "../utils/utils.h"
+
+namespace rk {
+
+    namespace {
+
+        struct Registry {
+            std::mutex mutex;
+            // Signalled whenever a build finishes, for loads waiting on a build of the same key
+            std::condition_variable built;
+            std::unordered_set<uint64_t> building;
+            // Live modules by key, the pointer tells a dying module whether the entry is still its own
+            std::unordered_map<uint64_t, std::pair<const ModuleRegistry::Module*,
+                                                   std::weak_ptr<const ModuleRegistry::Module>>> modules;
+            // Resident evictable modules in clock order
+            std::vector<const ModuleRegistry::Module*> clock;
+            size_t hand = 0;
+            size_t maxResident = 0;
+            ModuleRegistry::Statistics statistics;
+        };
+
+        // Never destroyed, modules held by static objects may outlive every other static
+        Registry& registry() {
+            static auto* instance = new Registry();
+            return *instance;
+        }
+
+        // Where the compiler puts a module outside the module cache
+        struct Output {
+            std::string path;
+            int fd = -1;
+            std::string directory;
+        };
+
+#ifndef WIN32
+        // Runs command with input on its standard input. A compiler exiting before reading all of it must not
+        // kill the process with SIGPIPE, so the signal is blocked on this thread and a pending one discarded
+        int runWithInput(const std::string& command, const std::string& input) {
+            sigset_t pipeSignal, old;
+            sigemptyset(&pipeSignal);
+            sigaddset(&pipeSignal, SIGPIPE);
+            pthread_sigmask(SIG_BLOCK, &pipeSignal, &old);
+            int status = -1;
+            if (FILE* pipe = popen(command.c_str(), "w")) {
+                const bool written = fwrite(input.data(), 1, input.size(), pipe) == input.size();
+                status = pclose(pipe);
+                if (!written)
+                    status = -1;
+            }
+            sigset_t pending;
+            sigpending(&pending);
+            if (sigismember(&pending, SIGPIPE) && !sigismember(&old, SIGPIPE)) {
+                int caught;
+                sigwait(&pipeSignal, &caught);
+            }
+            pthread_sigmask(SIG_SETMASK, &old, nullptr);
+            return status;
+        }
+
+        // Private directory for compiler output, on tmpfs where there is one
+        std::string privateDirectory() {
+            std::string base = "/dev/shm";
+            if (access(base.c_str(), W_OK) != 0) {
+                const char* tmp = std::getenv("TMPDIR");
+                base = tmp != nullptr ? tmp : "/tmp";
+            }
+            std::string pattern = base + "/rk-XXXXXX";
+            if (mkdtemp(&pattern[0]) == nullptr)
+                return "";
+            return pattern;
+        }
+#endif
+
+#ifdef __linux__
+        /*
+         * /proc/self/fd/fd spelled differently for every call. dlopen hands out the module it already has under
+         * the same name, and the number of a descriptor closed after mapping is given out again
+         */
+        std::string descriptorPath(int fd) {
+            static std::atomic<uint64_t> opened{0};
+            std::string path = "/proc/self";
+            for (uint64_t i = opened.fetch_add(1, std::memory_order_relaxed); i != 0; i >>= 1)
+                path += i & 1 ? "/fd/.." : "/.";
+            return path + "/fd/" + std::to_string(fd);
+        }
+#endif
+
+        bool compile(const std::string& source, const std::string& flags, Output& output) {
+#ifndef WIN32
+            const std::string compiler = "c++ -x c++ - -pipe " + flags + " -o ";
+#ifdef __linux__
+            int fd = memfd_create("rk-module", MFD_CLOEXEC);
+            if (fd >= 0) {
+                // The compiler is another process, it reaches the file through our descriptor table
+                if (runWithInput(compiler + "/proc/" + std::to_string(getpid()) + "/fd/" + std::to_string(fd),
+                                 source) == 0) {
+                    output.fd = fd;
+                    output.path = "/proc/self/fd/" + std::to_string(fd);
+                    return true;
+                }
+                // Out of descriptors in the compiler, no /proc, ...: the private directory may still do
+                close(fd);
+            }
+#endif
+            output.directory = privateDirectory();
+            if (output.directory.empty())
+                return false;
+            output.path = output.directory + "/module.so";
+            if (runWithInput(compiler + output.path, source) != 0) {
+                std::error_code ec;
+                std::filesystem::remove_all(output.directory, ec);
+                return false;
+            }
+            return true;
+#else
+            std::error_code ec;
+            output.directory = (std::filesystem::temp_directory_path(ec) / ("rk-" + utils_rk::generateUniqueString(16))).string();
+            if (!std::filesystem::create_directory(output.directory, ec))
+                return false;
+            std::ofstream sf(output.directory + "/module.cc");
+            sf << source;
+            sf.close();
+            output.path = output.directory + "/module.so";
+            std::string systemCall = "c++ " + output.directory + "/module.cc -o " + output.path + " " + flags;
+            if (system(systemCall.c_str()) != 0) {
+                std::filesystem::remove_all(output.directory, ec);
+                return false;
+            }
+            return true;
+#endif
+        }
+
+    }
+
+    ModuleRegistry::Lease::Lease(const Module& module) : module(module) {
+        // Counted before resident is checked, an eviction sees either this count or the reload it forces
+        module.active.fetch_add(1);
+        if (!module.used.load(std::memory_order_relaxed))
+            module.used.store(true, std::memory_order_relaxed);
+        if (!module.resident.load()) {
+            try {
+                ModuleRegistry::reload(module);
+            } catch (...) {
+                module.active.fetch_sub(1);
+                throw;
+            }
+        }
+    }
+
+    ModuleRegistry::Lease::~Lease() {
+        this->module.active.fetch_sub(1, std::memory_order_release);
+    }
+
+    void* ModuleRegistry::Lease::symbol(size_t index) const {
+        return this->module.symbols[index];
+    }
+
+    ModuleRegistry::Module::~Module() {
+        ModuleRegistry::release(*this);
+    }
+
+    std::shared_ptr<const ModuleRegistry::Module>
+    ModuleRegistry::load(const std::string& source, const std::string& valueName,
+                         const std::string& flags, const std::vector<std::string>& symbols, Timing* timing) {
+        Registry& r = registry();
+        uint64_t key = utils_rk::hashString(source);
+        key = utils_rk::hashString(std::string(1, '\0') + valueName, key);
+        key = utils_rk::hashString(std::string(1, '\0') + flags, key);
+        for (auto &s: symbols)
+            key = utils_rk::hashString(std::string(1, '\0') + s, key);
+
+        bool shareable = true;
+        // Outside the lock, the last reference to a module takes the lock to release it
+        std::shared_ptr<const Module> alive;
+        {
+            std::unique_lock<std::mutex> lock(r.mutex);
+            while (true) {
+                auto it = r.modules.find(key);
+                if (it != r.modules.end()) {
+                    if ((alive = it->second.second.lock())) {
+                        if (alive->source == source && alive->names == symbols) {
+                            ++r.statistics.shared;
+                            return alive;
+                        }
+                        // A hash collision, built on its own and left out of the table
+                        shareable = false;
+                        break;
+                    }
+                }
+                if (r.building.count(key) == 0)
+                    break;
+                r.built.wait(lock);
+            }
+            if (shareable)
+                r.building.insert(key);
+            ++r.statistics.builds;
+        }
+        // Whatever happens below, waiting loads have to look again
+        auto finish = [&r, key, shareable]() {
+            if (!shareable)
+                return;
+            std::lock_guard<std::mutex> lock(r.mutex);
+            r.building.erase(key);
+            r.built.notify_all();
+        };
+
+        using Clock = std::chrono::steady_clock;
+        auto seconds = [](Clock::time_point start) {
+            return std::chrono::duration<double>(Clock::now() - start).count();
+        };
+        // Cached modules are shared between processes and are never removed
+        Output output;
+        auto start = Clock::now();
+        output.path = ModuleCache::build(source, valueName, flags);
+        const bool built = !output.path.empty() || compile(source, flags, output);
+        if (timing != nullptr)
+            timing->build = seconds(start);
+        if (!built) {
+            finish();
+            return nullptr;
+        }
+
+        std::shared_ptr<Module> module(new Module());
+        module->key = key;
+        module->source = source;
+        module->path = output.path;
+        module->fd = output.fd;
+        module->directory = output.directory;
+        module->names = symbols;
+        std::error_code ec;
+        module->size = std::filesystem::file_size(output.path, ec);
+        {
+            std::lock_guard<std::mutex> lock(r.mutex);
+            module->canEvict = r.maxResident != 0;
+            ++r.statistics.modules;
+        }
+#ifdef __linux__
+        // The anonymous file goes with its descriptor and the module cache may remove its file once the module
+        // is loaded, so an evicted module is loaded again from a copy
+        if (module->canEvict) {
+            std::ifstream file(output.path, std::ios::binary);
+            module->image.resize(module->size);
+            if (!file.read(&module->image[0], (std::streamsize) module->size)) {
+                finish();
+                return nullptr;
+            }
+        }
+#endif
+        start = Clock::now();
+        const bool opened = ModuleRegistry::open(*module);
+        if (timing != nullptr)
+            timing->open = seconds(start);
+        if (!opened) {
+            finish();
+            return nullptr;
+        }
+
+        std::lock_guard<std::mutex> lock(r.mutex);
+        module->used.store(true, std::memory_order_relaxed);
+        module->resident.store(true);
+        ++r.statistics.resident;
+        r.statistics.residentBytes += module->size;
+        if (module->canEvict)
+            r.clock.push_back(module.get());
+        if (shareable) {
+            r.modules[key] = {module.get(), module};
+            r.building.erase(key);
+            r.built.notify_all();
+        }
+        ModuleRegistry::evict();
+        return module;
+    }
+
+    void ModuleRegistry::setMaxResident(size_t count) {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.maxResident = count;
+        ModuleRegistry::evict();
+    }
+
+    size_t ModuleRegistry::maxResident() {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        return r.maxResident;
+    }
+
+    ModuleRegistry::Statistics ModuleRegistry::statistics() {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        return r.statistics;
+    }
+
+    bool ModuleRegistry::open(const Module& module) {
+#ifdef __linux__
+        // An anonymous file is needed only until it is mapped, so the number of modules is not limited by the
+        // number of descriptors
+        if (module.fd < 0 && !module.image.empty()) {
+            module.fd = memfd_create("rk-module", MFD_CLOEXEC);
+            if (module.fd >= 0 && write(module.fd, module.image.data(), module.image.size())
+                                  != (ssize_t) module.image.size()) {
+                ::close(module.fd);
+                module.fd = -1;
+            }
+            if (module.fd < 0)
+                return false;
+        }
+        if (module.fd >= 0)
+            module.path = descriptorPath(module.fd);
+#endif
+#ifndef WIN32
+        void* handle = dlopen(module.path.c_str(), RTLD_LAZY);
+#else
+        void* handle = (void*) LoadLibrary(module.path.c_str());
+#endif
+#ifdef __linux__
+        if (module.fd >= 0) {
+            ::close(module.fd);
+            module.fd = -1;
+        }
+#endif
+        if (handle == nullptr)
+            return false;
+        module.handle = handle;
+        module.symbols.resize(module.names.size());
+        for (size_t i = 0; i < module.names.size(); ++i) {
+#ifndef WIN32
+            module.symbols[i] = dlsym(handle, module.names[i].c_str());
+#else
+            module.symbols[i] = (void*) GetProcAddress((HINSTANCE) handle, module.names[i].c_str());
+#endif
+        }
+        return true;
+    }
+
+    void ModuleRegistry::close(const Module& module) {
+#ifndef WIN32
+        dlclose(module.handle);
+#else
+        FreeLibrary((HINSTANCE) module.handle);
+#endif
+        module.handle = nullptr;
+        std::fill(module.symbols.begin(), module.symbols.end(), nullptr);
+    }
+
+    void ModuleRegistry::reload(const Module& module) {
+        Registry& r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        // Another lease may have been first, or the eviction which made this one look changed its mind
+        if (module.resident.load())
+            return;
+        if (!ModuleRegistry::open(module))
+            throw std::runtime_error("Module Error:\n\t\tUnable to load " + module.path + " again\n");
+        module.resident.store(true);
+        ++r.statistics.reloads;
+        ++r.statistics.resident;
+        r.statistics.residentBytes += module.size;
+        r.clock.push_back(&module);
+        ModuleRegistry::evict();
+    }
+
+    void ModuleRegistry::evict() {
+        Registry& r = registry();
+        // Every module gets two chances: one to lose its used mark, one to be unloaded unless it is running
+        size_t skipped = 0;
+        while (r.maxResident != 0 && r.statistics.resident > r.maxResident && !r.clock.empty()
+               && skipped < 2 * r.clock.size()) {
+            r.hand %= r.clock.size();
+            const Module* module = r.clock[r.hand];
+            if (module->used.exchange(false, std::memory_order_relaxed)) {
+                ++r.hand;
+                ++skipped;
+                continue;
+            }
+            // Pairs with the lease: whichever comes second sees the other
+            module->resident.store(false);
+            if (module->active.load() != 0) {
+                module->resident.store(true);
+                ++r.hand;
+                ++skipped;
+                continue;
+            }
+            ModuleRegistry::close(*module);
+            r.clock.erase(r.clock.begin() + (ptrdiff_t) r.hand);
+            --r.statistics.resident;
+            r.statistics.residentBytes -= module->size;
+            ++r.statistics.evictions;
+        }
+    }
+
+    void ModuleRegistry::release(Module& module) {
+        Registry& r = registry();
+        {
+            std::lock_guard<std::mutex> lock(r.mutex);
+            auto it = r.modules.find(module.key);
+            if (it != r.modules.end() && it->second.first == &module)
+                r.modules.erase(it);
+            if (module.resident.load()) {
+                auto position = std::find(r.clock.begin(), r.clock.end(), &module);
+                if (position != r.clock.end()) {
+                    if ((size_t) (position - r.clock.begin()) < r.hand)
+                        --r.hand;
+                    r.clock.erase(position);
+                }
+                ModuleRegistry::close(module);
+                --r.statistics.resident;
+                r.statistics.residentBytes -= module.size;
+            }
+            --r.statistics.modules;
+        }
+#ifndef WIN32
+        if (module.fd >= 0)
+            ::close(module.fd);
+#endif
+        if (!module.directory.empty()) {
+            std::error_code ec;
+            std::filesystem::remove_all(module.directory, ec);
+        }
+    }
+
+}
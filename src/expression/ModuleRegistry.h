@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace rk {
+
+    /*
+     * Process-wide table of shared objects built by the external compiler, safe to use from any number of threads.
+     * Identical sources built with the same Value type and flags share one loaded module, concurrent builds of
+     * different sources run the compiler in parallel, concurrent builds of the same source run it once.
+     * With a limit on resident modules the least recently used ones (approximated by a second chance clock, so
+     * evaluations never take the lock) are unloaded and loaded again by the next Lease, from a copy kept in memory
+     * on Linux and from their files elsewhere. Modules loaded while there is no limit are never unloaded before
+     * they die.
+     * Outside the module cache nothing is written to the working directory: the source reaches the compiler on its
+     * standard input and the shared object is written to an anonymous memory file (memfd_create), loaded through
+     * /proc/self/fd and closed once mapped, which the kernel frees with the last mapping. Systems without
+     * memfd_create, or where the compiler cannot write it, use a private temporary directory instead.
+     */
+    class ModuleRegistry {
+    public:
+        class Module;
+
+        /*
+         * Keeps a module loaded while alive, loading it again first if it was evicted.
+         * Symbol addresses of an evictable module are valid only under a lease
+         */
+        class Lease {
+        public:
+            explicit Lease(const Module& module);
+            ~Lease();
+            Lease(const Lease&) = delete;
+            Lease& operator=(const Lease&) = delete;
+
+            void* symbol(size_t index) const;
+        private:
+            const Module& module;
+        };
+
+        class Module {
+        public:
+            ~Module();
+            Module(const Module&) = delete;
+            Module& operator=(const Module&) = delete;
+
+            // Address of symbols[index] given to load, nullptr if the module does not export it. Stable unless
+            // the module is evictable, then it has to be read under a Lease
+            void* symbol(size_t index) const { return symbols[index]; }
+            // Loaded while the registry had a limit, every call into it needs a Lease
+            bool evictable() const { return canEvict; }
+            // Size of the shared object
+            uint64_t bytes() const { return size; }
+        private:
+            friend class ModuleRegistry;
+            friend class ModuleRegistry::Lease;
+
+            Module() = default;
+
+            uint64_t key = 0;
+            std::string source;
+            // What dlopen takes: a module cache entry, which stays on disk, or the anonymous file of fd. Both
+            // change when the anonymous file is mapped and its descriptor closed, before the module is shared or
+            // under the registry lock
+            mutable std::string path;
+            mutable int fd = -1;
+            // Copy of the shared object of an evictable module, mapped again from a new anonymous file
+            std::string image;
+            // Private directory holding path where there are no anonymous files, removed with the module
+            std::string directory;
+            bool canEvict = false;
+            uint64_t size = 0;
+            std::vector<std::string> names;
+            // Guarded by the registry lock, read under a Lease once resident is seen true
+            mutable void* handle = nullptr;
+            mutable std::vector<void*> symbols;
+            mutable std::atomic<bool> resident{false};
+            mutable std::atomic<size_t> active{0};
+            // Set by every Lease, cleared by the eviction clock passing by
+            mutable std::atomic<bool> used{false};
+        };
+
+        struct Statistics {
+            // Modules alive
+            size_t modules = 0;
+            // Modules currently loaded
+            size_t resident = 0;
+            // Builds started by load, each a compiler run or a module cache lookup
+            size_t builds = 0;
+            // Calls of load served by a module already alive
+            size_t shared = 0;
+            size_t evictions = 0;
+            size_t reloads = 0;
+            // Size of the loaded shared objects
+            uint64_t residentBytes = 0;
+        };
+
+        // Wall time of one load, in seconds. Both are 0 when the module was already alive
+        struct Timing {
+            // Compiler run, or module cache lookup
+            double build = 0;
+            // dlopen and the symbol lookups
+            double open = 0;
+        };
+
+        /*
+         * Module built from source, through the module cache if enabled, with symbols looked up by name.
+         * Returns the module already alive for the same source, valueName and flags if there is one.
+         * nullptr if it does not build or load. timing, if given, receives where the time went
+         */
+        static std::shared_ptr<const Module> load(const std::string& source, const std::string& valueName,
+                                                  const std::string& flags, const std::vector<std::string>& symbols,
+                                                  Timing* timing = nullptr);
+        // At most count modules loaded at once, 0 for no limit. Applies to modules loaded from now on
+        static void setMaxResident(size_t count);
+        static size_t maxResident();
+        static Statistics statistics();
+
+    private:
+        // Maps the shared object of module and looks up its symbols, false if it does not load
+        static bool open(const Module& module);
+        static void close(const Module& module);
+        // Loads an evicted module again, called by a Lease already counted in active
+        static void reload(const Module& module);
+        // Unloads modules until the limit is met, must hold the registry lock
+        static void evict();
+        // Forgets a dying module
+        static void release(Module& module);
+    };
+
+}
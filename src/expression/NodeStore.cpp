@@ -0,0 +1,400 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "NodeStore.h"
+
+
+namespace rk {
+
+    template class NodeStore<float>;
+    template class NodeStore<double>;
+    template class NodeStore<long double>;
+    template class NodeStore<Dual<float>>;
+    template class NodeStore<Dual<double>>;
+    template class NodeStore<Dual<long double>>;
+    template class NodeStore<Dual<double, 4>>;
+
+
+    namespace {
+
+        template<typename Value>
+        struct Store {
+            using Node = typename NodeStore<Value>::Node;
+
+            // Nodes live in chunks which never move, evaluations find them by id without the lock
+            static constexpr uint32_t chunkBits = 12;
+            static constexpr uint32_t chunkSize = 1u << chunkBits;
+            static constexpr uint32_t maxChunks = 1u << 16;
+
+            Node& at(uint32_t id) const {
+                return chunks[id >> chunkBits].load(std::memory_order_acquire)[id & (chunkSize - 1)];
+            }
+
+            std::mutex mutex;
+            std::unique_ptr<std::atomic<Node*>[]> chunks{new std::atomic<Node*>[maxChunks]()};
+            // Ids below slots have been handed out, freed ones wait in freeSlots
+            uint32_t slots = 0;
+            std::vector<uint32_t> freeSlots;
+            std::unordered_multimap<size_t, Node*> table;
+            typename NodeStore<Value>::Statistics statistics;
+        };
+
+        template<typename Value>
+        std::atomic<bool> enabledFlag{false};
+
+        // Never destroyed, dags held by static objects may outlive every other static
+        template<typename Value>
+        Store<Value>& store() {
+            static auto* instance = new Store<Value>();
+            return *instance;
+        }
+
+        size_t combine(size_t seed, size_t value) {
+            return seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2));
+        }
+
+        template<typename T>
+        size_t hashValue(const T& v) {
+            return std::hash<T>{}(v);
+        }
+
+        template<typename T, size_t N>
+        size_t hashValue(const Dual<T, N>& v) {
+            size_t h = hashValue(v.value);
+            for (auto &d: v.derivative)
+                h = combine(h, hashValue(d));
+            return h;
+        }
+
+        // Constants are merged only when they are the same number: -0 is not 0, every NaN is one NaN
+        template<typename T>
+        bool sameValue(const T& a, const T& b) {
+            using std::isnan, std::signbit;
+            if (isnan(a) || isnan(b))
+                return isnan(a) && isnan(b);
+            return a == b && signbit(a) == signbit(b);
+        }
+
+        template<typename T, size_t N>
+        bool sameValue(const Dual<T, N>& a, const Dual<T, N>& b) {
+            if (!sameValue(a.value, b.value))
+                return false;
+            for (size_t k = 0; k < N; ++k) {
+                if (!sameValue(a.derivative[k], b.derivative[k]))
+                    return false;
+            }
+            return true;
+        }
+
+        template<typename Value>
+        size_t hashNode(OpCode code, uint32_t arg, const Value& value, const std::vector<uint32_t>& args,
+                        const Token<Value>* token) {
+            size_t h = combine((size_t) code, arg);
+            if (code == OpNumber)
+                h = combine(h, hashValue(value));
+            for (auto a: args)
+                h = combine(h, a);
+            return combine(h, std::hash<const Token<Value>*>{}(token));
+        }
+
+        template<typename Value>
+        inline Value compute(const typename NodeStore<Value>::Node& node, const Value* values, const Value* vars) {
+            using std::sin, std::cos, std::pow, std::sqrt;
+            const uint32_t* a = node.args.data();
+            switch (node.code) {
+                case OpNumber:
+                    return node.value;
+                case OpVariable:
+                    return vars[node.arg];
+                case OpSum:
+                    return values[a[0]] + values[a[1]];
+                case OpSub:
+                    return values[a[0]] - values[a[1]];
+                case OpMul:
+                    return values[a[0]] * values[a[1]];
+                case OpDiv:
+                    return values[a[0]] / values[a[1]];
+                case OpPow:
+                    return pow(values[a[0]], values[a[1]]);
+                case OpUnaryMinus:
+                    return -values[a[0]];
+                case OpSin:
+                    return sin(values[a[0]]);
+                case OpCos:
+                    return cos(values[a[0]]);
+                case OpSqrt:
+                    return sqrt(values[a[0]]);
+                case OpCall: {
+                    const size_t arity = node.args.size();
+                    if (arity <= 8) {
+                        Value args[8];
+                        for (size_t i = 0; i < arity; ++i)
+                            args[i] = values[a[i]];
+                        return node.token->apply(args, arity, vars, node.arg);
+                    }
+                    std::vector<Value> args(arity);
+                    for (size_t i = 0; i < arity; ++i)
+                        args[i] = values[a[i]];
+                    return node.token->apply(args.data(), arity, vars, node.arg);
+                }
+                default:
+                    throw std::logic_error("Evaluation Error:\n\t\tUnexpected instruction in a shared node\n");
+            }
+        }
+
+    }
+
+    template<typename Value>
+    NodeStore<Value>::Dag::~Dag() {
+        NodeStore<Value>::release(*this);
+    }
+
+    template<typename Value>
+    void NodeStore<Value>::enable() {
+        enabledFlag<Value>.store(true);
+    }
+
+    template<typename Value>
+    void NodeStore<Value>::disable() {
+        enabledFlag<Value>.store(false);
+    }
+
+    template<typename Value>
+    bool NodeStore<Value>::enabled() {
+        return enabledFlag<Value>.load();
+    }
+
+    template<typename Value>
+    const typename NodeStore<Value>::Node& NodeStore<Value>::node(uint32_t id) {
+        return store<Value>().at(id);
+    }
+
+    template<typename Value>
+    size_t NodeStore<Value>::bytes(const Node& node) {
+        return sizeof(Node) + node.args.capacity() * sizeof(uint32_t);
+    }
+
+    template<typename Value>
+    std::shared_ptr<const typename NodeStore<Value>::Dag> NodeStore<Value>::intern(const Program<Value>& program) {
+        if (program.outputs != 1)
+            throw std::logic_error("Sharing Error:\n\t\tOnly programs with one output can be shared\n");
+        std::vector<uint32_t> roots;
+        const auto nodes = program.tree(roots);
+        std::vector<bool> reached(nodes.size(), false);
+        std::vector<uint32_t> todo = {roots[0]};
+        while (!todo.empty()) {
+            uint32_t i = todo.back();
+            todo.pop_back();
+            if (reached[i])
+                continue;
+            reached[i] = true;
+            todo.insert(todo.end(), nodes[i].args.begin(), nodes[i].args.end());
+        }
+
+        std::shared_ptr<Dag> dag(new Dag());
+        dag->variables = (uint32_t) program.varsCount;
+        Store<Value>& s = store<Value>();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        std::vector<Node*> mapped(nodes.size(), nullptr);
+        std::unordered_set<uint32_t> taken;
+        std::vector<uint32_t> args;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (!reached[i])
+                continue;
+            const auto &n = nodes[i];
+            // Calls see the row of variables, so they are only the same call over the same number of variables
+            const uint32_t arg = n.code == OpCall ? (uint32_t) program.varsCount : n.arg;
+            const Value value = n.code == OpNumber ? n.value : Value(0);
+            const std::shared_ptr<Token<Value>>& token = n.code == OpCall ? program.calls[n.arg].token : nullptr;
+            args.clear();
+            for (auto a: n.args)
+                args.push_back(mapped[a]->id);
+            const size_t hash = hashNode<Value>(n.code, arg, value, args, token.get());
+
+            ++s.statistics.lookups;
+            Node* found = nullptr;
+            for (auto [it, end] = s.table.equal_range(hash); it != end; ++it) {
+                const Node& candidate = *it->second;
+                if (candidate.code == n.code && candidate.arg == arg && candidate.token == token
+                    && candidate.args == args && (n.code != OpNumber || sameValue(candidate.value, value))) {
+                    found = it->second;
+                    break;
+                }
+            }
+            if (found != nullptr) {
+                ++s.statistics.hits;
+            } else {
+                uint32_t id;
+                if (!s.freeSlots.empty()) {
+                    id = s.freeSlots.back();
+                    s.freeSlots.pop_back();
+                } else {
+                    if (s.slots == Store<Value>::chunkSize * Store<Value>::maxChunks)
+                        throw std::logic_error("Sharing Error:\n\t\tToo many shared nodes\n");
+                    id = s.slots++;
+                    auto &chunk = s.chunks[id >> Store<Value>::chunkBits];
+                    if (chunk.load(std::memory_order_relaxed) == nullptr)
+                        chunk.store(new Node[Store<Value>::chunkSize](), std::memory_order_release);
+                }
+                found = &s.at(id);
+                *found = Node{n.code, arg, id, 0, value, args, token};
+                s.table.emplace(hash, found);
+                ++s.statistics.nodes;
+                s.statistics.bytes += NodeStore<Value>::bytes(*found);
+            }
+            mapped[i] = found;
+            // Equal subtrees the optimizer left apart are one node now, evaluated once
+            if (taken.insert(found->id).second) {
+                ++found->uses;
+                dag->order.push_back(found->id);
+                dag->bound = std::max(dag->bound, found->id + 1);
+            }
+        }
+        // The root comes after all of its operands, so moving it to the end keeps the order
+        dag->top = mapped[roots[0]];
+        dag->order.erase(std::find(dag->order.begin(), dag->order.end(), dag->top->id));
+        dag->order.push_back(dag->top->id);
+        dag->order.shrink_to_fit();
+        return dag;
+    }
+
+    template<typename Value>
+    void NodeStore<Value>::release(const Dag& dag) {
+        Store<Value>& s = store<Value>();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (auto id: dag.order) {
+            Node& n = s.at(id);
+            if (--n.uses != 0)
+                continue;
+            const size_t hash = hashNode<Value>(n.code, n.arg, n.value, n.args, n.token.get());
+            for (auto [it, end] = s.table.equal_range(hash); it != end; ++it) {
+                if (it->second == &n) {
+                    s.table.erase(it);
+                    break;
+                }
+            }
+            --s.statistics.nodes;
+            s.statistics.bytes -= NodeStore<Value>::bytes(n);
+            n.args = {};
+            n.token.reset();
+            s.freeSlots.push_back(n.id);
+        }
+    }
+
+    template<typename Value>
+    Program<Value> NodeStore<Value>::program(const Dag& dag) {
+        Program<Value> result;
+        result.varsCount = dag.variables;
+        std::vector<uint32_t> local(dag.bound);
+        std::vector<typename Program<Value>::Node> nodes;
+        nodes.reserve(dag.order.size());
+        for (auto id: dag.order) {
+            const Node* node = &NodeStore<Value>::node(id);
+            local[id] = (uint32_t) nodes.size();
+            typename Program<Value>::Node n{node->code, node->arg, node->value, {}};
+            for (auto a: node->args)
+                n.args.push_back(local[a]);
+            if (node->code == OpCall) {
+                n.arg = (uint32_t) result.calls.size();
+                result.calls.push_back({node->token, node->args.size()});
+            }
+            nodes.push_back(std::move(n));
+        }
+        result.assign(nodes, {local[dag.root()->id]});
+        return result;
+    }
+
+    template<typename Value>
+    typename NodeStore<Value>::Memo& NodeStore<Value>::threadMemo() {
+        thread_local Memo memo;
+        return memo;
+    }
+
+    template<typename Value>
+    Value NodeStore<Value>::evaluate(const Dag& dag, const Value* vars) {
+        Memo& memo = threadMemo();
+        if (memo.busy) {
+            Pass pass(vars);
+            return pass.evaluate(dag);
+        }
+        memo.busy = true;
+        if (memo.values.size() < dag.bound)
+            memo.values.resize(dag.bound);
+        // In order every operand is computed before its users, no value needs to be checked
+        Value* values = memo.values.data();
+        const Store<Value>& s = store<Value>();
+        try {
+            for (auto id: dag.order)
+                values[id] = compute<Value>(s.at(id), values, vars);
+        } catch (...) {
+            memo.busy = false;
+            throw;
+        }
+        memo.busy = false;
+        return values[dag.root()->id];
+    }
+
+    template<typename Value>
+    NodeStore<Value>::Pass::Pass(const Value* vars)
+            : memo(NodeStore<Value>::threadMemo().busy ? this->own : NodeStore<Value>::threadMemo()),
+              vars(vars), epoch(++this->memo.epoch) {
+        this->memo.busy = true;
+    }
+
+    template<typename Value>
+    NodeStore<Value>::Pass::~Pass() {
+        this->memo.busy = false;
+    }
+
+    template<typename Value>
+    Value NodeStore<Value>::Pass::evaluate(const Dag& dag) {
+        Memo& m = this->memo;
+        if (m.values.size() < dag.bound)
+            m.values.resize(dag.bound);
+        if (m.stamps.size() < dag.bound)
+            m.stamps.resize(dag.bound, 0);
+        Value* values = m.values.data();
+        uint64_t* stamps = m.stamps.data();
+        const Store<Value>& s = store<Value>();
+        for (auto id: dag.order) {
+            if (stamps[id] == this->epoch)
+                continue;
+            values[id] = compute<Value>(s.at(id), values, this->vars);
+            stamps[id] = this->epoch;
+        }
+        return values[dag.root()->id];
+    }
+
+    template<typename Value>
+    typename NodeStore<Value>::Usage NodeStore<Value>::usage(const Dag& dag) {
+        Usage result;
+        result.order = sizeof(Dag) + dag.order.capacity() * sizeof(uint32_t);
+        Store<Value>& s = store<Value>();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (auto id: dag.order) {
+            const Node* node = &s.at(id);
+            const size_t size = NodeStore<Value>::bytes(*node);
+            if (node->uses == 1) {
+                result.ownNodes += size;
+            } else {
+                result.sharedNodes += size;
+                result.sharedShare += size / node->uses;
+            }
+        }
+        return result;
+    }
+
+    template<typename Value>
+    typename NodeStore<Value>::Statistics NodeStore<Value>::statistics() {
+        Store<Value>& s = store<Value>();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        return s.statistics;
+    }
+
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "Program.h"
+
+namespace rk {
+
+    /*
+     * Process-wide hash-consing store of expression nodes, safe to use from any number of threads.
+     * Structurally identical subtrees of all interned programs are one node: an operator over the same operand
+     * nodes, the same constant (bit for bit, -0 is not 0) or the same variable is stored once however many
+     * expressions contain it. A Dag keeps the nodes of one expression alive, nodes are freed with the last Dag
+     * using them. Evaluation walks the nodes of a Dag in order, several Dags evaluated at one point in one Pass
+     * compute every node they share once.
+     * Disabled by default, parses and loads of expressions over Value intern their programs while it is enabled.
+     */
+    template<typename Value>
+    class NodeStore {
+    public:
+        struct Node {
+            OpCode code;
+            // Variable index for OpVariable, number of variables passed to the token for OpCall
+            uint32_t arg;
+            // Index of the node in the store and in the per-thread value tables, reused once the node is freed
+            uint32_t id;
+            // Dags using the node, guarded by the store lock
+            uint32_t uses;
+            // Value of OpNumber
+            Value value;
+            // Ids of the operand nodes
+            std::vector<uint32_t> args;
+            // Function of OpCall
+            std::shared_ptr<Token<Value>> token;
+        };
+
+        class Dag {
+        public:
+            ~Dag();
+            Dag(const Dag&) = delete;
+            Dag& operator=(const Dag&) = delete;
+
+            const Node* root() const { return top; }
+            // Number of distinct nodes
+            size_t size() const { return order.size(); }
+            size_t varsCount() const { return variables; }
+        private:
+            friend class NodeStore;
+
+            Dag() = default;
+
+            // Ids of every node once, operands before their users
+            std::vector<uint32_t> order;
+            const Node* top = nullptr;
+            // One past the largest node id
+            uint32_t bound = 0;
+            uint32_t variables = 0;
+        };
+
+    private:
+        // Values of the nodes by id, one table per thread
+        struct Memo {
+            std::vector<Value> values;
+            // Node i holds the value of the current pass if stamps[i] == epoch
+            std::vector<uint64_t> stamps;
+            uint64_t epoch = 0;
+            // Set while an evaluation runs, a function token evaluating another dag gets a table of its own
+            bool busy = false;
+        };
+    public:
+        /*
+         * Evaluation of any number of dags at one point, nodes they share are computed once.
+         * Does not allocate once the table of the thread has grown to the nodes evaluated
+         */
+        class Pass {
+        public:
+            explicit Pass(const Value* vars);
+            ~Pass();
+            Pass(const Pass&) = delete;
+            Pass& operator=(const Pass&) = delete;
+
+            Value evaluate(const Dag& dag);
+        private:
+            Memo own;
+            Memo& memo;
+            const Value* vars;
+            uint64_t epoch;
+        };
+
+        struct Statistics {
+            // Nodes alive
+            size_t nodes = 0;
+            // Memory of the nodes alive
+            size_t bytes = 0;
+            // Nodes looked up by intern, and how many of them were found alive
+            size_t lookups = 0;
+            size_t hits = 0;
+        };
+
+        // Memory of one Dag, in bytes
+        struct Usage {
+            // The evaluation order
+            size_t order = 0;
+            // Nodes no other Dag uses
+            size_t ownNodes = 0;
+            // Nodes other Dags use as well, in full and divided evenly between their users
+            size_t sharedNodes = 0;
+            size_t sharedShare = 0;
+        };
+
+        static void enable();
+        static void disable();
+        static bool enabled();
+
+        // Dag computing the single output of program, made of the nodes already alive wherever they match
+        static std::shared_ptr<const Dag> intern(const Program<Value>& program);
+        // Program computing dag, operands used more than once kept in registers
+        static Program<Value> program(const Dag& dag);
+
+        static Value evaluate(const Dag& dag, const Value* vars);
+
+        static Usage usage(const Dag& dag);
+        static Statistics statistics();
+
+    private:
+        static Memo& threadMemo();
+        // Node with id, which is alive. Does not take the lock
+        static const Node& node(uint32_t id);
+        static size_t bytes(const Node& node);
+        // Forgets the nodes of a dying dag
+        static void release(const Dag& dag);
+    };
+
+}
@@ -0,0 +1,307 @@
+#include <cmath>
+#include <map>
+#include <ostream>
+#include <tuple>
+#include <type_traits>
+
+#include "Optimizer.h"
+
+
+namespace rk {
+
+    namespace {
+
+        // Real part of a constant, which decides the strength reductions for Dual programs as well
+        template<typename Value>
+        long double real(const Value& v) { return (long double) v; }
+
+        template<typename T, size_t N>
+        long double real(const Dual<T, N>& v) { return (long double) v.value; }
+
+        template<typename Value>
+        class Simplifier {
+        public:
+            using Node = typename Program<Value>::Node;
+
+            Simplifier(std::vector<Node>& nodes, bool reciprocalDivision)
+                : nodes(nodes), reciprocalDivision(reciprocalDivision) {}
+
+            // Index of a node computing the same as n, whose operands are already simplified
+            uint32_t add(Node n) {
+                if (foldable(n))
+                    return this->push({OpNumber, 0, fold(n), {}});
+                switch (n.code) {
+                    case OpSum: {
+                        uint32_t a = n.args[0], b = n.args[1];
+                        if (isConstant(b, 0))
+                            return a;
+                        if (isConstant(a, 0))
+                            return b;
+                        if (is(b, OpUnaryMinus))
+                            return this->add({OpSub, 0, Value(0), {a, arg(b)}});
+                        if (is(a, OpUnaryMinus))
+                            return this->add({OpSub, 0, Value(0), {b, arg(a)}});
+                        break;
+                    }
+                    case OpSub: {
+                        uint32_t a = n.args[0], b = n.args[1];
+                        if (isConstant(b, 0))
+                            return a;
+                        if (is(b, OpUnaryMinus))
+                            return this->add({OpSum, 0, Value(0), {a, arg(b)}});
+                        break;
+                    }
+                    case OpMul: {
+                        uint32_t a = n.args[0], b = n.args[1];
+                        if (isConstant(b, 1))
+                            return a;
+                        if (isConstant(a, 1))
+                            return b;
+                        if (isConstant(b, -1))
+                            return this->add({OpUnaryMinus, 0, Value(0), {a}});
+                        if (isConstant(a, -1))
+                            return this->add({OpUnaryMinus, 0, Value(0), {b}});
+                        if (is(a, OpUnaryMinus) && is(b, OpUnaryMinus))
+                            return this->add({OpMul, 0, Value(0), {arg(a), arg(b)}});
+                        // a * (1 / b) rounds twice, a / b only once
+                        if (is(b, OpDiv) && isConstant(nodes[b].args[0], 1))
+                            return this->add({OpDiv, 0, Value(0), {a, nodes[b].args[1]}});
+                        if (is(a, OpDiv) && isConstant(nodes[a].args[0], 1))
+                            return this->add({OpDiv, 0, Value(0), {b, nodes[a].args[1]}});
+                        break;
+                    }
+                    case OpDiv: {
+                        uint32_t a = n.args[0], b = n.args[1];
+                        if (isConstant(b, 1))
+                            return a;
+                        if (isConstant(b, -1))
+                            return this->add({OpUnaryMinus, 0, Value(0), {a}});
+                        if (is(a, OpUnaryMinus) && is(b, OpUnaryMinus))
+                            return this->add({OpDiv, 0, Value(0), {arg(a), arg(b)}});
+                        if (is(b, OpNumber) && this->reciprocal(nodes[b].value))
+                            return this->add({OpMul, 0, Value(0), {a, this->push({OpNumber, 0, Value(1) / nodes[b].value, {}})}});
+                        break;
+                    }
+                    case OpUnaryMinus:
+                        if (is(n.args[0], OpUnaryMinus))
+                            return arg(n.args[0]);
+                        break;
+                    case OpPow:
+                        if (is(n.args[1], OpNumber)) {
+                            const uint32_t base = n.args[0];
+                            const long double exponent = real(nodes[n.args[1]].value);
+                            return this->power(base, exponent, std::move(n));
+                        }
+                        break;
+                    default:
+                        break;
+                }
+                return this->push(std::move(n));
+            }
+
+        private:
+            std::vector<Node>& nodes;
+            const bool reciprocalDivision;
+
+            // x / c as x * (1 / c): always for powers of two, where 1 / c is exact and so is the product,
+            // otherwise only if opted in, the result may then differ from the division in the last bit
+            bool reciprocal(const Value& c) const {
+                if constexpr (std::is_floating_point<Value>::value) {
+                    using std::isnormal;
+                    if (!isnormal(c) || !isnormal(Value(1) / c))
+                        return false;
+                    int exponent;
+                    return this->reciprocalDivision || std::fabs(std::frexp(c, &exponent)) == Value(0.5);
+                }
+                return false;
+            }
+
+            // pow(x, e) for a constant e: multiplications for integer e, and one sqrt more for half-integer e
+            uint32_t power(uint32_t x, long double e, Node n) {
+                if (e == 0)
+                    return this->push({OpNumber, 0, Value(1), {}});
+                const long double twice = 2 * e;
+                if (std::fabs(e) > maxReducedExponent || twice != std::floor(twice))
+                    return this->push(std::move(n));
+                // A power of 1 / x for negative e, x ^ |e| may overflow where the result does not
+                if (e < 0)
+                    x = this->add({OpDiv, 0, Value(0), {this->push({OpNumber, 0, Value(1), {}}), x}});
+                const auto whole = (unsigned long) std::floor(std::fabs(e));
+                uint32_t result = whole > 0 ? this->product(x, whole) : x;
+                if (twice != 2 * std::floor(e)) {
+                    uint32_t root = this->add({OpSqrt, 0, Value(0), {x}});
+                    result = whole > 0 ? this->add({OpMul, 0, Value(0), {result, root}}) : root;
+                }
+                return result;
+            }
+
+            // x ^ k by repeated squaring, k >= 1
+            uint32_t product(uint32_t x, unsigned long k) {
+                if (k == 1)
+                    return x;
+                uint32_t half = this->product(x, k / 2);
+                uint32_t square = this->add({OpMul, 0, Value(0), {half, half}});
+                return k % 2 == 0 ? square : this->add({OpMul, 0, Value(0), {square, x}});
+            }
+
+            uint32_t push(Node n) {
+                nodes.push_back(std::move(n));
+                return (uint32_t) nodes.size() - 1;
+            }
+
+            bool is(uint32_t i, OpCode code) const { return nodes[i].code == code; }
+            bool isConstant(uint32_t i, Value v) const { return is(i, OpNumber) && nodes[i].value == v; }
+            uint32_t arg(uint32_t i) const { return nodes[i].args[0]; }
+
+            bool foldable(const Node& n) const {
+                if (n.code == OpNumber || n.code == OpVariable || n.code == OpCall)
+                    return false;
+                for (auto a: n.args) {
+                    if (!is(a, OpNumber))
+                        return false;
+                }
+                return true;
+            }
+
+            // Same arithmetic as the VM, so folding does not change results
+            Value fold(const Node& n) const {
+                auto v = [this, &n](size_t i) { return nodes[n.args[i]].value; };
+                using std::sin, std::cos, std::pow, std::sqrt;
+                switch (n.code) {
+                    case OpSum: return v(0) + v(1);
+                    case OpSub: return v(0) - v(1);
+                    case OpMul: return v(0) * v(1);
+                    case OpDiv: return v(0) / v(1);
+                    case OpUnaryMinus: return -v(0);
+                    case OpSin: return sin(v(0));
+                    case OpCos: return cos(v(0));
+                    case OpPow: return pow(v(0), v(1));
+                    case OpSqrt: return sqrt(v(0));
+                    default: return Value(0);
+                }
+            }
+        };
+
+    }
+
+    template<typename Value>
+    size_t simplify(Program<Value>& program, bool reciprocalDivision) {
+        if (program.empty())
+            return 0;
+        size_t before = program.size();
+        std::vector<uint32_t> roots;
+        auto nodes = program.tree(roots);
+        const size_t count = nodes.size();
+        // Rewritten nodes are appended, forward maps every original node to its replacement
+        std::vector<uint32_t> forward(count);
+        Simplifier<Value> simplifier(nodes, reciprocalDivision);
+        for (size_t i = 0; i < count; ++i) {
+            auto n = nodes[i];
+            for (auto &a: n.args)
+                a = forward[a];
+            forward[i] = simplifier.add(std::move(n));
+        }
+        for (auto &r: roots)
+            r = forward[r];
+        program.assign(nodes, roots);
+        return before > program.size() ? before - program.size() : 0;
+    }
+
+    template<typename Value>
+    void eliminateCommonSubexpressions(Program<Value>& program) {
+        if (program.empty())
+            return;
+        using Node = typename Program<Value>::Node;
+        std::vector<uint32_t> roots;
+        auto nodes = program.tree(roots);
+        // Key of a node: opcode, argument (the token itself for calls), constant and canonical operands
+        using Key = std::tuple<int, uintptr_t, Value, bool, std::vector<uint32_t>>;
+        std::map<Key, uint32_t> unique;
+        std::vector<Node> canonical;
+        std::vector<uint32_t> forward(nodes.size());
+        using std::isnan, std::signbit;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            Node n = nodes[i];
+            for (auto &a: n.args)
+                a = forward[a];
+            // NaN compares unequal to itself, such constants are simply never shared
+            if (n.code == OpNumber && isnan(n.value)) {
+                forward[i] = (uint32_t) canonical.size();
+                canonical.push_back(std::move(n));
+                continue;
+            }
+            // Constants are told apart by value, their pool index does not matter
+            uintptr_t arg = n.code == OpCall ? (uintptr_t) program.calls[n.arg].token.get() : n.code == OpNumber ? 0 : n.arg;
+            Key key(n.code, arg, n.code == OpNumber ? n.value : Value(0), signbit(n.value), n.args);
+            auto it = unique.find(key);
+            if (it != unique.end()) {
+                forward[i] = it->second;
+                continue;
+            }
+            forward[i] = (uint32_t) canonical.size();
+            unique.emplace(std::move(key), forward[i]);
+            canonical.push_back(std::move(n));
+        }
+        for (auto &r: roots)
+            r = forward[r];
+        program.assign(canonical, roots);
+    }
+
+    template<typename Value>
+    EvaluationCounts countEvaluations(const Program<Value>& program) {
+        EvaluationCounts counts;
+        for (auto &ins: program.code) {
+            switch (ins.code) {
+                case OpSum: case OpSub: case OpMul: case OpDiv: case OpUnaryMinus: case OpSqrt:
+                    ++counts.arithmetic;
+                    break;
+                case OpSin: case OpCos: case OpPow: case OpSinCos:
+                    ++counts.transcendental;
+                    break;
+                case OpCall:
+                    ++counts.calls;
+                    break;
+                default:
+                    ++counts.memory;
+                    break;
+            }
+        }
+        return counts;
+    }
+
+    EvaluationCounts& EvaluationCounts::operator+=(const EvaluationCounts& other) {
+        arithmetic += other.arithmetic;
+        transcendental += other.transcendental;
+        calls += other.calls;
+        memory += other.memory;
+        return *this;
+    }
+
+    std::ostream& operator<<(std::ostream& out, const EvaluationCounts& counts) {
+        return out << "arithmetic: " << counts.arithmetic << ", transcendental: " << counts.transcendental
+                   << ", calls: " << counts.calls << ", loads and stores: " << counts.memory;
+    }
+
+    template size_t simplify<float>(Program<float>&, bool);
+    template size_t simplify<double>(Program<double>&, bool);
+    template size_t simplify<long double>(Program<long double>&, bool);
+    template size_t simplify<Dual<float>>(Program<Dual<float>>&, bool);
+    template size_t simplify<Dual<double>>(Program<Dual<double>>&, bool);
+    template size_t simplify<Dual<long double>>(Program<Dual<long double>>&, bool);
+    template size_t simplify<Dual<double, 4>>(Program<Dual<double, 4>>&, bool);
+    template void eliminateCommonSubexpressions<float>(Program<float>&);
+    template void eliminateCommonSubexpressions<double>(Program<double>&);
+    template void eliminateCommonSubexpressions<long double>(Program<long double>&);
+    template void eliminateCommonSubexpressions<Dual<float>>(Program<Dual<float>>&);
+    template void eliminateCommonSubexpressions<Dual<double>>(Program<Dual<double>>&);
+    template void eliminateCommonSubexpressions<Dual<long double>>(Program<Dual<long double>>&);
+    template void eliminateCommonSubexpressions<Dual<double, 4>>(Program<Dual<double, 4>>&);
+    template EvaluationCounts countEvaluations<float>(const Program<float>&);
+    template EvaluationCounts countEvaluations<double>(const Program<double>&);
+    template EvaluationCounts countEvaluations<long double>(const Program<long double>&);
+    template EvaluationCounts countEvaluations<Dual<float>>(const Program<Dual<float>>&);
+    template EvaluationCounts countEvaluations<Dual<double>>(const Program<Dual<double>>&);
+    template EvaluationCounts countEvaluations<Dual<long double>>(const Program<Dual<long double>>&);
+    template EvaluationCounts countEvaluations<Dual<double, 4>>(const Program<Dual<double, 4>>&);
+
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <iosfwd>
+
+#include "Program.h"
+
+namespace rk {
+
+    // Largest |e| of pow(x, e) which simplify turns into multiplications
+    constexpr long double maxReducedExponent = 16;
+
+    /*
+     * Folds constant subtrees and applies algebraic identities which keep the result:
+     * x * 1, x / 1, x + 0, x - 0, double negation, negations absorbed into
+     * the surrounding operator, and a * (1 / b) turned into a / b (one rounding instead of two).
+     * Custom function tokens are never folded. Returns the number of instructions removed.
+     *
+     * Strength reduction: pow(x, e) with a constant integer or half-integer e, |e| <= maxReducedExponent,
+     * becomes multiplications by repeated squaring and a sqrt for the half, of 1 / x for negative e.
+     * Each multiplication rounds, so results may move by a few ulp. For a half-integer e, at x = -0 and
+     * x = -inf where pow gives +0 or +inf, the rewrite may give -0 or NaN instead, following sqrt(-0) = -0
+     * and sqrt(-inf) = NaN. x / c becomes x * (1 / c) when c is a power of two, which is exact,
+     * and for any other constant c if reciprocalDivision is set.
+     */
+    template<typename Value>
+    size_t simplify(Program<Value>& program, bool reciprocalDivision = false);
+
+    /*
+     * Computes every distinct subexpression once: equal subtrees, within one output or across the outputs
+     * of a linked system, are merged and kept in registers, sin and cos of one argument become a single sincos.
+     * Function tokens are assumed to be pure.
+     */
+    template<typename Value>
+    void eliminateCommonSubexpressions(Program<Value>& program);
+
+    // Operations executed by one evaluation of a program
+    struct EvaluationCounts {
+        size_t arithmetic = 0;
+        // sin, cos, pow and sincos
+        size_t transcendental = 0;
+        // Function tokens
+        size_t calls = 0;
+        // Constants, variables and register accesses
+        size_t memory = 0;
+
+        EvaluationCounts& operator+=(const EvaluationCounts& other);
+    };
+
+    std::ostream& operator<<(std::ostream& out, const EvaluationCounts& counts);
+
+    template<typename Value>
+    EvaluationCounts countEvaluations(const Program<Value>& program);
+
+}
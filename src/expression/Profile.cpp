@@ -0,0 +1,35 @@
+#include <iomanip>
+#include <ostream>
+
+#include "Profile.h"
+
+
+namespace rk {
+
+    double Profile::estimatedSeconds() const {
+        if (this->timed == 0)
+            return 0;
+        return this->timedSeconds * (double) (this->interpreted + this->native) / (double) this->timed;
+    }
+
+    std::ostream& operator<<(std::ostream& out, const Profile& profile) {
+        const auto flags = out.flags();
+        const auto precision = out.precision();
+        out << std::setprecision(9)
+            << "{\"evaluations\": {\"interpreted\": " << profile.interpreted << ", \"native\": " << profile.native
+            << "}, \"time\": {\"timed\": " << profile.timed << ", \"timedSeconds\": " << profile.timedSeconds
+            << ", \"estimatedSeconds\": " << profile.estimatedSeconds() << "}, \"estimatedOperations\": {";
+        bool first = true;
+        for (auto &[name, count]: profile.estimatedOperations) {
+            out << (first ? "" : ", ") << "\"" << name << "\": " << count;
+            first = false;
+        }
+        out << "}, \"compile\": {\"count\": " << profile.compiles << ", \"codegenSeconds\": " << profile.codegenSeconds
+            << ", \"compilerSeconds\": " << profile.compilerSeconds << ", \"loadSeconds\": " << profile.loadSeconds
+            << "}}";
+        out.flags(flags);
+        out.precision(precision);
+        return out;
+    }
+
+}
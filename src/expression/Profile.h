@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <map>
+#include <string>
+
+namespace rk {
+
+    /*
+     * What a profiled expression and its copies did since profiling was enabled, see Expression::enableProfiling.
+     * Evaluations of a linked System through its fused program or rhs are not attributed to its equations
+     */
+    struct Profile {
+        // Points evaluated by the program or the shared nodes, and by native code, batches count every point
+        uint64_t interpreted = 0;
+        uint64_t native = 0;
+        // Points timed, those of one call in every sampling period, and their total time in seconds
+        uint64_t timed = 0;
+        double timedSeconds = 0;
+        // Estimate, nothing is counted while evaluating: the instructions of the current program times the points
+        // evaluated, by operator name. Native code may have optimized some of them away, and a program changed by
+        // parse is multiplied by the points of the old one too.
+        // "number", "variable", "+", "-", "*", "/", "neg", "pow", "sin", "cos", "sqrt", "sincos", "call", "load", "store"
+        std::map<std::string, uint64_t> estimatedOperations;
+
+        // Compilations, ExternalCompiler builds of a whole system included, and their wall time in seconds
+        uint64_t compiles = 0;
+        // Source generation, or machine code emission by the JIT
+        double codegenSeconds = 0;
+        // The compiler process, 0 for modules already loaded
+        double compilerSeconds = 0;
+        // dlopen and the symbol lookups
+        double loadSeconds = 0;
+
+        // Time of all evaluations, extrapolated from the timed ones
+        [[nodiscard]] double estimatedSeconds() const;
+    };
+
+    // Writes profile as one JSON object
+    std::ostream& operator<<(std::ostream& out, const Profile& profile);
+
+}
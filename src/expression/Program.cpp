@@ -0,0 +1,647 @@
+#include <stdexcept>
+#include <sstream>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <typeinfo>
+
+#include "Program.h"
+
+
+namespace rk {
+
+    template class Program<float>;
+    template class Program<double>;
+    template class Program<long double>;
+    template class Program<Dual<float>>;
+    template class Program<Dual<double>>;
+    template class Program<Dual<long double>>;
+    template class Program<Dual<double, 4>>;
+
+
+#ifdef __GLIBC__
+    void sinCos(float x, float* sin, float* cos) { ::sincosf(x, sin, cos); }
+    void sinCos(double x, double* sin, double* cos) { ::sincos(x, sin, cos); }
+    void sinCos(long double x, long double* sin, long double* cos) { ::sincosl(x, sin, cos); }
+#else
+    void sinCos(float x, float* sin, float* cos) { *sin = std::sin(x); *cos = std::cos(x); }
+    void sinCos(double x, double* sin, double* cos) { *sin = std::sin(x); *cos = std::cos(x); }
+    void sinCos(long double x, long double* sin, long double* cos) { *sin = std::sin(x); *cos = std::cos(x); }
+#endif
+
+    namespace {
+
+        // C spelling of a binary arithmetic opcode, surrounded by spaces
+        const char* infix(OpCode code) {
+            switch (code) {
+                case OpSum: return " + ";
+                case OpSub: return " - ";
+                case OpMul: return " * ";
+                case OpDiv: return " / ";
+                default:
+                    throw std::logic_error("Compile Error:\n\t\tOpcode " + std::to_string(code)
+                                           + " is not an infix operator\n");
+            }
+        }
+
+    }
+
+
+    template<typename Value>
+    void Program<Value>::clear() {
+        this->code.clear();
+        this->constants.clear();
+        this->calls.clear();
+        this->stackDepth = 0;
+        this->registers = 0;
+        this->outputs = 1;
+        this->varsCount = 0;
+    }
+
+    template<typename Value>
+    void Program<Value>::lower(const std::vector<std::shared_ptr<Token<Value>>>& rpn,
+                               const std::vector<size_t>& arities,
+                               size_t vCount) {
+        this->clear();
+        this->varsCount = vCount;
+        this->code.reserve(rpn.size());
+
+        size_t depth = 0;
+        auto consume = [&depth](size_t n) {
+            if (depth < n)
+                throw std::logic_error("Parsing Error:\n\t\tNot enough operands\n");
+            depth -= n;
+        };
+
+        size_t nextArity = 0;
+        for (auto &t: rpn) {
+            OpCode op = t->opcode();
+            switch (op) {
+                case OpNumber:
+                    this->code.push_back({op, (uint32_t) this->constants.size()});
+                    this->constants.push_back(std::static_pointer_cast<NumberToken<Value>>(t)->getValue());
+                    break;
+                case OpVariable:
+                    this->code.push_back({op, (uint32_t) std::static_pointer_cast<VariableToken<Value>>(t)->getNum()});
+                    break;
+                case OpSum: case OpSub: case OpMul: case OpDiv: case OpPow:
+                    consume(2);
+                    this->code.push_back({op, 0});
+                    break;
+                case OpUnaryMinus: case OpSin: case OpCos: case OpSqrt:
+                    consume(1);
+                    this->code.push_back({op, 0});
+                    break;
+                case OpCall: {
+                    size_t arity = nextArity < arities.size() ? arities[nextArity] : 1;
+                    consume(arity);
+                    this->code.push_back({op, (uint32_t) this->calls.size()});
+                    this->calls.push_back({t, arity});
+                    break;
+                }
+                case OpStore: case OpLoad: case OpSinCos: case OpOutput:
+                    // Emitted by the optimizer only, no token lowers to them
+                    throw std::logic_error("Parsing Error:\n\t\tToken with internal opcode "
+                                           + std::to_string(op) + "\n");
+            }
+            if (t->type() == Function)
+                ++nextArity;
+            this->stackDepth = std::max(this->stackDepth, ++depth);
+        }
+        if (depth != 1)
+            throw std::logic_error("Parsing Error:\n\t\tWrong number of operands\n");
+    }
+
+    template<typename Value>
+    void Program<Value>::link(const std::vector<const Program<Value>*>& programs) {
+        std::vector<Node> nodes;
+        std::vector<uint32_t> roots;
+        std::vector<Call> allCalls;
+        size_t vCount = 0;
+        for (auto p: programs) {
+            std::vector<uint32_t> subRoots;
+            auto sub = p->tree(subRoots);
+            const auto offset = (uint32_t) nodes.size(), callOffset = (uint32_t) allCalls.size();
+            for (auto &node: sub) {
+                for (auto &a: node.args)
+                    a += offset;
+                if (node.code == OpCall)
+                    node.arg += callOffset;
+                nodes.push_back(std::move(node));
+            }
+            for (auto r: subRoots)
+                roots.push_back(r + offset);
+            allCalls.insert(allCalls.end(), p->calls.begin(), p->calls.end());
+            vCount = std::max(vCount, p->varsCount);
+        }
+        this->calls = std::move(allCalls);
+        this->varsCount = vCount;
+        this->assign(nodes, roots);
+    }
+
+    template<typename Value>
+    std::vector<typename Program<Value>::Node> Program<Value>::tree(std::vector<uint32_t>& roots) const {
+        std::vector<Node> nodes;
+        nodes.reserve(this->code.size());
+        std::vector<uint32_t> stack;
+        std::vector<uint32_t> regs(this->registers);
+        roots.assign(this->outputs, 0);
+        for (auto &ins: this->code) {
+            Node node{ins.code, ins.arg, Value(0), {}};
+            size_t arity = 0;
+            switch (ins.code) {
+                case OpNumber:
+                    node.value = this->constants[ins.arg];
+                    break;
+                case OpVariable:
+                    break;
+                case OpSum: case OpSub: case OpMul: case OpDiv: case OpPow:
+                    arity = 2;
+                    break;
+                case OpUnaryMinus: case OpSin: case OpCos: case OpSqrt:
+                    arity = 1;
+                    break;
+                case OpCall:
+                    arity = this->calls[ins.arg].arity;
+                    break;
+                case OpStore:
+                    regs[ins.arg] = stack.back();
+                    continue;
+                case OpLoad:
+                    stack.push_back(regs[ins.arg]);
+                    continue;
+                case OpSinCos:
+                    nodes.push_back({OpSin, 0, Value(0), {stack.back()}});
+                    nodes.push_back({OpCos, 0, Value(0), {stack.back()}});
+                    stack.pop_back();
+                    regs[ins.arg] = (uint32_t) nodes.size() - 2;
+                    regs[ins.arg + 1] = (uint32_t) nodes.size() - 1;
+                    continue;
+                case OpOutput:
+                    roots[ins.arg] = stack.back();
+                    stack.pop_back();
+                    continue;
+            }
+            node.args.assign(stack.end() - arity, stack.end());
+            stack.resize(stack.size() - arity);
+            stack.push_back((uint32_t) nodes.size());
+            nodes.push_back(std::move(node));
+        }
+        if (this->outputs == 1 && !stack.empty())
+            roots[0] = stack.back();
+        return nodes;
+    }
+
+    template<typename Value>
+    void Program<Value>::assign(const std::vector<Node>& nodes, const std::vector<uint32_t>& roots) {
+        std::vector<Call> oldCalls = std::move(this->calls);
+        size_t vCount = this->varsCount;
+        this->clear();
+        this->varsCount = vCount;
+        this->outputs = roots.size();
+
+        // Number of references to every reachable node
+        std::vector<uint32_t> uses(nodes.size(), 0);
+        std::vector<uint32_t> todo(roots.begin(), roots.end());
+        for (auto r: roots)
+            ++uses[r];
+        std::vector<bool> reached(nodes.size(), false);
+        while (!todo.empty()) {
+            uint32_t i = todo.back();
+            todo.pop_back();
+            if (reached[i])
+                continue;
+            reached[i] = true;
+            for (auto a: nodes[i].args) {
+                ++uses[a];
+                todo.push_back(a);
+            }
+        }
+
+        // Registers: a pair for every argument both sine and cosine are taken of, one for every other shared value
+        const int64_t none = -1;
+        std::vector<int64_t> reg(nodes.size(), none);
+        std::map<uint32_t, std::pair<int64_t, int64_t>> trig;
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (!reached[i] || (nodes[i].code != OpSin && nodes[i].code != OpCos))
+                continue;
+            auto &t = trig.emplace(nodes[i].args[0], std::make_pair(none, none)).first->second;
+            (nodes[i].code == OpSin ? t.first : t.second) = (int64_t) i;
+        }
+        std::vector<bool> paired(nodes.size(), false);
+        for (auto &t: trig) {
+            if (t.second.first == none || t.second.second == none)
+                continue;
+            reg[t.second.first] = (int64_t) this->registers;
+            reg[t.second.second] = (int64_t) this->registers + 1;
+            paired[t.second.first] = paired[t.second.second] = true;
+            this->registers += 2;
+        }
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            if (reached[i] && uses[i] > 1 && reg[i] == none && nodes[i].code != OpNumber && nodes[i].code != OpVariable)
+                reg[i] = (int64_t) this->registers++;
+        }
+
+        size_t depth = 0;
+        auto emit = [this, &depth](OpCode op, uint32_t arg, size_t pops, size_t pushes) {
+            this->code.push_back({op, arg});
+            depth = depth - pops + pushes;
+            this->stackDepth = std::max(this->stackDepth, depth);
+        };
+        std::vector<bool> emitted(nodes.size(), false);
+        for (size_t r = 0; r < roots.size(); ++r) {
+            // Iterative post-order walk, so deep expressions do not exhaust the native stack
+            std::vector<std::pair<uint32_t, size_t>> walk = {{roots[r], 0}};
+            while (!walk.empty()) {
+                auto &top = walk.back();
+                const uint32_t i = top.first;
+                const Node& node = nodes[i];
+                if (emitted[i]) {
+                    emit(OpLoad, (uint32_t) reg[i], 0, 1);
+                    walk.pop_back();
+                    continue;
+                }
+                if (top.second < node.args.size()) {
+                    uint32_t next = node.args[top.second++];
+                    walk.emplace_back(next, 0);
+                    continue;
+                }
+                if (paired[i]) {
+                    // Registers of a pair start with the sine
+                    uint32_t first = (uint32_t) reg[i] - (node.code == OpCos ? 1 : 0);
+                    emit(OpSinCos, first, 1, 0);
+                    emit(OpLoad, (uint32_t) reg[i], 0, 1);
+                    const auto &pair = trig[node.args[0]];
+                    emitted[pair.first] = emitted[pair.second] = true;
+                    walk.pop_back();
+                    continue;
+                }
+                switch (node.code) {
+                    case OpNumber:
+                        emit(OpNumber, (uint32_t) this->constants.size(), 0, 1);
+                        this->constants.push_back(node.value);
+                        break;
+                    case OpCall:
+                        emit(OpCall, (uint32_t) this->calls.size(), node.args.size(), 1);
+                        this->calls.push_back(oldCalls[node.arg]);
+                        break;
+                    default:
+                        emit(node.code, node.arg, node.args.size(), 1);
+                        break;
+                }
+                if (reg[i] != none) {
+                    emit(OpStore, (uint32_t) reg[i], 0, 0);
+                    emitted[i] = true;
+                }
+                walk.pop_back();
+            }
+            if (roots.size() > 1)
+                emit(OpOutput, (uint32_t) r, 1, 0);
+        }
+    }
+
+    template<typename Value>
+    Value Program<Value>::run(const Value* vars) const {
+        if (this->frameSize() <= inlineStackSize) {
+            Value frame[inlineStackSize];
+            return this->run(vars, frame);
+        }
+        std::vector<Value> frame(this->frameSize());
+        return this->run(vars, frame.data());
+    }
+
+    template<typename Value>
+    void Program<Value>::runAll(const Value* vars, Value* out) const {
+        Value result;
+        if (this->frameSize() <= inlineStackSize) {
+            Value frame[inlineStackSize];
+            result = this->run(vars, frame, out);
+        } else {
+            std::vector<Value> frame(this->frameSize());
+            result = this->run(vars, frame.data(), out);
+        }
+        if (this->outputs == 1)
+            out[0] = result;
+    }
+
+    template<typename Value>
+    Value Program<Value>::run(const Value* vars, Value* frame, Value* out) const {
+        // sp points to the first free slot, so the top of the stack is sp[-1]
+        Value* sp = frame;
+        Value* regs = frame + this->stackDepth;
+        // Found by argument dependent lookup for other number types, such as Dual
+        using std::sin, std::cos, std::pow, std::sqrt;
+        const Instruction* ip = this->code.data();
+        const Instruction* end = ip + this->code.size();
+        const Value* cs = this->constants.data();
+        for (; ip != end; ++ip) {
+            switch (ip->code) {
+                case OpNumber:
+                    *sp++ = cs[ip->arg];
+                    break;
+                case OpVariable:
+                    *sp++ = vars[ip->arg];
+                    break;
+                case OpSum:
+                    --sp;
+                    sp[-1] = sp[-1] + sp[0];
+                    break;
+                case OpSub:
+                    --sp;
+                    sp[-1] = sp[-1] - sp[0];
+                    break;
+                case OpMul:
+                    --sp;
+                    sp[-1] = sp[-1] * sp[0];
+                    break;
+                case OpDiv:
+                    --sp;
+                    sp[-1] = sp[-1] / sp[0];
+                    break;
+                case OpPow:
+                    --sp;
+                    sp[-1] = pow(sp[-1], sp[0]);
+                    break;
+                case OpUnaryMinus:
+                    sp[-1] = -sp[-1];
+                    break;
+                case OpSin:
+                    sp[-1] = sin(sp[-1]);
+                    break;
+                case OpCos:
+                    sp[-1] = cos(sp[-1]);
+                    break;
+                case OpSqrt:
+                    sp[-1] = sqrt(sp[-1]);
+                    break;
+                case OpCall: {
+                    // Arguments are on top of the stack in source order, the result replaces them
+                    const Call& c = this->calls[ip->arg];
+                    sp -= c.arity;
+                    *sp = c.token->apply(sp, c.arity, vars, this->varsCount);
+                    ++sp;
+                    break;
+                }
+                case OpStore:
+                    regs[ip->arg] = sp[-1];
+                    break;
+                case OpLoad:
+                    *sp++ = regs[ip->arg];
+                    break;
+                case OpSinCos:
+                    --sp;
+                    sinCos(*sp, regs + ip->arg, regs + ip->arg + 1);
+                    break;
+                case OpOutput:
+                    out[ip->arg] = *--sp;
+                    break;
+            }
+        }
+        return sp != frame ? sp[-1] : out[0];
+    }
+
+    template<typename Value>
+    void Program<Value>::runBatch(const Value* const* vars, Value* results, size_t n) const {
+        // Slot k of the frame holds batchWidth lanes starting at buffer[k * batchWidth], registers follow the stack
+        std::vector<Value> buffer(this->frameSize() * batchWidth);
+        Value* regs = buffer.data() + this->stackDepth * batchWidth;
+        const VectorKernels<Value>& kernels = vectorKernels<Value>();
+        using std::sqrt;
+        std::vector<Value> row(this->varsCount), args;
+        const Value* cs = this->constants.data();
+        for (size_t offset = 0; offset < n; offset += batchWidth) {
+            const size_t w = std::min(batchWidth, n - offset);
+            Value* sp = buffer.data();
+            for (auto &ins: this->code) {
+                switch (ins.code) {
+                    case OpNumber:
+                        std::fill(sp, sp + w, cs[ins.arg]);
+                        sp += batchWidth;
+                        break;
+                    case OpVariable:
+                        std::copy(vars[ins.arg] + offset, vars[ins.arg] + offset + w, sp);
+                        sp += batchWidth;
+                        break;
+                    case OpSum: case OpSub: case OpMul: case OpDiv: case OpPow: {
+                        sp -= batchWidth;
+                        Value* __restrict a = sp - batchWidth;
+                        const Value* __restrict b = sp;
+                        if (ins.code == OpSum)
+                            for (size_t i = 0; i < w; ++i) a[i] = a[i] + b[i];
+                        else if (ins.code == OpSub)
+                            for (size_t i = 0; i < w; ++i) a[i] = a[i] - b[i];
+                        else if (ins.code == OpMul)
+                            for (size_t i = 0; i < w; ++i) a[i] = a[i] * b[i];
+                        else if (ins.code == OpDiv)
+                            for (size_t i = 0; i < w; ++i) a[i] = a[i] / b[i];
+                        else
+                            kernels.pow(a, b, a, w);
+                        break;
+                    }
+                    case OpUnaryMinus: case OpSin: case OpCos: case OpSqrt: {
+                        Value* __restrict a = sp - batchWidth;
+                        if (ins.code == OpUnaryMinus)
+                            for (size_t i = 0; i < w; ++i) a[i] = -a[i];
+                        else if (ins.code == OpSqrt)
+                            for (size_t i = 0; i < w; ++i) a[i] = sqrt(a[i]);
+                        else if (ins.code == OpSin)
+                            kernels.sin(a, a, w);
+                        else
+                            kernels.cos(a, a, w);
+                        break;
+                    }
+                    case OpCall: {
+                        const Call& c = this->calls[ins.arg];
+                        Value* first = sp - c.arity * batchWidth;
+                        args.resize(c.arity);
+                        for (size_t i = 0; i < w; ++i) {
+                            for (size_t j = 0; j < c.arity; ++j)
+                                args[j] = first[j * batchWidth + i];
+                            for (size_t j = 0; j < this->varsCount; ++j)
+                                row[j] = vars[j][offset + i];
+                            first[i] = c.token->apply(args.data(), c.arity, row.data(), row.size());
+                        }
+                        sp = first + batchWidth;
+                        break;
+                    }
+                    case OpStore:
+                        std::copy(sp - batchWidth, sp - batchWidth + w, regs + ins.arg * batchWidth);
+                        break;
+                    case OpLoad:
+                        std::copy(regs + ins.arg * batchWidth, regs + ins.arg * batchWidth + w, sp);
+                        sp += batchWidth;
+                        break;
+                    case OpSinCos: {
+                        sp -= batchWidth;
+                        Value* s = regs + ins.arg * batchWidth;
+                        kernels.sinCos(sp, s, s + batchWidth, w);
+                        break;
+                    }
+                    case OpOutput:
+                        sp -= batchWidth;
+                        std::copy(sp, sp + w, results + ins.arg * n + offset);
+                        break;
+                }
+            }
+            if (this->outputs == 1)
+                std::copy(buffer.data(), buffer.data() + w, results + offset);
+        }
+    }
+
+    template<typename Value>
+    std::string Program<Value>::literal(Value v) {
+        using std::isnan, std::isinf;
+        std::ostringstream ss;
+        if (isnan(v))
+            return "__builtin_nan(\"\")";
+        if (isinf(v))
+            return v < 0 ? "(-__builtin_huge_val())" : "__builtin_huge_val()";
+        ss << std::setprecision(std::numeric_limits<Value>::max_digits10) << std::scientific << v;
+        if (typeid(Value) == typeid(float))
+            ss << "f";
+        else if (typeid(Value) == typeid(long double))
+            ss << "L";
+        return v < 0 ? "(" + ss.str() + ")" : ss.str();
+    }
+
+    template<typename Value>
+    std::string Program<Value>::source(const std::function<std::string(uint32_t)>& variable, std::string& statements,
+                                       const std::function<std::string(uint32_t)>& output) const {
+        const std::string type = typeid(Value) == typeid(float) ? "float"
+                                 : typeid(Value) == typeid(double) ? "double" : "long double";
+        auto reg = [](uint32_t i) { return "r" + std::to_string(i); };
+        std::vector<std::string> s;
+        for (auto &ins: this->code) {
+            std::string a, b;
+            switch (ins.code) {
+                case OpNumber:
+                    s.push_back(literal(this->constants[ins.arg]));
+                    continue;
+                case OpVariable:
+                    s.push_back(variable(ins.arg));
+                    continue;
+                case OpSum: case OpSub: case OpMul: case OpDiv: case OpPow: {
+                    b = std::move(s.back());
+                    s.pop_back();
+                    a = std::move(s.back());
+                    s.pop_back();
+                    if (ins.code == OpPow)
+                        s.push_back("pow(" + a + ", " + b + ")");
+                    else
+                        s.push_back("(" + a + infix(ins.code) + b + ")");
+                    continue;
+                }
+                case OpUnaryMinus:
+                    s.back() = "(-" + s.back() + ")";
+                    continue;
+                case OpSin:
+                    s.back() = "sin(" + s.back() + ")";
+                    continue;
+                case OpCos:
+                    s.back() = "cos(" + s.back() + ")";
+                    continue;
+                case OpSqrt:
+                    s.back() = "sqrt(" + s.back() + ")";
+                    continue;
+                case OpCall: {
+                    const Call& c = this->calls[ins.arg];
+                    std::string args;
+                    for (size_t i = s.size() - c.arity; i < s.size(); ++i)
+                        args += (args.empty() ? "" : ", ") + s[i];
+                    s.resize(s.size() - c.arity);
+                    s.push_back(c.token->cname() + "(" + args + ")");
+                    continue;
+                }
+                case OpStore:
+                    statements += "const " + type + " " + reg(ins.arg) + " = " + s.back() + ";\n";
+                    s.back() = reg(ins.arg);
+                    continue;
+                case OpLoad:
+                    s.push_back(reg(ins.arg));
+                    continue;
+                case OpSinCos:
+                    // Compilers merge the pair into one sincos call
+                    statements += "const " + type + " " + reg(ins.arg) + " = sin(" + s.back() + ");\n";
+                    statements += "const " + type + " " + reg(ins.arg + 1) + " = cos(" + s.back() + ");\n";
+                    s.pop_back();
+                    continue;
+                case OpOutput:
+                    statements += output(ins.arg) + " = " + s.back() + ";\n";
+                    s.pop_back();
+                    continue;
+            }
+        }
+        return s.empty() ? "" : s.back();
+    }
+
+    template<typename Value>
+    std::string Program<Value>::batchSource(const std::function<std::string(uint32_t)>& variable,
+                                            const std::function<std::string(uint32_t)>& output) const {
+        // Same frame layout as runBatch, with every slot offset known here: slot k is f + k * batchWidth
+        auto slot = [](size_t k) { return "f[" + std::to_string(k * batchWidth) + " + i]"; };
+        auto lanes = [](const std::string& statement) { return "for (size_t i = 0; i < w; ++i) " + statement + ";\n"; };
+        auto column = [](size_t k) { return "f + " + std::to_string(k * batchWidth); };
+        std::string statements;
+        size_t depth = 0;
+        for (auto &ins: this->code) {
+            const size_t top = depth - 1;
+            switch (ins.code) {
+                case OpNumber:
+                    statements += lanes(slot(depth++) + " = " + literal(this->constants[ins.arg]));
+                    break;
+                case OpVariable:
+                    statements += lanes(slot(depth++) + " = " + variable(ins.arg) + "[offset + i]");
+                    break;
+                case OpSum: case OpSub: case OpMul: case OpDiv: {
+                    statements += lanes(slot(top - 1) + " = " + slot(top - 1) + infix(ins.code) + slot(top));
+                    --depth;
+                    break;
+                }
+                case OpPow:
+                    statements += "k->pow(" + column(top - 1) + ", " + column(top) + ", " + column(top - 1) + ", w);\n";
+                    --depth;
+                    break;
+                case OpUnaryMinus:
+                    statements += lanes(slot(top) + " = -" + slot(top));
+                    break;
+                case OpSqrt:
+                    statements += lanes(slot(top) + " = sqrt(" + slot(top) + ")");
+                    break;
+                case OpSin: case OpCos: {
+                    const std::string kernel = ins.code == OpSin ? "k->sin(" : "k->cos(";
+                    statements += kernel + column(top) + ", " + column(top) + ", w);\n";
+                    break;
+                }
+                case OpCall: {
+                    const Call& c = this->calls[ins.arg];
+                    const size_t first = depth - c.arity;
+                    std::string args;
+                    for (size_t j = first; j < depth; ++j)
+                        args += (args.empty() ? "" : ", ") + slot(j);
+                    statements += lanes(slot(first) + " = " + c.token->cname() + "(" + args + ")");
+                    depth = first + 1;
+                    break;
+                }
+                case OpStore:
+                    statements += lanes(slot(this->stackDepth + ins.arg) + " = " + slot(top));
+                    break;
+                case OpLoad:
+                    statements += lanes(slot(depth++) + " = " + slot(this->stackDepth + ins.arg));
+                    break;
+                case OpSinCos:
+                    statements += "k->sinCos(" + column(top) + ", " + column(this->stackDepth + ins.arg) + ", "
+                                  + column(this->stackDepth + ins.arg + 1) + ", w);\n";
+                    --depth;
+                    break;
+                case OpOutput:
+                    statements += lanes(output(ins.arg) + "[offset + i] = " + slot(top));
+                    --depth;
+                    break;
+            }
+        }
+        if (this->outputs == 1 && depth == 1)
+            statements += lanes(output(0) + "[offset + i] = " + slot(0));
+        return statements;
+    }
+
+}
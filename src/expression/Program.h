@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Tokens.h"
+#include "Dual.h"
+#include "VectorMath.h"
+
+namespace rk {
+
+    /*
+     * One VM instruction, arg indexes into constants, variables or calls depending on code
+     */
+    struct Instruction {
+        OpCode code;
+        uint32_t arg;
+    };
+
+    /*
+     * Flat bytecode form of a parsed expression.
+     * Built once by lower() from the shunting-yard output and evaluated by run()
+     * over a caller-provided buffer of at least frameSize() values: the value stack followed by the registers.
+     */
+    template<typename Value>
+    class Program {
+    public:
+        // Programs not deeper than this are evaluated over an on-stack buffer
+        static constexpr size_t inlineStackSize = 64;
+        // Number of points every opcode is applied to at once by runBatch
+        static constexpr size_t batchWidth = 64;
+
+        struct Call {
+            std::shared_ptr<Token<Value>> token;
+            size_t arity;
+        };
+
+        /*
+         * Expression graph view of the program for optimization passes.
+         * Operands always precede their users, values kept in registers are shared between users
+         */
+        struct Node {
+            OpCode code;
+            // Variable index for OpVariable, index into calls for OpCall
+            uint32_t arg;
+            // Value of OpNumber
+            Value value;
+            std::vector<uint32_t> args;
+        };
+
+        void lower(const std::vector<std::shared_ptr<Token<Value>>>& rpn,
+                   const std::vector<size_t>& arities,
+                   size_t varsCount);
+        void clear();
+        // Replaces the program with one computing every program as a separate output
+        void link(const std::vector<const Program<Value>*>& programs);
+
+        // roots receives the node of every output
+        [[nodiscard]] std::vector<Node> tree(std::vector<uint32_t>& roots) const;
+        /*
+         * Replaces the program with the graph computing roots, unreachable nodes are dropped.
+         * Nodes used more than once are computed once and kept in registers,
+         * sin and cos of one argument are computed together by OpSinCos
+         */
+        void assign(const std::vector<Node>& nodes, const std::vector<uint32_t>& roots);
+
+        Value run(const Value* vars, Value* frame, Value* out = nullptr) const;
+        Value run(const Value* vars) const;
+        // out[i] gets output i, for programs with several outputs
+        void runAll(const Value* vars, Value* out) const;
+        // vars holds one contiguous array of n values per variable (structure of arrays),
+        // output i is written to results[i * n]...results[i * n + n - 1]. Transcendental opcodes go through
+        // the vectorKernels, so results may differ from run in the last bits
+        void runBatch(const Value* const* vars, Value* results, size_t n) const;
+
+        /*
+         * C code computing the program, variable(i) spells the access to i-th variable.
+         * Registers become locals declared in statements, outputs of a program with several outputs
+         * are assigned to output(i) in statements as well. Returns the expression of the single output
+         */
+        [[nodiscard]] std::string source(const std::function<std::string(uint32_t)>& variable, std::string& statements,
+                                         const std::function<std::string(uint32_t)>& output = nullptr) const;
+        /*
+         * C statements computing lanes offset...offset + w - 1 (w <= batchWidth) of every output like runBatch does,
+         * over a frame f of frameSize() * batchWidth values. variable(i) and output(i) spell column pointers,
+         * transcendental opcodes call the kernel table k, laid out as VectorKernels<Value>
+         */
+        [[nodiscard]] std::string batchSource(const std::function<std::string(uint32_t)>& variable,
+                                              const std::function<std::string(uint32_t)>& output) const;
+        // C literal spelling v exactly
+        static std::string literal(Value v);
+
+        [[nodiscard]] bool empty() const { return code.empty(); }
+        [[nodiscard]] size_t size() const { return code.size(); }
+        [[nodiscard]] size_t frameSize() const { return stackDepth + registers; }
+
+        std::vector<Instruction> code;
+        std::vector<Value> constants;
+        std::vector<Call> calls;
+        size_t stackDepth = 0;
+        size_t registers = 0;
+        size_t outputs = 1;
+        size_t varsCount = 0;
+    };
+
+    // Sine and cosine of one argument, through a single libm call where the platform has one
+    void sinCos(float x, float* sin, float* cos);
+    void sinCos(double x, double* sin, double* cos);
+    void sinCos(long double x, long double* sin, long double* cos);
+
+}
@@ -0,0 +1,311 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+
+#include "Serialization.h"
+
+
+namespace rk {
+
+    namespace {
+
+        constexpr char magic[4] = {'R', 'K', 'B', 'C'};
+        constexpr uint32_t byteOrderMark = 0x01020304u;
+
+        static_assert(sizeof(OpCode) == sizeof(uint32_t) && sizeof(Instruction) == 2 * sizeof(uint32_t),
+                      "Instructions are stored as two 32 bit words");
+
+        /*
+         * Kind of the underlying floating point type, the number of derivative directions of Dual and the bytes
+         * a value is stored in: those carrying it, so the 80 bit x87 long double goes without its padding
+         */
+        template<typename Value>
+        struct ValueLayout {
+            static constexpr uint32_t kind = std::is_same<Value, float>::value ? 1
+                                           : std::is_same<Value, double>::value ? 2
+                                           : std::is_same<Value, long double>::value ? 3 : 0;
+            static constexpr uint32_t directions = 0;
+            static constexpr size_t bytes = std::numeric_limits<Value>::digits == 64 && sizeof(Value) > 10
+                                            ? 10 : sizeof(Value);
+        };
+
+        template<typename T, size_t N>
+        struct ValueLayout<Dual<T, N>> {
+            static constexpr uint32_t kind = ValueLayout<T>::kind;
+            static constexpr uint32_t directions = N;
+            static constexpr size_t bytes = (N + 1) * ValueLayout<T>::bytes;
+        };
+
+        // Value at p in ValueLayout<T>::bytes, the value first and then the derivatives for Dual
+        template<typename T>
+        void encode(char* p, const T& value) {
+            std::memcpy(p, &value, ValueLayout<T>::bytes);
+        }
+
+        template<typename T, size_t N>
+        void encode(char* p, const Dual<T, N>& value) {
+            encode(p, value.value);
+            for (size_t k = 0; k < N; ++k)
+                encode(p + (k + 1) * ValueLayout<T>::bytes, value.derivative[k]);
+        }
+
+        template<typename T>
+        void decode(const char* p, T& value) {
+            value = T(0);
+            std::memcpy(&value, p, ValueLayout<T>::bytes);
+        }
+
+        template<typename T, size_t N>
+        void decode(const char* p, Dual<T, N>& value) {
+            decode(p, value.value);
+            for (size_t k = 0; k < N; ++k)
+                decode(p + (k + 1) * ValueLayout<T>::bytes, value.derivative[k]);
+        }
+
+        [[noreturn]] void fail(const std::string& reason) {
+            throw std::logic_error("Loading Error:\n\t\t" + reason + "\n");
+        }
+
+        template<typename T>
+        void write(std::ostream& out, const T& value) {
+            out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+        }
+
+        template<typename T>
+        T read(std::istream& in) {
+            T value;
+            if (!in.read(reinterpret_cast<char*>(&value), sizeof(T)))
+                fail("Unexpected end of data");
+            return value;
+        }
+
+        template<typename T>
+        void writeArray(std::ostream& out, const std::vector<T>& v) {
+            writeSize(out, v.size());
+            out.write(reinterpret_cast<const char*>(v.data()), (std::streamsize) (v.size() * sizeof(T)));
+        }
+
+        // Grows in chunks, so a damaged size fails at the end of data instead of allocating it up front
+        constexpr size_t chunkBytes = 1u << 20u;
+
+        // Reads size elements, or size * scale of them for an array of bytes of scale sized values
+        template<typename T>
+        void readArray(std::istream& in, std::vector<T>& v, size_t scale = 1) {
+            const size_t size = readSize(in) * scale, chunk = std::max<size_t>(chunkBytes / sizeof(T), 1);
+            v.clear();
+            for (size_t done = 0; done < size; done = v.size()) {
+                v.resize(std::min(size, done + chunk));
+                if (!in.read(reinterpret_cast<char*>(v.data() + done), (std::streamsize) ((v.size() - done) * sizeof(T))))
+                    fail("Unexpected end of data");
+            }
+        }
+
+        // Replays the stack effect of every instruction, so a damaged file can not make the VM leave its frame
+        template<typename Value>
+        void check(const Program<Value>& program) {
+            if (program.stackDepth > program.code.size() || program.registers > 2 * program.code.size())
+                fail("Inconsistent frame size");
+            if (program.empty())
+                return;
+            size_t depth = 0, outputs = 0;
+            for (auto &ins: program.code) {
+                // Read as a plain word first, an out of range value is not an OpCode
+                uint32_t raw;
+                std::memcpy(&raw, &ins.code, sizeof(raw));
+                if (raw > OpSqrt)
+                    fail("Inconsistent bytecode");
+                size_t pops = 0, pushes = 0;
+                bool valid = true;
+                switch (ins.code) {
+                    case OpNumber: pushes = 1; valid = ins.arg < program.constants.size(); break;
+                    case OpVariable: pushes = 1; valid = ins.arg < program.varsCount; break;
+                    case OpSum: case OpSub: case OpMul: case OpDiv: case OpPow: pops = 2; pushes = 1; break;
+                    case OpUnaryMinus: case OpSin: case OpCos: case OpSqrt: pops = 1; pushes = 1; break;
+                    case OpCall:
+                        valid = ins.arg < program.calls.size();
+                        pops = valid ? program.calls[ins.arg].arity : 0;
+                        pushes = 1;
+                        break;
+                    case OpStore: pops = 1; pushes = 1; valid = ins.arg < program.registers; break;
+                    case OpLoad: pushes = 1; valid = ins.arg < program.registers; break;
+                    case OpSinCos: pops = 1; valid = (uint64_t) ins.arg + 1 < program.registers; break;
+                    case OpOutput: pops = 1; valid = ins.arg < program.outputs; ++outputs; break;
+                    default: valid = false; break;
+                }
+                if (!valid || depth < pops || depth - pops + pushes > program.stackDepth)
+                    fail("Inconsistent bytecode");
+                depth = depth - pops + pushes;
+            }
+            if (outputs == 0 ? depth != 1 || program.outputs != 1 : depth != 0)
+                fail("Inconsistent bytecode");
+        }
+
+    }
+
+    void writeSize(std::ostream& out, uint64_t size) {
+        write(out, size);
+    }
+
+    uint64_t readSize(std::istream& in) {
+        auto size = read<uint64_t>(in);
+        if (size > std::numeric_limits<uint32_t>::max())
+            fail("Size " + std::to_string(size) + " is out of range");
+        return size;
+    }
+
+    void writeString(std::ostream& out, const std::string& s) {
+        writeSize(out, s.size());
+        out.write(s.data(), (std::streamsize) s.size());
+    }
+
+    std::string readString(std::istream& in) {
+        std::vector<char> s;
+        readArray(in, s);
+        return std::string(s.begin(), s.end());
+    }
+
+    template<typename Value>
+    void writeHeader(std::ostream& out, uint64_t records) {
+        out.write(magic, sizeof(magic));
+        write(out, serializationVersion);
+        write(out, byteOrderMark);
+        write(out, ValueLayout<Value>::kind);
+        write(out, ValueLayout<Value>::directions);
+        write(out, (uint32_t) ValueLayout<Value>::bytes);
+        writeSize(out, records);
+    }
+
+    template<typename Value>
+    uint64_t readHeader(std::istream& in, uint32_t* version) {
+        char m[sizeof(magic)];
+        if (!in.read(m, sizeof(m)) || std::memcmp(m, magic, sizeof(magic)) != 0)
+            fail("Not a saved expression");
+        auto format = read<uint32_t>(in);
+        if (format == 0 || format > serializationVersion)
+            fail("Format version " + std::to_string(format) + " is not supported");
+        if (version != nullptr)
+            *version = format;
+        if (read<uint32_t>(in) != byteOrderMark)
+            fail("Saved on a machine of different byte order");
+        auto kind = read<uint32_t>(in), directions = read<uint32_t>(in), size = read<uint32_t>(in);
+        if (format < 3 && size != ValueLayout<Value>::bytes && size == sizeof(Value))
+            fail("Values with padding of format version " + std::to_string(format) + " are not read, save again");
+        if (kind != ValueLayout<Value>::kind || directions != ValueLayout<Value>::directions
+            || size != ValueLayout<Value>::bytes)
+            fail("Saved for a different Value type");
+        return readSize(in);
+    }
+
+    template<typename Value>
+    void writeValues(std::ostream& out, const std::vector<Value>& values) {
+        constexpr size_t bytes = ValueLayout<Value>::bytes;
+        std::vector<char> buffer(values.size() * bytes);
+        for (size_t i = 0; i < values.size(); ++i)
+            encode(buffer.data() + i * bytes, values[i]);
+        writeSize(out, values.size());
+        out.write(buffer.data(), (std::streamsize) buffer.size());
+    }
+
+    template<typename Value>
+    std::vector<Value> readValues(std::istream& in) {
+        constexpr size_t bytes = ValueLayout<Value>::bytes;
+        std::vector<char> buffer;
+        readArray(in, buffer, bytes);
+        std::vector<Value> values(buffer.size() / bytes);
+        for (size_t i = 0; i < values.size(); ++i)
+            decode(buffer.data() + i * bytes, values[i]);
+        return values;
+    }
+
+    template<typename Value>
+    void writeProgram(std::ostream& out, const Program<Value>& program,
+                      const std::function<std::string(const Token<Value>*)>& callName) {
+        for (uint64_t n: {program.stackDepth, program.registers, program.outputs, program.varsCount})
+            writeSize(out, n);
+        writeArray(out, program.code);
+        writeValues(out, program.constants);
+        writeSize(out, program.calls.size());
+        for (auto &c: program.calls) {
+            writeString(out, callName(c.token.get()));
+            writeSize(out, c.arity);
+        }
+    }
+
+    template<typename Value>
+    Program<Value> readProgram(std::istream& in,
+                               const std::function<std::shared_ptr<Token<Value>>(const std::string&)>& callToken) {
+        Program<Value> program;
+        program.stackDepth = readSize(in);
+        program.registers = readSize(in);
+        program.outputs = readSize(in);
+        program.varsCount = readSize(in);
+        readArray(in, program.code);
+        program.constants = readValues<Value>(in);
+        for (size_t i = 0, n = readSize(in); i < n; ++i) {
+            auto token = callToken(readString(in));
+            program.calls.push_back({std::move(token), readSize(in)});
+        }
+        check(program);
+        return program;
+    }
+
+    template void writeHeader<float>(std::ostream&, uint64_t);
+    template void writeHeader<double>(std::ostream&, uint64_t);
+    template void writeHeader<long double>(std::ostream&, uint64_t);
+    template void writeHeader<Dual<float>>(std::ostream&, uint64_t);
+    template void writeHeader<Dual<double>>(std::ostream&, uint64_t);
+    template void writeHeader<Dual<long double>>(std::ostream&, uint64_t);
+    template void writeHeader<Dual<double, 4>>(std::ostream&, uint64_t);
+    template uint64_t readHeader<float>(std::istream&, uint32_t*);
+    template uint64_t readHeader<double>(std::istream&, uint32_t*);
+    template uint64_t readHeader<long double>(std::istream&, uint32_t*);
+    template uint64_t readHeader<Dual<float>>(std::istream&, uint32_t*);
+    template uint64_t readHeader<Dual<double>>(std::istream&, uint32_t*);
+    template uint64_t readHeader<Dual<long double>>(std::istream&, uint32_t*);
+    template uint64_t readHeader<Dual<double, 4>>(std::istream&, uint32_t*);
+    template void writeValues<float>(std::ostream&, const std::vector<float>&);
+    template void writeValues<double>(std::ostream&, const std::vector<double>&);
+    template void writeValues<long double>(std::ostream&, const std::vector<long double>&);
+    template void writeValues<Dual<float>>(std::ostream&, const std::vector<Dual<float>>&);
+    template void writeValues<Dual<double>>(std::ostream&, const std::vector<Dual<double>>&);
+    template void writeValues<Dual<long double>>(std::ostream&, const std::vector<Dual<long double>>&);
+    template void writeValues<Dual<double, 4>>(std::ostream&, const std::vector<Dual<double, 4>>&);
+    template std::vector<float> readValues<float>(std::istream&);
+    template std::vector<double> readValues<double>(std::istream&);
+    template std::vector<long double> readValues<long double>(std::istream&);
+    template std::vector<Dual<float>> readValues<Dual<float>>(std::istream&);
+    template std::vector<Dual<double>> readValues<Dual<double>>(std::istream&);
+    template std::vector<Dual<long double>> readValues<Dual<long double>>(std::istream&);
+    template std::vector<Dual<double, 4>> readValues<Dual<double, 4>>(std::istream&);
+    template void writeProgram<float>(std::ostream&, const Program<float>&,
+                                      const std::function<std::string(const Token<float>*)>&);
+    template void writeProgram<double>(std::ostream&, const Program<double>&,
+                                       const std::function<std::string(const Token<double>*)>&);
+    template void writeProgram<long double>(std::ostream&, const Program<long double>&,
+                                            const std::function<std::string(const Token<long double>*)>&);
+    template void writeProgram<Dual<float>>(std::ostream&, const Program<Dual<float>>&,
+                                            const std::function<std::string(const Token<Dual<float>>*)>&);
+    template void writeProgram<Dual<double>>(std::ostream&, const Program<Dual<double>>&,
+                                             const std::function<std::string(const Token<Dual<double>>*)>&);
+    template void writeProgram<Dual<long double>>(std::ostream&, const Program<Dual<long double>>&,
+                                                  const std::function<std::string(const Token<Dual<long double>>*)>&);
+    template void writeProgram<Dual<double, 4>>(std::ostream&, const Program<Dual<double, 4>>&,
+                                                const std::function<std::string(const Token<Dual<double, 4>>*)>&);
+    template Program<float> readProgram<float>(std::istream&,
+            const std::function<std::shared_ptr<Token<float>>(const std::string&)>&);
+    template Program<double> readProgram<double>(std::istream&,
+            const std::function<std::shared_ptr<Token<double>>(const std::string&)>&);
+    template Program<long double> readProgram<long double>(std::istream&,
+            const std::function<std::shared_ptr<Token<long double>>(const std::string&)>&);
+    template Program<Dual<float>> readProgram<Dual<float>>(std::istream&,
+            const std::function<std::shared_ptr<Token<Dual<float>>>(const std::string&)>&);
+    template Program<Dual<double>> readProgram<Dual<double>>(std::istream&,
+            const std::function<std::shared_ptr<Token<Dual<double>>>(const std::string&)>&);
+    template Program<Dual<long double>> readProgram<Dual<long double>>(std::istream&,
+            const std::function<std::shared_ptr<Token<Dual<long double>>>(const std::string&)>&);
+    template Program<Dual<double, 4>> readProgram<Dual<double, 4>>(std::istream&,
+            const std::function<std::shared_ptr<Token<Dual<double, 4>>>(const std::string&)>&);
+
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <string>
+
+#include "Program.h"
+
+namespace rk {
+
+    // Version written by writeHeader, readHeader accepts this and every older one.
+    // 2: expressions carry their parameter names and values
+    // 3: values are stored without padding, 10 bytes for the x87 long double
+    constexpr uint32_t serializationVersion = 3;
+
+    /*
+     * Binary form of optimized programs, so models load without running the parser and the optimizer again.
+     * A file starts with a header: magic, format version, byte order mark, the Value type and the number of records.
+     * Bytecode is stored exactly as the VM keeps it in memory and read back with a single read, values only by the
+     * bytes which carry them, Dual member by member, function tokens by the name they are registered under. Everything is relative to the start
+     * of its record, so files can be concatenated, embedded or read from a mapped buffer through any std::istream.
+     * Reading throws std::logic_error on truncated, foreign or inconsistent data.
+     */
+    template<typename Value>
+    void writeHeader(std::ostream& out, uint64_t records);
+    // Number of records that follow, version gets the format version of the data if given
+    template<typename Value>
+    uint64_t readHeader(std::istream& in, uint32_t* version = nullptr);
+
+    template<typename Value>
+    void writeProgram(std::ostream& out, const Program<Value>& program,
+                      const std::function<std::string(const Token<Value>*)>& callName);
+    // The program is checked to stay within its frame, constants, variables, calls and outputs
+    template<typename Value>
+    Program<Value> readProgram(std::istream& in,
+                               const std::function<std::shared_ptr<Token<Value>>(const std::string&)>& callToken);
+
+    template<typename Value>
+    void writeValues(std::ostream& out, const std::vector<Value>& values);
+    template<typename Value>
+    std::vector<Value> readValues(std::istream& in);
+
+    void writeSize(std::ostream& out, uint64_t size);
+    uint64_t readSize(std::istream& in);
+    void writeString(std::ostream& out, const std::string& s);
+    std::string readString(std::istream& in);
+
+}
@@ -0,0 +1,197 @@
+#include <algorithm>
+#include <cstdio>
+#include <sstream>
+#include <stdexcept>
+
+#include "Table.h"
+#include "Program.h"
+#include "../utils/utils.h"
+
+
+namespace rk {
+
+    template class Table<float>;
+    template class Table<double>;
+    template class Table<long double>;
+    template class Table<Dual<float>>;
+    template class Table<Dual<double>>;
+    template class Table<Dual<long double>>;
+    template class Table<Dual<double, 4>>;
+
+    template class TableToken<float>;
+    template class TableToken<double>;
+    template class TableToken<long double>;
+    template class TableToken<Dual<float>>;
+    template class TableToken<Dual<double>>;
+    template class TableToken<Dual<long double>>;
+    template class TableToken<Dual<double, 4>>;
+
+
+    template<typename Value>
+    Table<Value>::Table(std::vector<Value> x, std::vector<Value> y, Interpolation interpolation)
+            : mode(interpolation), xs(std::move(x)), ys(std::move(y)) {
+        this->prepare();
+    }
+
+    template<typename Value>
+    Table<Value>::Table(Value first, Value step, std::vector<Value> y, Interpolation interpolation)
+            : mode(interpolation), ys(std::move(y)) {
+        if (!(step > Value(0)))
+            throw std::logic_error("Table Error:\n\t\tStep of a uniform grid must be positive\n");
+        for (size_t i = 0; i < this->ys.size(); ++i)
+            this->xs.push_back(first + Value((double) i) * step);
+        this->prepare();
+    }
+
+    template<typename Value>
+    void Table<Value>::prepare() {
+        using std::fabs;
+        const size_t n = this->ys.size();
+        if (this->xs.size() != n)
+            throw std::logic_error("Table Error:\n\t\t" + std::to_string(this->xs.size()) + " arguments for "
+                                   + std::to_string(n) + " values\n");
+        if (n < 2)
+            throw std::logic_error("Table Error:\n\t\tAt least two samples are needed\n");
+        for (size_t i = 0; i + 1 < n; ++i) {
+            if (!(this->xs[i] < this->xs[i + 1]))
+                throw std::logic_error("Table Error:\n\t\tArguments must be increasing, sample "
+                                       + std::to_string(i + 1) + " is not\n");
+        }
+
+        // Evenly spaced up to rounding of the arguments
+        const Value step = (this->xs.back() - this->xs.front()) / Value((double) (n - 1));
+        this->isUniform = true;
+        for (size_t i = 1; i + 1 < n && this->isUniform; ++i)
+            this->isUniform = fabs(this->xs[i] - (this->xs.front() + Value((double) i) * step)) <= step * Value(1e-9);
+        this->inverseStep = Value(1) / step;
+
+        if (this->mode != CubicInterpolation)
+            return;
+        // Second derivatives of the natural spline by the tridiagonal algorithm, then the slopes at the samples
+        std::vector<Value> h(n - 1), second(n, Value(0)), c(n, Value(0)), r(n, Value(0));
+        for (size_t i = 0; i + 1 < n; ++i)
+            h[i] = this->xs[i + 1] - this->xs[i];
+        for (size_t i = 1; i + 1 < n; ++i) {
+            const Value diagonal = Value(2) * (h[i - 1] + h[i]) - h[i - 1] * c[i - 1];
+            c[i] = h[i] / diagonal;
+            r[i] = (Value(6) * ((this->ys[i + 1] - this->ys[i]) / h[i] - (this->ys[i] - this->ys[i - 1]) / h[i - 1])
+                    - h[i - 1] * r[i - 1]) / diagonal;
+        }
+        for (size_t i = n - 2; i >= 1; --i)
+            second[i] = r[i] - c[i] * second[i + 1];
+        this->slopes.resize(n);
+        for (size_t i = 0; i + 1 < n; ++i)
+            this->slopes[i] = (this->ys[i + 1] - this->ys[i]) / h[i]
+                              - h[i] * (Value(2) * second[i] + second[i + 1]) / Value(6);
+        this->slopes[n - 1] = (this->ys[n - 1] - this->ys[n - 2]) / h[n - 2]
+                              + h[n - 2] * (second[n - 2] + Value(2) * second[n - 1]) / Value(6);
+    }
+
+    template<typename Value>
+    size_t Table<Value>::interval(const Value& x) const {
+        const size_t last = this->xs.size() - 2;
+        if (this->isUniform)
+            return std::min((size_t) ((x - this->xs[0]) * this->inverseStep), last);
+        size_t i = this->cursor.load(std::memory_order_relaxed);
+        if (this->xs[i] <= x && x < this->xs[i + 1])
+            return i;
+        if (i < last && this->xs[i + 1] <= x && x < this->xs[i + 2]) {
+            ++i;
+        } else {
+            i = (size_t) (std::upper_bound(this->xs.begin(), this->xs.end(), x) - this->xs.begin()) - 1;
+            i = std::min(i, last);
+        }
+        this->cursor.store(i, std::memory_order_relaxed);
+        return i;
+    }
+
+    template<typename Value>
+    Value Table<Value>::operator()(const Value& x) const {
+        using std::isnan;
+        if (isnan(x))
+            return x;
+        if (!(x > this->xs.front()))
+            return this->ys.front();
+        if (!(x < this->xs.back()))
+            return this->ys.back();
+        const size_t i = this->interval(x);
+        // The generated source spells the same operations in the same order, so both give the same numbers
+        const Value h = this->xs[i + 1] - this->xs[i];
+        const Value t = this->isUniform ? (x - this->xs[i]) * this->inverseStep : (x - this->xs[i]) / h;
+        if (this->mode == LinearInterpolation)
+            return this->ys[i] + t * (this->ys[i + 1] - this->ys[i]);
+        const Value t2 = t * t, t3 = t2 * t;
+        return (Value(2) * t3 - Value(3) * t2 + Value(1)) * this->ys[i]
+               + (t3 - Value(2) * t2 + t) * h * this->slopes[i]
+               + (Value(3) * t2 - Value(2) * t3) * this->ys[i + 1]
+               + (t3 - t2) * h * this->slopes[i + 1];
+    }
+
+    template<typename Value>
+    std::string Table<Value>::source(const std::string& name, const std::string& valueName) const {
+        const size_t n = this->xs.size();
+        auto array = [&](const std::string& suffix, const std::vector<Value>& values) {
+            std::string s = "static const " + valueName + " " + name + suffix + "[" + std::to_string(n) + "] = {";
+            for (size_t i = 0; i < n; ++i)
+                s += (i == 0 ? "" : ", ") + Program<Value>::literal(values[i]);
+            return s + "};\n";
+        };
+        const std::string x = name + "_x", y = name + "_y", d = name + "_d", last = std::to_string(n - 2);
+        std::stringstream source;
+        source << array("_x", this->xs) << array("_y", this->ys);
+        if (this->mode == CubicInterpolation)
+            source << array("_d", this->slopes);
+        source << "static " << valueName << " " << name << "(" << valueName << " x) {\n"
+               << "if (x != x) return x;\n"
+               << "if (!(x > " << x << "[0])) return " << y << "[0];\n"
+               << "if (!(x < " << x << "[" << n - 1 << "])) return " << y << "[" << n - 1 << "];\n";
+        const std::string inverse = Program<Value>::literal(this->inverseStep);
+        if (this->isUniform) {
+            source << "size_t i = (size_t) ((x - " << x << "[0]) * " << inverse << ");\n"
+                   << "if (i > " << last << ") i = " << last << ";\n";
+        } else {
+            source << "static thread_local size_t cursor = 0;\n"
+                   << "size_t i = cursor;\n"
+                   << "if (!(" << x << "[i] <= x && x < " << x << "[i + 1])) {\n"
+                   << "if (i < " << last << " && " << x << "[i + 1] <= x && x < " << x << "[i + 2]) {\n"
+                   << "++i;\n"
+                   << "} else {\n"
+                   << "size_t lo = 0, hi = " << n - 1 << ";\n"
+                   << "while (hi - lo > 1) {\n"
+                   << "const size_t mid = (lo + hi) / 2;\n"
+                   << "if (" << x << "[mid] <= x) lo = mid; else hi = mid;\n"
+                   << "}\n"
+                   << "i = lo;\n"
+                   << "}\n"
+                   << "cursor = i;\n"
+                   << "}\n";
+        }
+        if (!this->isUniform || this->mode == CubicInterpolation)
+            source << "const " << valueName << " h = " << x << "[i + 1] - " << x << "[i];\n";
+        source << "const " << valueName << " t = (x - " << x << "[i]) " << (this->isUniform ? "* " + inverse : "/ h")
+               << ";\n";
+        if (this->mode == LinearInterpolation) {
+            source << "return " << y << "[i] + t * (" << y << "[i + 1] - " << y << "[i]);\n";
+        } else {
+            const std::string two = Program<Value>::literal(Value(2)), three = Program<Value>::literal(Value(3)),
+                    one = Program<Value>::literal(Value(1));
+            source << "const " << valueName << " t2 = t * t, t3 = t2 * t;\n"
+                   << "return (" << two << " * t3 - " << three << " * t2 + " << one << ") * " << y << "[i]\n"
+                   << "+ (t3 - " << two << " * t2 + t) * h * " << d << "[i]\n"
+                   << "+ (" << three << " * t2 - " << two << " * t3) * " << y << "[i + 1]\n"
+                   << "+ (t3 - t2) * h * " << d << "[i + 1];\n";
+        }
+        source << "}\n";
+        return source.str();
+    }
+
+    template<typename Value>
+    TableToken<Value>::TableToken(std::shared_ptr<const Table<Value>> table) : table(std::move(table)) {
+        // Same samples and interpolation, same name
+        uint64_t hash = utils_rk::hashString(this->table->source("t", "v"));
+        char hex[17];
+        std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long) hash);
+        this->name = std::string("rk_table_") + hex;
+    }
+
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <stack>
+#include <string>
+#include <vector>
+
+#include "Tokens.h"
+
+namespace rk {
+
+    enum Interpolation {
+        // Straight lines between the samples
+        LinearInterpolation,
+        // Natural cubic spline through the samples, continuous first and second derivatives
+        CubicInterpolation
+    };
+
+    /*
+     * Samples of a function of one variable, such as measured forcing data, interpolated between them.
+     * Outside of the samples the first and the last value are kept. On a uniform grid the sample interval is
+     * found in O(1), otherwise the interval of the previous lookup and the one after it are tried before a binary
+     * search, so the lookups of a solver marching through time cost a comparison or two. Safe to evaluate from
+     * any number of threads. Registered with Expression<Value>::addTable, a table is called like a function of
+     * one argument and is interpreted and compiled like any other operation
+     */
+    template<typename Value>
+    class Table {
+    public:
+        // Values y[i] at increasing x[i], at least two of them. The grid is uniform if x is evenly spaced
+        Table(std::vector<Value> x, std::vector<Value> y, Interpolation interpolation = LinearInterpolation);
+        // Values y[i] at first + i * step, step > 0
+        Table(Value first, Value step, std::vector<Value> y, Interpolation interpolation = LinearInterpolation);
+        Table(const Table&) = delete;
+        Table& operator=(const Table&) = delete;
+
+        Value operator()(const Value& x) const;
+
+        [[nodiscard]] size_t size() const { return ys.size(); }
+        [[nodiscard]] bool uniform() const { return isUniform; }
+        [[nodiscard]] Interpolation interpolation() const { return mode; }
+        /*
+         * C++ definition of a function name(x) computing the table over valueName, with the samples as constants,
+         * for the source generated by compile. Only meaningful for the builtin floating types
+         */
+        [[nodiscard]] std::string source(const std::string& name, const std::string& valueName) const;
+
+    private:
+        void prepare();
+        // i with xs[i] <= x < xs[i + 1], 0 <= i <= size() - 2, for x inside the samples
+        size_t interval(const Value& x) const;
+
+        Interpolation mode;
+        std::vector<Value> xs, ys;
+        // Derivative of the spline at every sample, for CubicInterpolation
+        std::vector<Value> slopes;
+        bool isUniform = false;
+        // 1 / step of a uniform grid
+        Value inverseStep = Value(0);
+        // Interval of the last lookup, a hint shared by all threads
+        mutable std::atomic<size_t> cursor{0};
+    };
+
+    /*
+     * Function token evaluating a Table, the C function it calls in compiled code is named after a hash of the
+     * samples, so equal tables share one definition and cached modules match them across processes
+     */
+    template<typename Value>
+    class TableToken: public FunctionToken<Value> {
+    public:
+        explicit TableToken(std::shared_ptr<const Table<Value>> table);
+
+        void evaluate(std::stack<Value>& s, const std::vector<Value>&) const override {
+            Value x = s.top();
+            s.pop();
+            s.push((*table)(x));
+        }
+        Value apply(const Value* args, size_t arity, const Value*, size_t) const override {
+            return (*table)(args[arity - 1]);
+        }
+        [[nodiscard]] std::string cname() const override { return name; }
+        [[nodiscard]] std::string definition(const std::string& valueName) const override {
+            return table->source(name, valueName);
+        }
+
+        const std::shared_ptr<const Table<Value>> table;
+    private:
+        std::string name;
+    };
+
+}
@@ -21,6 +21,18 @@ enum TokenAssociativity {
     Both, Right, Left
 };
 
+/*
+ * Instruction set of the expression VM, every evaluable token lowers to exactly one opcode.
+ * The last four are only emitted by optimization passes: OpStore copies the top into register arg,
+ * OpLoad pushes register arg, OpSinCos pops x into registers arg (sin x) and arg + 1 (cos x),
+ * OpOutput pops the result number arg of a program with several outputs.
+ * OpSqrt came later and is kept last, so the numbers of the others stay those of saved programs
+ */
+enum OpCode {
+    OpNumber, OpVariable, OpSum, OpSub, OpMul, OpDiv, OpUnaryMinus, OpSin, OpCos, OpPow, OpCall,
+    OpStore, OpLoad, OpSinCos, OpOutput, OpSqrt
+};
+
 
 /*
  * Base Token Class
@@ -32,7 +44,21 @@ public:
     [[nodiscard]] virtual int precedence() const { return -1; }
     [[nodiscard]] virtual TokenAssociativity associativity() const { return Both; }
     virtual void evaluate(std::stack<Value>&, const std::vector<Value>&) const { }
+    /*
+     * Result of a function token for args[0]...args[arity - 1] in source order, called by the VM.
+     * The default goes through evaluate and allocates, tokens overriding it keep evaluation allocation free
+     */
+    virtual Value apply(const Value* args, size_t arity, const Value* vars, size_t varsCount) const {
+        std::stack<Value> s;
+        for (size_t i = 0; i < arity; ++i)
+            s.push(args[i]);
+        this->evaluate(s, std::vector<Value>(vars, vars + varsCount));
+        return s.top();
+    }
     [[nodiscard]] virtual std::string cname() const { return ""; }
+    // Definition of the function cname() names, placed before code generated over the named value type. Empty for math.h ones
+    [[nodiscard]] virtual std::string definition(const std::string&) const { return ""; }
+    [[nodiscard]] virtual OpCode opcode() const { return OpCall; }
 };
 
 
@@ -82,6 +108,8 @@ public:
         s.push(vars[this->num]);
     }
     [[nodiscard]] std::string cname() const override { return "vars[" + std::to_string(num) + "]"; }
+    [[nodiscard]] OpCode opcode() const override { return OpVariable; }
+    [[nodiscard]] int getNum() const { return num; }
 private:
     int num;
 };
@@ -95,7 +123,12 @@ public:
     void evaluate(std::stack<Value>& s, const std::vector<Value>& vars) const override {
         s.push(this->value);
     }
-    [[nodiscard]] std::string cname() const override { return std::to_string(value); }
+    [[nodiscard]] std::string cname() const override {
+        using std::to_string;
+        return to_string(value);
+    }
+    [[nodiscard]] OpCode opcode() const override { return OpNumber; }
+    [[nodiscard]] Value getValue() const { return value; }
 private:
     Value value;
 };
@@ -116,6 +149,7 @@ public:
         s.push(a + b);
     }
     [[nodiscard]] std::string cname() const override { return "+"; }
+    [[nodiscard]] OpCode opcode() const override { return OpSum; }
 };
 
 
@@ -132,6 +166,7 @@ public:
         s.push(b - a);
     }
     [[nodiscard]] std::string cname() const override { return "-"; }
+    [[nodiscard]] OpCode opcode() const override { return OpSub; }
 };
 
 
@@ -148,6 +183,7 @@ public:
         s.push(a * b);
     }
     [[nodiscard]] std::string cname() const override { return "*"; }
+    [[nodiscard]] OpCode opcode() const override { return OpMul; }
 };
 
 
@@ -164,6 +200,7 @@ public:
         s.push(b / a);
     }
     [[nodiscard]] std::string cname() const override { return "/"; }
+    [[nodiscard]] OpCode opcode() const override { return OpDiv; }
 };
 
 
@@ -177,6 +214,7 @@ class UnaryMinusToken: public OperationToken<Value> {
         s.push(-a);
     }
     [[nodiscard]] std::string cname() const override { return "-"; }
+    [[nodiscard]] OpCode opcode() const override { return OpUnaryMinus; }
 };
 
 
@@ -190,9 +228,11 @@ public:
     void evaluate(std::stack<Value>& s, const std::vector<Value>& vars) const override {
         Value a = s.top();
         s.pop();
-        s.push(std::sin(a));
+        using std::sin;
+        s.push(sin(a));
     }
     [[nodiscard]] std::string cname() const override { return "sin"; }
+    [[nodiscard]] OpCode opcode() const override { return OpSin; }
 };
 
 template<typename Value>
@@ -203,9 +243,11 @@ public:
         s.pop();
         Value b = s.top();
         s.pop();
-        s.push(std::pow(b, a));
+        using std::pow;
+        s.push(pow(b, a));
     }
     [[nodiscard]] std::string cname() const override { return "pow"; }
+    [[nodiscard]] OpCode opcode() const override { return OpPow; }
 };
 
 template<typename Value>
@@ -214,9 +256,24 @@ public:
     void evaluate(std::stack<Value>& s, const std::vector<Value>& vars) const override {
         Value a = s.top();
         s.pop();
-        s.push(std::cos(a));
+        using std::cos;
+        s.push(cos(a));
     }
     [[nodiscard]] std::string cname() const override { return "cos"; }
+    [[nodiscard]] OpCode opcode() const override { return OpCos; }
+};
+
+template<typename Value>
+class SqrtToken: public FunctionToken<Value> {
+public:
+    void evaluate(std::stack<Value>& s, const std::vector<Value>& vars) const override {
+        Value a = s.top();
+        s.pop();
+        using std::sqrt;
+        s.push(sqrt(a));
+    }
+    [[nodiscard]] std::string cname() const override { return "sqrt"; }
+    [[nodiscard]] OpCode opcode() const override { return OpSqrt; }
 };
 
 
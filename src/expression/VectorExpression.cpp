@@ -0,0 +1,70 @@
+#include "VectorExpression.h"
+
+
+namespace rk {
+
+    template class VectorExpression<float>;
+    template class VectorExpression<double>;
+    template class VectorExpression<long double>;
+    template class VectorExpression<Dual<float>>;
+    template class VectorExpression<Dual<double>>;
+    template class VectorExpression<Dual<long double>>;
+    template class VectorExpression<Dual<double, 4>>;
+
+    template<typename Value>
+    VectorExpression<Value>::VectorExpression(Equations equations) : equations(std::move(equations)) {
+        // Linked or compiled systems are kept as they are, relinking would drop a compiled rhs
+        if (Expression<Value>::linkedSystem(this->equations) == nullptr)
+            Expression<Value>::linkSystem(this->equations);
+    }
+
+    template<typename Value>
+    void VectorExpression<Value>::parse(const std::vector<std::string>& equations,
+                                        const std::vector<std::string>& variables,
+                                        std::pair<Value, bool> (*f)(const std::string&)) {
+        Equations parsed;
+        parsed.reserve(equations.size());
+        for (auto &equation: equations) {
+            parsed.push_back(std::make_shared<Expression<Value>>());
+            parsed.back()->parse(equation, variables, f);
+        }
+        Expression<Value>::linkSystem(parsed);
+        this->equations = std::move(parsed);
+    }
+
+    template<typename Value>
+    void VectorExpression<Value>::evaluate(const std::vector<Value>& vars, Value* out) const {
+        const size_t size = this->scratchSize();
+        if (size <= Program<Value>::inlineStackSize) {
+            Value scratch[Program<Value>::inlineStackSize];
+            this->evaluate(vars.data(), out, scratch);
+        } else {
+            std::vector<Value> scratch(size);
+            this->evaluate(vars.data(), out, scratch.data());
+        }
+    }
+
+    template<typename Value>
+    std::vector<Value> VectorExpression<Value>::evaluate(const std::vector<Value>& vars) const {
+        std::vector<Value> out(this->equations.size());
+        this->evaluate(vars, out.data());
+        return out;
+    }
+
+    template<typename Value>
+    void VectorExpression<Value>::evaluate(const Value* vars, Value* out, Value* scratch) const {
+        Expression<Value>::evaluateSystem(this->equations, Expression<Value>::linkedSystem(this->equations),
+                                          vars, out, scratch);
+    }
+
+    template<typename Value>
+    bool VectorExpression<Value>::compile(const CompileOptions& options) {
+        return Expression<Value>::compileSystem(this->equations, options);
+    }
+
+    template<typename Value>
+    VectorExpression<Value> VectorExpression<Value>::load(std::istream& in) {
+        return VectorExpression<Value>(Expression<Value>::loadSystem(in));
+    }
+
+}
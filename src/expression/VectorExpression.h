@@ -0,0 +1,53 @@
+#pragma once
+
+#include "Expression.h"
+
+namespace rk {
+
+    /*
+     * Vector valued function: several equations over the same variables, linked into one program which writes
+     * every result to an output array in a single pass over one scratch buffer. Converts to the vector of its
+     * equations, so every *SystemSolve takes it in place of a system.
+     * Copies share the equations, as the vectors of shared pointers they stand for do.
+     */
+    template<typename Value>
+    class VectorExpression {
+    public:
+        using Equations = std::vector<std::shared_ptr<Expression<Value>>>;
+
+        VectorExpression() = default;
+        // Takes equations parsed elsewhere and links them unless they are linked already,
+        // equations with parameters are evaluated one by one
+        explicit VectorExpression(Equations equations);
+
+        void parse(const std::vector<std::string>& equations,
+                   const std::vector<std::string>& variables = {},
+                   std::pair<Value, bool> (*f)(const std::string&) = utils_rk::stringToDouble);
+        // out[i] gets the value of equation i
+        void evaluate(const std::vector<Value>& vars, Value* out) const;
+        std::vector<Value> evaluate(const std::vector<Value>& vars) const;
+        // Scratch holds at least scratchSize() values owned by the caller, one buffer per thread. Allocates only as
+        // Expression::evaluate(vars, scratch) does
+        void evaluate(const Value* vars, Value* out, Value* scratch) const;
+        size_t scratchSize() const { return Expression<Value>::scratchSize(this->equations); }
+        // One shared object with a single entry point for the whole vector, see Expression::compileSystem
+        bool compile(const CompileOptions& options = {});
+        // Operations performed by one evaluation of every equation
+        EvaluationCounts evaluationCounts() const { return Expression<Value>::evaluationCounts(this->equations); }
+        // jacobian[i][j] is the derivative of equation i with respect to variable j + 1
+        std::vector<std::vector<std::shared_ptr<Expression<Value>>>> jacobian() const {
+            return Expression<Value>::jacobian(this->equations);
+        }
+
+        void save(std::ostream& out) const { Expression<Value>::saveSystem(out, this->equations); }
+        static VectorExpression<Value> load(std::istream& in);
+
+        [[nodiscard]] size_t size() const { return this->equations.size(); }
+        const Expression<Value>& operator[](size_t i) const { return *this->equations[i]; }
+        const Equations& system() const { return this->equations; }
+        operator const Equations&() const { return this->equations; }
+    private:
+        Equations equations;
+    };
+
+}
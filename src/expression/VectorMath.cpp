@@ -0,0 +1,326 @@
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "VectorMath.h"
+#include "Dual.h"
+
+
+namespace rk {
+
+    namespace {
+
+        // Scalar functions, found by argument dependent lookup for Dual
+        template<typename Value>
+        struct ScalarKernels {
+            static void sin(const Value* x, Value* y, size_t n) {
+                using std::sin;
+                for (size_t i = 0; i < n; ++i)
+                    y[i] = sin(x[i]);
+            }
+
+            static void cos(const Value* x, Value* y, size_t n) {
+                using std::cos;
+                for (size_t i = 0; i < n; ++i)
+                    y[i] = cos(x[i]);
+            }
+
+            static void sinCos(const Value* x, Value* s, Value* c, size_t n) {
+                using std::sin, std::cos;
+                for (size_t i = 0; i < n; ++i) {
+                    Value v = x[i];
+                    s[i] = sin(v);
+                    c[i] = cos(v);
+                }
+            }
+
+            static void pow(const Value* a, const Value* b, Value* y, size_t n) {
+                using std::pow;
+                for (size_t i = 0; i < n; ++i)
+                    y[i] = pow(a[i], b[i]);
+            }
+
+            static constexpr VectorKernels<Value> kernels = {sin, cos, sinCos, pow, "scalar"};
+        };
+
+#if defined(__GNUC__)
+
+#define RK_VECTOR_INLINE inline __attribute__((always_inline))
+
+// Lanes is always inlined into the kernels of one instruction set, vectors never cross a call boundary, so the ABI
+// note about passing them is moot. GCC reports it at the end of the unit, the pragma stays in effect to there
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+        /*
+         * Range reduction by pi / 2 in three parts short enough for q * part to be exact up to limit (Cody and Waite),
+         * the rounding constant turns x * 2 / pi into an integer kept in the low bits of its representation.
+         * Polynomials are the minimax ones of fdlibm (double) and Cephes (float) on [-pi / 4, pi / 4]
+         */
+        template<typename T>
+        struct Constants;
+
+        template<>
+        struct Constants<double> {
+            using Bits = int64_t;
+            static constexpr double twoOverPi = 6.36619772367581382433e-01;
+            static constexpr double pio2[4] = {1.57079632673412561417e+00, 6.07710050630396597660e-11,
+                                               2.02226624871116645580e-21, 8.47842766036889956997e-32};
+            static constexpr double round = 6755399441055744.0;
+            static constexpr double limit = 524288.0;
+            static constexpr double sinCoefficients[6] = {
+                    -1.66666666666666324348e-01, 8.33333333332248946124e-03, -1.98412698298579493134e-04,
+                    2.75573137070700676789e-06, -2.50507602534068634195e-08, 1.58969099521155010221e-10};
+            static constexpr double cosCoefficients[6] = {
+                    4.16666666666666019037e-02, -1.38888888888741095749e-03, 2.48015872894767294178e-05,
+                    -2.75573143513906633035e-07, 2.08757232129817482790e-09, -1.13596475577881948265e-11};
+            static constexpr double minNormal = 2.2250738585072014e-308;
+        };
+
+        template<>
+        struct Constants<float> {
+            using Bits = int32_t;
+            static constexpr float twoOverPi = 6.36619772e-01f;
+            static constexpr float pio2[4] = {1.5703125f, 4.837512969970703125e-4f, 7.549533620476723e-08f,
+                                              2.5633440682570896e-12f};
+            static constexpr float round = 12582912.0f;
+            static constexpr float limit = 8192.0f;
+            static constexpr float sinCoefficients[3] = {-1.6666654611e-1f, 8.3321608736e-3f, -1.9515295891e-4f};
+            static constexpr float cosCoefficients[3] = {4.166664568298827e-2f, -1.388731625493765e-3f,
+                                                         2.443315711809948e-5f};
+            static constexpr float minNormal = 1.17549435e-38f;
+        };
+
+        template<typename T, size_t Bytes>
+        struct Lanes {
+            using C = Constants<T>;
+            using Bits = typename C::Bits;
+            typedef T V __attribute__((vector_size(Bytes)));
+            typedef Bits I __attribute__((vector_size(Bytes)));
+            static constexpr size_t count = Bytes / sizeof(T);
+            static constexpr int signShift = 8 * sizeof(T) - 2;
+
+            static RK_VECTOR_INLINE void load(V& v, const T* p, size_t w, T fill) {
+                if (w == count) {
+                    std::memcpy(&v, p, sizeof(V));
+                } else {
+                    for (size_t j = 0; j < count; ++j)
+                        v[j] = j < w ? p[j] : fill;
+                }
+            }
+
+            static RK_VECTOR_INLINE void store(const V& v, T* p, size_t w) {
+                if (w == count) {
+                    std::memcpy(p, &v, sizeof(V));
+                } else {
+                    for (size_t j = 0; j < w; ++j)
+                        p[j] = v[j];
+                }
+            }
+
+            static RK_VECTOR_INLINE V select(const I& mask, const V& a, const V& b) {
+                return (V) (((I) a & mask) | ((I) b & ~mask));
+            }
+
+            template<size_t N>
+            static RK_VECTOR_INLINE V polynomial(const V& z, const T (&c)[N]) {
+                V p = z * c[N - 1];
+                for (size_t k = N - 1; k > 1; --k)
+                    p = z * (p + c[k - 1]);
+                return p + c[0];
+            }
+
+            // Both results, lanes beyond the reduction limit are left for libm
+            static RK_VECTOR_INLINE void sinCos(const V& x, V& s, V& c) {
+                V q = x * C::twoOverPi + C::round;
+                const I n = (I) q;
+                q = q - C::round;
+                // The reduced argument is r + low, low collects the rounding errors of the subtractions
+                V r = x - q * C::pio2[0];
+                V low = V{};
+                for (size_t k = 1; k < 4; ++k) {
+                    const V t = q * C::pio2[k];
+                    const V next = r - t;
+                    low = low + ((r - next) - t);
+                    r = next;
+                }
+                const V z = r * r;
+                // 1 - z / 2 with its rounding error added back
+                const V hz = z * T(0.5);
+                const V w = T(1) - hz;
+                const V ps = r + (r * z * polynomial(z, C::sinCoefficients) + low * w);
+                const V pc = w + ((((T(1) - w) - hz) + z * z * polynomial(z, C::cosCoefficients)) - r * low);
+                const I odd = -(n & 1);
+                // sin keeps the sign of zero
+                s = select(x == 0, x, (V) ((I) select(odd, pc, ps) ^ ((n & 2) << signShift)));
+                c = (V) ((I) select(odd, ps, pc) ^ (((n + 1) & 2) << signShift));
+            }
+
+            static RK_VECTOR_INLINE I outOfRange(const V& x) {
+                const I abs = (I) x & ~((I) V{} + ((Bits) 1 << (8 * sizeof(T) - 1)));
+                return (V) abs > C::limit;
+            }
+
+            static RK_VECTOR_INLINE void sin(const T* x, T* y, size_t n) {
+                for (size_t i = 0; i < n; i += count) {
+                    const size_t w = n - i < count ? n - i : count;
+                    V v, s, c;
+                    load(v, x + i, w, T(0));
+                    sinCos(v, s, c);
+                    const I far = outOfRange(v);
+                    for (size_t j = 0; j < w; ++j) {
+                        if (far[j])
+                            s[j] = std::sin(v[j]);
+                    }
+                    store(s, y + i, w);
+                }
+            }
+
+            static RK_VECTOR_INLINE void cos(const T* x, T* y, size_t n) {
+                for (size_t i = 0; i < n; i += count) {
+                    const size_t w = n - i < count ? n - i : count;
+                    V v, s, c;
+                    load(v, x + i, w, T(0));
+                    sinCos(v, s, c);
+                    const I far = outOfRange(v);
+                    for (size_t j = 0; j < w; ++j) {
+                        if (far[j])
+                            c[j] = std::cos(v[j]);
+                    }
+                    store(c, y + i, w);
+                }
+            }
+
+            static RK_VECTOR_INLINE void sinCos(const T* x, T* sines, T* cosines, size_t n) {
+                for (size_t i = 0; i < n; i += count) {
+                    const size_t w = n - i < count ? n - i : count;
+                    V v, s, c;
+                    load(v, x + i, w, T(0));
+                    sinCos(v, s, c);
+                    const I far = outOfRange(v);
+                    for (size_t j = 0; j < w; ++j) {
+                        if (far[j]) {
+                            s[j] = std::sin(v[j]);
+                            c[j] = std::cos(v[j]);
+                        }
+                    }
+                    store(s, sines + i, w);
+                    store(c, cosines + i, w);
+                }
+            }
+
+            // Integer exponents -4...4 by products, a^-n as 1 / a^n unless a^n is subnormal
+            static RK_VECTOR_INLINE void pow(const T* a, const T* b, T* y, size_t n) {
+                for (size_t i = 0; i < n; i += count) {
+                    const size_t w = n - i < count ? n - i : count;
+                    V x, e;
+                    load(x, a + i, w, T(1));
+                    load(e, b + i, w, T(1));
+                    const V x2 = x * x, x3 = x2 * x, x4 = x2 * x2;
+                    const V m = select(e < 0, -e, e);
+                    V p = select(m == 1, x, V{} + T(1));
+                    p = select(m == 2, x2, p);
+                    p = select(m == 3, x3, p);
+                    p = select(m == 4, x4, p);
+                    const I negative = e < 0;
+                    V r = select(negative, T(1) / p, p);
+                    const I exact = (m == 0) | (m == 1) | (m == 2) | (m == 3) | (m == 4);
+                    const I subnormal = negative & (select(p < 0, -p, p) < C::minNormal);
+                    for (size_t j = 0; j < w; ++j) {
+                        if (!exact[j] || subnormal[j])
+                            r[j] = std::pow(x[j], e[j]);
+                    }
+                    store(r, y + i, w);
+                }
+            }
+        };
+
+#define RK_VECTOR_TARGET(name, attribute, bytes)                                                               \
+        template<typename T>                                                                                   \
+        struct name {                                                                                          \
+            attribute static void sin(const T* x, T* y, size_t n) { Lanes<T, bytes>::sin(x, y, n); }           \
+            attribute static void cos(const T* x, T* y, size_t n) { Lanes<T, bytes>::cos(x, y, n); }           \
+            attribute static void sinCos(const T* x, T* s, T* c, size_t n) { Lanes<T, bytes>::sinCos(x, s, c, n); } \
+            attribute static void pow(const T* a, const T* b, T* y, size_t n) { Lanes<T, bytes>::pow(a, b, y, n); } \
+        };
+
+#if defined(__x86_64__) || defined(__i386__)
+        RK_VECTOR_TARGET(Sse2, __attribute__((target("sse2"))), 16)
+        RK_VECTOR_TARGET(Avx2, __attribute__((target("avx2,fma"))), 32)
+        RK_VECTOR_TARGET(Avx512, __attribute__((target("avx512f"))), 64)
+#else
+        RK_VECTOR_TARGET(Portable, , 16)
+#endif
+
+#undef RK_VECTOR_TARGET
+
+        template<template<typename> class Target, typename T>
+        const VectorKernels<T>* kernels(const char* target) {
+            static const VectorKernels<T> k = {Target<T>::sin, Target<T>::cos, Target<T>::sinCos, Target<T>::pow, target};
+            return &k;
+        }
+
+        template<typename T>
+        const VectorKernels<T>* simdKernels(const std::string& target) {
+#if defined(__x86_64__) || defined(__i386__)
+            __builtin_cpu_init();
+            if (target == "sse2" && __builtin_cpu_supports("sse2"))
+                return kernels<Sse2, T>("sse2");
+            if (target == "avx2" && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+                return kernels<Avx2, T>("avx2");
+            if (target == "avx512" && __builtin_cpu_supports("avx512f"))
+                return kernels<Avx512, T>("avx512");
+#else
+            if (target == "vector")
+                return kernels<Portable, T>("vector");
+#endif
+            return nullptr;
+        }
+
+#else
+
+        template<typename T>
+        const VectorKernels<T>* simdKernels(const std::string&) {
+            return nullptr;
+        }
+
+#endif
+
+    }
+
+    template<typename Value>
+    const VectorKernels<Value>* vectorKernels(const std::string& target) {
+        if (target == "scalar")
+            return &ScalarKernels<Value>::kernels;
+        if constexpr (std::is_same<Value, float>::value || std::is_same<Value, double>::value)
+            return simdKernels<Value>(target);
+        return nullptr;
+    }
+
+    template<typename Value>
+    const VectorKernels<Value>& vectorKernels() {
+        static const VectorKernels<Value>* best = []() {
+            for (auto target: {"avx512", "avx2", "sse2", "vector"}) {
+                if (auto k = vectorKernels<Value>(target))
+                    return k;
+            }
+            return vectorKernels<Value>("scalar");
+        }();
+        return *best;
+    }
+
+    template const VectorKernels<float>& vectorKernels<float>();
+    template const VectorKernels<double>& vectorKernels<double>();
+    template const VectorKernels<long double>& vectorKernels<long double>();
+    template const VectorKernels<Dual<float>>& vectorKernels<Dual<float>>();
+    template const VectorKernels<Dual<double>>& vectorKernels<Dual<double>>();
+    template const VectorKernels<Dual<long double>>& vectorKernels<Dual<long double>>();
+    template const VectorKernels<Dual<double, 4>>& vectorKernels<Dual<double, 4>>();
+    template const VectorKernels<float>* vectorKernels<float>(const std::string&);
+    template const VectorKernels<double>* vectorKernels<double>(const std::string&);
+    template const VectorKernels<long double>* vectorKernels<long double>(const std::string&);
+    template const VectorKernels<Dual<float>>* vectorKernels<Dual<float>>(const std::string&);
+    template const VectorKernels<Dual<double>>* vectorKernels<Dual<double>>(const std::string&);
+    template const VectorKernels<Dual<long double>>* vectorKernels<Dual<long double>>(const std::string&);
+    template const VectorKernels<Dual<double, 4>>* vectorKernels<Dual<double, 4>>(const std::string&);
+
+}
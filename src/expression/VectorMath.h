@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace rk {
+
+    /*
+     * Array forms of the transcendental opcodes for batched evaluation, y[i] = f(x[i]), in place allowed.
+     * float and double have SIMD kernels, the widest of AVX-512, AVX2 + FMA and SSE2 the CPU supports is picked
+     * on first use. Error against the exact result, checked against libm by the vector math test:
+     *   sin, cos, sinCos: at most 1 ulp for |x| up to 2^19 (double) or 8192 (float), further and non-finite
+     *                     arguments are passed to libm lane by lane
+     *   pow:              at most 4 ulp for integer exponents -4...4 (repeated products), other exponents go to libm
+     *                     lane by lane
+     * Other Value types, such as long double and Dual, apply the scalar functions element by element.
+     */
+    template<typename Value>
+    struct VectorKernels {
+        void (*sin)(const Value* x, Value* y, size_t n);
+        void (*cos)(const Value* x, Value* y, size_t n);
+        void (*sinCos)(const Value* x, Value* sin, Value* cos, size_t n);
+        void (*pow)(const Value* a, const Value* b, Value* y, size_t n);
+        // Instruction set of the kernels: "avx512", "avx2", "sse2", "vector" (portable vectors) or "scalar"
+        const char* target;
+    };
+
+    // Kernels for the best instruction set of this CPU
+    template<typename Value>
+    const VectorKernels<Value>& vectorKernels();
+    // Kernels for one instruction set, nullptr if the CPU or the build does not support it
+    template<typename Value>
+    const VectorKernels<Value>* vectorKernels(const std::string& target);
+
+}
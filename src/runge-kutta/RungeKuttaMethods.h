@@ -12,9 +12,10 @@
 
 namespace rk {
 
-    // Edited by TV on 10.05.2020
-    template<typename Value>
-    std::vector<Value> RKMasterSystemSolve(const std::vector<std::shared_ptr<Expression<Value>>>& functions,
+    // Explicit method over count equations, rhs(vars, out) writes the value of every equation to out
+    template<typename Value, typename Rhs>
+    std::vector<Value> RKMasterRhsSolve(size_t count,
+                                const Rhs& rhs,
                                 std::vector<Value> initValues,
                                 Value at,
                                 Value h,
@@ -25,21 +26,23 @@ namespace rk {
         else if (diff < 0)
             throw std::invalid_argument("RK methods do not compute solutions at points left of initValue");
         uint64_t n = (uint64_t)(((long double)diff / h) + 0.5);
-        std::vector<std::vector<Value>> k(functions.size(), std::vector<Value>(butcherTable.size() - 1));
+        std::vector<std::vector<Value>> k(count, std::vector<Value>(butcherTable.size() - 1));
         std::vector<Value> tmpValues(initValues);
+        std::vector<Value> f(count);
         for (uint64_t i = 1; i <= n; ++i) {
             for (size_t j = 0; j < butcherTable.size() - 1; ++j) {
                 tmpValues[0] = initValues[0] + h * butcherTable[j][0];
-                for (size_t t = 1; t <= functions.size(); ++t) {
+                for (size_t t = 1; t <= count; ++t) {
                     tmpValues[t] = initValues[t];
                     for (size_t j1 = 0; j1 < j; ++j1)
                         tmpValues[t] += k[t - 1][j1] * butcherTable[j][j1 + 1];
                 }
-                for (size_t t = 0; t < functions.size(); ++t)
-                    k[t][j] = h * functions[t]->evaluate(tmpValues);
+                rhs(tmpValues.data(), f.data());
+                for (size_t t = 0; t < count; ++t)
+                    k[t][j] = h * f[t];
             }
             initValues[0] += h;
-            for (size_t t = 1; t <= functions.size(); ++t) {
+            for (size_t t = 1; t <= count; ++t) {
                 for (size_t j = 0; j < butcherTable.size() - 1; ++j)
                     initValues[t] += k[t - 1][j] * butcherTable[butcherTable.size() - 1][j + 1];
             }
@@ -49,19 +52,35 @@ namespace rk {
 
     // Edited by TV on 10.05.2020
     template<typename Value>
-    std::vector<Value> RKMasterSolve(const Expression<Value>& function,
+    std::vector<Value> RKMasterSystemSolve(const std::vector<std::shared_ptr<Expression<Value>>>& functions,
                                 std::vector<Value> initValues,
                                 Value at,
                                 Value h,
                                 const std::vector<std::vector<Value>> &butcherTable) {
-        std::vector<std::shared_ptr<Expression<Value>>> tmp = { std::make_shared<Expression<Value>>(function) };
-        initValues = (RKMasterSystemSolve<Value>(tmp, initValues, at, h, butcherTable));
-        return std::move(initValues);
+        auto linked = Expression<Value>::linkedSystem(functions);
+        std::vector<Value> scratch(Expression<Value>::scratchSize(functions));
+        return RKMasterRhsSolve<Value>(functions.size(), [&](const Value* vars, Value* out) {
+            Expression<Value>::evaluateSystem(functions, linked, vars, out, scratch.data());
+        }, std::move(initValues), at, h, butcherTable);
     }
 
-    // Edited by TV on 13.05.2020
+    // Edited by TV on 10.05.2020
     template<typename Value>
-    std::vector<Value> ASRKMasterSystemSolve(const std::vector<std::shared_ptr<Expression<Value>>>& functions,
+    std::vector<Value> RKMasterSolve(const Expression<Value>& function,
+                                std::vector<Value> initValues,
+                                Value at,
+                                Value h,
+                                const std::vector<std::vector<Value>> &butcherTable) {
+        std::vector<Value> scratch(function.scratchSize());
+        return RKMasterRhsSolve<Value>(1, [&](const Value* vars, Value* out) {
+            out[0] = function.evaluate(vars, scratch.data());
+        }, std::move(initValues), at, h, butcherTable);
+    }
+
+    // Embedded adaptive method over count equations, rhs as for RKMasterRhsSolve
+    template<typename Value, typename Rhs>
+    std::vector<Value> ASRKMasterRhsSolve(size_t count,
+                                const Rhs& rhs,
                                 std::vector<Value> initValues,
                                 Value at,
                                 Value eps,
@@ -72,29 +91,31 @@ namespace rk {
         else if (diff < 0)
             throw std::invalid_argument("RK methods do not compute solutions at points left of initValue");
         
-        long double h = diff;
-        std::vector<std::vector<Value>> k(functions.size(), std::vector<Value>(butcherTable.size() - 2));
+        long double h = (long double) diff;
+        std::vector<std::vector<Value>> k(count, std::vector<Value>(butcherTable.size() - 2));
         std::vector<Value> valsHOrder(initValues);
         std::vector<Value> valsLOrder(initValues);
+        std::vector<Value> f(count);
         uint64_t n = 0;
         long double mDiff = std::numeric_limits<double>::infinity();
         while (at - initValues[0] >= eps * eps) {
             // Calculate all k-s
             for (size_t i = 0; i < butcherTable.size() - 2; ++i) {
                 valsLOrder[0] = initValues[0] + h * butcherTable[i][0];
-                for (size_t j = 1; j <= functions.size(); ++j) {
+                for (size_t j = 1; j <= count; ++j) {
                     valsLOrder[j] = initValues[j];
                     for (size_t t = 0; t < i; ++t){
                         valsLOrder[j] += k[j - 1][t] * butcherTable[i][t + 1];
                     }
                 }
-                for (size_t j = 0; j < functions.size(); ++j) 
-                    k[j][i] = h * functions[j]->evaluate(valsLOrder); 
+                rhs(valsLOrder.data(), f.data());
+                for (size_t j = 0; j < count; ++j)
+                    k[j][i] = h * f[j];
             }
             // Calculate Low order and High order vals
             valsLOrder[0] = initValues[0] + h;
             valsHOrder[0] = valsLOrder[0];
-            for (size_t j = 1; j <= functions.size(); ++j) {
+            for (size_t j = 1; j <= count; ++j) {
                 valsLOrder[j] = initValues[j];
                 valsHOrder[j] = initValues[j];
                 for (size_t t = 0; t < butcherTable.size() - 2; ++t) {
@@ -106,17 +127,17 @@ namespace rk {
             if ((n & 3) != 3) {
                 // Now find mDiff
                 mDiff = 0.0L;
-                for (size_t j = 1; j <= functions.size(); ++j) {
+                for (size_t j = 1; j <= count; ++j) {
                     auto tmpDiff = valsHOrder[j] - valsLOrder[j];
                     if (tmpDiff > mDiff)
-                        mDiff = tmpDiff;
+                        mDiff = (long double) tmpDiff;
                     else if (tmpDiff < -mDiff)
-                        mDiff = -tmpDiff;
+                        mDiff = (long double) -tmpDiff;
                 }
                 h *= 0.9L * std::min(2.0L, std::max(0.05L, std::sqrt((long double)eps / (2.0L * mDiff))));
                 if (h < 0.0000001L)
                     h = 0.0000001L;  
-                long double tmpH = at - initValues[0];
+                long double tmpH = (long double) (at - initValues[0]);
                 if (h > tmpH)
                     h = tmpH;
             } else {
@@ -128,6 +149,20 @@ namespace rk {
         }       
         return std::move(initValues);
     }
+    // Edited by TV on 13.05.2020
+    template<typename Value>
+    std::vector<Value> ASRKMasterSystemSolve(const std::vector<std::shared_ptr<Expression<Value>>>& functions,
+                                std::vector<Value> initValues,
+                                Value at,
+                                Value eps,
+                                const std::vector<std::vector<Value>> &butcherTable) {
+        auto linked = Expression<Value>::linkedSystem(functions);
+        std::vector<Value> scratch(Expression<Value>::scratchSize(functions));
+        return ASRKMasterRhsSolve<Value>(functions.size(), [&](const Value* vars, Value* out) {
+            Expression<Value>::evaluateSystem(functions, linked, vars, out, scratch.data());
+        }, std::move(initValues), at, eps, butcherTable);
+    }
+
     // Edited by TV on 12.05.2020
     template<typename Value>
     std::vector<Value> ASRKMasterSolve(const Expression<Value>& function,
@@ -135,9 +170,10 @@ namespace rk {
                                 Value at,
                                 Value eps,
                                 const std::vector<std::vector<Value>> &butcherTable) {
-        std::vector<std::shared_ptr<Expression<Value>>> tmp = { std::make_shared<Expression<Value>>(function) };
-        initValues = ASRKMasterSystemSolve<Value>(tmp, initValues, at, eps, butcherTable);
-        return std::move(initValues);
+        std::vector<Value> scratch(function.scratchSize());
+        return ASRKMasterRhsSolve<Value>(1, [&](const Value* vars, Value* out) {
+            out[0] = function.evaluate(vars, scratch.data());
+        }, std::move(initValues), at, eps, butcherTable);
     }
 
 
@@ -447,24 +483,31 @@ namespace rk {
         uint64_t n = (uint64_t)(((long double)diff / h) + 0.5);
         std::vector<std::vector<Value>> k(functions.size(), std::vector<Value>(4));
         std::vector<Value> tmpValues(initValues);
+        std::vector<Value> f(functions.size());
+        auto linked = Expression<Value>::linkedSystem(functions);
+        std::vector<Value> scratch(Expression<Value>::scratchSize(functions));
         Value frac = (Value(1) / Value(6));
         for (uint64_t i = 1; i <= n; ++i) {
+            Expression<Value>::evaluateSystem(functions, linked, tmpValues.data(), f.data(), scratch.data());
             for (size_t t = 0; t < functions.size(); ++t)
-                k[t][0] = h * functions[t]->evaluate(tmpValues);
+                k[t][0] = h * f[t];
             tmpValues[0] += 0.5 * h;
             for (size_t t = 0; t < functions.size(); ++t)
                 tmpValues[t + 1] = initValues[t + 1] + 0.5 * k[t][0];
+            Expression<Value>::evaluateSystem(functions, linked, tmpValues.data(), f.data(), scratch.data());
             for (size_t t = 0; t < functions.size(); ++t)
-                k[t][1] = h * functions[t]->evaluate(tmpValues);
+                k[t][1] = h * f[t];
             for (size_t t = 0; t < functions.size(); ++t)
                 tmpValues[t + 1] = initValues[t + 1] + 0.5 * k[t][1];
+            Expression<Value>::evaluateSystem(functions, linked, tmpValues.data(), f.data(), scratch.data());
             for (size_t t = 0; t < functions.size(); ++t)
-                k[t][2] = h * functions[t]->evaluate(tmpValues);
+                k[t][2] = h * f[t];
             tmpValues[0] += 0.5 * h;
             for (size_t t = 0; t < functions.size(); ++t)
                 tmpValues[t + 1] = initValues[t + 1] +  k[t][2];
+            Expression<Value>::evaluateSystem(functions, linked, tmpValues.data(), f.data(), scratch.data());
             for (size_t t = 0; t < functions.size(); ++t)
-                k[t][3] = h * functions[t]->evaluate(tmpValues);
+                k[t][3] = h * f[t];
             for (size_t t = 0; t < functions.size(); ++t) {
                 initValues[t + 1] = initValues[t + 1] +  frac * (k[t][0] + 2 * k[t][1] + 2 * k[t][2] + k[t][3]);
             }
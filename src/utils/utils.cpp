@@ -3,6 +3,7 @@
 //
 
 #include <algorithm>
+#include <atomic>
 #include "utils.h"
 
 namespace utils_rk {
@@ -53,7 +54,8 @@ namespace utils_rk {
         return result ? std::string(result.get()) : "error occurred";
     }
 
-    size_t RK_GS_CALLS = 0;
+    // Names are also generated by background compilations
+    std::atomic<size_t> RK_GS_CALLS{0};
     std::string generateUniqueString(size_t length)
     {
         auto randchar = []() -> char
@@ -71,4 +73,13 @@ namespace utils_rk {
         return str;
     }
 
+    uint64_t hashString(const std::string& s, uint64_t seed) {
+        uint64_t hash = seed;
+        for (unsigned char c: s) {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
 }
@@ -6,6 +6,7 @@
 
 #include <string>
 #include <memory>
+#include <cstdint>
 #include <cxxabi.h>
 
 namespace utils_rk {
@@ -20,4 +21,7 @@ namespace utils_rk {
     std::string typeNameToString(const char* type_name);
 
     std::string generateUniqueString(size_t length);
+
+    // 64-bit FNV-1a, seed allows chaining several strings into one hash
+    uint64_t hashString(const std::string& s, uint64_t seed = 14695981039346656037ull);
 }
\ No newline at end of file
@@ -0,0 +1,70 @@
+#include <cstdlib>
+#include <new>
+
+#include "Allocations.h"
+
+/*
+ * The replacement of the global allocation functions lives in its own translation unit, so no other one sees
+ * them inline. Every form of new and delete is replaced, plain, array, nothrow, sized and aligned, and all of
+ * them use the C allocator, so any new matches any delete. Only the threads holding a CountAllocations count
+ */
+
+namespace tests_rk {
+
+    thread_local size_t allocations = 0;
+
+    namespace {
+        thread_local size_t counting = 0;
+
+        void* allocate(size_t size, size_t alignment) {
+            if (counting)
+                ++allocations;
+            if (size == 0)
+                size = 1;
+            if (alignment <= alignof(std::max_align_t))
+                return std::malloc(size);
+            // aligned_alloc wants the size to be a multiple of the alignment
+            return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+        }
+
+        void* allocateOrThrow(size_t size, size_t alignment) {
+            if (void* p = allocate(size, alignment))
+                return p;
+            throw std::bad_alloc();
+        }
+    }
+
+    CountAllocations::CountAllocations() { ++counting; }
+
+    CountAllocations::~CountAllocations() { --counting; }
+
+}
+
+using tests_rk::allocate;
+using tests_rk::allocateOrThrow;
+
+void* operator new(size_t size) { return allocateOrThrow(size, 0); }
+void* operator new[](size_t size) { return allocateOrThrow(size, 0); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return allocate(size, 0); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return allocate(size, 0); }
+void* operator new(size_t size, std::align_val_t a) { return allocateOrThrow(size, (size_t) a); }
+void* operator new[](size_t size, std::align_val_t a) { return allocateOrThrow(size, (size_t) a); }
+void* operator new(size_t size, std::align_val_t a, const std::nothrow_t&) noexcept {
+    return allocate(size, (size_t) a);
+}
+void* operator new[](size_t size, std::align_val_t a, const std::nothrow_t&) noexcept {
+    return allocate(size, (size_t) a);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstddef>
+
+namespace tests_rk {
+
+    // Heap allocations made by the calling thread while it holds a CountAllocations, see Allocations.cpp
+    extern thread_local size_t allocations;
+
+    // Counts the allocations of the calling thread from construction to destruction, scopes may nest
+    class CountAllocations {
+    public:
+        CountAllocations();
+        ~CountAllocations();
+        CountAllocations(const CountAllocations&) = delete;
+        CountAllocations& operator=(const CountAllocations&) = delete;
+    };
+
+}
@@ -4,7 +4,13 @@
 
 #pragma once
 
+#include <thread>
+#include <random>
+#include <sstream>
+
 #include "../src/expression/Expression.h"
+#include "../src/expression/VectorMath.h"
+#include "../src/expression/VectorExpression.h"
 #include "../src/runge-kutta/RungeKuttaMethods.h"
 #include "Tests.h"
 
@@ -27,8 +33,495 @@ namespace tests_rk {
         }
     }
 
+    void runEvaluateBenchmark(const std::string& func, size_t n, std::vector<double> point) {
+        rk::Expression<double> expr;
+        expr.parse(func, {"x", "y"});
+        double sink = 0;
+        std::cout << "Evaluating [" << func << "]\n";
+        {
+            tests_rk::OverkillTimer<50, millisec> timer("Token interpreter 1.000.000 Points");
+            for (size_t i = 0; i < n; ++i) {
+                for (int j = 0; j < 1000000; ++j) {
+                    point[0] += 1e-9;
+                    sink += expr.interpret(point);
+                }
+                timer.reset();
+            }
+        }
+        {
+            tests_rk::OverkillTimer<50, millisec> timer("Bytecode VM 1.000.000 Points");
+            for (size_t i = 0; i < n; ++i) {
+                for (int j = 0; j < 1000000; ++j) {
+                    point[0] += 1e-9;
+                    sink += expr.evaluate(point);
+                }
+                timer.reset();
+            }
+        }
+        {
+            // Same million points, evaluated 1000 at a time from SoA columns
+            std::vector<double> xs(1000), ys(1000, point[1]), res(1000);
+            tests_rk::OverkillTimer<50, millisec> timer("Bytecode VM batch 1.000.000 Points");
+            for (size_t i = 0; i < n; ++i) {
+                for (int j = 0; j < 1000; ++j) {
+                    for (auto &x: xs)
+                        x = (point[0] += 1e-9);
+                    expr.evaluateBatch({xs.data(), ys.data()}, res.data(), res.size());
+                    sink += res[0];
+                }
+                timer.reset();
+            }
+        }
+        if (std::isnan(sink))
+            std::cout << "(nan checksum)\n";
+    }
+
+    void runCompileBenchmark(rk::CompileBackend backend, size_t count, const std::string& timerName) {
+        std::vector<rk::Expression<double>> exprs(count);
+        for (size_t i = 0; i < count; ++i)
+            exprs[i].parse("y * ((sin(x)) / x + (cos(x)) / (x * x)) + " + std::to_string(i), {"x", "y"});
+        tests_rk::OverkillTimer<50, microsec> timer(timerName + " 1 Expression");
+        for (auto &e: exprs) {
+            e.compile(backend);
+            timer.reset();
+        }
+    }
+
+    // Chain system y_i' = sin(y_{i+1}) - y_i, compiled equation by equation and as a whole
+    void runSystemBenchmark(size_t count, size_t n) {
+        std::vector<std::string> vars = {"x"};
+        for (size_t i = 0; i < count; ++i)
+            vars.push_back("y" + std::to_string(i));
+        auto makeSystem = [&]() {
+            std::vector<std::shared_ptr<rk::Expression<double>>> system;
+            for (size_t i = 0; i < count; ++i) {
+                system.push_back(std::make_shared<rk::Expression<double>>());
+                system.back()->parse("sin(" + vars[(i + 1) % count + 1] + ") - " + vars[i + 1] + " + 0.1 * x", vars);
+            }
+            return system;
+        };
+        std::vector<double> init(count + 1, 0.5);
+        init[0] = 0;
+        auto separate = makeSystem(), fused = makeSystem();
+        {
+            tests_rk::OverkillTimer<50, millisec> timer("External compile of " + std::to_string(count) + " equations one by one");
+            for (size_t i = 0; i < n; ++i) {
+                for (auto &e: separate)
+                    e->compile(rk::ExternalCompiler);
+                timer.reset();
+            }
+        }
+        {
+            tests_rk::OverkillTimer<50, millisec> timer("External compile of " + std::to_string(count) + " equations as a system");
+            for (size_t i = 0; i < n; ++i) {
+                rk::Expression<double>::compileSystem(fused);
+                timer.reset();
+            }
+        }
+        rk::VectorExpression<double> vector;
+        {
+            std::vector<std::string> equations;
+            for (size_t i = 0; i < count; ++i)
+                equations.push_back("sin(" + vars[(i + 1) % count + 1] + ") - " + vars[i + 1] + " + 0.1 * x");
+            vector.parse(equations, vars);
+        }
+        double sink = 0;
+        {
+            tests_rk::OverkillTimer<50, millisec> timer("Interpreted vector expression RK4SystemSolve 10.000 Steps");
+            for (size_t i = 0; i < n; ++i) {
+                sink += rk::RK4SystemSolve<double>(vector, init, 10, 0.001)[1];
+                timer.reset();
+            }
+        }
+        for (auto system: {&separate, &fused}) {
+            tests_rk::OverkillTimer<50, millisec> timer(std::string(system == &separate ? "Separate" : "Fused")
+                                                        + " RK4SystemSolve 10.000 Steps");
+            for (size_t i = 0; i < n; ++i) {
+                sink += rk::RK4SystemSolve<double>(*system, init, 10, 0.001)[1];
+                timer.reset();
+            }
+        }
+        if (std::isnan(sink))
+            std::cout << "(nan checksum)\n";
+    }
+
+    // Heap allocations per evaluation and the time of 1.000.000 evaluations on every thread at once
+    void runAllocationBenchmark(const std::string& func, size_t n) {
+        rk::Expression<double> expr;
+        expr.parse(func, {"x", "y"});
+        std::vector<double> point = {0.5, 2}, scratch(expr.scratchSize());
+        double sink = 0;
+        tests_rk::CountAllocations counting;
+        size_t before = tests_rk::allocations;
+        for (int j = 0; j < 1000; ++j)
+            sink += expr.interpret(point);
+        size_t interpreted = tests_rk::allocations - before;
+        before = tests_rk::allocations;
+        for (int j = 0; j < 1000; ++j)
+            sink += expr.evaluate(point.data(), scratch.data());
+        std::cout << "Allocations per evaluation of [" << func << "]: token interpreter " << interpreted / 1000.0
+                  << ", bytecode VM with scratch buffer " << (tests_rk::allocations - before) / 1000.0 << "\n";
+        const size_t threads = std::max(1u, std::thread::hardware_concurrency());
+        tests_rk::OverkillTimer<50, millisec> timer("Bytecode VM 1.000.000 Points on each of " + std::to_string(threads) + " threads");
+        for (size_t i = 0; i < n; ++i) {
+            std::vector<std::thread> workers;
+            std::vector<double> sums(threads);
+            for (size_t t = 0; t < threads; ++t) {
+                workers.emplace_back([&expr, &sums, t]() {
+                    std::vector<double> vars = {0.5, 2}, buffer(expr.scratchSize());
+                    for (int j = 0; j < 1000000; ++j) {
+                        vars[0] += 1e-9;
+                        sums[t] += expr.evaluate(vars.data(), buffer.data());
+                    }
+                });
+            }
+            for (auto &w: workers)
+                w.join();
+            for (auto s: sums)
+                sink += s;
+            timer.reset();
+        }
+        if (std::isnan(sink))
+            std::cout << "(nan checksum)\n";
+    }
+
+    // Generated system equations over x, y0 ... y49
+    std::vector<std::string> equationCorpus(size_t count, std::vector<std::string>& vars) {
+        vars = {"x"};
+        for (size_t i = 0; i < 50; ++i)
+            vars.push_back("y" + std::to_string(i));
+        std::mt19937 rng(7);
+        auto var = [&]() { return vars[rng() % vars.size()]; };
+        auto number = [&]() { return std::to_string((rng() % 10000) / 1000.0); };
+        std::vector<std::string> corpus;
+        for (size_t e = 0; e < count; ++e) {
+            std::string s = "0.5 * x";
+            for (int t = 0; t < 8; ++t) {
+                switch (rng() % 4) {
+                    case 0: s += " + " + number() + " * " + var(); break;
+                    case 1: s += " - sin(" + var() + ") * " + var(); break;
+                    case 2: s += " + pow(" + var() + ", 2) / (" + number() + " + " + var() + ")"; break;
+                    default: s += " - cos(" + number() + " * " + var() + ")"; break;
+                }
+            }
+            corpus.push_back(std::move(s));
+        }
+        return corpus;
+    }
+
+    // Parses the generated corpus and prints the throughput
+    void runParseBenchmark(size_t count, size_t n) {
+        std::vector<std::string> vars;
+        auto corpus = equationCorpus(count, vars);
+        size_t chars = 0;
+        for (auto &s: corpus)
+            chars += s.size();
+        // Uncached, then through a parse cache holding the whole corpus, filled by the first round
+        for (bool cached: {false, true}) {
+            if (cached)
+                rk::Expression<double>::enableParseCache(count);
+            double best = 0;
+            for (size_t i = 0; i < n; ++i) {
+                std::vector<rk::Expression<double>> exprs(count);
+                auto start = std::chrono::steady_clock::now();
+                for (size_t e = 0; e < count; ++e)
+                    exprs[e].parse(corpus[e], vars);
+                std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+                best = std::max(best, count / time.count());
+            }
+            std::cout << (cached ? "Cached parse of " : "Parse of ") << count << " expressions ("
+                      << chars / count << " characters each): " << (size_t) best << " expressions/sec\n";
+        }
+        rk::Expression<double>::disableParseCache();
+    }
+
+    // Loading a saved model of count equations against parsing and linking it
+    void runLoadBenchmark(size_t count, size_t n) {
+        std::vector<std::string> vars;
+        auto corpus = equationCorpus(count, vars);
+        std::vector<std::shared_ptr<rk::Expression<double>>> system;
+        {
+            tests_rk::OverkillTimer<50, millisec> timer("Parse and link of " + std::to_string(count) + " equations");
+            for (size_t i = 0; i < n; ++i) {
+                system.clear();
+                for (auto &s: corpus) {
+                    system.push_back(std::make_shared<rk::Expression<double>>());
+                    system.back()->parse(s, vars);
+                }
+                rk::Expression<double>::linkSystem(system);
+                timer.reset();
+            }
+        }
+        std::stringstream saved;
+        rk::Expression<double>::saveSystem(saved, system);
+        std::cout << "Saved model of " << count << " equations: " << saved.str().size() / 1024 << " KiB\n";
+        tests_rk::OverkillTimer<50, millisec> timer("Load of " + std::to_string(count) + " linked equations");
+        for (size_t i = 0; i < n; ++i) {
+            saved.clear();
+            saved.seekg(0);
+            rk::Expression<double>::loadSystem(saved);
+            timer.reset();
+        }
+    }
+
+    // sin over one array through every kernel set this CPU supports, and a batch of a trigonometric expression
+    void runVectorMathBenchmark(size_t size, size_t n) {
+        std::vector<double> xs(size), ys(size), res(size);
+        for (size_t i = 0; i < size; ++i) {
+            xs[i] = -20 + 40 * double(i) / double(size);
+            ys[i] = 1 + double(i % 7);
+        }
+        for (auto target: {"scalar", "sse2", "vector", "avx2", "avx512"}) {
+            const rk::VectorKernels<double>* k = rk::vectorKernels<double>(target);
+            if (k == nullptr)
+                continue;
+            double best = 0;
+            for (size_t i = 0; i < n; ++i) {
+                auto start = std::chrono::steady_clock::now();
+                k->sin(xs.data(), res.data(), size);
+                std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+                best = std::max(best, size / time.count());
+            }
+            std::cout << "Vector sin [" << target << "]: " << (size_t) (best / 1e6) << " M values/sec\n";
+        }
+        rk::Expression<double> expr;
+        expr.parse("sin(x) * cos(y) + pow(cos(x), 2) * y", {"x", "y"});
+        double best = 0;
+        for (size_t i = 0; i < n; ++i) {
+            auto start = std::chrono::steady_clock::now();
+            expr.evaluateBatch({xs.data(), ys.data()}, res.data(), size);
+            std::chrono::duration<double> time = std::chrono::steady_clock::now() - start;
+            best = std::max(best, size / time.count());
+        }
+        std::cout << "Batch of sin(x) * cos(y) + pow(cos(x), 2) * y: " << (size_t) (best / 1e6) << " M points/sec\n";
+    }
+
+    // Short solver runs, where copying the expression into the solver used to dominate
+    void runShortSolveBenchmark(const std::string& func, size_t n) {
+        rk::Expression<double> expr;
+        expr.parse(func, {"x", "y"});
+        expr.compile(rk::ExternalCompiler);
+        double sink = 0;
+        {
+            tests_rk::OverkillTimer<50, millisec> timer("1.000.000 Copies of [" + func + "]");
+            for (size_t i = 0; i < n; ++i) {
+                for (int j = 0; j < 1000000; ++j) {
+                    rk::Expression<double> copy(expr);
+                    sink += copy.isNative();
+                }
+                timer.reset();
+            }
+        }
+        tests_rk::OverkillTimer<50, millisec> timer("100.000 RK3Solve of 10 Steps");
+        for (size_t i = 0; i < n; ++i) {
+            for (int j = 0; j < 100000; ++j)
+                sink += rk::RK3Solve<double>(expr, {5, 0.944846841517}, 5.01, 0.001)[1];
+            timer.reset();
+        }
+        if (std::isnan(sink))
+            std::cout << "(nan checksum)\n";
+    }
+
+    // Evaluations of modules loaded with and without a resident limit, the limited ones run under a lease
+    void runRegistryBenchmark(const std::string& func, size_t n) {
+        double sink = 0;
+        for (size_t limit: {0, 64}) {
+            rk::ModuleRegistry::setMaxResident(limit);
+            rk::Expression<double> expr;
+            expr.parse(func, {"x", "y"});
+            expr.compile(rk::ExternalCompiler);
+            std::vector<double> vars = {0.5, 2};
+            tests_rk::OverkillTimer<50, millisec> timer(std::string(limit == 0 ? "Unlimited" : "Evictable")
+                                                        + " module 1.000.000 Points");
+            for (size_t i = 0; i < n; ++i) {
+                for (int j = 0; j < 1000000; ++j) {
+                    vars[0] += 1e-9;
+                    sink += expr.evaluate(vars);
+                }
+                timer.reset();
+            }
+        }
+        rk::ModuleRegistry::setMaxResident(0);
+        if (std::isnan(sink))
+            std::cout << "(nan checksum)\n";
+    }
+
+    // Default build against the variant auto-tuning picks on the same points
+    void runAutoTuneBenchmark(const std::string& func, size_t n) {
+        std::vector<std::vector<double>> samples;
+        for (int i = 1; i <= 256; ++i)
+            samples.push_back({0.01 * i, 2.0 - 0.005 * i});
+        rk::Expression<double> strict, tuned;
+        strict.parse(func, {"x", "y"});
+        strict.compile(rk::ExternalCompiler);
+        tuned.parse(func, {"x", "y"});
+        {
+            tests_rk::OverkillTimer<50, millisec> timer("Auto-tuning over " + std::to_string(rk::CompileOptions::candidates().size())
+                                                        + " variants");
+            tuned.autoTune(samples);
+        }
+        std::cout << "Auto-tuning picked [" << tuned.compileOptions().flags() << "]\n";
+        double sink = 0;
+        for (auto expr: {&strict, &tuned}) {
+            tests_rk::OverkillTimer<50, millisec> timer(std::string(expr == &strict ? "Default" : "Tuned")
+                                                        + " build 1.000.000 Points");
+            for (size_t i = 0; i < n; ++i) {
+                for (int j = 0; j < 1000000; ++j)
+                    sink += expr->evaluate(samples[j & 255u]);
+                timer.reset();
+            }
+        }
+        if (std::isnan(sink))
+            std::cout << "(nan checksum)\n";
+    }
+
+    // A generated family of equations repeating one subtree, evaluated unlinked: each on its own program
+    // against one pass over the shared nodes, which computes the common subtree once per point
+    void runSharedNodesBenchmark(size_t count, size_t n) {
+        auto plain = tests_rk::equation_family<double>(count);
+        rk::NodeStore<double>::enable();
+        auto shared = tests_rk::equation_family<double>(count);
+        rk::NodeStore<double>::disable();
+        size_t plainBytes = 0, sharedBytes = 0;
+        for (size_t i = 0; i < count; ++i) {
+            plainBytes += plain[i]->memoryUsage().total();
+            sharedBytes += shared[i]->memoryUsage().total();
+        }
+        std::cout << count << " equations take [" << plainBytes << "] bytes, shared [" << sharedBytes << "] bytes\n";
+        double sink = 0;
+        std::vector<double> out(count), vars = {0, 0.5, 2};
+        for (auto system: {&plain, &shared}) {
+            tests_rk::OverkillTimer<50, millisec> timer(std::string(system == &plain ? "Separate" : "Shared")
+                                                        + " " + std::to_string(count) + " equations 10.000 Points");
+            for (size_t i = 0; i < n; ++i) {
+                for (int j = 0; j < 10000; ++j) {
+                    vars[1] += 1e-9;
+                    rk::Expression<double>::evaluateSystem(*system, nullptr, vars, out.data());
+                    sink += out[j % count];
+                }
+                timer.reset();
+            }
+        }
+        if (std::isnan(sink))
+            std::cout << "(nan checksum)\n";
+    }
+
+    // Evaluation with profiling off and on, one call in every sampling period is timed
+    void runProfilingBenchmark(const std::string& expression, size_t n, const std::vector<double>& vars) {
+        double sink = 0;
+        for (bool profiled: {false, true}) {
+            rk::Expression<double> expr;
+            expr.parse(expression, {"x", "y"});
+            if (profiled)
+                expr.enableProfiling();
+            std::vector<double> point = vars;
+            tests_rk::OverkillTimer<50, millisec> timer(std::string(profiled ? "Profiled" : "Unprofiled")
+                                                        + " evaluate 1.000.000 Points");
+            for (size_t i = 0; i < n; ++i) {
+                for (int j = 0; j < 1000000; ++j) {
+                    point[0] += 1e-9;
+                    sink += expr.evaluate(point);
+                }
+                timer.reset();
+            }
+            if (profiled)
+                std::cout << expr.profile() << "\n";
+        }
+        if (std::isnan(sink))
+            std::cout << "(nan checksum)\n";
+    }
+
+    // Lookups of a solver marching through tabulated forcing, O(1) on the uniform grid and by the cursor on the other
+    void runTableBenchmark(size_t samples, size_t n) {
+        std::vector<double> uniform, skewed, values;
+        for (size_t i = 0; i < samples; ++i) {
+            const double s = (double) i / (double) (samples - 1);
+            uniform.push_back(s);
+            skewed.push_back(s * s);
+            values.push_back(sin(3 * s));
+        }
+        rk::Expression<double>::addTable("benchuniform", std::make_shared<const rk::Table<double>>(
+                uniform, values, rk::CubicInterpolation));
+        rk::Expression<double>::addTable("benchskewed", std::make_shared<const rk::Table<double>>(
+                skewed, values, rk::CubicInterpolation));
+        double sink = 0;
+        for (std::string table: {"benchuniform", "benchskewed"}) {
+            for (bool compiled: {false, true}) {
+                rk::Expression<double> expr;
+                expr.parse(table + "(x) * y", {"x", "y"});
+                if (compiled)
+                    expr.compile(rk::ExternalCompiler);
+                tests_rk::OverkillTimer<50, millisec> timer(table + (compiled ? " compiled" : " interpreted")
+                                                            + " 1.000.000 Points");
+                std::vector<double> point = {0, 2};
+                for (size_t i = 0; i < n; ++i) {
+                    for (int j = 0; j < 1000000; ++j) {
+                        point[0] = j * 1e-6;
+                        sink += expr.evaluate(point);
+                    }
+                    timer.reset();
+                }
+            }
+        }
+        if (std::isnan(sink))
+            std::cout << "(nan checksum)\n";
+    }
+
+    // Every strength reduction against the same operation left to libm or the divider: the exponent passed as
+    // a variable can not be reduced, division by a non power of two is only rewritten on request
+    void runStrengthReductionBenchmark(size_t n) {
+        const std::vector<std::pair<std::string, double>> powers = {{"2", 2}, {"3", 3}, {"-2", -2}, {"0.5", 0.5}, {"2.5", 2.5}};
+        double sink = 0;
+        auto time = [&sink, n](rk::Expression<double>& expr, const std::string& name, double y) {
+            tests_rk::OverkillTimer<50, millisec> timer(name + " 1.000.000 Points");
+            std::vector<double> point = {1.5, y};
+            for (size_t i = 0; i < n; ++i) {
+                for (int j = 0; j < 1000000; ++j) {
+                    point[0] += 1e-9;
+                    sink += expr.evaluate(point);
+                }
+                timer.reset();
+            }
+        };
+        for (auto &p: powers) {
+            rk::Expression<double> reduced, libm;
+            reduced.parse("pow(x, " + p.first + ")", {"x", "y"});
+            libm.parse("pow(x, y)", {"x", "y"});
+            time(reduced, "pow(x, " + p.first + ") reduced", p.second);
+            time(libm, "pow(x, " + p.first + ") by libm", p.second);
+        }
+        rk::Expression<double> divided, exact, reciprocal;
+        divided.parse("x / y", {"x", "y"});
+        exact.parse("x / 4", {"x", "y"});
+        reciprocal.setReciprocalDivision(true);
+        reciprocal.parse("x / 3", {"x", "y"});
+        time(divided, "x / y", 3);
+        time(exact, "x / 4 reduced", 4);
+        time(reciprocal, "x / 3 with reciprocal division", 3);
+        if (std::isnan(sink))
+            std::cout << "(nan checksum)\n";
+    }
+
     void Benchmark() {
         int n = 6;
+        runParseBenchmark(20000, n);
+        runLoadBenchmark(10000, n);
+        runVectorMathBenchmark(1u << 20u, n);
+        runStrengthReductionBenchmark(n);
+        runShortSolveBenchmark("y * ((sin(x)) / x + (cos(x)) / (x * x))", n);
+        runAllocationBenchmark("y * ((sin(x)) / x + (cos(x)) / (x * x))", n);
+        runRegistryBenchmark("y * ((sin(x)) / x + (cos(x)) / (x * x))", n);
+        runAutoTuneBenchmark("y * ((sin(x)) / x + (cos(x)) / (x * x)) + pow(x, 3) * y - x * y / 7", n);
+        runSharedNodesBenchmark(100, n);
+        runProfilingBenchmark("y * ((sin(x)) / x + (cos(x)) / (x * x))", n, {5, 0.944846841517});
+        runTableBenchmark(10000, n);
+        runSystemBenchmark(20, n);
+        runCompileBenchmark(rk::JitCompiler, 20, "JIT compile");
+        runCompileBenchmark(rk::ExternalCompiler, 20, "External compile");
+        runEvaluateBenchmark("y * ((sin(x)) / x + (cos(x)) / (x * x))", n, {5, 0.944846841517});
+        runEvaluateBenchmark("2 * y + ( 1 - (2 * sin(0.5 * x) * sin(0.5 * x)) ) * y * (1.0 / sin(x))", n, {0.5, 2.3});
+        runEvaluateBenchmark("cos(x) * y", n, {-0.5, 0.619138961097731});
+
         rk::Expression<double> p;
         p.parse("y * ((sin(x)) / x + (cos(x)) / (x * x))", {"x", "y"});
         p.compile();
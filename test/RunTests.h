@@ -14,6 +14,31 @@
 #include "tests/2.cpp"
 #include "tests/3.cpp"
 #include "tests/4.cpp"
+#include "tests/5.cpp"
+#include "tests/6.cpp"
+#include "tests/7.cpp"
+#include "tests/8.cpp"
+#include "tests/9.cpp"
+#include "tests/10.cpp"
+#include "tests/11.cpp"
+#include "tests/12.cpp"
+#include "tests/13.cpp"
+#include "tests/14.cpp"
+#include "tests/15.cpp"
+#include "tests/16.cpp"
+#include "tests/17.cpp"
+#include "tests/18.cpp"
+#include "tests/19.cpp"
+#include "tests/20.cpp"
+#include "tests/21.cpp"
+#include "tests/22.cpp"
+#include "tests/23.cpp"
+#include "tests/24.cpp"
+#include "tests/25.cpp"
+#include "tests/26.cpp"
+#include "tests/27.cpp"
+#include "tests/28.cpp"
+#include "tests/29.cpp"
 #include "tests/SolverTest1.cpp"
 
 namespace tests_rk {
@@ -121,5 +146,130 @@ namespace tests_rk {
             ASRK_test_1(rk::ASRKFehlbergSolve<long double>, 0.01, out, logOut);
         logOut.close();
 
+        logOut.open("../test/tests/logs/VM.log");
+        if (logOut.is_open())
+            vm_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/Batch.log");
+        if (logOut.is_open())
+            batch_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/JIT.log");
+        if (logOut.is_open())
+            jit_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/ModuleCache.log");
+        if (logOut.is_open())
+            cache_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/Tiering.log");
+        if (logOut.is_open())
+            tiering_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/SystemCompile.log");
+        if (logOut.is_open())
+            system_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/Simplify.log");
+        if (logOut.is_open())
+            simplify_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/CSE.log");
+        if (logOut.is_open())
+            cse_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/Derivative.log");
+        if (logOut.is_open())
+            derivative_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/Dual.log");
+        if (logOut.is_open())
+            dual_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/Concurrency.log");
+        if (logOut.is_open())
+            concurrency_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/Lexer.log");
+        if (logOut.is_open())
+            lexer_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/Serialization.log");
+        if (logOut.is_open())
+            serialization_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/VectorMath.log");
+        if (logOut.is_open())
+            vector_math_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/StrengthReduction.log");
+        if (logOut.is_open())
+            strength_reduction_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/Parameters.log");
+        if (logOut.is_open())
+            parameters_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/VectorExpression.log");
+        if (logOut.is_open())
+            vector_expression_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/SharedProgram.log");
+        if (logOut.is_open())
+            shared_program_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/ModuleRegistry.log");
+        if (logOut.is_open())
+            module_registry_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/InMemoryCompile.log");
+        if (logOut.is_open())
+            in_memory_compile_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/CompileOptions.log");
+        if (logOut.is_open())
+            compile_options_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/SharedNodes.log");
+        if (logOut.is_open())
+            shared_nodes_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/Profiling.log");
+        if (logOut.is_open())
+            profiling_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/ParseCache.log");
+        if (logOut.is_open())
+            parse_cache_test_1(out, logOut);
+        logOut.close();
+
+        logOut.open("../test/tests/logs/Table.log");
+        if (logOut.is_open())
+            table_test_1(out, logOut);
+        logOut.close();
+
     }
 }
\ No newline at end of file
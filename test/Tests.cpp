@@ -110,6 +110,17 @@ namespace tests_rk {
         }
     }
 
+    template<typename ValueType>
+    std::vector<std::shared_ptr<rk::Expression<ValueType>>> equation_family(size_t count) {
+        std::vector<std::shared_ptr<rk::Expression<ValueType>>> equations;
+        for (size_t i = 0; i < count; ++i) {
+            equations.push_back(std::make_shared<rk::Expression<ValueType>>());
+            equations.back()->parse("sin(x * y + 3) * cos(x - y) / (1 + x * x) + sqrt(y * y + 2) - "
+                                    + std::to_string(i + 1) + " * x", {"t", "x", "y"});
+        }
+        return equations;
+    }
+
     template<typename ValueType>
     template<class Container>
     int BasicTest<ValueType>::loadInputFile(const std::string& fileName, Container& data, bool readFlag) {
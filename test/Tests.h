@@ -3,6 +3,7 @@
 #include <chrono>
 #include <stdexcept>
 #include "../src/expression/Expression.h"
+#include "Allocations.h"
 
 namespace tests_rk {
     
@@ -53,6 +54,10 @@ namespace tests_rk {
 
     template<typename ValueType>
     const void * get_conv_func();
+
+    // Equations over t, x, y which all repeat one large subtree and add three nodes of their own
+    template<typename ValueType>
+    std::vector<std::shared_ptr<rk::Expression<ValueType>>> equation_family(size_t count);
     
     template<typename ValueType>
     class BasicTest {
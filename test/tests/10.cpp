@@ -0,0 +1,104 @@
+#include <iostream>
+#include <cmath>
+#include <filesystem>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+template<typename ValueType>
+static std::vector<std::shared_ptr<rk::Expression<ValueType>>> system_make(const std::vector<std::string>& funcs) {
+    auto conv = (std::pair<ValueType, bool> (*)(const std::string&))tests_rk::get_conv_func<ValueType>();
+    std::vector<std::shared_ptr<rk::Expression<ValueType>>> system;
+    for (auto &f: funcs) {
+        system.push_back(std::make_shared<rk::Expression<ValueType>>());
+        system.back()->parse(f, {"x", "y", "z", "w"}, conv);
+    }
+    return system;
+}
+
+template<typename ValueType>
+static size_t system_check(const std::vector<std::string>& funcs, ValueType delta, std::ostream& logFile) {
+    size_t errCount = 0;
+    auto fused = system_make<ValueType>(funcs), reference = system_make<ValueType>(funcs);
+    if (!rk::Expression<ValueType>::compileSystem(fused) || rk::Expression<ValueType>::linkedSystem(fused) == nullptr
+        || rk::Expression<ValueType>::linkedSystem(fused)->rhs == nullptr) {
+        logFile << "Unable to compile system of [" << funcs.size() << "] equations\n";
+        return 1;
+    }
+    std::vector<ValueType> p = {ValueType(0.3), ValueType(1.1), ValueType(-0.4), ValueType(2)};
+    std::vector<ValueType> out(funcs.size());
+    rk::Expression<ValueType>::evaluateSystem(fused, rk::Expression<ValueType>::linkedSystem(fused), p, out.data());
+    for (size_t i = 0; i < funcs.size(); ++i) {
+        ValueType expected = reference[i]->evaluate(p);
+        if (fabs(out[i] - expected) > delta || fabs(fused[i]->evaluate(p) - expected) > delta) {
+            logFile << "Equation [" << funcs[i] << "] of the fused system gives [" << out[i] << "], expected [" << expected << "]\n";
+            ++errCount;
+        }
+    }
+    std::vector<ValueType> init = {0, 1, ValueType(0.5), ValueType(-0.5)};
+    auto got = rk::RK4SystemSolve<ValueType>(fused, init, 1, ValueType(0.01));
+    auto expected = rk::RK4SystemSolve<ValueType>(reference, init, 1, ValueType(0.01));
+    auto gotAdaptive = rk::ASRKCashCarpSystemSolve<ValueType>(fused, init, 1, ValueType(0.001));
+    auto expectedAdaptive = rk::ASRKCashCarpSystemSolve<ValueType>(reference, init, 1, ValueType(0.001));
+    for (size_t i = 0; i < init.size(); ++i) {
+        if (fabs(got[i] - expected[i]) > delta * 100 || fabs(gotAdaptive[i] - expectedAdaptive[i]) > delta * 100) {
+            logFile << "Fused system solution [" << i << "] is [" << got[i] << "], expected [" << expected[i] << "]\n";
+            ++errCount;
+        }
+    }
+    return errCount;
+}
+
+int system_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running system compile test 1\n";
+    size_t errCount = 0;
+    {   /*  FUSED SYSTEM MODULE */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning system compile tests...\n";
+        const std::string dir = "./rk-system-cache-test";
+        std::filesystem::remove_all(dir);
+        rk::ModuleCache::setDirectory(dir);
+
+        std::vector<std::string> funcs = {"z", "-y + 0.1 * sin(x)", "pow(w, 2) * cos(y) - z"};
+        tmpErrCount += system_check<double>(funcs, 1e-12, logFile);
+        tmpErrCount += system_check<float>(funcs, 1e-5, logFile);
+        tmpErrCount += system_check<long double>(funcs, 1e-15, logFile);
+        size_t modules = 0;
+        for (auto &f: std::filesystem::directory_iterator(dir))
+            modules += f.path().extension() == ".so";
+        if (modules != 3) {
+            logFile << "Three systems produced [" << modules << "] modules\n";
+            ++tmpErrCount;
+        }
+        {
+            // Equations reordered or taken separately are not the compiled system any more
+            auto system = system_make<double>(funcs);
+            rk::Expression<double>::compileSystem(system);
+            std::vector<std::shared_ptr<rk::Expression<double>>> reordered = {system[1], system[0], system[2]};
+            std::vector<std::shared_ptr<rk::Expression<double>>> part = {system[0], system[1]};
+            if (rk::Expression<double>::linkedSystem(reordered) != nullptr || rk::Expression<double>::linkedSystem(part) != nullptr) {
+                logFile << "Fused function used for a different system\n";
+                ++tmpErrCount;
+            }
+            // Copies keep the module alive after the system is recompiled
+            rk::Expression<double> copy(*system[2]);
+            system[2]->parse("1", {});
+            std::vector<std::shared_ptr<rk::Expression<double>>> single = {std::make_shared<rk::Expression<double>>(copy)};
+            system.clear();
+            if (fabs(single[0]->evaluate({0.3, 1.1, -0.4, 2}) - (4 * cos(1.1) + 0.4)) > 1e-12) {
+                logFile << "Copy of a system equation gives [" << single[0]->evaluate({0.3, 1.1, -0.4, 2}) << "]\n";
+                ++tmpErrCount;
+            }
+        }
+        rk::ModuleCache::disable();
+        std::filesystem::remove_all(dir);
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running system compile tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running system compile test 1\n";
+    return errCount;
+}
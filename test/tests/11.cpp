@@ -0,0 +1,81 @@
+#include <iostream>
+#include <cmath>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+template<typename Value>
+class SimplifyTestAddToken: public FunctionToken<Value> {
+public:
+    void evaluate(std::stack<Value>& s, const std::vector<Value>& vars) const override {
+        Value a = s.top();
+        s.pop();
+        Value b = s.top();
+        s.pop();
+        s.push(a + b);
+    }
+    [[nodiscard]] std::string cname() const override { return "simplifyadd"; }
+};
+
+int simplify_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running simplification test 1\n";
+    size_t errCount = 0;
+    {   /*  CONSTANT FOLDING AND IDENTITIES */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning simplification tests...\n";
+        // Expression and the number of instructions simplification has to remove from it
+        const std::vector<std::pair<std::string, size_t>> funcs = {
+            {"x * 1", 2},
+            {"1 * x + 0", 4},
+            {"--x", 2},
+            {"x / -1", 2},
+            {"2 * 3 + x", 2},
+            {"pow(2, 0.5) * x", 2},
+            {"pow(x, 1) - 0", 4},
+            {"x - -y", 1},
+            {"-x * -y + -x", 3},
+            {"y * (1.0 / sin(x))", 2},
+            {"sin(1 - 1) * x", 3},
+            {"2 * y + ( 1 - (2 * sin(0.5 * x) * sin(0.5 * x)) ) * y * (1.0 / sin(x))", 2},
+            {"y * ((sin(x)) / x + (cos(x)) / (x * x))", 0},
+        };
+        const std::vector<std::vector<double>> points = {{0.5, 1}, {1, -2}, {-1.5, 0.25}, {3, 7}};
+        for (auto &f: funcs) {
+            rk::Expression<double> e, jitted;
+            e.parse(f.first, {"x", "y"});
+            jitted.parse(f.first, {"x", "y"});
+            jitted.compile();
+            if (e.removedOperations() != f.second) {
+                logFile << "Simplification removed [" << e.removedOperations() << "] operations from [" << f.first
+                        << "], expected [" << f.second << "]\n";
+                ++tmpErrCount;
+            }
+            for (auto &p: points) {
+                double got = e.evaluate(p), expected = e.interpret(p);
+                if (fabs(got - expected) > 1e-15 * (1 + fabs(expected)) || jitted.evaluate(p) != got) {
+                    logFile << "Simplified [" << f.first << "] at (" << p[0] << ", " << p[1] << ") gives [" << got
+                            << "], expected [" << expected << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+        }
+        {
+            // Custom functions are never folded, even with constant arguments
+            rk::Expression<double>::addFunctionToken("simplifyadd", std::make_shared<SimplifyTestAddToken<double>>());
+            rk::Expression<double> e;
+            e.parse("simplifyadd(1, 2) * x", {"x"});
+            if (e.removedOperations() != 0 || e.evaluate({2}) != 6) {
+                logFile << "Custom function call was folded\n";
+                ++tmpErrCount;
+            }
+        }
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running simplification tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running simplification test 1\n";
+    return errCount;
+}
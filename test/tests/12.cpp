@@ -0,0 +1,139 @@
+#include <iostream>
+#include <cmath>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+static std::vector<std::shared_ptr<rk::Expression<double>>> cse_system(const std::vector<std::string>& funcs) {
+    std::vector<std::shared_ptr<rk::Expression<double>>> system;
+    for (auto &f: funcs) {
+        system.push_back(std::make_shared<rk::Expression<double>>());
+        system.back()->parse(f, {"x", "y", "z"});
+    }
+    return system;
+}
+
+int cse_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running common subexpression test 1\n";
+    size_t errCount = 0;
+    {   /*  COMMON SUBEXPRESSIONS AND SINCOS */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning common subexpression tests...\n";
+        // Expression and the transcendental calls left in one evaluation
+        std::vector<std::pair<std::string, size_t>> funcs = {
+            {"2 * y + ( 1 - (2 * sin(0.5 * x) * sin(0.5 * x)) ) * y * (1.0 / sin(x))", 2},
+            {"sin(x) * cos(x) + sin(x)", 1},
+            {"pow(x, 2) + pow(x, 2) * y", 0},
+            {"(x + y) * (x + y) - cos(x + y)", 1},
+            {"sin(x) * sin(y) + cos(x) * cos(y)", 2},
+            {"y * ((sin(x)) / x + (cos(x)) / (x * x))", 1},
+        };
+        // More shared values than fit into the on-stack frame
+        std::string wide = "0";
+        for (int i = 0; i < 40; ++i)
+            wide += " + sin(x + " + std::to_string(i) + ") * sin(x + " + std::to_string(i) + ")";
+        funcs.emplace_back(wide, 40);
+        const std::vector<std::vector<double>> points = {{0.5, 1}, {1, -2}, {-1.5, 0.25}, {3, 7}};
+        for (auto &f: funcs) {
+            rk::Expression<double> e, jitted;
+            e.parse(f.first, {"x", "y"});
+            jitted.parse(f.first, {"x", "y"});
+            jitted.compile();
+            if (e.evaluationCounts().transcendental != f.second) {
+                logFile << "[" << f.first << "] evaluates with " << e.evaluationCounts() << ", expected ["
+                        << f.second << "] transcendental calls\n";
+                ++tmpErrCount;
+            }
+            std::vector<double> xs, ys, batch(points.size());
+            for (auto &p: points) {
+                xs.push_back(p[0]);
+                ys.push_back(p[1]);
+                double got = e.evaluate(p), expected = e.interpret(p);
+                if (fabs(got - expected) > 1e-14 * (1 + fabs(expected)) || jitted.evaluate(p) != got) {
+                    logFile << "[" << f.first << "] at (" << p[0] << ", " << p[1] << ") gives [" << got
+                            << "], JIT gives [" << jitted.evaluate(p) << "], expected [" << expected << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+            e.evaluateBatch({xs.data(), ys.data()}, batch.data(), batch.size());
+            for (size_t i = 0; i < points.size(); ++i) {
+                if (fabs(batch[i] - e.evaluate(points[i])) > 1e-13 * (1 + fabs(e.evaluate(points[i])))) {
+                    logFile << "Batch result for [" << f.first << "] at point [" << i << "] is [" << batch[i] << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+        }
+        {
+            // Passes run again over an optimized program keep its frame, registers are not stacked up
+            auto x = std::make_shared<VariableToken<double>>(0);
+            auto sine = std::make_shared<SinToken<double>>();
+            // sin(x) * sin(x) + sin(x)
+            rk::Program<double> program;
+            program.lower({x, sine, x, sine, std::make_shared<MulToken<double>>(), x, sine,
+                           std::make_shared<SumToken<double>>()}, {1, 1, 1}, 1);
+            rk::simplify(program);
+            rk::eliminateCommonSubexpressions(program);
+            const size_t frame = program.frameSize(), registers = program.registers;
+            rk::eliminateCommonSubexpressions(program);
+            rk::simplify(program);
+            rk::eliminateCommonSubexpressions(program);
+            const double at = 0.5;
+            if (program.frameSize() != frame || program.registers != registers || program.outputs != 1
+                || fabs(program.run(&at) - (sin(at) * sin(at) + sin(at))) > 1e-15) {
+                logFile << "Frame of [" << frame << "] values with [" << registers << "] registers grew to ["
+                        << program.frameSize() << "] and [" << program.registers << "] over repeated passes\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // Terms shared between equations are computed once for the whole system
+            const std::vector<std::string> eqs = {"sin(x) * y", "cos(x) * z - y", "sin(x) + cos(x) * y", "pow(y, 2) - sin(x)"};
+            auto reference = cse_system(eqs), linked = cse_system(eqs), compiled = cse_system(eqs);
+            auto before = rk::Expression<double>::evaluationCounts(reference);
+            if (!rk::Expression<double>::linkSystem(linked) || !rk::Expression<double>::compileSystem(compiled)) {
+                logFile << "Unable to link the system\n";
+                ++tmpErrCount;
+            }
+            auto after = rk::Expression<double>::evaluationCounts(linked);
+            logFile << "System before linking: " << before << "\nSystem after linking: " << after << "\n";
+            if (before.transcendental != 4 || after.transcendental != 1) {
+                logFile << "Linked system makes [" << after.transcendental << "] transcendental calls\n";
+                ++tmpErrCount;
+            }
+            std::vector<double> point = {0.7, 1.3, -0.2}, a(eqs.size()), b(eqs.size());
+            rk::Expression<double>::evaluateSystem(linked, rk::Expression<double>::linkedSystem(linked), point, a.data());
+            rk::Expression<double>::evaluateSystem(compiled, rk::Expression<double>::linkedSystem(compiled), point, b.data());
+            for (size_t i = 0; i < eqs.size(); ++i) {
+                double expected = reference[i]->evaluate(point);
+                if (fabs(a[i] - expected) > 1e-14 || fabs(b[i] - expected) > 1e-14) {
+                    logFile << "Linked equation [" << eqs[i] << "] gives [" << a[i] << "] and [" << b[i]
+                            << "], expected [" << expected << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+            std::vector<double> init = {0, 1, 0.5, -0.5, 0.25};
+            auto got = rk::RK4SystemSolve<double>(linked, init, 1, 0.01);
+            auto expected = rk::RK4SystemSolve<double>(reference, init, 1, 0.01);
+            for (size_t i = 0; i < init.size(); ++i) {
+                if (fabs(got[i] - expected[i]) > 1e-12) {
+                    logFile << "Linked system solution [" << i << "] is [" << got[i] << "], expected [" << expected[i] << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+            // Parsing one equation again breaks the link
+            linked[1]->parse("y", {"x", "y", "z"});
+            if (rk::Expression<double>::linkedSystem(linked) != nullptr) {
+                logFile << "System stayed linked after an equation changed\n";
+                ++tmpErrCount;
+            }
+        }
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running common subexpression tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running common subexpression test 1\n";
+    return errCount;
+}
@@ -0,0 +1,109 @@
+#include <iostream>
+#include <cmath>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+// Central difference of e along variable at point
+static double derivative_difference(const rk::Expression<double>& e, std::vector<double> point, size_t variable) {
+    const double h = 1e-6;
+    point[variable] += h;
+    double right = e.evaluate(point);
+    point[variable] -= 2 * h;
+    return (right - e.evaluate(point)) / (2 * h);
+}
+
+int derivative_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running derivative test 1\n";
+    size_t errCount = 0;
+    {   /*  SYMBOLIC DERIVATIVES AND JACOBIAN */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning derivative tests...\n";
+        const std::vector<std::string> funcs = {
+                "sin(x) * y + pow(x, 3) / (y + x) - cos(x * y)",
+                "-6 * (y - 0.683939720586) * pow(sin(x), 5) * cos(x)",
+                "y * ((sin(x)) / x + (cos(x)) / (x * x))",
+                "pow(y, 2) - sin(cos(y))",
+                "x / -y + 3",
+                "7",
+        };
+        const std::vector<std::vector<double>> points = {{0.7, 1.3}, {1.5, -0.4}, {-2, 3}};
+        for (auto &f: funcs) {
+            rk::Expression<double> e;
+            e.parse(f, {"x", "y"});
+            for (size_t v = 0; v < 2; ++v) {
+                auto d = e.derivative(v);
+                auto jitted = e.derivative(v);
+                jitted.compile();
+                for (auto &p: points) {
+                    double expected = derivative_difference(e, p, v), got = d.evaluate(p);
+                    if (fabs(got - expected) > 1e-6 * (1 + fabs(expected)) || fabs(d.interpret(p) - got) > 1e-12
+                        || fabs(jitted.evaluate(p) - got) > 1e-12) {
+                        logFile << "Derivative of [" << f << "] by variable [" << v << "] at (" << p[0] << ", " << p[1]
+                                << ") gives [" << got << "], expected [" << expected << "]\n";
+                        ++tmpErrCount;
+                    }
+                }
+            }
+        }
+        {
+            // Known closed forms, second derivatives and terms not depending on the variable
+            rk::Expression<double> e;
+            e.parse("pow(x, 3) + y * sin(y)", {"x", "y"});
+            auto second = e.derivative(0).derivative(0);
+            if (second.evaluate({2, 5}) != 12 || e.derivative(0).derivative(1).evaluate({2, 5}) != 0) {
+                logFile << "Second derivative of [pow(x, 3) + y * sin(y)] gives [" << second.evaluate({2, 5}) << "]\n";
+                ++tmpErrCount;
+            }
+            if (e.derivative(0).evaluationCounts().transcendental != 0) {
+                logFile << "Derivative of [pow(x, 3) + y * sin(y)] by x evaluates with " << e.derivative(0).evaluationCounts() << "\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // Derivatives which need a logarithm are rejected
+            size_t thrown = 0;
+            rk::Expression<double> e;
+            e.parse("pow(2, x)", {"x"});
+            try { e.derivative(0); } catch (std::logic_error&) { ++thrown; }
+            try { e.derivative(1); } catch (std::logic_error&) { ++thrown; }
+            rk::Expression<double> native;
+            native.setFunction([](const double* v) { return v[0]; });
+            try { native.derivative(0); } catch (std::logic_error&) { ++thrown; }
+            if (thrown != 3) {
+                logFile << "Only [" << thrown << "] of 3 invalid derivatives were rejected\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // Jacobian of a system over the state variables
+            std::vector<std::string> eqs = {"y * z", "-y + 0.1 * sin(x * z)", "pow(w, 2) * cos(y) - z"};
+            std::vector<std::shared_ptr<rk::Expression<double>>> system;
+            for (auto &eq: eqs) {
+                system.push_back(std::make_shared<rk::Expression<double>>());
+                system.back()->parse(eq, {"x", "y", "z", "w"});
+            }
+            auto jacobian = rk::Expression<double>::jacobian(system);
+            std::vector<double> p = {0.3, 1.1, -0.4, 2};
+            for (size_t i = 0; i < eqs.size(); ++i) {
+                for (size_t j = 0; j < eqs.size(); ++j) {
+                    jacobian[i][j]->compile();
+                    double expected = derivative_difference(*system[i], p, j + 1);
+                    if (jacobian.size() != eqs.size() || fabs(jacobian[i][j]->evaluate(p) - expected) > 1e-6) {
+                        logFile << "Jacobian entry [" << i << "][" << j << "] is [" << jacobian[i][j]->evaluate(p)
+                                << "], expected [" << expected << "]\n";
+                        ++tmpErrCount;
+                    }
+                }
+            }
+        }
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running derivative tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running derivative test 1\n";
+    return errCount;
+}
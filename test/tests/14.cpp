@@ -0,0 +1,108 @@
+#include <iostream>
+#include <cmath>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+int dual_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running dual number test 1\n";
+    size_t errCount = 0;
+    {   /*  FORWARD MODE AUTOMATIC DIFFERENTIATION */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning dual number tests...\n";
+        using D = rk::Dual<double>;
+        using D4 = rk::Dual<double, 4>;
+        const std::vector<std::string> funcs = {
+                "sin(x) * y + pow(x, 3) / (y + x) - cos(x * y)",
+                "-6 * (y - 0.683939720586) * pow(sin(x), 5) * cos(x)",
+                "y * ((sin(x)) / x + (cos(x)) / (x * x))",
+                "pow(y, x) - sin(cos(y)) * 2",
+        };
+        for (auto &f: funcs) {
+            rk::Expression<double> reference;
+            rk::Expression<D> dual;
+            rk::Expression<D4> gradient;
+            reference.parse(f, {"x", "y"});
+            dual.parse(f, {"x", "y"}, rk::stringToDual<double>);
+            gradient.parse(f, {"x", "y"}, rk::stringToDual<double, 4>);
+            // Nothing to compile dual numbers to, they keep being interpreted
+            if (dual.compile()) {
+                logFile << "Expression over dual numbers compiled\n";
+                ++tmpErrCount;
+            }
+            const double x = 0.7, y = 1.3, h = 1e-6;
+            // Directional derivative along (1, -2) in one evaluation
+            D got = dual.evaluate({D(x, {1}), D(y, {-2})});
+            double expected = (reference.evaluate({x + h, y - 2 * h}) - reference.evaluate({x - h, y + 2 * h})) / (2 * h);
+            // The token interpreter is not strength reduced, so it agrees with the VM up to rounding
+            D interpreted = dual.interpret({D(x, {1}), D(y, {-2})});
+            if (got.value != reference.evaluate({x, y}) || fabs(got.derivative[0] - expected) > 1e-6 * (1 + fabs(expected))
+                || fabs(interpreted.value - got.value) > 1e-14 * (1 + fabs(got.value))
+                || fabs(interpreted.derivative[0] - got.derivative[0]) > 1e-14 * (1 + fabs(got.derivative[0]))) {
+                logFile << "[" << f << "] gives [" << got << "], interpreted [" << interpreted << "], expected derivative ["
+                        << expected << "]\n";
+                ++tmpErrCount;
+            }
+            // Every partial derivative at once
+            D4 all = gradient.evaluate({D4(x, {1, 0, 0, 0}), D4(y, {0, 1, 0, 0})});
+            const double partials[] = {
+                    (reference.evaluate({x + h, y}) - reference.evaluate({x - h, y})) / (2 * h),
+                    (reference.evaluate({x, y + h}) - reference.evaluate({x, y - h})) / (2 * h)
+            };
+            for (size_t v = 0; v < 2; ++v) {
+                if (fabs(all.derivative[v] - partials[v]) > 1e-6 * (1 + fabs(partials[v])) || all.derivative[2 + v] != 0) {
+                    logFile << "Partial derivative [" << v << "] of [" << f << "] is [" << all.derivative[v]
+                            << "], expected [" << partials[v] << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+            std::vector<D> xs = {D(x, {1}), D(2 * x, {1})}, ys = {D(y), D(y)}, batch(2);
+            dual.evaluateBatch({xs.data(), ys.data()}, batch.data(), 2);
+            for (size_t i = 0; i < batch.size(); ++i) {
+                D single = dual.evaluate({xs[i], ys[i]});
+                if (batch[i].value != single.value || batch[i].derivative != single.derivative) {
+                    logFile << "Batch result [" << i << "] of [" << f << "] is [" << batch[i] << "], expected [" << single << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+        }
+        {
+            // Solvers carry the sensitivity of the solution to the initial value
+            const std::vector<std::string> eqs = {"z", "-y + 0.1 * sin(x)"};
+            std::vector<std::shared_ptr<rk::Expression<double>>> reference;
+            std::vector<std::shared_ptr<rk::Expression<D>>> system;
+            for (auto &eq: eqs) {
+                reference.push_back(std::make_shared<rk::Expression<double>>());
+                reference.back()->parse(eq, {"x", "y", "z"});
+                system.push_back(std::make_shared<rk::Expression<D>>());
+                system.back()->parse(eq, {"x", "y", "z"}, rk::stringToDual<double>);
+            }
+            rk::Expression<D>::linkSystem(system);
+            // Adaptive steps keep long double intermediates only for plain numbers, so values match closely, not exactly.
+            // y'' = -y + 0.1 * sin(x), so dy(x)/dy(0) = cos(x) and dz(x)/dy(0) = -sin(x)
+            const std::vector<double> sensitivity = {cos(2.0), -sin(2.0)};
+            for (bool adaptive: {false, true}) {
+                std::vector<D> init = {D(0), D(1, {1}), D(0)};
+                auto got = adaptive ? rk::ASRKCashCarpSystemSolve<D>(system, init, D(2), D(0.0001))
+                                    : rk::RK4SystemSolve<D>(system, init, D(2), D(0.01));
+                auto plain = adaptive ? rk::ASRKCashCarpSystemSolve<double>(reference, {0, 1, 0}, 2, 0.0001)
+                                      : rk::RK4SystemSolve<double>(reference, {0, 1, 0}, 2, 0.01);
+                for (size_t i = 1; i < got.size(); ++i) {
+                    if (fabs(got[i].value - plain[i]) > 1e-12 || fabs(got[i].derivative[0] - sensitivity[i - 1]) > 1e-3) {
+                        logFile << "Solution [" << i << "] is [" << got[i] << "], expected [" << plain[i] << " ["
+                                << sensitivity[i - 1] << "]]\n";
+                        ++tmpErrCount;
+                    }
+                }
+            }
+        }
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running dual number tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running dual number test 1\n";
+    return errCount;
+}
@@ -0,0 +1,122 @@
+#include <iostream>
+#include <cmath>
+#include <thread>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+// Allocation free function token: overrides apply and keeps evaluate for the token interpreter
+class StressHypotToken: public FunctionToken<double> {
+public:
+    void evaluate(std::stack<double>& s, const std::vector<double>& vars) const override {
+        double b = s.top();
+        s.pop();
+        double a = s.top();
+        s.pop();
+        s.push(std::hypot(a, b));
+    }
+    double apply(const double* args, size_t, const double*, size_t) const override { return std::hypot(args[0], args[1]); }
+    [[nodiscard]] std::string cname() const override { return "hypot"; }
+};
+
+int concurrency_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running concurrent evaluation test 1\n";
+    size_t errCount = 0;
+    {   /*  REENTRANT, ALLOCATION FREE EVALUATE */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning concurrent evaluation tests...\n";
+        rk::Expression<double>::addFunctionToken("stresshypot", std::make_shared<StressHypotToken>());
+        std::string wide = "0";
+        for (int i = 0; i < 40; ++i)
+            wide += " + sin(x + " + std::to_string(i) + ") * sin(x + " + std::to_string(i) + ")";
+        const std::vector<std::string> funcs = {
+                "y * ((sin(x)) / x + (cos(x)) / (x * x))",
+                "stresshypot(x, y) * sin(x) + stresshypot(y, 1)",
+                wide,
+        };
+        // Interpreted, JIT compiled and tiered copies of every expression
+        std::vector<rk::Expression<double>> exprs;
+        for (auto &f: funcs) {
+            for (int kind = 0; kind < 3; ++kind) {
+                exprs.emplace_back();
+                exprs.back().parse(f, {"x", "y"});
+                if (kind == 1)
+                    exprs.back().compile();
+                if (kind == 2)
+                    exprs.back().enableTiering(500);
+            }
+        }
+        // Small enough for the on-stack frame, so evaluateSystem does not allocate either
+        std::vector<std::shared_ptr<rk::Expression<double>>> system;
+        for (auto &f: {funcs[0], funcs[1]}) {
+            system.push_back(std::make_shared<rk::Expression<double>>());
+            system.back()->parse(f, {"x", "y"});
+        }
+        rk::Expression<double>::linkSystem(system);
+
+        const size_t points = 2000;
+        std::vector<std::vector<double>> expected(exprs.size(), std::vector<double>(points));
+        for (size_t e = 0; e < exprs.size(); ++e) {
+            for (size_t i = 0; i < points; ++i)
+                expected[e][i] = exprs[e].interpret({0.1 + 0.001 * i, 2 - 0.0005 * i});
+        }
+
+        const size_t threads = std::max<size_t>(4, std::thread::hardware_concurrency());
+        std::vector<size_t> mismatches(threads, 0), allocated(threads, 0);
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; ++t) {
+            workers.emplace_back([&, t]() {
+                size_t scratchSize = 0;
+                for (auto &e: exprs)
+                    scratchSize = std::max(scratchSize, e.scratchSize());
+                std::vector<double> scratch(scratchSize), vars(2), outs(system.size());
+                auto linked = rk::Expression<double>::linkedSystem(system);
+                for (size_t round = 0; round < 5; ++round) {
+                    tests_rk::CountAllocations counting;
+                    size_t before = tests_rk::allocations;
+                    for (size_t i = (t * 37) % points, n = 0; n < points; ++n, i = (i + 1) % points) {
+                        vars[0] = 0.1 + 0.001 * i;
+                        vars[1] = 2 - 0.0005 * i;
+                        for (size_t e = 0; e < exprs.size(); ++e) {
+                            double got = exprs[e].evaluate(vars.data(), scratch.data());
+                            if (fabs(got - expected[e][i]) > 1e-12 * (1 + fabs(expected[e][i])))
+                                ++mismatches[t];
+                        }
+                        rk::Expression<double>::evaluateSystem(system, linked, vars, outs.data());
+                        for (size_t e = 0; e < system.size(); ++e) {
+                            if (fabs(outs[e] - expected[3 * e][i]) > 1e-12 * (1 + fabs(expected[3 * e][i])))
+                                ++mismatches[t];
+                        }
+                    }
+                    // Tiering copies the expression once when it reaches the threshold, later rounds must be clean
+                    if (round > 0)
+                        allocated[t] += tests_rk::allocations - before;
+                }
+            });
+        }
+        // Parsing other expressions and registering tokens meanwhile does not disturb the evaluations
+        for (int i = 0; i < 50; ++i) {
+            rk::Expression<double> other;
+            other.parse("stresshypot(x, " + std::to_string(i) + ")", {"x"});
+            rk::Expression<double>::addFunctionToken("stresshypot" + std::to_string(i), std::make_shared<StressHypotToken>());
+        }
+        for (auto &w: workers)
+            w.join();
+        for (size_t t = 0; t < threads; ++t) {
+            if (mismatches[t] != 0 || allocated[t] != 0) {
+                logFile << "Thread [" << t << "] got [" << mismatches[t] << "] wrong results and made ["
+                        << allocated[t] << "] allocations\n";
+                ++tmpErrCount;
+            }
+        }
+        logFile << "Evaluated [" << exprs.size() << "] expressions and a linked system on [" << threads << "] threads\n";
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running concurrent evaluation tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running concurrent evaluation test 1\n";
+    return errCount;
+}
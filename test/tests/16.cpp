@@ -0,0 +1,133 @@
+#include <iostream>
+#include <cmath>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+int lexer_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running lexer test 1\n";
+    size_t errCount = 0;
+    {   /*  NUMBERS, NAMES AND OPERATORS */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning lexer tests...\n";
+        const std::vector<std::string> vars = {"x", "y", "y10", "e"};
+        const std::vector<double> point = {0.5, 2, -3, 7};
+        const std::vector<std::pair<std::string, double>> funcs = {
+                {".5 + x", 1},
+                {"1e5 * x", 5e4},
+                {"2.5E3 - y", 2498},
+                {"1e-5 * 1e+5 + 2E-1", 1.2},
+                {"SIN(X) * Y", 2 * sin(0.5)},
+                {"y10 * y - y", -8},
+                {"   -x + -y", -2.5},
+                {"pow(-y, 2) * -(x - -1)", -6},
+                {"e * 2", 14},
+                {"0x1e - 5", 25},
+                {"x*y/(y10+e)", 0.25},
+        };
+        for (auto &f: funcs) {
+            rk::Expression<double> e;
+            try {
+                e.parse(f.first, vars);
+                double got = e.evaluate(point);
+                if (fabs(got - f.second) > 1e-12 * (1 + fabs(f.second))) {
+                    logFile << "[" << f.first << "] gives [" << got << "], expected [" << f.second << "]\n";
+                    ++tmpErrCount;
+                }
+            } catch (const std::logic_error& error) {
+                logFile << "[" << f.first << "] failed to parse: " << error.what();
+                ++tmpErrCount;
+            }
+        }
+        {
+            // Infinity and NaN are numbers, variables or parameters of those names are refused
+            rk::Expression<double> e;
+            e.parse("inf - x", {"x"});
+            if (!std::isinf(e.evaluate({1.0}))) {
+                logFile << "[inf - x] gives [" << e.evaluate({1.0}) << "]\n";
+                ++tmpErrCount;
+            }
+            size_t thrown = 0;
+            for (auto &names: std::vector<std::pair<std::vector<std::string>, std::vector<std::string>>>{
+                    {{"x", "inf"}, {}}, {{"x"}, {"NaN"}}, {{"x", "infinity"}, {"k"}}}) {
+                try {
+                    e.parse("inf - x", names.first, names.second);
+                } catch (const std::logic_error&) {
+                    ++thrown;
+                }
+            }
+            if (thrown != 3 || !std::isinf(e.evaluate({1.0}))) {
+                logFile << "Only [" << thrown << "] of 3 variables named like numbers were refused\n";
+                ++tmpErrCount;
+            }
+        }
+        for (auto &wrong: {"x + z", "x $ 2", "x -", "sinx(x)", "2e * 1"}) {
+            rk::Expression<double> e;
+            try {
+                e.parse(wrong, {"x"});
+                logFile << "[" << wrong << "] parsed without an error\n";
+                ++tmpErrCount;
+            } catch (const std::logic_error&) { }
+        }
+        {
+            // Copies share the number tokens and the variable table, reparsing does not touch them
+            rk::Expression<double> a;
+            a.parse("2.5 * x + 4 * y", {"x", "y"});
+            rk::Expression<double> b(a);
+            a.parse("x - y", {"y", "x"});
+            a.parse("x - y", {"x", "y"});
+            if (b.evaluate({1.0, 2.0}) != 10.5 || b.interpret({1.0, 2.0}) != 10.5 || a.evaluate({1.0, 2.0}) != -1) {
+                logFile << "Copy gives [" << b.evaluate({1.0, 2.0}) << "], reparsed expression gives ["
+                        << a.evaluate({1.0, 2.0}) << "]\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // Generated equations over many variables against their values computed directly
+            std::vector<std::string> names = {"x"};
+            std::vector<double> values = {0.25};
+            for (int i = 0; i < 50; ++i) {
+                names.push_back("y" + std::to_string(i));
+                values.push_back(1 + 0.01 * i);
+            }
+            size_t wrong = 0;
+            for (int k = 0; k < 500; ++k) {
+                std::string s = "0.5 * x";
+                double expected = 0.5 * values[0];
+                for (int t = 0; t < 6; ++t) {
+                    size_t a = (k * 7 + t * 13) % names.size(), b = (k * 3 + t * 29 + 1) % names.size();
+                    double c = (k * 31 + t) % 1000 / 100.0;
+                    switch ((k + t) % 3) {
+                        case 0:
+                            s += " + " + std::to_string(c) + " * " + names[a];
+                            expected += std::stod(std::to_string(c)) * values[a];
+                            break;
+                        case 1:
+                            s += " - sin(" + names[a] + ") * " + names[b];
+                            expected -= sin(values[a]) * values[b];
+                            break;
+                        default:
+                            s += " + pow(" + names[a] + ", 2) / (" + std::to_string(c) + " + " + names[b] + ")";
+                            expected += pow(values[a], 2) / (std::stod(std::to_string(c)) + values[b]);
+                            break;
+                    }
+                }
+                rk::Expression<double> e;
+                e.parse(s, names);
+                if (fabs(e.evaluate(values) - expected) > 1e-12 * (1 + fabs(expected))) {
+                    if (wrong++ == 0)
+                        logFile << "[" << s << "] gives [" << e.evaluate(values) << "], expected [" << expected << "]\n";
+                }
+            }
+            tmpErrCount += wrong;
+        }
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running lexer tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running lexer test 1\n";
+    return errCount;
+}
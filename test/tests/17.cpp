@@ -0,0 +1,171 @@
+#include <iostream>
+#include <cmath>
+#include <sstream>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+class LoadHypotToken: public FunctionToken<double> {
+public:
+    void evaluate(std::stack<double>& s, const std::vector<double>& vars) const override {
+        double b = s.top();
+        s.pop();
+        double a = s.top();
+        s.pop();
+        s.push(std::hypot(a, b));
+    }
+    [[nodiscard]] std::string cname() const override { return "hypot"; }
+};
+
+template<typename ValueType>
+static size_t serialization_roundtrip(const std::vector<std::string>& funcs, std::ostream& logFile) {
+    size_t errCount = 0;
+    auto conv = (std::pair<ValueType, bool> (*)(const std::string&))tests_rk::get_conv_func<ValueType>();
+    const std::vector<ValueType> point = {ValueType(0.7), ValueType(-1.3)};
+    for (auto &f: funcs) {
+        rk::Expression<ValueType> e;
+        e.parse(f, {"x", "y"}, conv);
+        std::stringstream buffer;
+        e.save(buffer);
+        auto loaded = rk::Expression<ValueType>::load(buffer);
+        if (loaded.evaluate(point) != e.evaluate(point) || loaded.interpret(point) != e.evaluate(point)
+            || loaded.evaluationCounts().transcendental != e.evaluationCounts().transcendental) {
+            logFile << "Loaded [" << f << "] gives [" << loaded.evaluate(point) << "], expected [" << e.evaluate(point) << "]\n";
+            ++errCount;
+        }
+        if (loaded.compile() && fabs(loaded.evaluate(point) - e.evaluate(point)) > 1e-5) {
+            logFile << "Loaded and compiled [" << f << "] gives [" << loaded.evaluate(point) << "]\n";
+            ++errCount;
+        }
+    }
+    return errCount;
+}
+
+int serialization_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running serialization test 1\n";
+    size_t errCount = 0;
+    {   /*  SAVE AND LOAD */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning serialization tests...\n";
+        rk::Expression<double>::addFunctionToken("loadhypot", std::make_shared<LoadHypotToken>());
+        const std::vector<std::string> funcs = {
+                "y * ((sin(x)) / x + (cos(x)) / (x * x))",
+                "pow(x, 2) + pow(x, 2) * y - 3.5",
+                "-x",
+                "42",
+        };
+        tmpErrCount += serialization_roundtrip<double>(funcs, logFile);
+        tmpErrCount += serialization_roundtrip<double>({"loadhypot(x, y) * sin(x) + loadhypot(y, 1)"}, logFile);
+        tmpErrCount += serialization_roundtrip<float>(funcs, logFile);
+        tmpErrCount += serialization_roundtrip<long double>(funcs, logFile);
+        {
+            // Duals keep their seeded derivatives through a loaded program
+            rk::Expression<rk::Dual<double>> e;
+            e.parse("sin(x) * y", {"x", "y"}, rk::stringToDual<double>);
+            std::stringstream buffer;
+            e.save(buffer);
+            auto loaded = rk::Expression<rk::Dual<double>>::load(buffer);
+            rk::Dual<double> got = loaded.evaluate({rk::Dual<double>(0.5, {1.0}), rk::Dual<double>(2)});
+            if (fabs(got.value - 2 * sin(0.5)) > 1e-15 || fabs(got.derivative[0] - 2 * cos(0.5)) > 1e-15) {
+                logFile << "Loaded dual expression gives [" << got << "]\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // Long doubles are stored without padding, member by member in Duals, and come back exactly
+            using LD = rk::Dual<long double>;
+            const std::vector<LD> values = {LD(0.1L, {1.0L / 3}), LD(-1e300L * 1e300L, {0}), LD(1.5L, {-2.25L})};
+            std::stringstream buffer;
+            rk::writeValues(buffer, values);
+            const size_t bytes = buffer.str().size();
+            auto got = rk::readValues<LD>(buffer);
+            const size_t significant = std::numeric_limits<long double>::digits == 64 ? 10 : sizeof(long double);
+            const size_t expected = sizeof(uint64_t) + values.size() * 2 * significant;
+            bool same = got.size() == values.size();
+            for (size_t i = 0; same && i < got.size(); ++i)
+                same = got[i].value == values[i].value && got[i].derivative[0] == values[i].derivative[0];
+            if (!same || bytes != expected) {
+                logFile << "[" << values.size() << "] long double duals take [" << bytes << "] bytes, expected ["
+                        << expected << "], same values [" << same << "]\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // A linked system comes back linked, and evaluates and integrates like the original
+            std::vector<std::string> vars = {"x", "y1", "y2", "y3"};
+            std::vector<std::shared_ptr<rk::Expression<double>>> system;
+            for (auto &f: {"y2 * sin(x)", "-y1 + sin(x) * y3", "cos(y1) - y3"}) {
+                system.push_back(std::make_shared<rk::Expression<double>>());
+                system.back()->parse(f, vars);
+            }
+            rk::Expression<double>::linkSystem(system);
+            std::stringstream buffer;
+            rk::Expression<double>::saveSystem(buffer, system);
+            auto loaded = rk::Expression<double>::loadSystem(buffer);
+            if (loaded.size() != system.size() || rk::Expression<double>::linkedSystem(loaded) == nullptr) {
+                logFile << "Loaded system of [" << loaded.size() << "] equations is not linked\n";
+                ++tmpErrCount;
+            } else {
+                std::vector<double> init = {0, 1, 0.5, -0.5};
+                auto got = rk::RK4SystemSolve<double>(loaded, init, 1, 0.01);
+                auto expected = rk::RK4SystemSolve<double>(system, init, 1, 0.01);
+                if (got != expected) {
+                    logFile << "Loaded system solution differs from the original\n";
+                    ++tmpErrCount;
+                }
+                auto derived = loaded[2]->derivative(1).evaluate({0, 0.3, 0, 0});
+                if (fabs(derived + sin(0.3)) > 1e-15) {
+                    logFile << "Derivative of a loaded equation gives [" << derived << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+        }
+        {
+            // Foreign, truncated and damaged data is rejected with an error
+            rk::Expression<double> e;
+            e.parse("loadhypot(x, y) + pow(x, y) * sin(y)", {"x", "y"});
+            std::stringstream buffer;
+            e.save(buffer);
+            const std::string saved = buffer.str();
+            auto rejected = [&](const std::string& data) {
+                std::stringstream in(data);
+                try {
+                    rk::Expression<double>::load(in);
+                } catch (const std::logic_error&) {
+                    return true;
+                }
+                return false;
+            };
+            std::string unknown = saved;
+            unknown.replace(unknown.find("loadhypot"), 9, "loadhypox");
+            std::stringstream asFloat(saved);
+            bool floatRejected = false;
+            try {
+                rk::Expression<float>::load(asFloat);
+            } catch (const std::logic_error&) {
+                floatRejected = true;
+            }
+            if (!rejected("") || !rejected("RKBC") || !rejected(unknown) || !floatRejected
+                || !rejected(saved.substr(0, saved.size() - 1))) {
+                logFile << "Invalid data loaded without an error\n";
+                ++tmpErrCount;
+            }
+            // Any single damaged byte either loads or throws, it never makes load misbehave
+            size_t thrown = 0;
+            for (size_t i = 0; i < saved.size(); ++i) {
+                std::string damaged = saved;
+                damaged[i] = (char) ~damaged[i];
+                thrown += rejected(damaged);
+            }
+            logFile << "[" << thrown << "] of [" << saved.size() << "] single byte damages rejected\n";
+        }
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running serialization tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running serialization test 1\n";
+    return errCount;
+}
@@ -0,0 +1,175 @@
+#include <iostream>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include "../../src/expression/Expression.h"
+#include "../../src/expression/VectorMath.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+// Distance from the exact result in units in the last place of T
+template<typename T>
+static double vector_math_ulp(T got, long double exact) {
+    if ((std::isnan(got) && std::isnan(exact)) || got == exact)
+        return 0;
+    const T rounded = (T) exact;
+    T unit = std::numeric_limits<T>::denorm_min();
+    if (std::fabs(rounded) >= std::numeric_limits<T>::min())
+        unit = std::ldexp(T(1), std::ilogb(rounded) - (std::numeric_limits<T>::digits - 1));
+    return (double) (std::fabs((long double) got - exact) / unit);
+}
+
+template<typename T>
+static size_t vector_math_accuracy(const std::string& target, std::ostream& logFile) {
+    const rk::VectorKernels<T>* k = rk::vectorKernels<T>(target);
+    if (k == nullptr) {
+        logFile << "Target [" << target << "] is not supported for " << sizeof(T) << " byte values\n";
+        return 0;
+    }
+    const size_t n = 1u << 16u;
+    std::mt19937_64 rng(7);
+    std::vector<T> x(n), b(n), s(n), c(n), y(n);
+    double sinUlp = 0, cosUlp = 0, sinCosUlp = 0, powUlp = 0;
+    // Up to and past the range reduction limit of float and double
+    for (double range: {1.0, 10.0, 1000.0, 8000.0, 5e5}) {
+        std::uniform_real_distribution<double> d(-range, range);
+        for (size_t i = 0; i < n; ++i) {
+            x[i] = (T) d(rng);
+            b[i] = T(int(rng() % 9) - 4);
+        }
+        k->sin(x.data(), y.data(), n);
+        for (size_t i = 0; i < n; ++i)
+            sinUlp = std::max(sinUlp, vector_math_ulp(y[i], sinl(x[i])));
+        k->cos(x.data(), y.data(), n);
+        for (size_t i = 0; i < n; ++i)
+            cosUlp = std::max(cosUlp, vector_math_ulp(y[i], cosl(x[i])));
+        k->sinCos(x.data(), s.data(), c.data(), n);
+        for (size_t i = 0; i < n; ++i)
+            sinCosUlp = std::max({sinCosUlp, vector_math_ulp(s[i], sinl(x[i])), vector_math_ulp(c[i], cosl(x[i]))});
+        k->pow(x.data(), b.data(), y.data(), n);
+        for (size_t i = 0; i < n; ++i)
+            powUlp = std::max(powUlp, vector_math_ulp(y[i], powl(x[i], b[i])));
+    }
+    logFile << "[" << target << "] " << sizeof(T) << " byte values, max ulp: sin [" << sinUlp << "], cos [" << cosUlp
+            << "], sinCos [" << sinCosUlp << "], pow [" << powUlp << "]\n";
+    size_t errCount = 0;
+    if (sinUlp > 1 || cosUlp > 1 || sinCosUlp > 1 || powUlp > 4) {
+        logFile << "[" << target << "] is out of the documented error bounds\n";
+        ++errCount;
+    }
+
+    // Special values keep the libm behaviour
+    const T inf = std::numeric_limits<T>::infinity(), nan = std::numeric_limits<T>::quiet_NaN();
+    const std::vector<T> special = {T(0), -T(0), inf, -inf, nan, T(1e30), T(-3e7), std::numeric_limits<T>::denorm_min()};
+    std::vector<T> got(special.size()), exponent(special.size(), T(-2));
+    k->sin(special.data(), got.data(), special.size());
+    for (size_t i = 0; i < special.size(); ++i) {
+        const T expected = std::sin(special[i]);
+        if (vector_math_ulp(got[i], expected) > 1 || std::signbit(got[i]) != std::signbit(expected)) {
+            logFile << "[" << target << "] sin(" << special[i] << ") is [" << got[i] << "], expected [" << expected << "]\n";
+            ++errCount;
+        }
+    }
+    k->pow(special.data(), exponent.data(), got.data(), special.size());
+    for (size_t i = 0; i < special.size(); ++i) {
+        const T expected = std::pow(special[i], T(-2));
+        if (vector_math_ulp(got[i], expected) > 4) {
+            logFile << "[" << target << "] pow(" << special[i] << ", -2) is [" << got[i] << "], expected [" << expected << "]\n";
+            ++errCount;
+        }
+    }
+
+    // Every tail length, computed in place
+    for (size_t m = 0; m < 70; ++m) {
+        std::vector<T> v(x.begin(), x.begin() + m), guard(m + 1, T(5));
+        std::copy(v.begin(), v.end(), guard.begin());
+        k->cos(guard.data(), guard.data(), m);
+        for (size_t i = 0; i < m; ++i) {
+            if (vector_math_ulp(guard[i], cosl(v[i])) > 1) {
+                logFile << "[" << target << "] cos over [" << m << "] values is wrong at [" << i << "]\n";
+                ++errCount;
+                break;
+            }
+        }
+        if (guard[m] != T(5)) {
+            logFile << "[" << target << "] cos over [" << m << "] values writes past the end\n";
+            ++errCount;
+        }
+    }
+    return errCount;
+}
+
+template<typename T>
+static void vector_math_throughput(std::ostream& logFile) {
+    const size_t n = 4096, repeats = 500;
+    std::vector<T> x(n), y(n);
+    for (size_t i = 0; i < n; ++i)
+        x[i] = T(-10) + T(20) * T(i) / T(n);
+    for (auto target: {"scalar", "sse2", "vector", "avx2", "avx512"}) {
+        const rk::VectorKernels<T>* k = rk::vectorKernels<T>(target);
+        if (k == nullptr)
+            continue;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < repeats; ++r)
+            k->sin(x.data(), y.data(), n);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        logFile << "[" << target << "] " << sizeof(T) << " byte sin: " << double(n * repeats) / seconds / 1e6 << " M/s\n";
+    }
+}
+
+int vector_math_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running vector math test 1\n";
+    size_t errCount = 0;
+    {   /*  KERNELS AGAINST LIBM */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning vector math tests...\n";
+        logFile << "Selected kernels: [" << rk::vectorKernels<double>().target << "] for double, ["
+                << rk::vectorKernels<float>().target << "] for float\n";
+        for (auto target: {"scalar", "sse2", "vector", "avx2", "avx512"}) {
+            tmpErrCount += vector_math_accuracy<double>(target, logFile);
+            tmpErrCount += vector_math_accuracy<float>(target, logFile);
+        }
+        if (rk::vectorKernels<double>("unknown") != nullptr || rk::vectorKernels<long double>("avx2") != nullptr
+            || std::string(rk::vectorKernels<long double>().target) != "scalar") {
+            logFile << "Kernels reported for an unsupported target\n";
+            ++tmpErrCount;
+        }
+        {
+            // Generated batch code calls the same kernels as the interpreter
+            const std::string f = "pow(sin(x), 3) * cos(y) + pow(x, -2) - sin(x) * cos(x)";
+            rk::Expression<double> interpreted, compiled;
+            interpreted.parse(f, {"x", "y"});
+            compiled.parse(f, {"x", "y"});
+            if (!compiled.compile(rk::ExternalCompiler)) {
+                logFile << "Unable to compile [" << f << "]\n";
+                ++tmpErrCount;
+            }
+            const size_t n = 200;
+            std::vector<double> xs(n), ys(n), a(n), b(n);
+            for (size_t i = 0; i < n; ++i) {
+                xs[i] = 0.1 + 0.05 * double(i);
+                ys[i] = 3 - 0.02 * double(i);
+            }
+            interpreted.evaluateBatch({xs.data(), ys.data()}, a.data(), n);
+            compiled.evaluateBatch({xs.data(), ys.data()}, b.data(), n);
+            for (size_t i = 0; i < n; ++i) {
+                if (fabs(a[i] - b[i]) > 1e-13 * (1 + fabs(a[i]))) {
+                    logFile << "Compiled batch of [" << f << "] at point [" << i << "] is [" << b[i]
+                            << "], interpreted is [" << a[i] << "]\n";
+                    ++tmpErrCount;
+                    break;
+                }
+            }
+        }
+        vector_math_throughput<double>(logFile);
+        vector_math_throughput<float>(logFile);
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running vector math tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running vector math test 1\n";
+    return errCount;
+}
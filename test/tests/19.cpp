@@ -0,0 +1,128 @@
+#include <iostream>
+#include <cmath>
+#include <sstream>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+int strength_reduction_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running strength reduction test 1\n";
+    size_t errCount = 0;
+    {   /*  POW AND DIVISION BY CONSTANTS */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning strength reduction tests...\n";
+        const std::vector<double> points = {0.3, 1, 1.7, 2.5, 13, 1e-3};
+        // Integer and half-integer exponents leave no pow behind and stay within a few ulp of it
+        for (int twice = -32; twice <= 32; ++twice) {
+            const double exponent = twice / 2.0;
+            std::ostringstream f;
+            f << "pow(x, " << exponent << ")";
+            rk::Expression<double> e, jitted;
+            e.parse(f.str(), {"x"});
+            jitted.parse(f.str(), {"x"});
+            jitted.compile();
+            if (e.evaluationCounts().transcendental != 0) {
+                logFile << "[" << f.str() << "] evaluates with " << e.evaluationCounts() << "\n";
+                ++tmpErrCount;
+            }
+            for (double x: points) {
+                const double expected = std::pow(x, exponent), got = e.evaluate({x});
+                if (fabs(got - expected) > 1e-14 * fabs(expected) || jitted.evaluate({x}) != got) {
+                    logFile << "[" << f.str() << "] at [" << x << "] gives [" << got << "], JIT gives ["
+                            << jitted.evaluate({x}) << "], expected [" << expected << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+        }
+        // Other exponents are left to pow
+        for (auto &f: {"pow(x, 17)", "pow(x, 1.3)", "pow(x, y)", "pow(x, -16.5)"}) {
+            rk::Expression<double> e;
+            e.parse(f, {"x", "y"});
+            if (e.evaluationCounts().transcendental != 1) {
+                logFile << "[" << f << "] evaluates with " << e.evaluationCounts() << "\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // Shared squares are computed once, reductions fold into the surrounding division
+            rk::Expression<double> e;
+            e.parse("pow(x, 8) + y * pow(x, -1)", {"x", "y"});
+            const double got = e.evaluate({1.5, 2}), expected = pow(1.5, 8) + 2 / 1.5;
+            if (e.evaluationCounts().arithmetic != 5 || fabs(got - expected) > 1e-14 * expected) {
+                logFile << "[pow(x, 8) + y * pow(x, -1)] gives [" << got << "] with " << e.evaluationCounts() << "\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // Negative exponents do not overflow on the way to a small result, nor underflow on the way to a large one
+            rk::Expression<double> e;
+            e.parse("pow(x, -16)", {"x"});
+            for (double x: {1e20, -1e20, 1e-20, 1e-19}) {
+                const double expected = std::pow(x, -16.0), got = e.evaluate({x});
+                if (!(fabs(got - expected) <= 1e-3 * fabs(expected)) && got != expected) {
+                    logFile << "[pow(x, -16)] at [" << x << "] gives [" << got << "], expected [" << expected << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+        }
+        {
+            // Division by a power of two is exact as a multiplication, other constants divide unless opted in
+            rk::Expression<double> quarter, third, reciprocal;
+            quarter.parse("x / 4 + x / 0.125", {"x"});
+            third.parse("x / 3", {"x"});
+            reciprocal.setReciprocalDivision(true);
+            reciprocal.parse("x / 3", {"x"});
+            size_t differs = 0;
+            for (int i = 1; i < 1000; ++i) {
+                const double x = 0.37 * i;
+                if (quarter.evaluate({x}) != x / 4 + x / 0.125 || third.evaluate({x}) != x / 3
+                    || reciprocal.evaluate({x}) != x * (1.0 / 3)) {
+                    logFile << "Division by a constant at [" << x << "] gives [" << quarter.evaluate({x}) << "], ["
+                            << third.evaluate({x}) << "], [" << reciprocal.evaluate({x}) << "]\n";
+                    ++tmpErrCount;
+                    break;
+                }
+                differs += x / 3 != x * (1.0 / 3);
+            }
+            logFile << "Reciprocal division differs from division at [" << differs << "] of [999] points\n";
+        }
+        {
+            // sqrt is a builtin, differentiated, compiled and saved like the other functions
+            rk::Expression<double> e, compiled;
+            e.parse("sqrt(x) * y + pow(x, 1.5)", {"x", "y"});
+            compiled.parse("sqrt(x) * y + pow(x, 1.5)", {"x", "y"});
+            if (!compiled.compile(rk::ExternalCompiler)) {
+                logFile << "Unable to compile [sqrt(x) * y + pow(x, 1.5)]\n";
+                ++tmpErrCount;
+            }
+            const double x = 2.25, y = 3;
+            auto d = e.derivative(0);
+            std::stringstream buffer;
+            e.save(buffer);
+            auto loaded = rk::Expression<double>::load(buffer);
+            if (e.evaluate({x, y}) != 1.5 * 3 + 3.375 || fabs(compiled.evaluate({x, y}) - e.evaluate({x, y})) > 1e-14
+                || loaded.evaluate({x, y}) != e.evaluate({x, y}) || fabs(d.evaluate({x, y}) - (y / 3 + 2.25)) > 1e-14) {
+                logFile << "[sqrt(x) * y + pow(x, 1.5)] gives [" << e.evaluate({x, y}) << "], derivative ["
+                        << d.evaluate({x, y}) << "]\n";
+                ++tmpErrCount;
+            }
+            // Duals follow the reduced program, with no derivative where the argument does not move
+            using D = rk::Dual<double>;
+            rk::Expression<D> dual;
+            dual.parse("pow(x, 2.5) + sqrt(y)", {"x", "y"}, rk::stringToDual<double>);
+            D got = dual.evaluate({D(4, {1}), D(0)});
+            if (got.value != 32 || fabs(got.derivative[0] - 20) > 1e-14) {
+                logFile << "[pow(x, 2.5) + sqrt(y)] over dual numbers gives [" << got << "]\n";
+                ++tmpErrCount;
+            }
+        }
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running strength reduction tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running strength reduction test 1\n";
+    return errCount;
+}
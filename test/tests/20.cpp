@@ -0,0 +1,160 @@
+#include <iostream>
+#include <cmath>
+#include <sstream>
+#include <thread>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+int parameters_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running parameters test 1\n";
+    size_t errCount = 0;
+    {   /*  NAMED PARAMETERS */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning parameters tests...\n";
+        const std::string f = "k * sin(x) * y + c";
+        {
+            // Every way of evaluating follows the parameters, compiled code included, without a new compile
+            rk::Expression<double> interpreted, jitted, external;
+            interpreted.parse(f, {"x", "y"}, {"k", "c"});
+            jitted.parse(f, {"x", "y"}, {"k", "c"});
+            external.parse(f, {"x", "y"}, {"k", "c"});
+            if (interpreted.evaluate({0.5, 2}) != 0 || !jitted.compile() || !external.compile(rk::ExternalCompiler)) {
+                logFile << "Parameters do not start at zero or the expression does not compile\n";
+                ++tmpErrCount;
+            }
+            std::vector<double> xs = {0.1, 0.5, 0.9}, ys = {2, 3, 4}, batch(3);
+            std::vector<double> scratch(interpreted.scratchSize());
+            for (double k: {1.0, -2.5, 7.0}) {
+                for (auto e: {&interpreted, &jitted, &external}) {
+                    e->setParameter("k", k);
+                    e->setParameter("c", k / 2);
+                }
+                const double expected = k * sin(0.5) * 2 + k / 2;
+                const double point[] = {0.5, 2};
+                tests_rk::CountAllocations counting;
+                size_t before = tests_rk::allocations;
+                const double fromScratch = interpreted.evaluate(point, scratch.data());
+                const size_t allocated = tests_rk::allocations - before;
+                if (fabs(interpreted.evaluate({0.5, 2}) - expected) > 1e-14 || fromScratch != interpreted.evaluate({0.5, 2})
+                    || interpreted.interpret({0.5, 2}) != interpreted.evaluate({0.5, 2}) || allocated != 0
+                    || fabs(jitted.evaluate({0.5, 2}) - expected) > 1e-14 || fabs(external.evaluate({0.5, 2}) - expected) > 1e-14) {
+                    logFile << "[" << f << "] with k = [" << k << "] gives [" << interpreted.evaluate({0.5, 2}) << "], JIT ["
+                            << jitted.evaluate({0.5, 2}) << "], external [" << external.evaluate({0.5, 2}) << "], expected ["
+                            << expected << "], [" << allocated << "] allocations\n";
+                    ++tmpErrCount;
+                }
+                for (auto e: {&interpreted, &external}) {
+                    e->evaluateBatch({xs.data(), ys.data()}, batch.data(), batch.size());
+                    for (size_t i = 0; i < xs.size(); ++i) {
+                        if (fabs(batch[i] - (k * sin(xs[i]) * ys[i] + k / 2)) > 1e-13) {
+                            logFile << "Batch of [" << f << "] with k = [" << k << "] at [" << i << "] gives [" << batch[i] << "]\n";
+                            ++tmpErrCount;
+                        }
+                    }
+                }
+            }
+            // Values are kept by copies, a new parse over the same parameters and a save
+            rk::Expression<double> copy(interpreted);
+            interpreted.parse("k * x - c", {"x", "y"}, {"k", "c"});
+            std::stringstream buffer;
+            interpreted.save(buffer);
+            auto loaded = rk::Expression<double>::load(buffer);
+            if (copy.getParameter("k") != 7 || interpreted.evaluate({1, 0}) != 3.5 || loaded.evaluate({1, 0}) != 3.5
+                || loaded.parameterNames() != std::vector<std::string>{"k", "c"}) {
+                logFile << "Parameters are lost by a copy, a parse or a save\n";
+                ++tmpErrCount;
+            }
+            interpreted.setParameters({2, 1});
+            if (interpreted.derivative(0).evaluate({5, 0}) != 2 || interpreted.getParameter("c") != 1) {
+                logFile << "Derivative of [k * x - c] gives [" << interpreted.derivative(0).evaluate({5, 0}) << "]\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // Unknown names, clashes and wrong counts are errors
+            size_t thrown = 0;
+            rk::Expression<double> e;
+            e.parse("a * x", {"x"}, {"a"});
+            try { e.setParameter("b", 1); } catch (const std::logic_error&) { ++thrown; }
+            try { e.setParameters({1, 2}); } catch (const std::logic_error&) { ++thrown; }
+            try { e.parse("x", {"x"}, {"x"}); } catch (const std::logic_error&) { ++thrown; }
+            try { e.parse("a * z", {"x"}, {"a"}); } catch (const std::logic_error&) { ++thrown; }
+            try { e.evaluate({1}, {}); } catch (const std::logic_error&) { ++thrown; }
+            if (thrown != 5) {
+                logFile << "[" << thrown << "] of [5] invalid parameter uses throw\n";
+                ++tmpErrCount;
+            }
+        }
+        for (auto backend: {-1, (int) rk::JitCompiler, (int) rk::ExternalCompiler}) {
+            // Threads sweep the parameters over one expression, each passing its own values on every call
+            rk::Expression<double> e;
+            e.parse(f, {"x", "y"}, {"k", "c"});
+            if (backend >= 0)
+                e.compile((rk::CompileBackend) backend);
+            e.setParameters({100, 100});
+            const size_t n = 3000;
+            std::vector<double> xs(n), ys(n, 2);
+            for (size_t i = 0; i < n; ++i)
+                xs[i] = 0.001 * (double) i;
+            std::vector<size_t> wrong(4, 0);
+            std::vector<std::thread> threads;
+            for (size_t t = 0; t < wrong.size(); ++t) {
+                threads.emplace_back([&e, &xs, &ys, &wrong, t, n]() {
+                    std::vector<double> batch(n);
+                    for (int round = 0; round < 20; ++round) {
+                        const double k = (double) t + 0.25 * round, c = -(double) t;
+                        wrong[t] += fabs(e.evaluate({0.5, 2}, {k, c}) - (k * sin(0.5) * 2 + c)) > 1e-13;
+                        e.evaluateBatch({xs.data(), ys.data()}, batch.data(), n, {k, c});
+                        for (size_t i = 0; i < n; i += 97)
+                            wrong[t] += fabs(batch[i] - (k * sin(xs[i]) * 2 + c)) > 1e-12;
+                        wrong[t] += fabs(batch[n - 1] - (k * sin(xs[n - 1]) * 2 + c)) > 1e-12;
+                    }
+                });
+            }
+            for (auto &t: threads)
+                t.join();
+            for (size_t t = 0; t < wrong.size(); ++t) {
+                if (wrong[t] != 0) {
+                    logFile << "Thread [" << t << "] got [" << wrong[t] << "] wrong results with its own parameters,"
+                            << " backend [" << backend << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+            if (e.getParameter("k") != 100 || e.evaluate({0.5, 2}) != 100 * sin(0.5) * 2 + 100) {
+                logFile << "Values passed to evaluate changed the values set\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // A parameter sweep over a system: equations are not linked, but integrate with their own values
+            std::vector<std::string> vars = {"t", "y1", "y2"};
+            std::vector<std::shared_ptr<rk::Expression<double>>> system, reference;
+            for (auto &eq: {"y2", "-w * w * y1"}) {
+                system.push_back(std::make_shared<rk::Expression<double>>());
+                system.back()->parse(eq, vars, {"w"});
+            }
+            if (rk::Expression<double>::linkSystem(system)) {
+                logFile << "System with parameters was linked\n";
+                ++tmpErrCount;
+            }
+            for (double w: {1.0, 2.0}) {
+                for (auto &e: system)
+                    e->setParameter("w", w);
+                auto got = rk::RK4SystemSolve<double>(system, {0, 1, 0}, 1, 0.001);
+                if (fabs(got[1] - cos(w)) > 1e-9 || fabs(got[2] + w * sin(w)) > 1e-9) {
+                    logFile << "System with w = [" << w << "] gives [" << got[1] << ", " << got[2] << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+        }
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running parameters tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running parameters test 1\n";
+    return errCount;
+}
@@ -0,0 +1,125 @@
+#include <iostream>
+#include <cmath>
+#include <sstream>
+#include "../../src/expression/Expression.h"
+#include "../../src/expression/VectorExpression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+int vector_expression_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running vector expression test 1\n";
+    size_t errCount = 0;
+    {   /*  MULTI-OUTPUT EXPRESSIONS */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning vector expression tests...\n";
+        const std::vector<std::string> vars = {"t", "x", "y", "z"};
+        const std::vector<std::string> lorenz = {"10 * (y - x)", "x * (28 - z) - y", "x * y - 8 / 3 * z"};
+        rk::VectorExpression<double> f;
+        f.parse(lorenz, vars);
+        std::vector<std::shared_ptr<rk::Expression<double>>> separate;
+        for (auto &e: lorenz) {
+            separate.push_back(std::make_shared<rk::Expression<double>>());
+            separate.back()->parse(e, vars);
+        }
+        {
+            // One pass gives what every equation gives on its own, without allocating over a scratch buffer
+            const std::vector<double> point = {0, 1.5, -2, 20};
+            std::vector<double> scratch(f.scratchSize()), got(3);
+            tests_rk::CountAllocations counting;
+            size_t before = tests_rk::allocations;
+            f.evaluate(point.data(), got.data(), scratch.data());
+            const size_t allocated = tests_rk::allocations - before;
+            if (f.size() != 3 || allocated != 0 || rk::Expression<double>::linkedSystem(f) == nullptr
+                || f.evaluate(point) != got) {
+                logFile << "Vector of [" << f.size() << "] equations is not linked or allocates [" << allocated << "] times\n";
+                ++tmpErrCount;
+            }
+            for (size_t i = 0; i < 3; ++i) {
+                if (got[i] != separate[i]->evaluate(point)) {
+                    logFile << "[" << lorenz[i] << "] gives [" << got[i] << "], on its own [" << separate[i]->evaluate(point) << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+        }
+        {
+            // Solvers take it in place of the equations, fixed step, adaptive and RK4 alike
+            const std::vector<double> init = {0, 1, 1, 1};
+            auto check = [&](const std::string& name, const std::vector<double>& got, const std::vector<double>& expected) {
+                for (size_t i = 0; i < got.size(); ++i) {
+                    if (fabs(got[i] - expected[i]) > 1e-12 * (1 + fabs(expected[i]))) {
+                        logFile << name << " over the vector expression gives [" << got[i] << "] at [" << i
+                                << "], over the equations [" << expected[i] << "]\n";
+                        ++tmpErrCount;
+                        return;
+                    }
+                }
+            };
+            check("RK4SystemSolve", rk::RK4SystemSolve<double>(f, init, 0.5, 0.001),
+                  rk::RK4SystemSolve<double>(separate, init, 0.5, 0.001));
+            check("RK3SystemSolve", rk::RK3SystemSolve<double>(f, init, 0.5, 0.001),
+                  rk::RK3SystemSolve<double>(separate, init, 0.5, 0.001));
+            check("ASRKDormandPrinceSystemSolve", rk::ASRKDormandPrinceSystemSolve<double>(f, init, 0.5, 0.001),
+                  rk::ASRKDormandPrinceSystemSolve<double>(separate, init, 0.5, 0.001));
+            rk::VectorExpression<double> compiled;
+            compiled.parse(lorenz, vars);
+            if (!compiled.compile()) {
+                logFile << "Unable to compile the vector expression\n";
+                ++tmpErrCount;
+            }
+            check("Compiled RK4SystemSolve", rk::RK4SystemSolve<double>(compiled, init, 0.5, 0.001),
+                  rk::RK4SystemSolve<double>(separate, init, 0.5, 0.001));
+            // A compiled system passed in is not relinked
+            rk::VectorExpression<double> wrapped(compiled.system());
+            if (rk::Expression<double>::linkedSystem(wrapped)->rhs == nullptr) {
+                logFile << "Wrapping a compiled system drops its rhs\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // A system too large for the stack frame of the VM still takes no allocation per stage
+            const size_t count = 100;
+            std::vector<std::string> chainVars = {"t"}, chain;
+            for (size_t i = 0; i < count; ++i)
+                chainVars.push_back("y" + std::to_string(i));
+            for (size_t i = 0; i < count; ++i)
+                chain.push_back("sin(" + chainVars[(i + 1) % count + 1] + ") * cos(t) - sin(" + chainVars[i + 1] + ")");
+            rk::VectorExpression<double> large;
+            large.parse(chain, chainVars);
+            std::vector<double> init(count + 1, 0.5);
+            init[0] = 0;
+            tests_rk::CountAllocations counting;
+            size_t before = tests_rk::allocations;
+            rk::RK4SystemSolve<double>(large, init, 0.01, 0.001);
+            const size_t few = tests_rk::allocations - before;
+            before = tests_rk::allocations;
+            rk::RK4SystemSolve<double>(large, init, 1, 0.001);
+            const size_t many = tests_rk::allocations - before;
+            if (large.scratchSize() <= rk::Program<double>::inlineStackSize || few != many) {
+                logFile << "Scratch of [" << large.scratchSize() << "] values, [" << few << "] allocations for 10 steps, ["
+                        << many << "] for 1000\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // Saved and loaded as the system it stands for, the jacobian by equation
+            std::stringstream buffer;
+            f.save(buffer);
+            auto loaded = rk::VectorExpression<double>::load(buffer);
+            auto jacobian = f.jacobian();
+            const std::vector<double> point = {0, 1.5, -2, 20};
+            if (loaded.evaluate(point) != f.evaluate(point) || rk::Expression<double>::linkedSystem(loaded) == nullptr
+                || jacobian.size() != 3 || jacobian[1][0]->evaluate(point) != 8 || loaded[2].evaluate(point) != f[2].evaluate(point)) {
+                logFile << "Loaded vector expression or its jacobian differ\n";
+                ++tmpErrCount;
+            }
+        }
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running vector expression tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running vector expression test 1\n";
+    return errCount;
+}
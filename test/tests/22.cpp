@@ -0,0 +1,125 @@
+#include <iostream>
+#include <cmath>
+#include <thread>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+int shared_program_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running shared program test 1\n";
+    size_t errCount = 0;
+    {   /*  COPIES SHARE THE PROGRAM AND THE NATIVE CODE */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning shared program tests...\n";
+        const std::string f = "y * ((sin(x)) / x + (cos(x)) / (x * x)) + pow(x, 3) * sin(y) - cos(x * y)";
+        {
+            // A copy is a few reference counts, whatever the size of the expression and its backend
+            for (auto backend: {rk::JitCompiler, rk::ExternalCompiler}) {
+                rk::Expression<double> e;
+                e.parse(f, {"x", "y"});
+                e.compile(backend);
+                tests_rk::CountAllocations counting;
+                size_t before = tests_rk::allocations;
+                rk::Expression<double> copy(e);
+                rk::Expression<double> assigned;
+                assigned = copy;
+                const size_t allocated = tests_rk::allocations - before;
+                if (allocated != 0 || copy.evaluate({0.5, 2}) != e.evaluate({0.5, 2})
+                    || assigned.evaluate({0.5, 2}) != e.evaluate({0.5, 2}) || !assigned.isNative()) {
+                    logFile << "Copies of [" << f << "] allocate [" << allocated << "] times or evaluate differently\n";
+                    ++tmpErrCount;
+                }
+            }
+        }
+        {
+            // Native code stays loaded while any copy uses it, and a parse of one copy leaves the others alone
+            rk::Expression<double> copy;
+            {
+                rk::Expression<double> original;
+                original.parse(f, {"x", "y"});
+                original.compile(rk::ExternalCompiler);
+                copy = original;
+                original.parse("x - y", {"x", "y"});
+                if (original.evaluate({3, 1}) != 2) {
+                    logFile << "Reparsed original gives [" << original.evaluate({3, 1}) << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+            rk::Expression<double> reference;
+            reference.parse(f, {"x", "y"});
+            if (!copy.isNative() || fabs(copy.evaluate({0.5, 2}) - reference.evaluate({0.5, 2})) > 1e-14) {
+                logFile << "Copy outliving a compiled original gives [" << copy.evaluate({0.5, 2}) << "]\n";
+                ++tmpErrCount;
+            }
+            // So does the fused rhs of a compiled system once its equations are gone
+            std::vector<std::shared_ptr<rk::Expression<double>>> system;
+            for (auto &eq: {"y", "-x"}) {
+                system.push_back(std::make_shared<rk::Expression<double>>());
+                system.back()->parse(eq, {"t", "x", "y"});
+            }
+            rk::Expression<double>::compileSystem(system);
+            std::vector<std::shared_ptr<rk::Expression<double>>> copies;
+            for (auto &e: system)
+                copies.push_back(std::make_shared<rk::Expression<double>>(*e));
+            system.clear();
+            auto got = rk::RK4SystemSolve<double>(copies, {0, 0, 1}, 1, 0.001);
+            if (rk::Expression<double>::linkedSystem(copies) == nullptr || fabs(got[1] - sin(1)) > 1e-9) {
+                logFile << "Copies of a compiled system give [" << got[1] << "], expected [" << sin(1) << "]\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // Copies made concurrently from threads sharing one expression
+            rk::Expression<double> e;
+            e.parse(f, {"x", "y"});
+            e.compile();
+            const double expected = e.evaluate({0.5, 2});
+            std::vector<size_t> wrong(4, 0);
+            std::vector<std::thread> threads;
+            for (size_t t = 0; t < wrong.size(); ++t) {
+                threads.emplace_back([&e, &wrong, t, expected]() {
+                    for (int i = 0; i < 10000; ++i) {
+                        rk::Expression<double> copy(e);
+                        wrong[t] += copy.evaluate({0.5, 2}) != expected;
+                    }
+                });
+            }
+            for (auto &t: threads)
+                t.join();
+            for (size_t t = 0; t < wrong.size(); ++t) {
+                if (wrong[t] != 0) {
+                    logFile << "Thread [" << t << "] got [" << wrong[t] << "] wrong results from copies\n";
+                    ++tmpErrCount;
+                }
+            }
+        }
+        {
+            // Single equation solvers evaluate the expression they are given: allocations grow neither with it
+            // nor with the number of steps
+            rk::Expression<double> small, large;
+            small.parse("y", {"x", "y"});
+            large.parse(f, {"x", "y"});
+            tests_rk::CountAllocations counting;
+            size_t before = tests_rk::allocations;
+            rk::RK3Solve<double>(small, {1, 1}, 1.1, 0.01);
+            const size_t forSmall = tests_rk::allocations - before;
+            before = tests_rk::allocations;
+            rk::RK3Solve<double>(large, {1, 1}, 2, 0.01);
+            const size_t forLarge = tests_rk::allocations - before;
+            auto adaptive = rk::ASRKDormandPrinceSolve<double>(small, {0, 1}, 1, 1e-6);
+            if (forSmall != forLarge || fabs(adaptive[1] - exp(1)) > 1e-4) {
+                logFile << "RK3Solve allocates [" << forSmall << "] times for 10 steps of [y], [" << forLarge
+                        << "] for 100 steps of [" << f << "], ASRKDormandPrinceSolve gives [" << adaptive[1] << "]\n";
+                ++tmpErrCount;
+            }
+        }
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running shared program tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running shared program test 1\n";
+    return errCount;
+}
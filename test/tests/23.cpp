@@ -0,0 +1,142 @@
+#include <iostream>
+#include <cmath>
+#include <thread>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+int module_registry_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running module registry test 1\n";
+    size_t errCount = 0;
+    {   /*  SHARED, BOUNDED AND THREAD-SAFE COMPILED MODULES */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning module registry tests...\n";
+        using Registry = rk::ModuleRegistry;
+        {
+            // Identical sources are built once and loaded once, the module goes away with its last user
+            const Registry::Statistics before = Registry::statistics();
+            {
+                rk::Expression<double> a, b;
+                a.parse("x * sin(y) + 17", {"x", "y"});
+                b.parse("x * sin(y) + 17", {"x", "y"});
+                a.compile(rk::ExternalCompiler);
+                b.compile(rk::ExternalCompiler);
+                const Registry::Statistics during = Registry::statistics();
+                if (during.builds - before.builds != 1 || during.shared - before.shared != 1
+                    || during.modules - before.modules != 1 || during.residentBytes <= before.residentBytes
+                    || a.evaluate({2, 1}) != b.evaluate({2, 1})) {
+                    logFile << "Two compiles of one source ran [" << during.builds - before.builds << "] builds and left ["
+                            << during.modules - before.modules << "] modules\n";
+                    ++tmpErrCount;
+                }
+            }
+            if (Registry::statistics().modules != before.modules) {
+                logFile << "Modules of destroyed expressions are still alive\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // Compiles from several threads, every source built once however many threads ask for it
+            const Registry::Statistics before = Registry::statistics();
+            const std::vector<std::string> sources = {"x + 3 * y", "x - 3 * y", "x * y * 3"};
+            std::vector<rk::Expression<double>> expressions(8);
+            std::vector<std::thread> threads;
+            for (size_t t = 0; t < expressions.size(); ++t) {
+                threads.emplace_back([&expressions, &sources, t]() {
+                    expressions[t].parse(sources[t % sources.size()], {"x", "y"});
+                    expressions[t].compile(rk::ExternalCompiler);
+                });
+            }
+            for (auto &t: threads)
+                t.join();
+            const Registry::Statistics during = Registry::statistics();
+            if (during.builds - before.builds != sources.size() || during.modules - before.modules != sources.size()) {
+                logFile << "Concurrent compiles of [" << sources.size() << "] sources ran ["
+                        << during.builds - before.builds << "] builds\n";
+                ++tmpErrCount;
+            }
+            const double expected[] = {5, -1, 6};
+            for (size_t t = 0; t < expressions.size(); ++t) {
+                if (!expressions[t].isNative() || expressions[t].evaluate({2, 1}) != expected[t % sources.size()]) {
+                    logFile << "Concurrently compiled [" << sources[t % sources.size()] << "] gives ["
+                            << expressions[t].evaluate({2, 1}) << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+        }
+        {
+            // Over the limit the least recently used modules are unloaded and loaded again on their next use
+            Registry::setMaxResident(2);
+            const Registry::Statistics before = Registry::statistics();
+            std::vector<rk::Expression<double>> expressions(5);
+            for (size_t i = 0; i < expressions.size(); ++i) {
+                expressions[i].parse("x * " + std::to_string(i + 2) + " - cos(y)", {"x", "y"});
+                expressions[i].compile(rk::ExternalCompiler);
+            }
+            std::vector<size_t> wrong(4, 0);
+            std::vector<std::thread> threads;
+            for (size_t t = 0; t < wrong.size(); ++t) {
+                threads.emplace_back([&expressions, &wrong, t]() {
+                    for (int i = 0; i < 2000; ++i) {
+                        size_t j = (t + (size_t) i) % expressions.size();
+                        wrong[t] += expressions[j].evaluate({1, 0}) != (double) (j + 2) - 1;
+                    }
+                });
+            }
+            for (auto &t: threads)
+                t.join();
+            for (size_t t = 0; t < wrong.size(); ++t) {
+                if (wrong[t] != 0) {
+                    logFile << "Thread [" << t << "] got [" << wrong[t] << "] wrong results from evicted modules\n";
+                    ++tmpErrCount;
+                }
+            }
+            // A compiled system is evicted and reloaded through its fused rhs as well
+            std::vector<std::shared_ptr<rk::Expression<double>>> system;
+            for (auto &eq: {"y", "-x"}) {
+                system.push_back(std::make_shared<rk::Expression<double>>());
+                system.back()->parse(eq, {"t", "x", "y"});
+            }
+            rk::Expression<double>::compileSystem(system);
+            for (auto &e: expressions)
+                e.evaluate({1, 0});
+            auto got = rk::RK4SystemSolve<double>(system, {0, 0, 1}, 1, 0.001);
+            const Registry::Statistics during = Registry::statistics();
+            if (during.resident > 2 || during.evictions == before.evictions || during.reloads == before.reloads
+                || fabs(got[1] - sin(1)) > 1e-9) {
+                logFile << "Limit of 2 left [" << during.resident << "] modules resident after ["
+                        << during.evictions - before.evictions << "] evictions and ["
+                        << during.reloads - before.reloads << "] reloads, system gives [" << got[1] << "]\n";
+                ++tmpErrCount;
+            }
+            Registry::setMaxResident(0);
+        }
+        {
+            // Modules loaded before the limit fill it, a new one is unloaded as soon as it is loaded and still compiles
+            std::vector<rk::Expression<double>> unlimited(2), limited(2);
+            for (size_t i = 0; i < unlimited.size(); ++i) {
+                unlimited[i].parse("x * " + std::to_string(i + 7) + " + y", {"x", "y"});
+                unlimited[i].compile(rk::ExternalCompiler);
+            }
+            Registry::setMaxResident(1);
+            for (size_t i = 0; i < limited.size(); ++i) {
+                limited[i].parse("x * " + std::to_string(i + 9) + " + y", {"x", "y"});
+                if (!limited[i].compile(rk::ExternalCompiler) || !limited[i].isNative()
+                    || limited[i].evaluate({1, 1}) != (double) (i + 10)) {
+                    logFile << "Module evicted on load gives [" << limited[i].evaluate({1, 1}) << "], expected ["
+                            << i + 10 << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+            Registry::setMaxResident(0);
+        }
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running module registry tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running module registry test 1\n";
+    return errCount;
+}
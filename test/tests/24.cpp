@@ -0,0 +1,111 @@
+#include <iostream>
+#include <cmath>
+#include <filesystem>
+#include <set>
+#include "../../src/expression/Expression.h"
+#include "../Tests.h"
+
+int in_memory_compile_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running in-memory compile test 1\n";
+    size_t errCount = 0;
+    {   /*  COMPILES WITHOUT SCRATCH FILES */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning in-memory compile tests...\n";
+        auto listing = []() {
+            std::set<std::string> names;
+            for (auto &f: std::filesystem::directory_iterator("."))
+                names.insert(f.path().filename().string());
+            return names;
+        };
+        {
+            // Neither the source nor the shared object is written to the working directory, for single
+            // expressions and systems alike, while the modules are loaded and after they are gone
+            const bool cache = rk::ModuleCache::enabled();
+            const std::string cacheDirectory = rk::ModuleCache::directory();
+            rk::ModuleCache::disable();
+            const auto before = listing();
+            {
+                rk::Expression<double> e;
+                e.parse("x * x - 2 * sin(y) + 0.125", {"x", "y"});
+                std::vector<std::shared_ptr<rk::Expression<double>>> system;
+                for (auto &eq: {"y + 0.25", "-x - 0.25"}) {
+                    system.push_back(std::make_shared<rk::Expression<double>>());
+                    system.back()->parse(eq, {"t", "x", "y"});
+                }
+                if (!e.compile(rk::ExternalCompiler) || !rk::Expression<double>::compileSystem(system)
+                    || fabs(e.evaluate({3, 1}) - (9.125 - 2 * sin(1))) > 1e-14 || system[1]->evaluate({0, 1, 2}) != -1.25) {
+                    logFile << "Compiled in memory [x * x - 2 * sin(y) + 0.125] gives [" << e.evaluate({3, 1}) << "]\n";
+                    ++tmpErrCount;
+                }
+                if (listing() != before) {
+                    logFile << "Compiling wrote to the working directory\n";
+                    ++tmpErrCount;
+                }
+            }
+            if (listing() != before) {
+                logFile << "Unloaded modules left files in the working directory\n";
+                ++tmpErrCount;
+            }
+            if (cache)
+                rk::ModuleCache::setDirectory(cacheDirectory);
+        }
+        if (std::filesystem::exists("/proc/self/fd")) {
+            // Loaded modules keep no descriptor open, and a descriptor number given out again is a new module
+            const bool cache = rk::ModuleCache::enabled();
+            const std::string cacheDirectory = rk::ModuleCache::directory();
+            rk::ModuleCache::disable();
+            auto descriptors = []() {
+                size_t count = 0;
+                for (auto &f: std::filesystem::directory_iterator("/proc/self/fd"))
+                    count += !f.path().empty();
+                return count;
+            };
+            const size_t before = descriptors();
+            std::vector<rk::Expression<double>> expressions(20);
+            for (size_t i = 0; i < expressions.size(); ++i) {
+                expressions[i].parse("x * " + std::to_string(i) + " + 0.5", {"x"});
+                expressions[i].compile(rk::ExternalCompiler);
+            }
+            const size_t loaded = descriptors();
+            for (size_t i = 0; i < expressions.size(); ++i) {
+                if (!expressions[i].isNative() || expressions[i].evaluate({2}) != 2.0 * i + 0.5) {
+                    logFile << "Module [" << i << "] gives [" << expressions[i].evaluate({2}) << "], expected ["
+                            << 2.0 * i + 0.5 << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+            if (loaded != before) {
+                logFile << "[" << expressions.size() << "] loaded modules hold [" << loaded - before
+                        << "] descriptors\n";
+                ++tmpErrCount;
+            }
+            if (cache)
+                rk::ModuleCache::setDirectory(cacheDirectory);
+        }
+        {
+            // Evicted modules come back from their anonymous files
+            rk::ModuleRegistry::setMaxResident(1);
+            rk::Expression<double> a, b;
+            a.parse("x / 8 + y", {"x", "y"});
+            b.parse("x / 8 - y", {"x", "y"});
+            a.compile(rk::ExternalCompiler);
+            b.compile(rk::ExternalCompiler);
+            double sum = 0;
+            for (int i = 0; i < 10; ++i)
+                sum += a.evaluate({8, 1}) + b.evaluate({8, 1});
+            rk::ModuleRegistry::setMaxResident(0);
+            if (sum != 20) {
+                logFile << "Reloaded modules give [" << sum << "], expected [20]\n";
+                ++tmpErrCount;
+            }
+        }
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running in-memory compile tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running in-memory compile test 1\n";
+    return errCount;
+}
@@ -0,0 +1,97 @@
+#include <iostream>
+#include <cmath>
+#include "../../src/expression/Expression.h"
+#include "../../src/expression/Dual.h"
+#include "../Tests.h"
+
+int compile_options_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running compile options test 1\n";
+    size_t errCount = 0;
+    {   /*  COMPILER SETTINGS AND AUTO-TUNING */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning compile options tests...\n";
+        {
+            // The defaults are the strict build, every option adds its flags
+            rk::CompileOptions strict, fast;
+            fast.optimization = 3;
+            fast.nativeArchitecture = true;
+            fast.contractFma = true;
+            fast.noMathErrno = true;
+            fast.vectorWidth = 256;
+            const std::string flags = fast.flags();
+            if (strict.flags() != "-shared -fPIC -O2 -ffp-contract=off" || flags.find("-O3") == std::string::npos
+                || flags.find("-march=native") == std::string::npos || flags.find("-ffp-contract=fast") == std::string::npos
+                || flags.find("-fno-math-errno") == std::string::npos
+                || flags.find("-mprefer-vector-width=256") == std::string::npos || strict == fast) {
+                logFile << "Compile options give [" << strict.flags() << "] and [" << flags << "]\n";
+                ++tmpErrCount;
+            }
+            // Built with them, expressions and systems give what the interpreter gives
+            rk::Expression<double> e;
+            e.parse("x * y + sin(x) * 1.5 - y / 4", {"x", "y"});
+            e.setCompileOptions(fast);
+            if (!e.compile(rk::ExternalCompiler) || !e.isNative() || e.compileOptions() != fast
+                || fabs(e.evaluate({0.5, 2}) - e.interpret({0.5, 2})) > 1e-14) {
+                logFile << "Expression built with [" << flags << "] gives [" << e.evaluate({0.5, 2}) << "]\n";
+                ++tmpErrCount;
+            }
+            std::vector<std::shared_ptr<rk::Expression<double>>> system;
+            for (auto &eq: {"x * 3 + y", "y * 3 - x"}) {
+                system.push_back(std::make_shared<rk::Expression<double>>());
+                system.back()->parse(eq, {"t", "x", "y"});
+            }
+            if (!rk::Expression<double>::compileSystem(system, fast) || system[1]->evaluate({0, 1, 2}) != 5) {
+                logFile << "System built with [" << flags << "] gives [" << system[1]->evaluate({0, 1, 2}) << "]\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // The fastest accurate variant wins, variants off by more than the tolerance never do
+            rk::Expression<double> e;
+            e.parse("y * ((sin(x)) / x + (cos(x)) / (x * x)) + x / 3", {"x", "y"});
+            std::vector<std::vector<double>> samples;
+            for (int i = 1; i <= 64; ++i)
+                samples.push_back({0.1 * i, 1.0 / i});
+            const auto candidates = rk::CompileOptions::candidates();
+            if (!e.autoTune(samples) || !e.isNative()
+                || std::find(candidates.begin(), candidates.end(), e.compileOptions()) == candidates.end()) {
+                logFile << "Auto-tuning over [" << candidates.size() << "] candidates found nothing, kept ["
+                        << e.compileOptions().flags() << "]\n";
+                ++tmpErrCount;
+            }
+            for (auto &s: samples) {
+                if (fabs(e.evaluate(s) - e.interpret(s)) > 1e-12 * std::max(1.0, fabs(e.interpret(s)))) {
+                    logFile << "Tuned [" << e.compileOptions().flags() << "] gives [" << e.evaluate(s) << "] at ["
+                            << s[0] << "], expected [" << e.interpret(s) << "]\n";
+                    ++tmpErrCount;
+                    break;
+                }
+            }
+            // x / 3 multiplied by the rounded reciprocal is off in the last bit at 5
+            rk::CompileOptions reciprocal;
+            reciprocal.reciprocalMath = true;
+            rk::Expression<double> divided;
+            divided.parse("x / 3", {"x"});
+            if (divided.autoTune({{5}}, 0, {reciprocal}) || divided.isNative() || divided.compileOptions() == reciprocal
+                || !divided.autoTune({{5}}, 1e-15, {reciprocal}) || divided.compileOptions() != reciprocal) {
+                logFile << "Auto-tuning [x / 3] does not respect its tolerance\n";
+                ++tmpErrCount;
+            }
+            // Numbers the generated code does not know stay interpreted
+            rk::Expression<rk::Dual<double>> dual;
+            dual.parse("x * x", {"x"}, rk::stringToDual<double>);
+            if (dual.autoTune({{rk::Dual<double>(2)}}) || dual.isNative()) {
+                logFile << "Auto-tuning a dual expression claims native code\n";
+                ++tmpErrCount;
+            }
+        }
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running compile options tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running compile options test 1\n";
+    return errCount;
+}
@@ -0,0 +1,139 @@
+#include <iostream>
+#include <cmath>
+#include <sstream>
+#include <thread>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+int shared_nodes_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running shared nodes test 1\n";
+    size_t errCount = 0;
+    {   /*  HASH-CONSED EXPRESSION NODES */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning shared nodes tests...\n";
+        using Store = rk::NodeStore<double>;
+        {
+            // Shared equations cost less, give the same values and free their nodes when they are gone
+            const Store::Statistics before = Store::statistics();
+            auto plain = tests_rk::equation_family<double>(200);
+            Store::enable();
+            auto shared = tests_rk::equation_family<double>(200);
+            Store::disable();
+            const Store::Statistics during = Store::statistics();
+            size_t plainBytes = 0, sharedBytes = 0;
+            for (size_t i = 0; i < plain.size(); ++i) {
+                plainBytes += plain[i]->memoryUsage().total();
+                sharedBytes += shared[i]->memoryUsage().total();
+            }
+            if (sharedBytes * 2 > plainBytes || during.hits == before.hits
+                || during.nodes - before.nodes > 3 * shared.size() + 30) {
+                logFile << "200 shared equations take [" << sharedBytes << "] bytes and [" << during.nodes - before.nodes
+                        << "] nodes, unshared [" << plainBytes << "] bytes\n";
+                ++tmpErrCount;
+            }
+            if (shared[0]->memoryUsage().tokens != 0 || shared[0]->memoryUsage().program != 0
+                || shared[0]->memoryUsage().nodes.sharedNodes == 0) {
+                logFile << "Shared equation still keeps its tokens or program\n";
+                ++tmpErrCount;
+            }
+            for (double x: {-1.5, 0.25, 2.0}) {
+                for (size_t i = 0; i < plain.size(); i += 37) {
+                    double expected = plain[i]->evaluate({0, x, 0.5}), got = shared[i]->evaluate({0, x, 0.5});
+                    if (fabs(got - expected) > 1e-14 * std::max(1.0, fabs(expected))
+                        || shared[i]->interpret({0, x, 0.5}) != got) {
+                        logFile << "Shared equation [" << i << "] gives [" << got << "] at x = [" << x
+                                << "], expected [" << expected << "]\n";
+                        ++tmpErrCount;
+                    }
+                }
+            }
+            shared.clear();
+            if (Store::statistics().nodes != before.nodes || Store::statistics().bytes != before.bytes) {
+                logFile << "Nodes of destroyed equations are still alive\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // Unlinked shared equations of a system are evaluated in one pass over their nodes
+            const std::vector<std::string> equations = {"y * cos(x * y) + 1", "-x * cos(x * y) + 1"};
+            std::vector<std::shared_ptr<rk::Expression<double>>> plain, shared;
+            for (auto &eq: equations) {
+                plain.push_back(std::make_shared<rk::Expression<double>>());
+                plain.back()->parse(eq, {"t", "x", "y"});
+            }
+            Store::enable();
+            for (auto &eq: equations) {
+                shared.push_back(std::make_shared<rk::Expression<double>>());
+                shared.back()->parse(eq, {"t", "x", "y"});
+            }
+            Store::disable();
+            auto expected = rk::RK4SystemSolve<double>(plain, {0, 0.5, 0.25}, 1, 0.001);
+            auto got = rk::RK4SystemSolve<double>(shared, {0, 0.5, 0.25}, 1, 0.001);
+            if (fabs(got[1] - expected[1]) > 1e-12 || fabs(got[2] - expected[2]) > 1e-12) {
+                logFile << "Shared system gives [" << got[1] << ", " << got[2] << "], expected ["
+                        << expected[1] << ", " << expected[2] << "]\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // The program comes back for compile, derivative, save and link
+            Store::enable();
+            rk::Expression<double> e;
+            e.parse("x * x * y + sin(y)", {"x", "y"});
+            rk::Expression<double> dx = e.derivative(0);
+            std::stringstream buffer;
+            e.save(buffer);
+            rk::Expression<double> loaded = rk::Expression<double>::load(buffer);
+            std::vector<std::shared_ptr<rk::Expression<double>>> system = {
+                    std::make_shared<rk::Expression<double>>(e), std::make_shared<rk::Expression<double>>(dx)};
+            bool linked = rk::Expression<double>::linkSystem(system);
+            Store::disable();
+            const double expected = 9 * 2 + sin(2);
+            double out[2] = {0, 0};
+            rk::Expression<double>::evaluateSystem(system, rk::Expression<double>::linkedSystem(system), {3, 2}, out);
+            if (fabs(dx.evaluate({3, 2}) - 12) > 1e-14 || fabs(loaded.evaluate({3, 2}) - expected) > 1e-14
+                || loaded.memoryUsage().nodes.order == 0 || !linked || fabs(out[0] - expected) > 1e-14 || out[1] != 12) {
+                logFile << "Derivative, loaded and linked copies of a shared expression give [" << dx.evaluate({3, 2})
+                        << "], [" << loaded.evaluate({3, 2}) << "], [" << out[0] << ", " << out[1] << "]\n";
+                ++tmpErrCount;
+            }
+            if (!e.compile(rk::ExternalCompiler) || fabs(e.evaluate({3, 2}) - expected) > 1e-14) {
+                logFile << "Compiled shared expression gives [" << e.evaluate({3, 2}) << "]\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // Threads parse and evaluate over one store
+            Store::enable();
+            std::vector<size_t> wrong(4, 0);
+            std::vector<std::thread> threads;
+            for (size_t t = 0; t < wrong.size(); ++t) {
+                threads.emplace_back([&wrong, t]() {
+                    for (int i = 0; i < 200; ++i) {
+                        rk::Expression<double> e;
+                        e.parse("cos(x) * x + " + std::to_string(i % 7), {"x"});
+                        wrong[t] += e.evaluate({0}) != i % 7;
+                    }
+                });
+            }
+            for (auto &t: threads)
+                t.join();
+            Store::disable();
+            for (size_t t = 0; t < wrong.size(); ++t) {
+                if (wrong[t] != 0) {
+                    logFile << "Thread [" << t << "] got [" << wrong[t] << "] wrong results from shared nodes\n";
+                    ++tmpErrCount;
+                }
+            }
+        }
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running shared nodes tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running shared nodes test 1\n";
+    return errCount;
+}
@@ -0,0 +1,99 @@
+#include <iostream>
+#include <cmath>
+#include <sstream>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+int profiling_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running profiling test 1\n";
+    size_t errCount = 0;
+    {   /*  EVALUATION AND COMPILE PROFILES */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning profiling tests...\n";
+        {
+            // Off, nothing is recorded
+            rk::Expression<double> e;
+            e.parse("x * y + sin(x)", {"x", "y"});
+            e.evaluate({1, 2});
+            rk::Profile p = e.profile();
+            if (p.interpreted != 0 || p.native != 0 || p.compiles != 0 || !p.estimatedOperations.empty()) {
+                logFile << "Expression without profiling reports [" << p.interpreted << "] evaluations\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // Interpreted evaluations, batches, solver copies and timing samples
+            rk::Expression<double> e;
+            e.parse("x * y + sin(x)", {"x", "y"});
+            e.enableProfiling(50);
+            double sink = 0;
+            for (int i = 0; i < 1000; ++i)
+                sink += e.evaluate({0.001 * i, 2});
+            std::vector<double> xs(100, 0.5), ys(100, 2), results(100);
+            e.evaluateBatch({xs.data(), ys.data()}, results.data(), xs.size());
+            rk::Profile p = e.profile();
+            // A period of 50 is rounded to 64: calls 0, 64, ..., 960 are timed, the batch is call 1000
+            if (p.interpreted != 1100 || p.native != 0 || p.timed != 16 || p.timedSeconds <= 0
+                || p.estimatedOperations["*"] != 1100 || p.estimatedOperations["sin"] != 1100 || p.estimatedOperations.count("cos") != 0
+                || fabs(p.estimatedSeconds() - p.timedSeconds * 1100 / 16) > 1e-12 || std::isnan(sink)) {
+                logFile << "1000 evaluations and a batch of 100 give [" << p << "]\n";
+                ++tmpErrCount;
+            }
+            rk::RK4Solve<double>(e, {0, 1}, 1, 0.01);
+            if (e.profile().interpreted < 1100 + 400) {
+                logFile << "Solver evaluations of a copy are not counted, profile [" << e.profile() << "]\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // Compiles split into code generation, the compiler and loading, native evaluations apart
+            rk::Expression<double> e, same;
+            e.parse("x * y - cos(y) / 3", {"x", "y"});
+            same.parse("x * y - cos(y) / 3", {"x", "y"});
+            e.enableProfiling();
+            same.enableProfiling();
+            e.compile(rk::ExternalCompiler);
+            same.compile(rk::ExternalCompiler);
+            for (int i = 0; i < 10; ++i)
+                e.evaluate({1, 2});
+            rk::Profile p = e.profile(), shared = same.profile();
+            if (p.compiles != 1 || p.codegenSeconds <= 0 || p.compilerSeconds <= 0 || p.loadSeconds <= 0
+                || p.native != 10 || p.interpreted != 0) {
+                logFile << "Compiled expression reports [" << p << "]\n";
+                ++tmpErrCount;
+            }
+            if (shared.compiles != 1 || shared.compilerSeconds != 0 || shared.loadSeconds != 0) {
+                logFile << "Compile of a module already loaded reports [" << shared << "]\n";
+                ++tmpErrCount;
+            }
+            e.compile(rk::JitCompiler);
+            p = e.profile();
+            if (p.compiles != 2 || (e.isNative() && p.codegenSeconds <= 0)) {
+                logFile << "JIT compile reports [" << p << "]\n";
+                ++tmpErrCount;
+            }
+            std::stringstream report;
+            report << p;
+            if (report.str().find("\"native\": 10") == std::string::npos || report.str().front() != '{'
+                || report.str().back() != '}') {
+                logFile << "Report reads [" << report.str() << "]\n";
+                ++tmpErrCount;
+            }
+            e.disableProfiling();
+            e.evaluate({1, 2});
+            if (e.profile().native != 0) {
+                logFile << "Disabled profiling still counts\n";
+                ++tmpErrCount;
+            }
+        }
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running profiling tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running profiling test 1\n";
+    return errCount;
+}
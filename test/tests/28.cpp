@@ -0,0 +1,138 @@
+#include <iostream>
+#include <cmath>
+#include <thread>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+int parse_cache_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running parse cache test 1\n";
+    size_t errCount = 0;
+    {   /*  PROCESS-WIDE PARSE CACHE */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning parse cache tests...\n";
+        using E = rk::Expression<double>;
+        {
+            // Hits up to whitespace and case, misses for other variables, settings or sources
+            E::enableParseCache(4);
+            const E::ParseCacheStatistics before = E::parseCacheStatistics();
+            E a, b, c, d;
+            a.parse("2 * x + sin( y )", {"x", "y"});
+            b.parse("2*X+Sin(y)", {"x", "y"});
+            c.parse("2 * x + sin(y)", {"y", "x"});
+            d.setReciprocalDivision(true);
+            d.parse("2 * x + sin(y)", {"x", "y"});
+            E::ParseCacheStatistics after = E::parseCacheStatistics();
+            if (after.hits - before.hits != 1 || after.misses - before.misses != 3 || after.entries != 3
+                || after.capacity != 4) {
+                logFile << "Four parses give [" << after.hits - before.hits << "] hits and ["
+                        << after.misses - before.misses << "] misses\n";
+                ++tmpErrCount;
+            }
+            if (b.evaluate({1.5, 0.5}) != a.evaluate({1.5, 0.5}) || c.evaluate({0.5, 1.5}) != a.evaluate({1.5, 0.5})) {
+                logFile << "Cached parse gives [" << b.evaluate({1.5, 0.5}) << "], expected ["
+                        << a.evaluate({1.5, 0.5}) << "]\n";
+                ++tmpErrCount;
+            }
+            // Failed parses are not cached
+            for (int i = 0; i < 2; ++i) {
+                try {
+                    a.parse("x + (y", {"x", "y"});
+                    logFile << "Broken source parsed from the cache\n";
+                    ++tmpErrCount;
+                } catch (std::logic_error&) {}
+            }
+            if (E::parseCacheStatistics().misses - after.misses != 2) {
+                logFile << "Failed parse was cached\n";
+                ++tmpErrCount;
+            }
+            E::disableParseCache();
+        }
+        {
+            // The least recently parsed go first, x + 0 is parsed after every other source and is never evicted
+            E::enableParseCache(3);
+            const E::ParseCacheStatistics before = E::parseCacheStatistics();
+            E e;
+            for (int i = 0; i < 5; ++i) {
+                e.parse("x + " + std::to_string(i), {"x"});
+                e.parse("x + 0", {"x"});
+            }
+            e.parse("x + 1", {"x"});
+            const E::ParseCacheStatistics after = E::parseCacheStatistics();
+            if (after.entries != 3 || after.evictions - before.evictions != 3 || after.hits - before.hits != 5
+                || e.evaluate({1}) != 2) {
+                logFile << "Cache of 3 keeps [" << after.entries << "] entries after ["
+                        << after.evictions - before.evictions << "] evictions and [" << after.hits - before.hits
+                        << "] hits\n";
+                ++tmpErrCount;
+            }
+            E::disableParseCache();
+            e.parse("x + 0", {"x"});
+            if (E::parseCacheStatistics().entries != 0 || E::parseCacheStatistics().hits != after.hits) {
+                logFile << "Disabled cache still serves parses\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // A cache hit takes the native code of the first compile
+            E::enableParseCache();
+            for (auto backend: {rk::ExternalCompiler, rk::JitCompiler}) {
+                const E::ParseCacheStatistics before = E::parseCacheStatistics();
+                E first, second;
+                first.parse("x * x - cos(x) / 7", {"x"});
+                if (!first.compile(backend))
+                    continue;
+                second.parse("x * x - cos(x) / 7", {"x"});
+                second.enableProfiling();
+                bool compiled = second.compile(backend);
+                const E::ParseCacheStatistics after = E::parseCacheStatistics();
+                if (!compiled || !second.isNative() || after.nativeHits - before.nativeHits != 1
+                    || second.profile().codegenSeconds != 0 || second.evaluate({2}) != first.evaluate({2})) {
+                    logFile << "Compile of a cached program with backend [" << backend << "] took ["
+                            << after.nativeHits - before.nativeHits << "] native hits\n";
+                    ++tmpErrCount;
+                }
+            }
+            E::disableParseCache();
+        }
+        {
+            // Threads parse the same sources
+            E::enableParseCache(8);
+            const E::ParseCacheStatistics before = E::parseCacheStatistics();
+            std::vector<size_t> wrong(4, 0);
+            std::vector<std::thread> threads;
+            for (size_t t = 0; t < wrong.size(); ++t) {
+                threads.emplace_back([&wrong, t]() {
+                    for (int i = 0; i < 200; ++i) {
+                        E e;
+                        e.parse("cos(x) * x + " + std::to_string(i % 10), {"x"});
+                        wrong[t] += e.evaluate({0}) != i % 10;
+                    }
+                });
+            }
+            for (auto &t: threads)
+                t.join();
+            const E::ParseCacheStatistics after = E::parseCacheStatistics();
+            for (size_t t = 0; t < wrong.size(); ++t) {
+                if (wrong[t] != 0) {
+                    logFile << "Thread [" << t << "] got [" << wrong[t] << "] wrong results from cached parses\n";
+                    ++tmpErrCount;
+                }
+            }
+            if (after.hits + after.misses - before.hits - before.misses != 800 || after.entries != 8) {
+                logFile << "800 parses from threads counted [" << after.hits - before.hits << "] hits and ["
+                        << after.misses - before.misses << "] misses\n";
+                ++tmpErrCount;
+            }
+            E::disableParseCache();
+        }
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running parse cache tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running parse cache test 1\n";
+    return errCount;
+}
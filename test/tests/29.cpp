@@ -0,0 +1,213 @@
+#include <iostream>
+#include <cmath>
+#include <thread>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+int table_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running table test 1\n";
+    size_t errCount = 0;
+    {   /*  TABULATED DATA LOOKUP */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning table tests...\n";
+        using Table = rk::Table<double>;
+        {
+            // Linear interpolation, values outside of the samples are kept
+            Table steps({0, 1, 3, 4}, {0, 2, 2, 6});
+            std::vector<std::pair<double, double>> expected = {{0.5, 1}, {2, 2}, {3.5, 4}, {1, 2}, {-1, 0},
+                                                               {5, 6}, {3.75, 5}, {0.25, 0.5}};
+            for (auto &[x, y]: expected) {
+                if (fabs(steps(x) - y) > 1e-15) {
+                    logFile << "Linear table gives [" << steps(x) << "] at [" << x << "], expected [" << y << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+            if (steps.uniform() || !Table(0, 0.5, {1, 2, 3}).uniform()
+                || !Table({1, 1.5, 2, 2.5}, {0, 0, 0, 0}).uniform() || !std::isnan(steps(NAN))) {
+                logFile << "Uniform grids are not told from the others\n";
+                ++tmpErrCount;
+            }
+            size_t thrown = 0;
+            for (auto &bad: std::vector<std::pair<std::vector<double>, std::vector<double>>>{
+                    {{0, 1, 1}, {0, 1, 2}}, {{0, 1}, {0, 1, 2}}, {{0}, {1}}}) {
+                try {
+                    Table table(bad.first, bad.second);
+                } catch (std::logic_error&) {
+                    ++thrown;
+                }
+            }
+            if (thrown != 3) {
+                logFile << "Only [" << thrown << "] of 3 broken tables were refused\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // Cubic is closer than linear, on uniform and non-uniform grids alike
+            std::vector<double> xs, ys, skewed;
+            for (int i = 0; i <= 40; ++i) {
+                xs.push_back(M_PI * i / 40);
+                skewed.push_back(M_PI * (i / 40.0) * (i / 40.0));
+            }
+            for (double x: xs)
+                ys.push_back(sin(x));
+            std::vector<double> skewedY;
+            for (double x: skewed)
+                skewedY.push_back(sin(x));
+            Table linear(xs, ys), cubic(xs, ys, rk::CubicInterpolation);
+            Table cubicSkewed(skewed, skewedY, rk::CubicInterpolation);
+            double linearError = 0, cubicError = 0, skewedError = 0;
+            for (int i = 0; i < 1000; ++i) {
+                double x = 0.1 + 2.9 * i / 1000;
+                linearError = std::max(linearError, fabs(linear(x) - sin(x)));
+                cubicError = std::max(cubicError, fabs(cubic(x) - sin(x)));
+                skewedError = std::max(skewedError, fabs(cubicSkewed(x) - sin(x)));
+            }
+            if (!cubic.uniform() || cubicSkewed.uniform() || linearError > 1e-3 || cubicError > 1e-5
+                || skewedError > 1e-4 || cubic(xs[7]) != ys[7]) {
+                logFile << "Errors of sin tables: linear [" << linearError << "], cubic [" << cubicError
+                        << "], cubic non-uniform [" << skewedError << "]\n";
+                ++tmpErrCount;
+            }
+
+            // Interpreted and compiled expressions give the same numbers
+            rk::Expression<double>::addTable("tabsin", std::make_shared<const Table>(xs, ys, rk::CubicInterpolation));
+            rk::Expression<double>::addTable("TabSkewed",
+                                             std::make_shared<const Table>(skewed, skewedY, rk::CubicInterpolation));
+            rk::Expression<double>::addTable("tabsteps", std::make_shared<const Table>(
+                    std::vector<double>{0, 1, 3, 4}, std::vector<double>{0, 2, 2, 6}));
+            rk::Expression<double> e;
+            e.parse("tabsin(x) * y + tabskewed(x) - tabsteps(x + 1)", {"x", "y"});
+            std::vector<std::vector<double>> points;
+            for (int i = -5; i < 40; ++i)
+                points.push_back({0.1 * i, 1.5});
+            std::vector<double> interpreted;
+            for (auto &p: points)
+                interpreted.push_back(e.evaluate(p));
+            for (auto backend: {rk::ExternalCompiler, rk::JitCompiler}) {
+                if (!e.compile(backend) || !e.isNative()) {
+                    logFile << "Expression over tables does not compile with backend [" << backend << "]\n";
+                    ++tmpErrCount;
+                    continue;
+                }
+                std::vector<double> xs(points.size()), ys(points.size(), 1.5), batch(points.size());
+                for (size_t i = 0; i < points.size(); ++i)
+                    xs[i] = points[i][0];
+                e.evaluateBatch({xs.data(), ys.data()}, batch.data(), points.size());
+                for (size_t i = 0; i < points.size(); ++i) {
+                    double got = e.evaluate(points[i]);
+                    if (fabs(got - interpreted[i]) > 1e-14 || fabs(batch[i] - interpreted[i]) > 1e-14) {
+                        logFile << "Compiled table gives [" << got << "] and [" << batch[i] << "] at ["
+                                << points[i][0] << "], interpreted [" << interpreted[i] << "]\n";
+                        ++tmpErrCount;
+                        break;
+                    }
+                }
+            }
+        }
+        {
+            // Measured forcing: y' = cos(t) tabulated gives y = sin(t), up to the natural ends of the spline
+            std::vector<double> samples;
+            for (int i = 0; i <= 200; ++i)
+                samples.push_back(cos(0.01 * i));
+            rk::Expression<double>::addTable("forcing", std::make_shared<const Table>(0, 0.01, samples,
+                                                                                      rk::CubicInterpolation));
+            rk::Expression<double> rhs;
+            rhs.parse("forcing(t)", {"t", "y"});
+            auto interpreted = rk::RK4Solve<double>(rhs, {0, 0}, 1.5, 0.001);
+            rhs.compile(rk::ExternalCompiler);
+            auto compiled = rk::RK4Solve<double>(rhs, {0, 0}, 1.5, 0.001);
+            if (fabs(interpreted[1] - sin(1.5)) > 1e-6 || fabs(compiled[1] - interpreted[1]) > 1e-13) {
+                logFile << "Tabulated forcing gives [" << interpreted[1] << "] interpreted and [" << compiled[1]
+                        << "] compiled, expected [" << sin(1.5) << "]\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // Duals carry the slope of the table
+            using D = rk::Dual<double>;
+            rk::Expression<D>::addTable("dualsteps", std::make_shared<const rk::Table<D>>(
+                    std::vector<D>{0, 1, 3, 4}, std::vector<D>{0, 2, 2, 6}));
+            rk::Expression<D> e;
+            e.parse("dualsteps(x) * x", {"x"}, rk::stringToDual<double>);
+            D got = e.evaluate({D(0.5, {1})}), flat = e.evaluate({D(2, {1})});
+            if (fabs(got.value - 0.5) > 1e-15 || fabs(got.derivative[0] - 2) > 1e-15
+                || fabs(flat.derivative[0] - 2) > 1e-15) {
+                logFile << "Dual lookup gives [" << got << "] and [" << flat << "]\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // A replaced table is looked up again by cached parses, a removed one is not found, expressions parsed
+            // before keep their table
+            using E = rk::Expression<double>;
+            E::enableParseCache();
+            E::addTable("replaced", std::make_shared<const Table>(std::vector<double>{0, 1}, std::vector<double>{0, 1}));
+            E before, cached;
+            before.parse("replaced(x) + 1", {"x"});
+            E::replaceTable("Replaced", std::make_shared<const Table>(std::vector<double>{0, 1},
+                                                                      std::vector<double>{0, 3}));
+            cached.parse("replaced(x) + 1", {"x"});
+            E::removeTable("replaced");
+            size_t thrown = 0;
+            try {
+                E gone;
+                gone.parse("replaced(x) + 1", {"x"});
+            } catch (std::logic_error&) {
+                ++thrown;
+            }
+            try {
+                E::removeTable("replaced");
+            } catch (std::logic_error&) {
+                ++thrown;
+            }
+            E::replaceTable("replaced", std::make_shared<const Table>(std::vector<double>{0, 1},
+                                                                      std::vector<double>{0, 5}));
+            E again;
+            again.parse("replaced(x) + 1", {"x"});
+            if (before.evaluate({0.5}) != 1.5 || cached.evaluate({0.5}) != 2.5 || again.evaluate({0.5}) != 3.5
+                || thrown != 2) {
+                logFile << "Replaced tables give [" << before.evaluate({0.5}) << "], [" << cached.evaluate({0.5})
+                        << "] and [" << again.evaluate({0.5}) << "], [" << thrown << "] of 2 lookups failed\n";
+                ++tmpErrCount;
+            }
+            E::removeTable("replaced");
+            E::disableParseCache();
+        }
+        {
+            // Threads looking up far apart points share the cursor of a non-uniform table
+            std::vector<double> xs, ys;
+            for (int i = 0; i <= 100; ++i) {
+                xs.push_back(i * i);
+                ys.push_back(2.0 * i * i);
+            }
+            Table table(xs, ys);
+            std::vector<size_t> wrong(4, 0);
+            std::vector<std::thread> threads;
+            for (size_t t = 0; t < wrong.size(); ++t) {
+                threads.emplace_back([&table, &wrong, t]() {
+                    for (int i = 0; i < 20000; ++i) {
+                        double x = (double) ((i * 7919 + t * 2500) % 10000) + 0.5;
+                        wrong[t] += fabs(table(x) - 2 * x) > 1e-9;
+                    }
+                });
+            }
+            for (auto &t: threads)
+                t.join();
+            for (size_t t = 0; t < wrong.size(); ++t) {
+                if (wrong[t] != 0) {
+                    logFile << "Thread [" << t << "] got [" << wrong[t] << "] wrong lookups\n";
+                    ++tmpErrCount;
+                }
+            }
+        }
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running table tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running table test 1\n";
+    return errCount;
+}
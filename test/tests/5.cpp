@@ -0,0 +1,79 @@
+#include <iostream>
+#include <cmath>
+#include <limits>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+template<typename Value>
+class VMTestAddToken: public FunctionToken<Value> {
+public:
+    void evaluate(std::stack<Value>& s, const std::vector<Value>& vars) const override {
+        Value a = s.top();
+        s.pop();
+        Value b = s.top();
+        s.pop();
+        s.push(a + b);
+    }
+    [[nodiscard]] std::string cname() const override { return "vmadd"; }
+};
+
+int vm_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running VM test 1\n";
+    size_t errCount = 0;
+    {   /*  VM AGAINST TOKEN INTERPRETER */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning bytecode tests...\n";
+        rk::Expression<double>::addFunctionToken("vmadd", std::make_shared<VMTestAddToken<double>>());
+        const std::vector<std::string> funcs = {
+            "5 + x",
+            "-0",
+            "y * ((sin(x)) / x + (cos(x)) / (x * x))",
+            "2 * y + ( 1 - (2 * sin(0.5 * x) * sin(0.5 * x)) ) * y * (1.0 / sin(x))",
+            "( 1 / (2 * (y - (1/x))) ) - (1/(pow(x, 2)))",
+            "-6 * (y - 0.683939720586) * pow(sin(x), 5) * cos(x)",
+            "x - y - x * -y / 3",
+            "vmadd(x, y) * vmadd(2, -x)",
+        };
+        const std::vector<std::vector<double>> points = {{0.5, 1}, {1, -2}, {-1.5, 0.25}, {3, 7}};
+        for (auto &f: funcs) {
+            rk::Expression<double> e;
+            e.parse(f, {"x", "y"});
+            for (auto &p: points) {
+                // The VM runs the simplified program, a * (1 / b) becomes a / b and rounds once less
+                double vm = e.evaluate(p), ref = e.interpret(p);
+                if (fabs(vm - ref) > 4 * std::numeric_limits<double>::epsilon() * fabs(ref) && !(std::isnan(vm) && std::isnan(ref))) {
+                    logFile << "VM result for [" << f << "] at (" << p[0] << ", " << p[1] << ") is [" << vm
+                            << "], interpreter gives [" << ref << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+        }
+        {
+            // Operators inside earlier function arguments must not leak into later ones
+            rk::Expression<double> e;
+            e.parse("pow(x + 1, 2) - pow(2 * x, y - 1)", {"x", "y"});
+            double expected = std::pow(3.0, 2) - std::pow(4.0, 2);
+            if (e.evaluate({2, 3}) != expected) {
+                logFile << "pow with compound arguments evaluated to [" << e.evaluate({2, 3}) << "]\n";
+                ++tmpErrCount;
+            }
+        }
+        for (const std::string f: {"", "x +", "pow(x)", "sin(x, x)", "x y"}) {
+            rk::Expression<double> e;
+            try {
+                e.parse(f, {"x", "y"});
+                logFile << "Malformed expression [" << f << "] was accepted\n";
+                ++tmpErrCount;
+            } catch (const std::logic_error&) { }
+        }
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running bytecode tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running VM test 1\n";
+    return errCount;
+}
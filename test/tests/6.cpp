@@ -0,0 +1,69 @@
+#include <iostream>
+#include <cmath>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+template<typename ValueType>
+static size_t batch_check(rk::Expression<ValueType>& expr, const std::string& func, size_t n, ValueType delta, std::ostream& logFile) {
+    std::vector<std::vector<ValueType>> columns(2, std::vector<ValueType>(n));
+    for (size_t i = 0; i < n; ++i) {
+        columns[0][i] = ValueType(0.1) + ValueType(i) / ValueType(n);
+        columns[1][i] = ValueType(2) - ValueType(3 * i) / ValueType(n);
+    }
+    std::vector<ValueType> results(n);
+    expr.evaluateBatch({columns[0].data(), columns[1].data()}, results.data(), n);
+    size_t errCount = 0;
+    for (size_t i = 0; i < n; ++i) {
+        ValueType expected = expr.evaluate({columns[0][i], columns[1][i]});
+        if (fabs(results[i] - expected) > delta * (1 + fabs(expected))) {
+            logFile << "Batch result for [" << func << "] at point [" << i << "] is [" << results[i]
+                    << "], expected [" << expected << "]\n";
+            ++errCount;
+        }
+    }
+    return errCount;
+}
+
+int batch_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running batch test 1\n";
+    size_t errCount = 0;
+    {   /*  BATCH AGAINST POINTWISE EVALUATION */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning batch evaluation tests...\n";
+        const std::vector<std::string> funcs = {
+            "5",
+            "y * ((sin(x)) / x + (cos(x)) / (x * x))",
+            "2 * y + ( 1 - (2 * sin(0.5 * x) * sin(0.5 * x)) ) * y * (1.0 / sin(x))",
+            "-6 * (y - 0.683939720586) * pow(sin(x), 5) * cos(x)",
+            "pow(x + 1, 2) - -y",
+        };
+        for (auto &f: funcs) {
+            // Sizes around the VM batch width exercise the partial last chunk, the batch goes through the vector
+            // kernels and may differ from libm in the last bits
+            for (size_t n: {1, 63, 64, 65, 1000}) {
+                rk::Expression<double> d;
+                d.parse(f, {"x", "y"});
+                tmpErrCount += batch_check<double>(d, f, n, 1e-13, logFile);
+                rk::Expression<float> s;
+                s.parse(f, {"x", "y"}, utils_rk::stringToFloat);
+                tmpErrCount += batch_check<float>(s, f, n, 1e-5f, logFile);
+            }
+            rk::Expression<double> c;
+            c.parse(f, {"x", "y"});
+            if (!c.compile()) {
+                logFile << "Unable to compile [" << f << "]\n";
+                ++tmpErrCount;
+            }
+            tmpErrCount += batch_check<double>(c, f, 1000, 1e-12, logFile);
+        }
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running batch evaluation tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running batch test 1\n";
+    return errCount;
+}
@@ -0,0 +1,68 @@
+#include <iostream>
+#include <cmath>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+template<typename ValueType>
+static size_t jit_check(const std::string& func, rk::CompileBackend backend, ValueType delta, std::ostream& logFile) {
+    rk::Expression<ValueType> jitted, reference;
+    auto conv = (std::pair<ValueType, bool> (*)(const std::string&))tests_rk::get_conv_func<ValueType>();
+    jitted.parse(func, {"x", "y", "z"}, conv);
+    reference.parse(func, {"x", "y", "z"}, conv);
+    if (!jitted.compile(backend)) {
+        logFile << "Unable to compile [" << func << "]\n";
+        return 1;
+    }
+    // Copies share the generated code and must stay valid after the original is gone
+    rk::Expression<ValueType> copy(jitted);
+    jitted.parse("0", {}, conv);
+    size_t errCount = 0;
+    for (int i = 0; i < 50; ++i) {
+        std::vector<ValueType> p = {ValueType(0.1) + ValueType(0.13) * i, ValueType(2) - ValueType(0.07) * i, ValueType(0.5) * (i % 7)};
+        ValueType got = copy.evaluate(p), expected = reference.evaluate(p);
+        if (fabs(got - expected) > delta * (1 + fabs(expected)) && !(std::isnan(got) && std::isnan(expected))) {
+            logFile << "Compiled [" << func << "] at point [" << i << "] gives [" << got
+                    << "], interpreter gives [" << expected << "]\n";
+            ++errCount;
+        }
+    }
+    return errCount;
+}
+
+int jit_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running JIT test 1\n";
+    size_t errCount = 0;
+    {   /*  JIT AGAINST INTERPRETER */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning JIT tests...\n";
+        std::vector<std::string> funcs = {
+            "5",
+            "-x",
+            "x - y / z",
+            "y * ((sin(x)) / x + (cos(x)) / (x * x))",
+            "2 * y + ( 1 - (2 * sin(0.5 * x) * sin(0.5 * x)) ) * y * (1.0 / sin(x))",
+            "-6 * (y - 0.683939720586) * pow(sin(x), 5) * cos(x)",
+            "pow(x, pow(y, 2) - z) * -(x + sin(y * cos(z - pow(x, 0.5))))",
+        };
+        // Deeper than the register file, falls back to the external compiler
+        std::string deep = "sin(y)";
+        for (int i = 0; i < 16; ++i)
+            deep = (i % 2 ? "x + (" : "y * (") + deep + ")";
+        funcs.push_back(deep);
+        for (auto &f: funcs) {
+            tmpErrCount += jit_check<double>(f, rk::JitCompiler, 0, logFile);
+            tmpErrCount += jit_check<float>(f, rk::JitCompiler, 0, logFile);
+            tmpErrCount += jit_check<long double>(f, rk::JitCompiler, 1e-15, logFile);
+        }
+        tmpErrCount += jit_check<double>(funcs[3], rk::ExternalCompiler, 1e-12, logFile);
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running JIT tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running JIT test 1\n";
+    return errCount;
+}
@@ -0,0 +1,120 @@
+#include <iostream>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <thread>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+static size_t count_modules(const std::string& dir) {
+    size_t n = 0;
+    for (auto &f: std::filesystem::directory_iterator(dir))
+        if (f.path().extension() == ".so")
+            ++n;
+    return n;
+}
+
+int cache_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running module cache test 1\n";
+    size_t errCount = 0;
+    {   /*  PERSISTENT MODULE CACHE */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning module cache tests...\n";
+        const std::string dir = "./rk-module-cache-test";
+        std::filesystem::remove_all(dir);
+        rk::ModuleCache::setDirectory(dir);
+
+        const std::string f = "y * ((sin(x)) / x + (cos(x)) / (x * x))";
+        {
+            rk::Expression<double> a, b;
+            a.parse(f, {"x", "y"});
+            b.parse(f, {"x", "y"});
+            if (!a.compile(rk::ExternalCompiler) || !b.compile(rk::ExternalCompiler)) {
+                logFile << "Unable to compile through the cache\n";
+                ++tmpErrCount;
+            }
+            if (count_modules(dir) != 1) {
+                logFile << "Identical expressions produced [" << count_modules(dir) << "] modules\n";
+                ++tmpErrCount;
+            }
+            if (fabs(a.evaluate({1.5, 2}) - b.evaluate({1.5, 2})) > 0 || fabs(a.evaluate({1.5, 2}) - a.interpret({1.5, 2})) > 1e-12) {
+                logFile << "Cached module evaluates to [" << b.evaluate({1.5, 2}) << "]\n";
+                ++tmpErrCount;
+            }
+        }
+        if (count_modules(dir) != 1) {
+            logFile << "Cached module was removed together with its expressions\n";
+            ++tmpErrCount;
+        }
+        {
+            // Concurrent builds of one module, from threads or processes, must run the compiler once
+            const std::string source = "extern \"C\" double compiled(const double* vars) { return vars[0] * 2; }";
+            std::vector<std::string> paths(4);
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < paths.size(); ++i)
+                threads.emplace_back([&paths, &source, i]() { paths[i] = rk::ModuleCache::build(source, "double", "-shared -fPIC"); });
+            for (auto &t: threads)
+                t.join();
+            for (auto &p: paths) {
+                if (p.empty() || p != paths[0]) {
+                    logFile << "Concurrent build returned [" << p << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+            if (count_modules(dir) != 2) {
+                logFile << "Concurrent builds produced [" << count_modules(dir) - 1 << "] modules\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // With a tiny limit, modules used within the grace period survive, afterwards only the module in use
+            rk::ModuleCache::setDirectory(dir, 1);
+            rk::Expression<double> e, later;
+            e.parse("x - 1", {"x"});
+            if (!e.compile(rk::ExternalCompiler) || e.evaluate({3}) != 2 || count_modules(dir) != 3) {
+                logFile << "Size limit within the grace period kept [" << count_modules(dir) << "] modules\n";
+                ++tmpErrCount;
+            }
+            const double grace = rk::ModuleCache::gracePeriod();
+            rk::ModuleCache::setGracePeriod(0);
+            later.parse("x - 2", {"x"});
+            if (!later.compile(rk::ExternalCompiler) || later.evaluate({3}) != 1 || count_modules(dir) != 1) {
+                logFile << "Size limit kept [" << count_modules(dir) << "] modules\n";
+                ++tmpErrCount;
+            }
+            rk::ModuleCache::setGracePeriod(grace);
+        }
+        {
+            // The recorded size follows the modules added, a build under the limit does not scan the directory
+            rk::ModuleCache::setDirectory(dir);
+            std::filesystem::remove(dir + "/cache.size");
+            rk::ModuleCache::evict();
+            uint64_t recorded = 0, actual = 0;
+            rk::Expression<double> e;
+            e.parse("x - 3", {"x"});
+            e.compile(rk::ExternalCompiler);
+            for (auto &f: std::filesystem::directory_iterator(dir)) {
+                const std::string extension = f.path().extension().string();
+                if (extension == ".so" || extension == ".cc")
+                    actual += f.file_size();
+            }
+            std::ifstream(dir + "/cache.size") >> recorded;
+            if (recorded != actual || count_modules(dir) != 2) {
+                logFile << "Cache of [" << actual << "] bytes in [" << count_modules(dir) << "] modules is recorded as ["
+                        << recorded << "]\n";
+                ++tmpErrCount;
+            }
+        }
+        rk::ModuleCache::disable();
+        std::filesystem::remove_all(dir);
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running module cache tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running module cache test 1\n";
+    return errCount;
+}
@@ -0,0 +1,98 @@
+#include <iostream>
+#include <cmath>
+#include <chrono>
+#include <thread>
+#include "../../src/expression/Expression.h"
+#include "../../src/runge-kutta/RungeKuttaMethods.h"
+#include "../Tests.h"
+
+// Evaluates until the background compilation lands, returns the number of evaluations it took
+static size_t tiering_wait(const rk::Expression<double>& expr, std::ostream& logFile, size_t& errCount) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+    size_t evaluations = 0;
+    while (!expr.isNative() && std::chrono::steady_clock::now() < deadline) {
+        double x = 0.1 + 0.001 * (evaluations % 1000);
+        double got = expr.evaluate({x, 2}), expected = expr.interpret({x, 2});
+        if (fabs(got - expected) > 1e-12) {
+            logFile << "Evaluation during compilation gives [" << got << "], expected [" << expected << "]\n";
+            ++errCount;
+        }
+        ++evaluations;
+        if (evaluations % 1000 == 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    if (!expr.isNative()) {
+        logFile << "Background compilation did not finish\n";
+        ++errCount;
+    }
+    return evaluations;
+}
+
+int tiering_test_1(std::ostream& out, std::ostream& logFile) {
+    out << "Running tiering test 1\n";
+    size_t errCount = 0;
+    {   /*  INTERPRETER TO NATIVE TIERING */
+
+        size_t tmpErrCount = 0;
+        out << "\nRunning tiering tests...\n";
+        const std::string f = "y * ((sin(x)) / x + (cos(x)) / (x * x))";
+        {
+            rk::Expression<double> e;
+            e.parse(f, {"x", "y"});
+            e.enableTiering(50, rk::ExternalCompiler);
+            rk::Expression<double> copy(e);
+            for (int i = 0; i < 49; ++i)
+                e.evaluate({1.5, 2});
+            if (e.isNative()) {
+                logFile << "Compiled before reaching the threshold\n";
+                ++tmpErrCount;
+            }
+            // The threshold is shared, so the copy starts the compilation for both
+            copy.evaluate({1.5, 2});
+            tiering_wait(e, logFile, tmpErrCount);
+            if (!copy.isNative() || fabs(copy.evaluate({0.7, 3}) - e.interpret({0.7, 3})) > 1e-12) {
+                logFile << "Copy did not switch to native code\n";
+                ++tmpErrCount;
+            }
+            std::vector<double> xs = {0.5, 1, 1.5}, ys = {2, 2, 2}, results(3);
+            e.evaluateBatch({xs.data(), ys.data()}, results.data(), 3);
+            for (size_t i = 0; i < xs.size(); ++i) {
+                if (fabs(results[i] - e.interpret({xs[i], ys[i]})) > 1e-12) {
+                    logFile << "Native batch result at point [" << i << "] is [" << results[i] << "]\n";
+                    ++tmpErrCount;
+                }
+            }
+            // A new expression starts over in the interpreter
+            e.parse("x * y", {"x", "y"});
+            if (e.isNative() || e.evaluate({3, 4}) != 12) {
+                logFile << "Parse kept native code of the previous expression\n";
+                ++tmpErrCount;
+            }
+        }
+        {
+            // Solvers copy the expression on every call and still end up on native code
+            rk::Expression<double> tiered, reference;
+            tiered.parse("-6 * (y - 0.683939720586) * pow(sin(x), 5) * cos(x)", {"x", "y"});
+            reference.parse("-6 * (y - 0.683939720586) * pow(sin(x), 5) * cos(x)", {"x", "y"});
+            tiered.enableTiering(100);
+            double got = 0, expected = 0;
+            for (int i = 0; i < 20; ++i) {
+                got = rk::RK4Solve<double>(tiered, {0, 1}, 1, 0.01)[1];
+                expected = rk::RK4Solve<double>(reference, {0, 1}, 1, 0.01)[1];
+            }
+            tiering_wait(tiered, logFile, tmpErrCount);
+            got = rk::RK4Solve<double>(tiered, {0, 1}, 1, 0.01)[1];
+            if (fabs(got - expected) > 1e-12) {
+                logFile << "Tiered solver gives [" << got << "], expected [" << expected << "]\n";
+                ++tmpErrCount;
+            }
+        }
+        logFile << "\nFinished test with [" << tmpErrCount << "] errors\n";
+        if (tmpErrCount > 0)
+            out << "\nTotal errors: " << tmpErrCount << "\n";
+        out << "Finished running tiering tests\n";
+        errCount += tmpErrCount;
+    }
+    out << "\nFinished running tiering test 1\n";
+    return errCount;
+}